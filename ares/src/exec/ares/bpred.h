@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core.h"
+#include "types.h"
+
+// Branch prediction models, fed with the control transfers retired by the
+// last emulate(). A direction predictor guesses conditional branches, a
+// direct-mapped BTB supplies targets at fetch and a return address stack
+// follows the same call (rd = ra) and return (jr ra) patterns as callsan.
+#define BPRED_NOT_TAKEN 0
+// backward taken, forward not taken
+#define BPRED_BTFN 1
+#define BPRED_BIMODAL 2
+#define BPRED_GSHARE 3
+
+// how the last retired instruction was predicted
+#define BPRED_HIT 0
+// direct target missing from the BTB, redirected once decoded
+#define BPRED_DECODE 1
+// wrong direction or target, redirected once resolved
+#define BPRED_MISS 2
+
+typedef struct {
+    u32 type;
+    // log2 of the number of 2-bit counters
+    u32 table_bits;
+    // global history length for gshare
+    u32 history_bits;
+    // power of two, 0 disables the BTB
+    u32 btb_entries;
+    // 0 predicts returns with the BTB like any indirect jump
+    u32 ras_depth;
+    // cycles added per misprediction when the pipeline model is disabled
+    u32 mispredict_penalty;
+} BpredConfig;
+
+typedef struct {
+    u64 branches;
+    u64 branch_mispredicts;
+    // jal and jalr other than returns
+    u64 jumps;
+    u64 jump_mispredicts;
+    u64 returns;
+    u64 return_mispredicts;
+    u64 decode_redirects;
+} BpredStats;
+
+// per .text halfword, like g_profile_counts
+typedef struct {
+    u64 executed;
+    u64 mispredicts;
+} BpredSiteStats;
+
+ARES_ARRAY_TYPE(BpredSiteStats);
+
+extern export bool g_bpred_enabled;
+extern export BpredConfig g_bpred_config;
+extern export BpredStats g_bpred_stats;
+extern export ARES_ARRAY(BpredSiteStats) g_bpred_sites;
+// BPRED_* outcome of the last retired instruction, read by the cycle models
+extern u32 g_bpred_outcome;
+
+// takes g_bpred_config, returns false if it's not a valid configuration
+export bool bpred_start(void);
+export void bpred_stop(void);
+void bpred_retire(void);
+
+// parses "type[:bits=N][:history=N][:btb=N][:ras=N][:penalty=N]" where type
+// is nt, btfn, bimodal or gshare
+bool bpred_parse_config(const char *spec, BpredConfig *out, char **error);
+
+// fills g_bpred_label_stats, parallel to g_labels, with the summed
+// BpredSiteStats of the control transfers under each label
+export void bpred_attribute(void);
+extern export ARES_ARRAY(BpredSiteStats) g_bpred_label_stats;
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core.h"
+#include "types.h"
+
+// Set-associative L1 cache models, one for instruction fetches and one for
+// data accesses. They only track tags, the contents always come from the
+// sections. Both are fed with what the last emulate() retired, so accesses
+// from the UI or syscalls aren't counted.
+#define CACHE_I 0
+#define CACHE_D 1
+#define CACHE_COUNT 2
+
+#define CACHE_LRU 0
+#define CACHE_FIFO 1
+#define CACHE_RANDOM 2
+
+typedef struct {
+    // in bytes, size / (line_size * assoc) must be a power of two
+    u32 size;
+    u32 line_size;
+    u32 assoc;
+    u32 replacement;
+    // write-back with write-allocate, otherwise write-through without it
+    bool write_back;
+    // fetch the next line too on a miss
+    bool prefetch;
+    // cycles added to the pipeline model on a miss
+    u32 miss_penalty;
+} CacheConfig;
+
+typedef struct {
+    u64 accesses;
+    u64 misses;
+    u64 evictions;
+    u64 writebacks;
+    u64 prefetches;
+} CacheStats;
+
+// per .text halfword, like g_profile_counts
+typedef struct {
+    u64 accesses;
+    u64 misses;
+    u64 evictions;
+} CacheSiteStats;
+
+ARES_ARRAY_TYPE(CacheSiteStats);
+
+extern export bool g_cache_enabled;
+extern export CacheConfig g_cache_config[CACHE_COUNT];
+extern export CacheStats g_cache_stats[CACHE_COUNT];
+extern ARES_ARRAY(CacheSiteStats) g_cache_sites[CACHE_COUNT];
+// miss penalty of the last retired instruction, read by the pipeline model
+extern u32 g_cache_stall[CACHE_COUNT];
+
+// takes g_cache_config, returns false if it's not a valid geometry
+export bool cache_start(void);
+export void cache_stop(void);
+void cache_retire(void);
+
+// parses "size:line:ways[:lru|fifo|random][:wb|wt][:prefetch]", sizes
+// accept a k or m suffix
+bool cache_parse_config(const char *spec, CacheConfig *out, char **error);
+
+// fills g_cache_label_stats, parallel to g_labels, with the summed
+// CacheSiteStats of each cache (CACHE_COUNT entries per label)
+export void cache_attribute(void);
+extern export ARES_ARRAY(CacheSiteStats) g_cache_label_stats;
+
+// fills g_cache_lines with accesses, misses and evictions of each cache
+// (6 u32 per source line, saturating), indexed by line
+export void cache_lines(void);
+extern export ARES_ARRAY(u32) g_cache_lines;
@@ -26,10 +26,18 @@ void callsan_init();
 void callsan_store(int reg);
 void callsan_call();
 bool callsan_ret();
+// call after overwriting g_callsan_stack_written_by
+void callsan_sync();
+// starts tracking a stack of words words below STACK_TOP, all poisoned
+void callsan_reset_stack(u32 words);
+// called when the stack grows to words words, the new ones are poisoned
+void callsan_grow_stack(u32 words);
 bool callsan_can_load(int reg);
 void callsan_report_store(u32 addr, u32 size, int reg);
 bool callsan_check_load(u32 addr, u32 size);
 
 extern u32 g_reg_bitmap;
 extern ARES_ARRAY(ShadowStackEnt) g_shadow_stack;
-extern u8 g_callsan_stack_written_by[];
+// register that last wrote each stack word, 0xFF if it's poisoned. Entry 0
+// is the lowest word of the stack, which grows down from STACK_TOP
+extern ARES_ARRAY(u8) g_callsan_stack_written_by;
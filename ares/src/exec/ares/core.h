@@ -11,10 +11,12 @@
 
 #ifdef __wasm__
 void *malloc(size_t size);
+void *calloc(size_t n, size_t size);
 void free(void *ptr);
 extern void panic();
 extern void emu_exit();
 extern void putchar(uint8_t);
+extern u64 gettime64(void);
 size_t strlen(const char *str);
 int memcmp(const void *s1, const void *s2, size_t n);
 void *memcpy(void *dest, const void *src, size_t n);
@@ -34,15 +36,29 @@ static inline void shadowstack_pop() {}
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define emu_exit() g_exited = true
+
+// 100ns ticks, like the webui's gettime64 import
+static inline u64 gettime64(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 10000000 + ts.tv_nsec / 100;
+}
 #endif
 
 #define TEXT_BASE 0x00400000
 #define TEXT_END 0x10000000
 #define DATA_BASE 0x10000000
 #define STACK_TOP 0x7FFFF000
+// the stack starts with STACK_LEN bytes mapped and grows down on demand in
+// STACK_PAGE chunks, up to g_stack_limit bytes. The page below the limit is
+// a guard page, accesses to it are reported as a stack overflow
 #define STACK_LEN 4096
+#define STACK_PAGE 4096
+#define STACK_LIMIT (1024 * 1024)
+#define STACK_LIMIT_MAX (64 * 1024 * 1024)
 #define DATA_END 0x70000000
 
 #define VGA_WIDTH 160
@@ -82,6 +98,7 @@ static inline void shadowstack_pop() {}
 
 ARES_ARRAY_TYPE(u8);
 ARES_ARRAY_TYPE(u32);
+ARES_ARRAY_TYPE(u64);
 
 typedef struct Parser {
     const char *input;
@@ -89,6 +106,8 @@ typedef struct Parser {
     size_t size;
     int lineidx;
     int startline;
+    // where the statement on startline begins
+    size_t startpos;
 } Parser;
 
 typedef struct {
@@ -123,11 +142,21 @@ typedef struct Section {
     struct {
         size_t shidx;
     } elf;
+    // copy-on-write bookkeeping for the active snapshot, see snapshot.c
+    struct {
+        u8 **pages;
+        u32 *dirty;
+        size_t npages;
+    } snapshot;
     bool read;
     bool write;
     bool execute;
     bool super;
     bool physical;
+    // contents point into a file mapping and are not owned by the section
+    bool mapped;
+    // contents come from zero_pages_alloc()
+    bool zero_pages;
 } Section, *SectionPtr;
 
 typedef struct LabelData {
@@ -137,18 +166,26 @@ typedef struct LabelData {
     Section *section;
 } LabelData, *LabelDataPtr;
 
-typedef const char *DeferredInsnCb(Parser *p, const char *opcode,
-                                   size_t opcode_len);
+// op is the mnemonic's OP_ id
+typedef const char *DeferredInsnCb(Parser *p, u32 op);
 typedef const char *DeferredInsnReloc(const char *sym, size_t sym_len);
 
+// An instruction that refers to a label. The ones whose label comes later
+// are emitted again by the fixup pass, and asm_relax() emits all of them
+// again once it moves the code around.
 typedef struct DeferredInsn {
     Parser p;
     Section *section;
     DeferredInsnCb *cb;
     DeferredInsnReloc *reloc;
-    const char *opcode;
-    size_t opcode_len;
+    u32 op;
     size_t emit_idx;
+    // its first entry in g_text_by_linenum
+    size_t line_idx;
+    // bytes it takes, set by the fixup pass
+    u8 size;
+    // emitted without compressed forms, see asm_relax()
+    bool pinned;
 } DeferredInsn;
 
 typedef struct Global {
@@ -159,6 +196,16 @@ typedef struct Global {
     } elf;
 } Global;
 
+// binary data for .incbin
+typedef struct Blob {
+    const char *name;
+    size_t name_len;
+    const u8 *data;
+    size_t len;
+    // a file .incbin mapped itself, name is owned too
+    bool mapped;
+} Blob;
+
 typedef enum Error : u32 {
     ERROR_NONE = 0,
     ERROR_FETCH = 1,
@@ -172,7 +219,8 @@ typedef enum Error : u32 {
     ERROR_CALLSAN_RET_EMPTY = 9,
     ERROR_CALLSAN_LOAD_STACK = 10,
     ERROR_PROTECTION = 11,
-    ERROR_DOUBLE = 12
+    ERROR_DOUBLE = 12,
+    ERROR_STACK_OVERFLOW = 13
 } Error;
 
 ARES_ARRAY_TYPE(SectionPtr);
@@ -181,6 +229,17 @@ ARES_ARRAY_TYPE(Global);
 ARES_ARRAY_TYPE(Extern);
 ARES_ARRAY_TYPE(DeferredInsn);
 ARES_ARRAY_TYPE(char);
+ARES_ARRAY_TYPE(Blob);
+
+// an error found by lint()
+typedef struct Diagnostic {
+    u32 line;
+    // 1-based, where the statement starts
+    u32 col;
+    const char *msg;
+} Diagnostic;
+
+ARES_ARRAY_TYPE(Diagnostic);
 
 extern export Section *g_text;
 extern export Section *g_data;
@@ -201,6 +260,8 @@ extern export u32 g_gif_used;
 extern export u32 g_gif_body_ptr;
 extern export u32 g_gif_body_len;
 
+// per-assembly data that free_runtime() frees in one go, see section_alloc()
+extern Arena g_runtime_arena;
 extern ARES_ARRAY(SectionPtr) g_sections;
 extern ARES_ARRAY(LabelData) g_labels;
 extern ARES_ARRAY(Global) g_globals;
@@ -217,9 +278,40 @@ void assemble(const char *str, size_t len, bool allow_externs);
 void emulate();
 bool resolve_symbol(const char *sym, size_t sym_len, bool global, u32 *addr,
                     Section **sec);
+// a zeroed section in g_runtime_arena, its relocations are pushed with
+// ARES_ARENA_PUSH
+Section *section_alloc();
+// the section mapped at TEXT_BASE, wherever it came from. g_text isn't it
+// when running an ELF without one
+Section *text_section();
+// zeroed memory that is only committed once it's touched, for sections with
+// zero_pages set
+u8 *zero_pages_alloc(size_t size);
 void prepare_runtime_sections();
 void prepare_aux_sections();
 void free_runtime();
+// makes data available to .incbin "name" in the next assemble(), it isn't
+// copied so it has to outlive the assembly. Natively, names that aren't
+// registered are mapped from the file with that path
+export void incbin_register(const char *name, size_t name_len, const u8 *data,
+                            size_t len);
+// forgets the symbol index, for when g_labels is replaced wholesale
+void symtab_clear();
+
+// -- the editor's linter
+// room for the len bytes of source the next lint() reads
+export char *lint_buffer(size_t len);
+// assembles the source in lint_buffer() without touching the runtime,
+// parsing only what changed since the last call could affect. Unlike
+// assemble() it goes on after an error, with the next line, and every error
+// goes to g_lint_diagnostics in line order. Returns false if the source has
+// to go through assemble() instead
+export bool lint(size_t len);
+// frees the linter's copy of the last source, free_runtime() calls it
+void lint_free();
+extern export ARES_ARRAY(Diagnostic) g_lint_diagnostics;
+// chunks (statements, about a line each) parsed by the last lint()
+extern export u32 g_lint_parsed;
 u32 LOAD(u32 addr, int size, bool *err);
 bool pc_to_label_r(u32 pc, LabelData **ret, u32 *off);
 
@@ -5,6 +5,8 @@
 #include "core.h"
 
 #define MMIO_DEVICE_RSV 64
+#define MMIO_DEVICE_COUNT 7
+#define MMIO_STATE_SIZE (MMIO_DEVICE_COUNT * MMIO_DEVICE_RSV)
 
 // DEVICE INFO
 
@@ -76,3 +78,7 @@
 
 bool mmio_read(u32 mmio_addr, int size, u32 *ret);
 bool mmio_write(u32 mmio_addr, int size, u32 value);
+
+// raw register state of all devices, MMIO_STATE_SIZE bytes
+void mmio_save_state(u8 *out);
+void mmio_load_state(const u8 *in);
@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "core.h"
 #include "types.h"
 
 // Constants taken from musl libc
@@ -2687,6 +2688,15 @@ typedef struct {
 
 bool elf_read(u8 *elf_contents, size_t elf_contents_len, ReadElfResult *out,
               char **error);
+// build the whole file in one malloc'd buffer
 bool elf_emit_exec(void **out, size_t *len, char **error);
 bool elf_emit_obj(void **out, size_t *len, char **error);
-bool elf_load(u8 *elf_contents, size_t elf_len, char **error);
+// stream the file to path, nothing is created if the program can't be emitted
+bool elf_write_exec(const char *path, char **error);
+bool elf_write_obj(const char *path, char **error);
+// Loads the PT_LOAD segments of an executable. Segments point into
+// elf_contents where they can, so it has to outlive the program, and guest
+// stores may write to it
+export bool elf_load(u8 *elf_contents, size_t elf_len, char **error);
+// maps path privately, the guest's stores never reach the file
+bool elf_load_file(const char *path, char **error);
@@ -34,6 +34,27 @@
 #define CAUSE_SUPERVISOR_EXTERNAL (CAUSE_INTERRUPT | 9)
 #define CAUSE_MACHINE_EXTERNAL (CAUSE_INTERRUPT | 11)
 
+// Zicntr/Zihpm counters. The user CSRs are read-only views of the machine
+// ones, +0x80 selects the high half (cycleh, mcycleh, ...)
+#define CSR_CYCLE 0xC00
+#define CSR_TIME 0xC01
+#define CSR_INSTRET 0xC02
+#define CSR_HPMCOUNTER3 0xC03
+#define CSR_MCYCLE 0xB00
+#define CSR_MINSTRET 0xB02
+#define CSR_MHPMCOUNTER3 0xB03
+#define CSR_COUNTER_HIGH 0x80
+
+// events counted by hpmcounter3 onwards, in this order
+#define HPM_EVENT_LOAD 0
+#define HPM_EVENT_STORE 1
+#define HPM_EVENT_TAKEN_BRANCH 2
+#define HPM_EVENT_MMIO 3
+#define HPM_EVENT_COUNT 4
+
+// frequency of the time CSR, matches the webui's gettime64()
+#define TIME_FREQ 10000000
+
 extern export u32 g_regs[32];
 extern export u32 g_csr[4096];
 extern export u32 g_pc;
@@ -44,10 +65,37 @@ extern export Error g_runtime_error_type;
 extern export bool g_exited;
 extern export int g_exit_code;
 
+// bytes the stack may grow to, a multiple of STACK_PAGE between STACK_LEN
+// and STACK_LIMIT_MAX
+extern export u32 g_stack_limit;
+
+extern export u64 g_cycle;
+extern export u64 g_instret;
+extern export u64 g_hpm_counters[HPM_EVENT_COUNT];
+
+// side effects of the last emulate(), for the UI and tracing
+extern export u32 g_mem_written_len;
+extern export u32 g_mem_written_addr;
+extern export u32 g_mem_read_len;
+extern export u32 g_mem_read_addr;
+extern export u32 g_reg_written;
+extern export u32 g_fetch_pc;
+// the instruction at g_fetch_pc, decompressed
+extern export u32 g_inst;
+extern export u32 g_inst_len;
+extern export bool g_trap_taken;
+extern export u32 g_trap_cause;
+
 void emulator_enter_kernel(void);
 void emulator_leave_kernel(void);
+int emulator_get_privilege_level(void);
+void emulator_set_privilege_level(int level);
+// the first section in g_sections that spans addr
+Section *emulator_get_section(u32 addr);
 u32 LOAD(u32 addr, int size, bool *err);
 void STORE(u32 addr, u32 val, int size, bool *err);
+// whether a failed access to addr hit the stack's guard page
+bool emulator_stack_overflow(u32 addr);
 void emulator_deliver_interrupt(u32 cause);
 void emulator_init(void);
 void emulator_interrupt_set_pending(u32 intno);
@@ -55,3 +103,5 @@ void emulator_interrupt_clear_pending(u32 intno);
 
 export u32 emu_load(u32 addr, int size);
 export void emu_store(u32 addr, u32 val, int size);
+// sets g_stack_limit, false if it's out of range or below the mapped stack
+export bool emu_set_stack_limit(u32 bytes);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "core.h"
+#include "types.h"
+
+// Fixed cost per instruction class, a cheap cycle estimate for when the
+// pipeline or out-of-order models are too slow. Each retired instruction
+// adds g_latency_table[class] cycles.
+#define LAT_ALU 0
+#define LAT_MUL 1
+#define LAT_DIV 2
+#define LAT_LOAD 3
+#define LAT_STORE 4
+#define LAT_BRANCH_TAKEN 5
+#define LAT_BRANCH_NOT_TAKEN 6
+// jal and jalr
+#define LAT_JUMP 7
+#define LAT_CSR 8
+// ecall, ebreak, mret, sret and wfi
+#define LAT_ECALL 9
+#define LAT_COUNT 10
+
+extern export bool g_latency_enabled;
+extern export u32 g_latency_table[LAT_COUNT];
+// instructions retired per class since latency_start()
+extern export u64 g_latency_counts[LAT_COUNT];
+
+export void latency_start(void);
+export void latency_stop(void);
+// returns the cost of the instruction retired by the last emulate()
+u32 latency_retire(void);
+
+// reads "class = cycles" lines into g_latency_table, # starts a comment
+// and classes that aren't listed keep their value. On error, *error_line is
+// the 1-based line it happened on
+bool latency_parse_config(const char *text, size_t len, char **error,
+                          int *error_line);
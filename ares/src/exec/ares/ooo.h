@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core.h"
+#include "types.h"
+
+// Trace-driven out-of-order timing model, an alternative to the in-order
+// pipeline. Instructions retired by emulate() are dispatched in order into
+// a reorder buffer, issue to functional units once their operands are ready
+// (Tomasulo style, results are broadcast the cycle they complete) and
+// commit in order. Only timing is modelled, architectural state is always
+// the one computed by the functional emulator.
+#define OOO_FU_ALU 0
+#define OOO_FU_MUL 1
+#define OOO_FU_DIV 2
+#define OOO_FU_LSU 3
+#define OOO_FU_COUNT 4
+
+#define OOO_MAX_WIDTH 16
+#define OOO_MAX_ROB 1024
+// cycles of ROB occupancy kept for ooo_occupancy()
+#define OOO_HISTORY 4096
+
+typedef struct {
+    // instructions dispatched and committed per cycle
+    u32 width;
+    u32 rob_size;
+    u32 units[OOO_FU_COUNT];
+    // cycles from issue to result, loads use the LSU latency and the divider
+    // isn't pipelined
+    u32 latency[OOO_FU_COUNT];
+    // cycles from a redirect to the first dispatch on the right path
+    u32 frontend_depth;
+} OooConfig;
+
+// every cycle without a commit (beyond the initial fill) is attributed to
+// the constraint that delayed the next committing instruction the most
+typedef struct {
+    u64 cycles;
+    u64 instret;
+    // mispredicted control transfers and traps
+    u64 control_stalls;
+    // taken jumps redirected at decode and instruction cache misses
+    u64 frontend_stalls;
+    u64 rob_full_stalls;
+    // waiting for an operand
+    u64 dependency_stalls;
+    // waiting for a functional unit
+    u64 structural_stalls;
+    // loads, including data cache misses
+    u64 memory_stalls;
+    // multi-cycle arithmetic
+    u64 execute_stalls;
+    // summed over every cycle, divide by cycles for the average
+    u64 rob_occupancy_sum;
+} OooStats;
+
+extern export bool g_ooo_enabled;
+extern export OooConfig g_ooo_config;
+extern export OooStats g_ooo_stats;
+
+// takes g_ooo_config, returns false if it's not a valid configuration
+export bool ooo_start(void);
+export void ooo_stop(void);
+// feeds the instruction retired by the last emulate(), returns the cycles
+// it added to the total
+u32 ooo_retire(void);
+
+// parses "width=N:rob=N:alu=N:mul=N:div=N:lsu=N:mul_lat=N:div_lat=N:
+// load_lat=N:frontend=N", every field is optional
+bool ooo_parse_config(const char *spec, OooConfig *out, char **error);
+
+// fills g_ooo_window with the ROB occupancy of count cycles starting at
+// first, returns how many of them are known
+export u32 ooo_occupancy(u32 first, u32 count);
+extern export ARES_ARRAY(u32) g_ooo_window;
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core.h"
+#include "types.h"
+
+// In-order IF/ID/EX/MEM/WB timing model, driven by the instructions retired
+// by emulate(). Results are forwarded to EX, loads forward from MEM,
+// branches and jalr resolve in EX (predicted not taken unless the branch
+// predictor is enabled), jal in ID, and traps redirect fetch once they reach
+// MEM. Cache misses stretch IF and MEM.
+#define PIPE_IF 0
+#define PIPE_ID 1
+#define PIPE_EX 2
+#define PIPE_MEM 3
+#define PIPE_WB 4
+#define PIPE_STAGES 5
+
+// cycles of stage occupancy kept for pipeline_stages()
+#define PIPELINE_HISTORY 4096
+
+typedef struct {
+    // cycles spent in EX
+    u32 mul_latency;
+    u32 div_latency;
+} PipelineConfig;
+
+// every cycle beyond one per instruction (plus the initial fill) is
+// attributed to exactly one of the *_stalls counters. Structural stalls are
+// the extra cycles of MUL/DIV in EX, control stalls the fetch bubbles
+// after a redirect and memory stalls the cache miss penalties, when the
+// cache model is enabled
+typedef struct {
+    u64 cycles;
+    u64 instret;
+    u64 load_use_stalls;
+    u64 structural_stalls;
+    u64 control_stalls;
+    u64 memory_stalls;
+} PipelineStats;
+
+extern export bool g_pipeline_enabled;
+extern export PipelineConfig g_pipeline_config;
+extern export PipelineStats g_pipeline_stats;
+
+export void pipeline_start(void);
+export void pipeline_stop(void);
+// feeds the instruction retired by the last emulate(), returns the cycles
+// it added to the total
+u32 pipeline_retire(void);
+
+// fills g_pipeline_window with the pc in each stage (0 for a bubble) for
+// count cycles starting at first, returns how many of them are known
+export u32 pipeline_stages(u32 first, u32 count);
+extern export ARES_ARRAY(u32) g_pipeline_window;
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core.h"
+#include "types.h"
+
+// Calling context tree node, one per distinct call path.
+// Frames are identified by the callee entry pc saved by callsan_call()
+typedef struct {
+    u32 func_pc;
+    u32 parent;
+    u32 first_child;
+    u32 next_sibling;
+    u64 self;
+} ProfileNode;
+
+ARES_ARRAY_TYPE(ProfileNode);
+
+extern export bool g_profiling;
+// one counter per halfword of .text, like g_text_by_linenum
+extern export ARES_ARRAY(u64) g_profile_counts;
+// instructions executed outside of .text
+extern export u64 g_profile_other;
+extern ARES_ARRAY(ProfileNode) g_profile_nodes;
+
+export void profile_start(void);
+export void profile_stop(void);
+void profile_tick(void);
+
+// fills g_profile_label_counts, parallel to g_labels
+export void profile_attribute(void);
+extern export ARES_ARRAY(u64) g_profile_label_counts;
+
+// fills g_profile_lines, hit count indexed by source line
+export void profile_lines(void);
+extern export ARES_ARRAY(u32) g_profile_lines;
+
+// folded stacks ("a;b;c count" lines) for flamegraph tools
+void profile_folded(ARES_ARRAY(char) *out);
+export void profile_folded_text(void);
+extern export ARES_ARRAY(char) g_profile_folded;
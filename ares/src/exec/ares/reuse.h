@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core.h"
+#include "types.h"
+
+// Reuse (LRU stack) distance analysis of the instruction fetch and data
+// streams, fed with what the last emulate() retired like the cache model.
+// The distance of an access is the number of distinct lines touched since
+// the previous access to its line, so a fully associative LRU cache of C
+// lines misses exactly on the accesses with a distance >= C. Distances are
+// counted with a Fenwick tree over access times, in O(log n) per access.
+#define REUSE_I 0
+#define REUSE_D 1
+#define REUSE_COUNT 2
+
+// distances are counted exactly up to this many lines, the rest go to
+// g_reuse_stats.far
+#define REUSE_MAX_DISTANCE 65536
+
+typedef struct {
+    u32 line_size;
+    // instructions per working set sample
+    u32 epoch;
+} ReuseConfig;
+
+typedef struct {
+    u64 accesses;
+    // first touch of a line
+    u64 cold;
+    u64 far;
+} ReuseStats;
+
+extern export bool g_reuse_enabled;
+extern export ReuseConfig g_reuse_config;
+extern export ReuseStats g_reuse_stats[REUSE_COUNT];
+// accesses per distance, the length is one past the largest distance seen
+extern export ARES_ARRAY(u64) g_reuse_hist[REUSE_COUNT];
+// distinct lines of each section touched during each epoch by either stream,
+// g_reuse_sections entries per finished epoch (the last one for addresses
+// outside of every section)
+extern export ARES_ARRAY(u32) g_reuse_working_set;
+extern export u32 g_reuse_sections;
+
+// takes g_reuse_config, returns false if the line size isn't a power of two
+export bool reuse_start(void);
+export void reuse_stop(void);
+void reuse_retire(void);
+
+// fills g_reuse_mrc with the misses of a fully associative LRU cache of
+// 1 .. lines lines (entry i is for i + 1 lines)
+export void reuse_mrc(u32 which, u32 lines);
+extern export ARES_ARRAY(u64) g_reuse_mrc;
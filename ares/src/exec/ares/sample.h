@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core.h"
+#include "types.h"
+
+// Sampled simulation: the timing models (cache, branch predictor, pipeline,
+// out-of-order core or latency table) that were enabled when sampling starts
+// only run for the last warmup + measure instructions of every period, the
+// rest of it is purely functional. Cycles are only counted during the
+// measure part and the whole-program CPI is extrapolated from the per-period
+// samples.
+typedef struct {
+    // instructions per sampling unit
+    u64 period;
+    // detailed instructions before each measurement, not counted
+    u64 warmup;
+    u64 measure;
+} SampleConfig;
+
+typedef struct {
+    u64 instret;
+    u64 samples;
+    u64 measured_instret;
+    u64 measured_cycles;
+    // sum and sum of squares of the per-sample CPI
+    double cpi_sum;
+    double cpi_sq_sum;
+} SampleStats;
+
+// filled by sample_estimate()
+typedef struct {
+    double cpi;
+    // 95% confidence interval of the mean CPI, assuming normally
+    // distributed samples
+    double cpi_low;
+    double cpi_high;
+    // cpi * instret
+    double cycles;
+} SampleEstimate;
+
+extern export bool g_sampling;
+extern export SampleConfig g_sample_config;
+extern export SampleStats g_sample_stats;
+extern export SampleEstimate g_sample_estimate;
+
+// takes over the timing models enabled so far, returns false if the
+// configuration doesn't fit in a period. Stop sampling before stopping any
+// of the models
+export bool sample_start(void);
+// leaves the timing models enabled again
+export void sample_stop(void);
+// accounts the instruction retired by the last emulate() and selects the
+// models for the next one
+void sample_retire(u32 cycles);
+export void sample_estimate(void);
+
+// parses "period:warmup:measure", counts accept a k or m suffix
+bool sample_parse_config(const char *spec, SampleConfig *out, char **error);
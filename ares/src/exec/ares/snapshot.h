@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "core.h"
+#include "types.h"
+
+#define SNAPSHOT_PAGE_SIZE 4096
+
+// Taking a snapshot only copies the CPU, device and callsan state.
+// Section contents are saved lazily: the first store to a page after a
+// snapshot (or restore) copies the page, and restoring only copies back
+// the pages that were dirtied in the meantime.
+export void emu_snapshot(void);
+export bool emu_restore(void);
+void snapshot_free(void);
+
+// called by STORE before a section with an active snapshot is modified
+void snapshot_cow(Section *sec, u32 off, u32 size);
+// called when added bytes (a multiple of SNAPSHOT_PAGE_SIZE) are mapped below
+// the base of a section with an active snapshot, like the growing stack
+void snapshot_grow_front(Section *sec, u32 added);
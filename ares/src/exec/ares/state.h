@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dev.h"
+#include "emulate.h"
+#include "types.h"
+
+// On-disk machine checkpoint, used by the CLI's --save-state/--load-state.
+// Layout: StateHeader, then the section, label and shadow stack tables, the
+// callsan stack words and the string table, then the section contents, each
+// one page aligned so the whole file can be mapped and executed in place.
+#define STATE_MAGIC "ARESSTAT"
+#define STATE_VERSION 3
+#define STATE_PAGE_ALIGN 4096
+
+#define STATE_SEC_READ 1
+#define STATE_SEC_WRITE (1 << 1)
+#define STATE_SEC_EXECUTE (1 << 2)
+#define STATE_SEC_SUPER (1 << 3)
+#define STATE_SEC_PHYSICAL (1 << 4)
+
+typedef struct {
+    u8 magic[8];
+    u32 version;
+    u32 header_sz;
+    u64 cycle;
+    u64 instret;
+    u64 hpm_counters[HPM_EVENT_COUNT];
+    u32 pc;
+    u32 privilege_level;
+    u32 exited;
+    i32 exit_code;
+    u32 regs[32];
+    u32 csr[4096];
+    u8 mmio[MMIO_STATE_SIZE];
+    u32 gif_used;
+    u32 gif_body_ptr;
+    u32 gif_body_len;
+    u32 reg_bitmap;
+    u32 sections_off;
+    u32 sections_num;
+    u32 labels_off;
+    u32 labels_num;
+    u32 shadow_stack_off;
+    u32 shadow_stack_num;
+    u32 callsan_off;
+    u32 callsan_num;
+    u32 strtab_off;
+    u32 strtab_sz;
+} __attribute__((__packed__)) StateHeader;
+
+typedef struct {
+    u32 name_off;
+    u32 base;
+    u32 limit;
+    u32 align;
+    u32 flags;
+    u32 contents_off;
+    u32 contents_sz;
+} __attribute__((__packed__)) StateSection;
+
+typedef struct {
+    u32 name_off;
+    u32 name_len;
+    u32 addr;
+    i32 section_idx;
+} __attribute__((__packed__)) StateLabel;
+
+bool state_save(const char *path, char **error);
+bool state_load(const char *path, char **error);
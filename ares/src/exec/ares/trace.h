@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "types.h"
+
+// Binary execution trace written by the CLI's --trace.
+// The file starts with TRACE_MAGIC, a u32 version and the label table
+// (varint count, then varint addr, varint length and the name bytes for
+// each label). After that there is one record per emulate() call:
+//   u8 flags
+//   varint zigzag(pc - previous pc)
+//   TRACE_REG:   u8 rd, varint value
+//   TRACE_LOAD:  varint zigzag(addr - previous addr), u8 size
+//   TRACE_STORE: varint zigzag(addr - previous addr), u8 size
+//   TRACE_TRAP:  varint cause
+//   TRACE_ERROR: u8 error type
+#define TRACE_MAGIC "ARESTRC"
+#define TRACE_VERSION 1
+
+#define TRACE_REG 1
+#define TRACE_LOAD (1 << 1)
+#define TRACE_STORE (1 << 2)
+#define TRACE_TRAP (1 << 3)
+#define TRACE_ERROR (1 << 4)
+
+bool trace_open(const char *path, char **error);
+// records the side effects of the last emulate()
+void trace_record(void);
+bool trace_close(char **error);
+bool trace_decode(const char *path, FILE *out, char **error);
@@ -68,20 +68,98 @@ void *memset(void *dest, int c, size_t n);
         goto fail_label;                    \
     }
 
-static void *ares_array_grow(void *arr, size_t *cap, size_t size) {
+// grows the capacity to at least need, doubling it
+static inline void *ares_array_reserve(void *arr, size_t *cap, size_t need,
+                                       size_t size) {
     size_t oldcap = *cap;
-    if (oldcap) *cap = oldcap * 2;
-    else *cap = 4;
-    void *newarr = malloc(*cap * size);
+    if (oldcap >= need) return arr;
+    size_t newcap = oldcap ? oldcap : 4;
+    while (newcap < need) newcap *= 2;
+    void *newarr = malloc(newcap * size);
     ARES_CHECK_OOM(newarr);
-    memset(newarr, 0, *cap * size);
+    // only the new part needs clearing, the rest is copied over
+    size_t keep = arr ? oldcap : 0;
+    memset((u8 *)newarr + keep * size, 0, (newcap - keep) * size);
     if (arr) {
         memcpy(newarr, arr, oldcap * size);
         free(arr);
     }
+    *cap = newcap;
     return newarr;
 }
 
+static inline void *ares_array_grow(void *arr, size_t *cap, size_t size) {
+    return ares_array_reserve(arr, cap, *cap + 1, size);
+}
+
+// Bump allocator for data that is all freed at once. Blocks are chained and
+// never move, so pointers into them stay valid until ares_arena_free()
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t cap;
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+} Arena;
+
+#define ARES_ARENA_BLOCK_SIZE (64 * 1024)
+
+static inline void *ares_arena_alloc(Arena *arena, size_t size) {
+    // malloc isn't 8 byte aligned in the WASM build
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock *b = arena->head;
+    if (!b || b->cap - b->used < size) {
+        size_t cap = size;
+        if (cap < ARES_ARENA_BLOCK_SIZE) cap = ARES_ARENA_BLOCK_SIZE;
+        b = malloc(sizeof(ArenaBlock) + cap + 7);
+        ARES_CHECK_OOM(b);
+        b->next = arena->head;
+        b->cap = cap;
+        b->used = 0;
+        arena->head = b;
+    }
+    uintptr_t start = ((uintptr_t)(b + 1) + 7) & ~(uintptr_t)7;
+    void *ret = (u8 *)start + b->used;
+    b->used += size;
+    return ret;
+}
+
+static inline void ares_arena_free(Arena *arena) {
+    while (arena->head) {
+        ArenaBlock *next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+}
+
+// like ares_array_grow(), the old buffer stays in the arena
+static inline void *ares_arena_grow(Arena *arena, void *arr, size_t *cap,
+                                    size_t size) {
+    size_t oldcap = *cap;
+    if (oldcap) *cap = oldcap * 2;
+    else *cap = 4;
+    void *newarr = ares_arena_alloc(arena, *cap * size);
+    size_t keep = arr ? oldcap : 0;
+    memset((u8 *)newarr + keep * size, 0, (*cap - keep) * size);
+    if (arr) memcpy(newarr, arr, oldcap * size);
+    return newarr;
+}
+
+// ARES_ARRAY_PUSH for arrays allocated from an arena, they're never passed to
+// ARES_ARRAY_FREE
+#define ARES_ARENA_PUSH(arena, arr)                                        \
+    (((arr)->len) >= ((arr)->cap)                                          \
+     ? (arr)->buf = ares_arena_grow((arena), (arr)->buf, &((arr)->cap),  \
+                                      sizeof(*((arr)->buf))),              \
+     (arr)->buf + ((arr)->len)++ : (arr)->buf + ((arr)->len)++)
+
+// makes room for n more elements with at most one reallocation
+#define ARES_ARRAY_RESERVE(arr, n)                                \
+    ((arr)->buf = ares_array_reserve((arr)->buf, &((arr)->cap),   \
+                                     (arr)->len + (n), sizeof(*((arr)->buf))))
+
 static inline bool ares_buf_read(u8 *buf, int size, u32 *ret) {
     if (size == 1) {
         *ret = buf[0];
@@ -117,3 +195,52 @@ static inline bool ares_buf_write(u8 *buf, int size, u32 value) {
 
     return true;
 }
+
+static inline bool ares_is_pow2(u32 x) { return x && !(x & (x - 1)); }
+
+static inline u64 ares_max64(u64 a, u64 b) { return a > b ? a : b; }
+
+// Parses a decimal number of at most max into out and moves s past it. With
+// a unit, a k or m suffix multiplies it by unit or unit * unit. Fails without
+// moving s if there are no digits or the number is bigger than max
+static inline bool ares_parse_num(const char **s, u64 unit, u64 max,
+                                  u64 *out) {
+    const char *p = *s;
+    u64 v = 0;
+    if (*p < '0' || *p > '9') return false;
+    while (*p >= '0' && *p <= '9') {
+        u32 d = *p++ - '0';
+        if (v > (max - d) / 10) return false;
+        v = v * 10 + d;
+    }
+    if (unit && (*p == 'k' || *p == 'K')) {
+        if (v > max / unit) return false;
+        v *= unit, p++;
+    } else if (unit && (*p == 'm' || *p == 'M')) {
+        if (v > max / unit / unit) return false;
+        v *= unit * unit, p++;
+    }
+    *out = v;
+    *s = p;
+    return true;
+}
+
+static inline bool ares_parse_u32(const char **s, u32 *out) {
+    u64 v;
+    if (!ares_parse_num(s, 0, UINT32_MAX, &v)) return false;
+    *out = v;
+    return true;
+}
+
+// Matches the option name opt at s, followed by ':', the end of the string
+// or '='. s is moved past the name, and past the '=' onto the value if there
+// is one
+static inline bool ares_option_eq(const char **s, const char *opt) {
+    const char *p = *s;
+    while (*opt && *p == *opt) p++, opt++;
+    if (*opt) return false;
+    if (*p == '=') p++;
+    else if (*p != ':' && *p != 0) return false;
+    *s = p;
+    return true;
+}
@@ -0,0 +1,269 @@
+#include "ares/bpred.h"
+
+#include "ares/core.h"
+#include "ares/emulate.h"
+
+export bool g_bpred_enabled;
+export BpredConfig g_bpred_config = {
+    .type = BPRED_GSHARE,
+    .table_bits = 12,
+    .history_bits = 8,
+    .btb_entries = 512,
+    .ras_depth = 16,
+    .mispredict_penalty = 2,
+};
+export BpredStats g_bpred_stats;
+export ARES_ARRAY(BpredSiteStats) g_bpred_sites =
+    ARES_ARRAY_NEW(BpredSiteStats);
+export ARES_ARRAY(BpredSiteStats) g_bpred_label_stats =
+    ARES_ARRAY_NEW(BpredSiteStats);
+u32 g_bpred_outcome;
+
+typedef struct {
+    // 2-bit saturating counters, taken if >= 2
+    u8 *counters;
+    u32 history;
+    // pc | 1 of the owning instruction, 0 if the entry is empty
+    u32 *btb_tags;
+    u32 *btb_targets;
+    u32 *ras;
+    // pushes minus pops, the oldest entries get overwritten
+    u32 ras_top;
+    u32 ras_len;
+} Bpred;
+
+static Bpred g_bp;
+
+static bool bpred_config_valid(const BpredConfig *cfg) {
+    return cfg->type <= BPRED_GSHARE && cfg->table_bits >= 1 &&
+           cfg->table_bits <= 24 && cfg->history_bits <= cfg->table_bits &&
+           (!cfg->btb_entries || ares_is_pow2(cfg->btb_entries)) &&
+           cfg->ras_depth <= 4096;
+}
+
+export bool bpred_start(void) {
+    bpred_stop();
+    BpredConfig *cfg = &g_bpred_config;
+    if (!bpred_config_valid(cfg)) return false;
+
+    size_t counters = (size_t)1 << cfg->table_bits;
+    g_bp.counters = malloc(counters);
+    ARES_CHECK_OOM(g_bp.counters);
+    // weakly not taken
+    memset(g_bp.counters, 1, counters);
+    if (cfg->btb_entries) {
+        g_bp.btb_tags = malloc(cfg->btb_entries * sizeof(u32));
+        ARES_CHECK_OOM(g_bp.btb_tags);
+        memset(g_bp.btb_tags, 0, cfg->btb_entries * sizeof(u32));
+        g_bp.btb_targets = malloc(cfg->btb_entries * sizeof(u32));
+        ARES_CHECK_OOM(g_bp.btb_targets);
+    }
+    if (cfg->ras_depth) {
+        g_bp.ras = malloc(cfg->ras_depth * sizeof(u32));
+        ARES_CHECK_OOM(g_bp.ras);
+    }
+
+    Section *text = text_section();
+    size_t slots = text ? (ARES_ARRAY_LEN(&text->contents) + 1) / 2 : 0;
+    g_bpred_sites = ARES_ARRAY_PREPARE(BpredSiteStats, slots);
+    if (slots) {
+        g_bpred_sites.buf = malloc(slots * sizeof(BpredSiteStats));
+        ARES_CHECK_OOM(g_bpred_sites.buf);
+        memset(g_bpred_sites.buf, 0, slots * sizeof(BpredSiteStats));
+    }
+
+    memset(&g_bpred_stats, 0, sizeof(g_bpred_stats));
+    g_bpred_outcome = BPRED_HIT;
+    g_bpred_enabled = true;
+    return true;
+}
+
+export void bpred_stop(void) {
+    g_bpred_enabled = false;
+    free(g_bp.counters);
+    free(g_bp.btb_tags);
+    free(g_bp.btb_targets);
+    free(g_bp.ras);
+    g_bp = (Bpred){0};
+    ARES_ARRAY_FREE(&g_bpred_sites);
+    ARES_ARRAY_FREE(&g_bpred_label_stats);
+}
+
+static inline u8 *bpred_counter(u32 pc) {
+    u32 idx = pc >> 1;
+    if (g_bpred_config.type == BPRED_GSHARE) idx ^= g_bp.history;
+    return &g_bp.counters[idx & ((1u << g_bpred_config.table_bits) - 1)];
+}
+
+static bool bpred_direction(u32 pc, u32 inst) {
+    switch (g_bpred_config.type) {
+        case BPRED_NOT_TAKEN:
+            return false;
+        case BPRED_BTFN:
+            // sign of the B-type immediate
+            return inst >> 31;
+        default:
+            return *bpred_counter(pc) >= 2;
+    }
+}
+
+static void bpred_train(u32 pc, bool taken) {
+    u8 *ctr = bpred_counter(pc);
+    if (taken && *ctr < 3) (*ctr)++;
+    else if (!taken && *ctr > 0) (*ctr)--;
+    u32 mask = (1u << g_bpred_config.history_bits) - 1;
+    g_bp.history = ((g_bp.history << 1) | taken) & mask;
+}
+
+static bool btb_lookup(u32 pc, u32 *target) {
+    if (!g_bp.btb_tags) return false;
+    u32 idx = (pc >> 1) & (g_bpred_config.btb_entries - 1);
+    if (g_bp.btb_tags[idx] != (pc | 1)) return false;
+    *target = g_bp.btb_targets[idx];
+    return true;
+}
+
+static void btb_update(u32 pc, u32 target) {
+    if (!g_bp.btb_tags) return;
+    u32 idx = (pc >> 1) & (g_bpred_config.btb_entries - 1);
+    g_bp.btb_tags[idx] = pc | 1;
+    g_bp.btb_targets[idx] = target;
+}
+
+static void ras_push(u32 addr) {
+    if (!g_bp.ras) return;
+    g_bp.ras[g_bp.ras_top++ % g_bpred_config.ras_depth] = addr;
+    if (g_bp.ras_len < g_bpred_config.ras_depth) g_bp.ras_len++;
+}
+
+static bool ras_pop(u32 *addr) {
+    if (!g_bp.ras_len) return false;
+    g_bp.ras_len--;
+    *addr = g_bp.ras[--g_bp.ras_top % g_bpred_config.ras_depth];
+    return true;
+}
+
+void bpred_retire(void) {
+    u32 inst = g_inst;
+    u32 opcode = inst & 0x7F;
+    u32 rd = (inst >> 7) & 0x1F;
+    u32 rs1 = (inst >> 15) & 0x1F;
+    u32 pc = g_fetch_pc;
+    u32 next = pc + g_inst_len;
+    BpredStats *st = &g_bpred_stats;
+
+    g_bpred_outcome = BPRED_HIT;
+    if (g_trap_taken) return;
+    bool branch = opcode == 0b1100011, jal = opcode == 0b1101111;
+    bool jalr = opcode == 0b1100111;
+    if (!branch && !jal && !jalr) return;
+
+    bool taken = g_pc != next;
+    u32 predicted;
+    bool btb_hit = btb_lookup(pc, &predicted) && predicted == g_pc;
+    // same patterns as callsan_call() and callsan_ret()
+    bool is_ret = jalr && rd == 0 && rs1 == 1;
+    bool is_call = (jal || jalr) && rd == 1;
+
+    u32 outcome;
+    if (branch) {
+        st->branches++;
+        if (bpred_direction(pc, inst) != taken) outcome = BPRED_MISS;
+        else if (!taken || btb_hit) outcome = BPRED_HIT;
+        // the target is part of the instruction
+        else outcome = BPRED_DECODE;
+        bpred_train(pc, taken);
+        if (outcome == BPRED_MISS) st->branch_mispredicts++;
+    } else if (jal) {
+        st->jumps++;
+        outcome = btb_hit ? BPRED_HIT : BPRED_DECODE;
+    } else if (is_ret && g_bp.ras) {
+        st->returns++;
+        outcome = ras_pop(&predicted) && predicted == g_pc ? BPRED_HIT
+                                                           : BPRED_MISS;
+        if (outcome == BPRED_MISS) st->return_mispredicts++;
+    } else {
+        outcome = btb_hit ? BPRED_HIT : BPRED_MISS;
+        if (is_ret) {
+            st->returns++;
+            if (outcome == BPRED_MISS) st->return_mispredicts++;
+        } else {
+            st->jumps++;
+            if (outcome == BPRED_MISS) st->jump_mispredicts++;
+        }
+    }
+    if (outcome == BPRED_DECODE) st->decode_redirects++;
+
+    if (taken && !(is_ret && g_bp.ras)) btb_update(pc, g_pc);
+    if (is_call) ras_push(next);
+
+    u32 slot = (pc - TEXT_BASE) / 2;
+    if (slot < ARES_ARRAY_LEN(&g_bpred_sites)) {
+        BpredSiteStats *site = ARES_ARRAY_GET(&g_bpred_sites, slot);
+        site->executed++;
+        if (outcome == BPRED_MISS) site->mispredicts++;
+    }
+    g_bpred_outcome = outcome;
+}
+
+bool bpred_parse_config(const char *spec, BpredConfig *out, char **error) {
+    BpredConfig cfg = *out;
+    const char *p = spec;
+
+    if (ares_option_eq(&p, "nt")) cfg.type = BPRED_NOT_TAKEN;
+    else if (ares_option_eq(&p, "btfn")) cfg.type = BPRED_BTFN;
+    else if (ares_option_eq(&p, "bimodal")) cfg.type = BPRED_BIMODAL;
+    else if (ares_option_eq(&p, "gshare")) cfg.type = BPRED_GSHARE;
+    else {
+        *error = "expected nt, btfn, bimodal or gshare";
+        return false;
+    }
+    if (cfg.type != BPRED_GSHARE) cfg.history_bits = 0;
+
+    while (*p == ':') {
+        p++;
+        u32 *field;
+        if (ares_option_eq(&p, "bits")) field = &cfg.table_bits;
+        else if (ares_option_eq(&p, "history")) field = &cfg.history_bits;
+        else if (ares_option_eq(&p, "btb")) field = &cfg.btb_entries;
+        else if (ares_option_eq(&p, "ras")) field = &cfg.ras_depth;
+        else if (ares_option_eq(&p, "penalty")) field = &cfg.mispredict_penalty;
+        else {
+            *error = "unknown predictor option";
+            return false;
+        }
+        if (!ares_parse_u32(&p, field)) {
+            *error = "expected a number";
+            return false;
+        }
+    }
+    if (*p) {
+        *error = "unexpected characters after predictor options";
+        return false;
+    }
+    if (!bpred_config_valid(&cfg)) {
+        *error = "invalid predictor configuration";
+        return false;
+    }
+
+    *out = cfg;
+    return true;
+}
+
+export void bpred_attribute(void) {
+    size_t n = ARES_ARRAY_LEN(&g_labels);
+    g_bpred_label_stats.len = 0;
+    for (size_t i = 0; i < n; i++)
+        *ARES_ARRAY_PUSH(&g_bpred_label_stats) = (BpredSiteStats){0};
+
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_bpred_sites); i++) {
+        BpredSiteStats *site = ARES_ARRAY_GET(&g_bpred_sites, i);
+        if (!site->executed) continue;
+        LabelData *label;
+        u32 off;
+        if (!pc_to_label_r(TEXT_BASE + i * 2, &label, &off)) continue;
+        BpredSiteStats *dst = &g_bpred_label_stats.buf[label - g_labels.buf];
+        dst->executed += site->executed;
+        dst->mispredicts += site->mispredicts;
+    }
+}
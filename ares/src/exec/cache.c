@@ -0,0 +1,315 @@
+#include "ares/cache.h"
+
+#include "ares/core.h"
+#include "ares/emulate.h"
+
+#define CACHE_VALID 1
+#define CACHE_DIRTY 2
+
+export bool g_cache_enabled;
+export CacheConfig g_cache_config[CACHE_COUNT] = {
+    [CACHE_I] = {.size = 4096, .line_size = 32, .assoc = 2, .miss_penalty = 20},
+    [CACHE_D] = {.size = 4096,
+                 .line_size = 32,
+                 .assoc = 4,
+                 .write_back = true,
+                 .miss_penalty = 20},
+};
+export CacheStats g_cache_stats[CACHE_COUNT];
+ARES_ARRAY(CacheSiteStats) g_cache_sites[CACHE_COUNT];
+u32 g_cache_stall[CACHE_COUNT];
+export ARES_ARRAY(CacheSiteStats) g_cache_label_stats =
+    ARES_ARRAY_NEW(CacheSiteStats);
+export ARES_ARRAY(u32) g_cache_lines = ARES_ARRAY_NEW(u32);
+
+typedef struct {
+    u32 sets;
+    u32 line_shift;
+    // line address (addr >> line_shift) of each way, sets * assoc of them
+    u32 *tags;
+    u8 *state;
+    // last use for LRU, fill time for FIFO
+    u64 *stamp;
+    u64 clock;
+} CacheState;
+
+static CacheState g_caches[CACHE_COUNT];
+static u32 g_cache_rng;
+
+static bool cache_config_valid(const CacheConfig *cfg) {
+    if (!ares_is_pow2(cfg->line_size) || cfg->line_size < 4 || !cfg->assoc ||
+        cfg->assoc > cfg->size / cfg->line_size)
+        return false;
+    u32 set_size = cfg->line_size * cfg->assoc;
+    return cfg->size % set_size == 0 && ares_is_pow2(cfg->size / set_size) &&
+           cfg->replacement <= CACHE_RANDOM;
+}
+
+static void cache_free(CacheState *c) {
+    free(c->tags);
+    free(c->state);
+    free(c->stamp);
+    *c = (CacheState){0};
+}
+
+export bool cache_start(void) {
+    cache_stop();
+
+    for (int i = 0; i < CACHE_COUNT; i++) {
+        CacheConfig *cfg = &g_cache_config[i];
+        CacheState *c = &g_caches[i];
+        if (!cfg->size) continue;
+        if (!cache_config_valid(cfg)) return false;
+
+        c->sets = cfg->size / (cfg->line_size * cfg->assoc);
+        c->line_shift = __builtin_ctz(cfg->line_size);
+        size_t ways = (size_t)c->sets * cfg->assoc;
+        c->tags = malloc(ways * sizeof(u32));
+        ARES_CHECK_OOM(c->tags);
+        c->state = malloc(ways);
+        ARES_CHECK_OOM(c->state);
+        memset(c->state, 0, ways);
+        c->stamp = malloc(ways * sizeof(u64));
+        ARES_CHECK_OOM(c->stamp);
+    }
+
+    Section *text = text_section();
+    size_t slots = text ? (ARES_ARRAY_LEN(&text->contents) + 1) / 2 : 0;
+    for (int i = 0; i < CACHE_COUNT; i++) {
+        g_cache_sites[i] = ARES_ARRAY_PREPARE(CacheSiteStats, slots);
+        if (!slots) continue;
+        g_cache_sites[i].buf = malloc(slots * sizeof(CacheSiteStats));
+        ARES_CHECK_OOM(g_cache_sites[i].buf);
+        memset(g_cache_sites[i].buf, 0, slots * sizeof(CacheSiteStats));
+    }
+
+    memset(g_cache_stats, 0, sizeof(g_cache_stats));
+    memset(g_cache_stall, 0, sizeof(g_cache_stall));
+    g_cache_rng = 0x2545F491;
+    g_cache_enabled = true;
+    return true;
+}
+
+export void cache_stop(void) {
+    g_cache_enabled = false;
+    for (int i = 0; i < CACHE_COUNT; i++) {
+        cache_free(&g_caches[i]);
+        ARES_ARRAY_FREE(&g_cache_sites[i]);
+    }
+    ARES_ARRAY_FREE(&g_cache_label_stats);
+    ARES_ARRAY_FREE(&g_cache_lines);
+}
+
+static u32 cache_victim(int which, u32 base) {
+    CacheState *c = &g_caches[which];
+    CacheConfig *cfg = &g_cache_config[which];
+
+    for (u32 w = 0; w < cfg->assoc; w++)
+        if (!(c->state[base + w] & CACHE_VALID)) return base + w;
+
+    if (cfg->replacement == CACHE_RANDOM) {
+        g_cache_rng ^= g_cache_rng << 13;
+        g_cache_rng ^= g_cache_rng >> 17;
+        g_cache_rng ^= g_cache_rng << 5;
+        return base + g_cache_rng % cfg->assoc;
+    }
+
+    // LRU and FIFO only differ in when the stamp is updated
+    u32 victim = base;
+    for (u32 w = 1; w < cfg->assoc; w++)
+        if (c->stamp[base + w] < c->stamp[victim]) victim = base + w;
+    return victim;
+}
+
+static u32 cache_fill(int which, u32 line, CacheSiteStats *site) {
+    CacheState *c = &g_caches[which];
+    CacheStats *st = &g_cache_stats[which];
+    u32 set = line & (c->sets - 1);
+    u32 way = cache_victim(which, set * g_cache_config[which].assoc);
+
+    if (c->state[way] & CACHE_VALID) {
+        st->evictions++;
+        if (site) site->evictions++;
+        if (c->state[way] & CACHE_DIRTY) st->writebacks++;
+    }
+    c->tags[way] = line;
+    c->state[way] = CACHE_VALID;
+    c->stamp[way] = c->clock;
+    return way;
+}
+
+static inline bool cache_present(int which, u32 line, u32 *way) {
+    CacheState *c = &g_caches[which];
+    u32 assoc = g_cache_config[which].assoc;
+    u32 base = (line & (c->sets - 1)) * assoc;
+    for (u32 w = base; w < base + assoc; w++) {
+        if ((c->state[w] & CACHE_VALID) && c->tags[w] == line) {
+            *way = w;
+            return true;
+        }
+    }
+    return false;
+}
+
+// returns true on a hit
+static bool cache_line_access(int which, u32 line, bool write,
+                              CacheSiteStats *site) {
+    CacheState *c = &g_caches[which];
+    CacheConfig *cfg = &g_cache_config[which];
+    CacheStats *st = &g_cache_stats[which];
+    u32 way;
+
+    c->clock++;
+    st->accesses++;
+    if (site) site->accesses++;
+
+    if (cache_present(which, line, &way)) {
+        if (cfg->replacement == CACHE_LRU) c->stamp[way] = c->clock;
+        if (write && cfg->write_back) c->state[way] |= CACHE_DIRTY;
+        return true;
+    }
+
+    st->misses++;
+    if (site) site->misses++;
+    // write-through caches don't allocate on a write miss
+    if (write && !cfg->write_back) return false;
+
+    way = cache_fill(which, line, site);
+    if (write) c->state[way] |= CACHE_DIRTY;
+    if (cfg->prefetch && !cache_present(which, line + 1, &way)) {
+        cache_fill(which, line + 1, site);
+        st->prefetches++;
+    }
+    return false;
+}
+
+// returns the miss penalty, accesses can straddle two lines
+static u32 cache_access(int which, u32 addr, u32 size, bool write,
+                        CacheSiteStats *site) {
+    CacheState *c = &g_caches[which];
+    u32 penalty = 0;
+    if (!c->tags) return 0;
+    for (u32 line = addr >> c->line_shift;
+         line <= (addr + size - 1) >> c->line_shift; line++)
+        if (!cache_line_access(which, line, write, site))
+            penalty += g_cache_config[which].miss_penalty;
+    return penalty;
+}
+
+static inline bool is_uncached(u32 addr) {
+    return addr >= MMIO_BASE && addr < MMIO_END;
+}
+
+void cache_retire(void) {
+    CacheSiteStats *site[CACHE_COUNT] = {NULL, NULL};
+    u32 slot = (g_fetch_pc - TEXT_BASE) / 2;
+    for (int i = 0; i < CACHE_COUNT; i++)
+        if (slot < ARES_ARRAY_LEN(&g_cache_sites[i]))
+            site[i] = ARES_ARRAY_GET(&g_cache_sites[i], slot);
+
+    g_cache_stall[CACHE_I] =
+        cache_access(CACHE_I, g_fetch_pc, g_inst_len, false, site[CACHE_I]);
+
+    g_cache_stall[CACHE_D] = 0;
+    if (g_mem_read_len && !is_uncached(g_mem_read_addr))
+        g_cache_stall[CACHE_D] += cache_access(
+            CACHE_D, g_mem_read_addr, g_mem_read_len, false, site[CACHE_D]);
+    if (g_mem_written_len && !is_uncached(g_mem_written_addr))
+        g_cache_stall[CACHE_D] +=
+            cache_access(CACHE_D, g_mem_written_addr, g_mem_written_len, true,
+                         site[CACHE_D]);
+}
+
+static bool parse_size(const char **s, u32 *out) {
+    u64 v;
+    if (!ares_parse_num(s, 1024, UINT32_MAX, &v)) return false;
+    *out = v;
+    return true;
+}
+
+bool cache_parse_config(const char *spec, CacheConfig *out, char **error) {
+    CacheConfig cfg = {.miss_penalty = out->miss_penalty};
+    const char *p = spec;
+
+    if (!parse_size(&p, &cfg.size) || *p++ != ':' ||
+        !parse_size(&p, &cfg.line_size) || *p++ != ':' ||
+        !parse_size(&p, &cfg.assoc)) {
+        *error = "expected size:line:ways, each below 4G";
+        return false;
+    }
+
+    cfg.write_back = true;
+    while (*p == ':') {
+        p++;
+        if (ares_option_eq(&p, "lru")) cfg.replacement = CACHE_LRU;
+        else if (ares_option_eq(&p, "fifo")) cfg.replacement = CACHE_FIFO;
+        else if (ares_option_eq(&p, "random")) cfg.replacement = CACHE_RANDOM;
+        else if (ares_option_eq(&p, "wb")) cfg.write_back = true;
+        else if (ares_option_eq(&p, "wt")) cfg.write_back = false;
+        else if (ares_option_eq(&p, "prefetch")) cfg.prefetch = true;
+        else {
+            *error = "unknown cache option";
+            return false;
+        }
+    }
+    if (*p) {
+        *error = "expected size:line:ways";
+        return false;
+    }
+    if (!cache_config_valid(&cfg)) {
+        *error = "line size and set count must be powers of two";
+        return false;
+    }
+
+    *out = cfg;
+    return true;
+}
+
+export void cache_attribute(void) {
+    size_t n = ARES_ARRAY_LEN(&g_labels) * CACHE_COUNT;
+    g_cache_label_stats.len = 0;
+    for (size_t i = 0; i < n; i++)
+        *ARES_ARRAY_PUSH(&g_cache_label_stats) = (CacheSiteStats){0};
+
+    for (int c = 0; c < CACHE_COUNT; c++) {
+        for (size_t i = 0; i < ARES_ARRAY_LEN(&g_cache_sites[c]); i++) {
+            CacheSiteStats *site = ARES_ARRAY_GET(&g_cache_sites[c], i);
+            if (!site->accesses) continue;
+            LabelData *label;
+            u32 off;
+            if (!pc_to_label_r(TEXT_BASE + i * 2, &label, &off)) continue;
+            CacheSiteStats *dst =
+                &g_cache_label_stats
+                     .buf[(label - g_labels.buf) * CACHE_COUNT + c];
+            dst->accesses += site->accesses;
+            dst->misses += site->misses;
+            dst->evictions += site->evictions;
+        }
+    }
+}
+
+static inline void add_sat(u32 *dst, u64 v) {
+    u64 sum = *dst + v;
+    *dst = sum > (u32)-1 ? (u32)-1 : sum;
+}
+
+export void cache_lines(void) {
+    g_cache_lines.len = 0;
+    for (int c = 0; c < CACHE_COUNT; c++) {
+        size_t n = ARES_ARRAY_LEN(&g_cache_sites[c]);
+        if (ARES_ARRAY_LEN(&g_text_by_linenum) < n)
+            n = ARES_ARRAY_LEN(&g_text_by_linenum);
+
+        for (size_t i = 0; i < n; i++) {
+            CacheSiteStats *site = ARES_ARRAY_GET(&g_cache_sites[c], i);
+            u32 line = g_text_by_linenum.buf[i];
+            if (!site->accesses || !line) continue;
+            while (g_cache_lines.len < (line + 1) * 3 * CACHE_COUNT)
+                *ARES_ARRAY_PUSH(&g_cache_lines) = 0;
+            u32 *dst = &g_cache_lines.buf[(line * CACHE_COUNT + c) * 3];
+            add_sat(&dst[0], site->accesses);
+            add_sat(&dst[1], site->misses);
+            add_sat(&dst[2], site->evictions);
+        }
+    }
+}
@@ -5,18 +5,45 @@
 
 export u32 g_reg_bitmap;
 ARES_ARRAY(ShadowStackEnt) g_shadow_stack = ARES_ARRAY_NEW(ShadowStackEnt);
-export u8 g_callsan_stack_written_by[STACK_LEN / 4];
+export ARES_ARRAY(u8) g_callsan_stack_written_by = ARES_ARRAY_NEW(u8);
+// every stack word below this index is poisoned, so a return only has to
+// poison what was written since the previous one
+static u32 g_callsan_clean;
+
+#define CALLSAN_WORDS ((u32)ARES_ARRAY_LEN(&g_callsan_stack_written_by))
+#define CALLSAN_BASE (STACK_TOP - CALLSAN_WORDS * 4)
+
+void callsan_reset_stack(u32 words) {
+    ARES_ARRAY_FREE(&g_callsan_stack_written_by);
+    g_callsan_stack_written_by = ARES_ARRAY_PREPARE(u8, words);
+    g_callsan_stack_written_by.buf = malloc(words);
+    ARES_CHECK_OOM(g_callsan_stack_written_by.buf);
+    memset(g_callsan_stack_written_by.buf, 0xFF, words);
+    g_callsan_clean = words;
+}
+
+void callsan_grow_stack(u32 words) {
+    u32 len = CALLSAN_WORDS;
+    if (words <= len) return;
+    u8 *buf = malloc(words);
+    ARES_CHECK_OOM(buf);
+    memset(buf, 0xFF, words - len);
+    memcpy(buf + words - len, g_callsan_stack_written_by.buf, len);
+    free(g_callsan_stack_written_by.buf);
+    g_callsan_stack_written_by.buf = buf;
+    g_callsan_stack_written_by.len = g_callsan_stack_written_by.cap = words;
+    g_callsan_clean += words - len;
+}
 
 void callsan_init() {
-    memset(g_callsan_stack_written_by, 0xFF,
-           sizeof(g_callsan_stack_written_by));
+    callsan_reset_stack(STACK_LEN / 4);
     g_reg_bitmap = (1ul << REG_ZERO) | (1ul << REG_SP) | (1ul << REG_TP) |
                    (1ul << REG_GP) | (1ul << REG_RA) | (1u << REG_FP) |
                    (1u << REG_S1) | (1u << REG_S2) | (1u << REG_S3) |
                    (1u << REG_S4) | (1u << REG_S5) | (1u << REG_S6) |
                    (1u << REG_S7) | (1u << REG_S8) | (1u << REG_S9) |
                    (1u << REG_S10) | (1u << REG_S11);
-    g_shadow_stack = ARES_ARRAY_NEW(ShadowStackEnt);
+    ARES_ARRAY_FREE(&g_shadow_stack);
 }
 
 bool callsan_can_load(int reg) {
@@ -102,27 +129,39 @@ bool callsan_ret() {
     g_reg_bitmap = e->reg_bitmap & ~CALLSAN_CALL_CLOBBERED;
 
     // rest of the stack is all poisoned
-    u32 endidx = (e->sp - (STACK_TOP - STACK_LEN)) / 4;
-    for (u32 i = 0; i < endidx; i++) g_callsan_stack_written_by[i] = -1;
+    u32 endidx = 0;
+    if (e->sp >= STACK_TOP) endidx = CALLSAN_WORDS;
+    else if (e->sp > CALLSAN_BASE) endidx = (e->sp - CALLSAN_BASE) / 4;
+    for (u32 i = g_callsan_clean; i < endidx; i++)
+        g_callsan_stack_written_by.buf[i] = -1;
+    if (endidx > g_callsan_clean) g_callsan_clean = endidx;
     return true;
 }
 
+void callsan_sync() {
+    g_callsan_clean = 0;
+    while (g_callsan_clean < CALLSAN_WORDS &&
+           g_callsan_stack_written_by.buf[g_callsan_clean] == 0xFF)
+        g_callsan_clean++;
+}
+
 void callsan_report_store(u32 addr, u32 size, int reg) {
-    bool in_stack = addr >= STACK_TOP - STACK_LEN && addr + size <= STACK_TOP;
+    bool in_stack = addr >= CALLSAN_BASE && addr + size <= STACK_TOP;
     if (!in_stack) return;
-    u32 off = addr - (STACK_TOP - STACK_LEN);
+    u32 off = addr - CALLSAN_BASE;
     u32 startidx = off / 4;
     u32 endidx = (off + size - 1) / 4;
-    g_callsan_stack_written_by[startidx] = reg;
-    if (endidx != startidx) g_callsan_stack_written_by[endidx] = reg;
+    g_callsan_stack_written_by.buf[startidx] = reg;
+    if (endidx != startidx) g_callsan_stack_written_by.buf[endidx] = reg;
+    if (startidx < g_callsan_clean) g_callsan_clean = startidx;
 }
 
 bool callsan_check_load(u32 addr, u32 size) {
-    bool in_stack = addr >= STACK_TOP - STACK_LEN && addr + size <= STACK_TOP;
+    bool in_stack = addr >= CALLSAN_BASE && addr + size <= STACK_TOP;
     if (!in_stack) return true;
-    u32 off = addr - (STACK_TOP - STACK_LEN);
+    u32 off = addr - CALLSAN_BASE;
     u32 startidx = off / 4;
     u32 endidx = (off + size - 1) / 4;
-    return g_callsan_stack_written_by[startidx] != 0xFF &&
-           g_callsan_stack_written_by[endidx] != 0xFF;
+    return g_callsan_stack_written_by.buf[startidx] != 0xFF &&
+           g_callsan_stack_written_by.buf[endidx] != 0xFF;
 }
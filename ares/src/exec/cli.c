@@ -1,3 +1,4 @@
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -7,10 +8,20 @@
 
 #include "ezld/include/ezld/linker.h"
 #include "ezld/include/ezld/runtime.h"
+#include "ares/bpred.h"
+#include "ares/cache.h"
 #include "ares/callsan.h"
 #include "ares/core.h"
 #include "ares/elf.h"
 #include "ares/emulate.h"
+#include "ares/latency.h"
+#include "ares/ooo.h"
+#include "ares/pipeline.h"
+#include "ares/profile.h"
+#include "ares/reuse.h"
+#include "ares/sample.h"
+#include "ares/state.h"
+#include "ares/trace.h"
 #include "ares/util.h"
 #include "vendor/commander.h"
 
@@ -39,6 +50,34 @@ static int g_cmd_args_len;
 // Flags
 // Set by variout opt_* like --sanitize, --fuzz
 static bool g_flg_callsan = false;
+static bool g_flg_pipeline = false;
+// set by --icache and --dcache, g_cache_config holds the geometry
+static bool g_flg_cache = false;
+// set by --bpred, g_bpred_config holds the predictor
+static bool g_flg_bpred = false;
+// set by --ooo, g_ooo_config holds the core
+static bool g_flg_ooo = false;
+// set by --sample, g_sample_config holds the intervals
+static bool g_flg_sample = false;
+// set by --latency, g_latency_table holds the costs
+static bool g_flg_latency = false;
+
+// Checkpointing, set by --save-state and --save-at
+// g_save_requested is set asynchronously by SIGUSR1
+static char *g_state_out = NULL;
+static u64 g_save_at = 0;
+// the count may already be past g_save_at, e.g. after --load-state
+static bool g_saved_at = false;
+static volatile sig_atomic_t g_save_requested = 0;
+
+// Execution trace output, set by --trace
+static char *g_trace_out = NULL;
+
+// Folded stack output, set by --profile
+static char *g_profile_out = NULL;
+
+// Miss-ratio curves and working sets, set by --reuse
+static char *g_reuse_out = NULL;
 
 // The file text, used as backing storage by all global strings
 // this simplifies lifetime management significantly
@@ -60,10 +99,32 @@ static void update_argument(const char *arg) {
 
 // UTILITY FUNCTIONS
 
+static void save_state(void) {
+    char *error = NULL;
+    if (!state_save(g_state_out, &error)) {
+        fprintf(stderr, "state: %s\n", error);
+    }
+}
+
+static void on_save_signal(int sig) { g_save_requested = 1; }
+
 static void emulate_safe(void) {
     while (!g_exited) {
+        if (g_save_at && !g_saved_at && g_instret >= g_save_at) {
+            g_saved_at = true;
+            g_save_requested = 1;
+        }
+        if (g_save_requested) {
+            g_save_requested = 0;
+            save_state();
+        }
+
         emulate();
 
+        if (g_trace_out) {
+            trace_record();
+        }
+
         switch (g_runtime_error_type) {
             case ERROR_NONE:
                 break;
@@ -86,6 +147,13 @@ static void emulate_safe(void) {
                         g_pc, g_runtime_error_params[0]);
                 return;
 
+            case ERROR_STACK_OVERFLOW:
+                fprintf(stderr,
+                        "emulator: stack overflow at pc=0x%08x on addr=0x%08x, "
+                        "the stack is limited to %u bytes (see --stack)\n",
+                        g_pc, g_runtime_error_params[0], g_stack_limit);
+                goto err;
+
             case ERROR_UNHANDLED_INSN:
                 fprintf(stderr,
                         "emulator: unhandled instruction at pc=0x%08x\n", g_pc);
@@ -188,6 +256,403 @@ err:
     }
 }
 
+static int cmp_label_count(const void *a, const void *b) {
+    u64 ca = g_profile_label_counts.buf[*(const u32 *)a];
+    u64 cb = g_profile_label_counts.buf[*(const u32 *)b];
+    return (ca < cb) - (ca > cb);
+}
+
+// writes the folded stacks to g_profile_out and a flat profile to stderr
+static void write_profile(void) {
+    ARES_ARRAY(char) folded = ARES_ARRAY_NEW(char);
+    profile_folded(&folded);
+    FILE *f = fopen(g_profile_out, "w");
+    if (!f || fwrite(folded.buf, 1, folded.len, f) != folded.len) {
+        fprintf(stderr, "profile: could not write output file\n");
+    }
+    if (f) fclose(f);
+    ARES_ARRAY_FREE(&folded);
+
+    u64 total = g_profile_other;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_profile_counts); i++) {
+        total += g_profile_counts.buf[i];
+    }
+    if (!total) return;
+
+    profile_attribute();
+    size_t n = ARES_ARRAY_LEN(&g_profile_label_counts);
+    u32 *order = malloc(n * sizeof(u32) + 1);
+    ARES_CHECK_OOM(order);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    qsort(order, n, sizeof(u32), cmp_label_count);
+
+    fprintf(stderr, "%12s %7s  %s\n", "instrs", "%", "label");
+    for (size_t i = 0; i < n; i++) {
+        u64 count = g_profile_label_counts.buf[order[i]];
+        if (!count) break;
+        LabelData *l = ARES_ARRAY_GET(&g_labels, order[i]);
+        fprintf(stderr, "%12llu %6.2f%%  %.*s\n", (unsigned long long)count,
+                100.0 * count / total, (int)l->len, l->txt);
+    }
+    if (g_profile_other) {
+        fprintf(stderr, "%12llu %6.2f%%  [outside .text]\n",
+                (unsigned long long)g_profile_other,
+                100.0 * g_profile_other / total);
+    }
+    free(order);
+}
+
+static void print_pipeline_stats(void) {
+    PipelineStats *st = &g_pipeline_stats;
+    if (!st->instret) return;
+    fprintf(stderr, "pipeline: %llu cycles, %llu instructions, CPI %.3f\n",
+            (unsigned long long)st->cycles, (unsigned long long)st->instret,
+            (double)st->cycles / st->instret);
+    fprintf(stderr,
+            "  stalls: %llu load-use, %llu structural, %llu control, "
+            "%llu memory\n",
+            (unsigned long long)st->load_use_stalls,
+            (unsigned long long)st->structural_stalls,
+            (unsigned long long)st->control_stalls,
+            (unsigned long long)st->memory_stalls);
+}
+
+static int cmp_label_misses(const void *a, const void *b) {
+    CacheSiteStats *sa = g_cache_label_stats.buf + *(const u32 *)a;
+    CacheSiteStats *sb = g_cache_label_stats.buf + *(const u32 *)b;
+    return (sa->misses < sb->misses) - (sa->misses > sb->misses);
+}
+
+// miss-ratio curves at every power of two size and the working set of each
+// section per epoch
+static void write_reuse(void) {
+    FILE *f = fopen(g_reuse_out, "w");
+    if (!f) {
+        fprintf(stderr, "reuse: could not write output file\n");
+        return;
+    }
+
+    u32 line = g_reuse_config.line_size;
+    fprintf(f, "# fully associative LRU, %u byte lines\n", line);
+    fprintf(f,
+            "# size icache_misses icache_ratio dcache_misses dcache_ratio\n");
+    u64 *misses[REUSE_COUNT];
+    for (int c = 0; c < REUSE_COUNT; c++) {
+        reuse_mrc(c, REUSE_MAX_DISTANCE);
+        misses[c] = g_reuse_mrc.buf;
+        // keep the buffer, the next call would overwrite it
+        g_reuse_mrc = ARES_ARRAY_NEW(u64);
+    }
+    for (u32 lines = 1; lines <= REUSE_MAX_DISTANCE; lines *= 2) {
+        fprintf(f, "%llu", (unsigned long long)lines * line);
+        for (int c = 0; c < REUSE_COUNT; c++) {
+            u64 m = misses[c][lines - 1];
+            u64 n = g_reuse_stats[c].accesses;
+            fprintf(f, " %llu %.6f", (unsigned long long)m,
+                    n ? (double)m / n : 0.0);
+        }
+        fprintf(f, "\n");
+    }
+    for (int c = 0; c < REUSE_COUNT; c++) free(misses[c]);
+
+    fprintf(f, "\n# distinct lines touched per %u instructions\n# epoch",
+            g_reuse_config.epoch);
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++)
+        fprintf(f, " %s", (*ARES_ARRAY_GET(&g_sections, i))->name);
+    fprintf(f, " other\n");
+    size_t epochs = ARES_ARRAY_LEN(&g_reuse_working_set) / g_reuse_sections;
+    for (size_t e = 0; e < epochs; e++) {
+        fprintf(f, "%zu", e);
+        for (u32 i = 0; i < g_reuse_sections; i++)
+            fprintf(f, " %u",
+                    g_reuse_working_set.buf[e * g_reuse_sections + i]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+
+    for (int c = 0; c < REUSE_COUNT; c++)
+        fprintf(stderr,
+                "reuse: %s %llu accesses, %llu distinct lines, "
+                "%llu beyond %u lines\n",
+                c == REUSE_I ? "fetch" : "data",
+                (unsigned long long)g_reuse_stats[c].accesses,
+                (unsigned long long)g_reuse_stats[c].cold,
+                (unsigned long long)g_reuse_stats[c].far, REUSE_MAX_DISTANCE);
+}
+
+static void print_sample_estimate(void) {
+    SampleStats *st = &g_sample_stats;
+    SampleEstimate *est = &g_sample_estimate;
+    sample_estimate();
+    fprintf(stderr,
+            "sample: %llu samples, %llu of %llu instructions measured "
+            "(%llu cycles)\n",
+            (unsigned long long)st->samples,
+            (unsigned long long)st->measured_instret,
+            (unsigned long long)st->instret,
+            (unsigned long long)st->measured_cycles);
+    if (!st->samples) {
+        fprintf(stderr, "  the program is shorter than one period\n");
+        return;
+    }
+    fprintf(stderr, "  CPI %.3f (95%% CI %.3f - %.3f), ~%.0f cycles\n",
+            est->cpi, est->cpi_low, est->cpi_high, est->cycles);
+}
+
+static void print_latency_stats(void) {
+    static const char *names[LAT_COUNT] = {
+        [LAT_ALU] = "alu",
+        [LAT_MUL] = "mul",
+        [LAT_DIV] = "div",
+        [LAT_LOAD] = "load",
+        [LAT_STORE] = "store",
+        [LAT_BRANCH_TAKEN] = "taken branch",
+        [LAT_BRANCH_NOT_TAKEN] = "not taken branch",
+        [LAT_JUMP] = "jump",
+        [LAT_CSR] = "csr",
+        [LAT_ECALL] = "ecall",
+    };
+    u64 total = 0, instret = 0;
+    for (int i = 0; i < LAT_COUNT; i++) {
+        total += g_latency_counts[i] * g_latency_table[i];
+        instret += g_latency_counts[i];
+    }
+    fprintf(stderr, "latency: ~%llu cycles, %llu instructions, CPI %.3f\n",
+            (unsigned long long)total, (unsigned long long)instret,
+            instret ? (double)total / instret : 0.0);
+    for (int i = 0; i < LAT_COUNT; i++) {
+        if (!g_latency_counts[i]) continue;
+        u64 cycles = g_latency_counts[i] * g_latency_table[i];
+        fprintf(stderr, "%12llu cycles %6.2f%%  %llu x %s\n",
+                (unsigned long long)cycles, 100.0 * cycles / total,
+                (unsigned long long)g_latency_counts[i], names[i]);
+    }
+}
+
+static void print_ooo_stats(void) {
+    OooStats *st = &g_ooo_stats;
+    fprintf(stderr, "ooo: %llu cycles, %llu instructions, IPC %.3f\n",
+            (unsigned long long)st->cycles, (unsigned long long)st->instret,
+            st->cycles ? (double)st->instret / st->cycles : 0.0);
+    fprintf(stderr,
+            "  stalls: %llu control, %llu frontend, %llu rob full, "
+            "%llu dependency, %llu structural, %llu memory, %llu execute\n",
+            (unsigned long long)st->control_stalls,
+            (unsigned long long)st->frontend_stalls,
+            (unsigned long long)st->rob_full_stalls,
+            (unsigned long long)st->dependency_stalls,
+            (unsigned long long)st->structural_stalls,
+            (unsigned long long)st->memory_stalls,
+            (unsigned long long)st->execute_stalls);
+    fprintf(stderr, "  average rob occupancy: %.2f of %u\n",
+            st->cycles ? (double)st->rob_occupancy_sum / st->cycles : 0.0,
+            g_ooo_config.rob_size);
+}
+
+static int cmp_site_mispredicts(const void *a, const void *b) {
+    BpredSiteStats *sa = g_bpred_sites.buf + *(const u32 *)a;
+    BpredSiteStats *sb = g_bpred_sites.buf + *(const u32 *)b;
+    return (sa->mispredicts < sb->mispredicts) -
+           (sa->mispredicts > sb->mispredicts);
+}
+
+static int cmp_label_mispredicts(const void *a, const void *b) {
+    BpredSiteStats *sa = g_bpred_label_stats.buf + *(const u32 *)a;
+    BpredSiteStats *sb = g_bpred_label_stats.buf + *(const u32 *)b;
+    return (sa->mispredicts < sb->mispredicts) -
+           (sa->mispredicts > sb->mispredicts);
+}
+
+static double percent(u64 part, u64 whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void print_bpred_stats(void) {
+    BpredStats *st = &g_bpred_stats;
+    fprintf(stderr,
+            "bpred: %llu branches, %llu mispredicted (%.2f%%), "
+            "%llu jumps, %llu mispredicted (%.2f%%), "
+            "%llu returns, %llu mispredicted (%.2f%%), "
+            "%llu decode redirects\n",
+            (unsigned long long)st->branches,
+            (unsigned long long)st->branch_mispredicts,
+            percent(st->branch_mispredicts, st->branches),
+            (unsigned long long)st->jumps,
+            (unsigned long long)st->jump_mispredicts,
+            percent(st->jump_mispredicts, st->jumps),
+            (unsigned long long)st->returns,
+            (unsigned long long)st->return_mispredicts,
+            percent(st->return_mispredicts, st->returns),
+            (unsigned long long)st->decode_redirects);
+
+    size_t n = ARES_ARRAY_LEN(&g_bpred_sites);
+    u32 *order = malloc(n * sizeof(u32) + 1);
+    ARES_CHECK_OOM(order);
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++)
+        if (g_bpred_sites.buf[i].mispredicts) order[m++] = i;
+    qsort(order, m, sizeof(u32), cmp_site_mispredicts);
+    for (size_t i = 0; i < m && i < 10; i++) {
+        BpredSiteStats *s = g_bpred_sites.buf + order[i];
+        u32 pc = TEXT_BASE + order[i] * 2;
+        LabelData *l;
+        u32 off;
+        fprintf(stderr, "%12llu / %-12llu (%6.2f%%)  ",
+                (unsigned long long)s->mispredicts,
+                (unsigned long long)s->executed,
+                percent(s->mispredicts, s->executed));
+        if (pc_to_label_r(pc, &l, &off))
+            fprintf(stderr, "%.*s+0x%x\n", (int)l->len, l->txt, off);
+        else fprintf(stderr, "0x%08x\n", pc);
+    }
+    free(order);
+
+    bpred_attribute();
+    n = ARES_ARRAY_LEN(&g_bpred_label_stats);
+    order = malloc(n * sizeof(u32) + 1);
+    ARES_CHECK_OOM(order);
+    m = 0;
+    for (size_t i = 0; i < n; i++)
+        if (g_bpred_label_stats.buf[i].mispredicts) order[m++] = i;
+    qsort(order, m, sizeof(u32), cmp_label_mispredicts);
+    if (m) fprintf(stderr, "per label:\n");
+    for (size_t i = 0; i < m && i < 10; i++) {
+        BpredSiteStats *s = g_bpred_label_stats.buf + order[i];
+        LabelData *l = ARES_ARRAY_GET(&g_labels, order[i]);
+        fprintf(stderr, "%12llu / %-12llu (%6.2f%%)  %.*s\n",
+                (unsigned long long)s->mispredicts,
+                (unsigned long long)s->executed,
+                percent(s->mispredicts, s->executed), (int)l->len, l->txt);
+    }
+    free(order);
+}
+
+static void print_cache_stats(void) {
+    static const char *names[CACHE_COUNT] = {"icache", "dcache"};
+
+    cache_attribute();
+    size_t n = ARES_ARRAY_LEN(&g_cache_label_stats);
+    u32 *order = malloc(n * sizeof(u32) + 1);
+    ARES_CHECK_OOM(order);
+
+    for (int c = 0; c < CACHE_COUNT; c++) {
+        CacheStats *st = &g_cache_stats[c];
+        if (!st->accesses) continue;
+        fprintf(stderr,
+                "%s: %llu accesses, %llu misses (%.2f%%), %llu evictions, "
+                "%llu writebacks, %llu prefetches\n",
+                names[c], (unsigned long long)st->accesses,
+                (unsigned long long)st->misses,
+                100.0 * st->misses / st->accesses,
+                (unsigned long long)st->evictions,
+                (unsigned long long)st->writebacks,
+                (unsigned long long)st->prefetches);
+
+        // labels of this cache only, they are interleaved
+        size_t m = 0;
+        for (size_t i = c; i < n; i += CACHE_COUNT) order[m++] = i;
+        qsort(order, m, sizeof(u32), cmp_label_misses);
+        for (size_t i = 0; i < m && i < 10; i++) {
+            CacheSiteStats *s = g_cache_label_stats.buf + order[i];
+            if (!s->misses) break;
+            LabelData *l = ARES_ARRAY_GET(&g_labels, order[i] / CACHE_COUNT);
+            fprintf(stderr, "%12llu misses %12llu accesses  %.*s\n",
+                    (unsigned long long)s->misses,
+                    (unsigned long long)s->accesses, (int)l->len, l->txt);
+        }
+    }
+    free(order);
+}
+
+// emulate_safe, plus the checkpoint and trace requested on the command line
+static void run_guest(void) {
+    char *error = NULL;
+
+    if (g_state_out) {
+        signal(SIGUSR1, on_save_signal);
+    }
+
+    if (g_trace_out && !trace_open(g_trace_out, &error)) {
+        fprintf(stderr, "trace: %s\n", error);
+        return;
+    }
+
+    if (g_profile_out) {
+        profile_start();
+    }
+
+    if (g_reuse_out) {
+        reuse_start();
+    }
+
+    if (g_flg_cache && !cache_start()) {
+        fprintf(stderr, "cache: invalid cache geometry\n");
+        return;
+    }
+
+    if (g_flg_bpred) {
+        bpred_start();
+    }
+
+    if (g_flg_ooo) {
+        ooo_start();
+    } else if (g_flg_pipeline) {
+        pipeline_start();
+    } else if (g_flg_latency) {
+        latency_start();
+    }
+
+    if (g_flg_sample) {
+        sample_start();
+    }
+
+    emulate_safe();
+
+    if (g_trace_out && !trace_close(&error)) {
+        fprintf(stderr, "trace: %s\n", error);
+    }
+
+    if (g_profile_out) {
+        write_profile();
+        profile_stop();
+    }
+
+    if (g_flg_sample) {
+        sample_stop();
+        print_sample_estimate();
+    }
+
+    if (g_reuse_out) {
+        write_reuse();
+        reuse_stop();
+    }
+
+    if (g_flg_cache) {
+        print_cache_stats();
+        cache_stop();
+    }
+
+    if (g_flg_bpred) {
+        print_bpred_stats();
+        bpred_stop();
+    }
+
+    if (g_flg_ooo) {
+        print_ooo_stats();
+        ooo_stop();
+    } else if (g_flg_pipeline) {
+        print_pipeline_stats();
+        pipeline_stop();
+    } else if (g_flg_latency) {
+        print_latency_stats();
+        latency_stop();
+    }
+
+    if (g_state_out && !g_save_at) {
+        save_state();
+    }
+}
+
 static void assemble_from_file(const char *src_path, bool allow_externs) {
     FILE *f = fopen(src_path, "r");
 
@@ -215,31 +680,18 @@ static void assemble_from_file(const char *src_path, bool allow_externs) {
 // COMMANDS
 
 static void c_build(void) {
-    FILE *out = NULL;
     assemble_from_file(g_next_arg, false);
 
     if (g_error) goto exit;
 
-    void *elf_contents = NULL;
-    size_t elf_sz = 0;
     char *error = NULL;
 
-    if (!elf_emit_exec(&elf_contents, &elf_sz, &error)) {
+    if (!elf_write_exec(g_exec_out, &error)) {
         fprintf(stderr, "linker: %s\n", error);
         goto exit;
     }
 
-    out = fopen(g_exec_out, "wb");
-
-    if (!out) {
-        fprintf(stderr, "linker: could not open output file\n");
-        goto exit;
-    }
-
-    fwrite(elf_contents, elf_sz, 1, out);
-
 exit:
-    if (out) fclose(out);
     if (g_txt) {
         free(g_txt);
         g_txt = NULL;
@@ -248,39 +700,21 @@ exit:
 }
 
 static void c_run(void) {
-    FILE *elf = fopen(g_next_arg, "rb");
-    u8 *elf_contents = NULL;
     char *error = NULL;
 
-    if (!elf) {
-        fprintf(stderr, "loader: could not open input file\n");
-        goto exit;
+    if (!elf_load_file(g_next_arg, &error)) {
+        fprintf(stderr, "loader: %s\n", error);
+        return;
     }
 
-    fseek(elf, 0, SEEK_END);
-    size_t sz = ftell(elf);
-    rewind(elf);
-
-    elf_contents = malloc(sz);
-    ARES_CHECK_OOM(elf_contents);
-
-    fread(elf_contents, sz, 1, elf);
-
-    ARES_CHECK_CALL(elf_load(elf_contents, sz, &error), exit);
-
-    emulate_safe();
-
-exit:
-    if (error) fprintf(stderr, "loader: %s\n", error);
-    if (elf) fclose(elf);
-    if (elf_contents) free(elf_contents);
+    run_guest();
 }
 
 static void c_emulate(void) {
     assemble_from_file(g_next_arg, false);
     if (g_error) goto exit;
 
-    emulate_safe();
+    run_guest();
 
 exit:
     if (g_txt) {
@@ -289,6 +723,25 @@ exit:
     }
 }
 
+static void c_load_state(void) {
+    char *error = NULL;
+
+    if (!state_load(g_next_arg, &error)) {
+        fprintf(stderr, "state: %s\n", error);
+        return;
+    }
+
+    run_guest();
+}
+
+static void c_decode_trace(void) {
+    char *error = NULL;
+
+    if (!trace_decode(g_next_arg, stdout, &error)) {
+        fprintf(stderr, "trace: %s\n", error);
+    }
+}
+
 static void c_readelf(void) {
     FILE *elf = fopen(g_next_arg, "rb");
     char *error = NULL;
@@ -375,30 +828,17 @@ exit:
 }
 
 static void c_assemble(void) {
-    FILE *out = NULL;
     assemble_from_file(g_next_arg, true);
     if (g_error) goto exit;
 
-    void *elf_contents = NULL;
-    size_t elf_sz = 0;
     char *error = NULL;
 
-    if (!elf_emit_obj(&elf_contents, &elf_sz, &error)) {
+    if (!elf_write_obj(g_obj_out, &error)) {
         fprintf(stderr, "assembler: %s\n", error);
         goto exit;
     }
 
-    out = fopen(g_obj_out, "wb");
-
-    if (!out) {
-        fprintf(stderr, "assembelr: could not open output file\n");
-        return;
-    }
-
-    fwrite(elf_contents, elf_sz, 1, out);
-
 exit:
-    if (out) fclose(out);
     if (g_txt) {
         free(g_txt);
         g_txt = NULL;
@@ -541,6 +981,45 @@ static void opt_emulate(command_t *self) {
     g_command = c_emulate;
 }
 
+static void opt_load_state(command_t *self) {
+    update_argument(self->arg);
+    g_command = c_load_state;
+}
+
+static void opt_save_state(command_t *self) {
+    g_state_out = strdup(self->arg);
+    ARES_CHECK_OOM(g_state_out);
+}
+
+static void opt_save_at(command_t *self) {
+    char *end;
+    g_save_at = strtoull(self->arg, &end, 0);
+    if (*end || !g_save_at) {
+        fprintf(stderr, "invalid instruction count %s\n", self->arg);
+        exit(-1);
+    }
+}
+
+static void opt_trace(command_t *self) {
+    g_trace_out = strdup(self->arg);
+    ARES_CHECK_OOM(g_trace_out);
+}
+
+static void opt_profile(command_t *self) {
+    g_profile_out = strdup(self->arg);
+    ARES_CHECK_OOM(g_profile_out);
+}
+
+static void opt_reuse(command_t *self) {
+    g_reuse_out = strdup(self->arg);
+    ARES_CHECK_OOM(g_reuse_out);
+}
+
+static void opt_decode_trace(command_t *self) {
+    update_argument(self->arg);
+    g_command = c_decode_trace;
+}
+
 static void opt_readelf(command_t *self) {
     update_argument(self->arg);
     g_command = c_readelf;
@@ -569,6 +1048,92 @@ static void opt_ascii(command_t *self) {
     g_command = c_ascii;
 }
 
+static void opt_pipeline(command_t *self) { g_flg_pipeline = true; }
+
+static void opt_cache(command_t *self, int which) {
+    char *error = NULL;
+    if (!cache_parse_config(self->arg, &g_cache_config[which], &error)) {
+        fprintf(stderr, "cache: %s\n", error);
+        exit(EXIT_FAILURE);
+    }
+    g_flg_cache = true;
+}
+
+static void opt_bpred(command_t *self) {
+    char *error = NULL;
+    if (!bpred_parse_config(self->arg, &g_bpred_config, &error)) {
+        fprintf(stderr, "bpred: %s\n", error);
+        exit(EXIT_FAILURE);
+    }
+    g_flg_bpred = true;
+}
+
+static void opt_ooo(command_t *self) {
+    char *error = NULL;
+    if (!ooo_parse_config(self->arg, &g_ooo_config, &error)) {
+        fprintf(stderr, "ooo: %s\n", error);
+        exit(EXIT_FAILURE);
+    }
+    g_flg_ooo = true;
+}
+
+static void opt_sample(command_t *self) {
+    char *error = NULL;
+    if (!sample_parse_config(self->arg, &g_sample_config, &error)) {
+        fprintf(stderr, "sample: %s\n", error);
+        exit(EXIT_FAILURE);
+    }
+    g_flg_sample = true;
+}
+
+static void opt_stack(command_t *self) {
+    const char *p = self->arg;
+    u64 v;
+    if (!ares_parse_num(&p, 1024, STACK_LIMIT_MAX, &v) || *p ||
+        !emu_set_stack_limit(v)) {
+        fprintf(stderr,
+                "stack: size must be a multiple of %d between %d and %d "
+                "bytes\n",
+                STACK_PAGE, STACK_LEN, STACK_LIMIT_MAX);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void opt_latency(command_t *self) {
+    FILE *f = fopen(self->arg, "r");
+    if (!f) {
+        fprintf(stderr, "latency: could not open %s\n", self->arg);
+        exit(EXIT_FAILURE);
+    }
+    fseek(f, 0, SEEK_END);
+    size_t s = ftell(f);
+    rewind(f);
+    char *text = malloc(s + 1);
+    ARES_CHECK_OOM(text);
+    s = fread(text, 1, s, f);
+    fclose(f);
+
+    char *error = NULL;
+    int line = 0;
+    if (!latency_parse_config(text, s, &error, &line)) {
+        fprintf(stderr, "latency: %s:%d: %s\n", self->arg, line, error);
+        exit(EXIT_FAILURE);
+    }
+    free(text);
+    g_flg_latency = true;
+}
+
+static void opt_icache(command_t *self) {
+    // only the caches named on the command line are simulated
+    if (!g_flg_cache) g_cache_config[CACHE_D].size = 0;
+    opt_cache(self, CACHE_I);
+}
+
+static void opt_dcache(command_t *self) {
+    if (!g_flg_cache) g_cache_config[CACHE_I].size = 0;
+    opt_cache(self, CACHE_D);
+}
+
 static void opt_sanitize(command_t *self) {
     g_flg_callsan = true;
     callsan_init();
@@ -595,6 +1160,28 @@ int main(int argc, char **argv) {
                    opt_run);
     command_option(&cmd, "-e", "--emulate <file>",
                    "assemble and run an RV32 assembly file", opt_emulate);
+    command_option(&cmd, NULL, "--load-state <file>",
+                   "resume a machine state saved with --save-state",
+                   opt_load_state);
+    command_option(&cmd, NULL, "--save-state <file>",
+                   "save the machine state to file when the guest stops, "
+                   "after --save-at instructions or on SIGUSR1",
+                   opt_save_state);
+    command_option(&cmd, NULL, "--save-at <count>",
+                   "with --save-state, save after <count> instructions",
+                   opt_save_at);
+    command_option(&cmd, NULL, "--trace <file>",
+                   "record a binary execution trace to file", opt_trace);
+    command_option(&cmd, NULL, "--decode-trace <file>",
+                   "print a trace recorded with --trace", opt_decode_trace);
+    command_option(&cmd, NULL, "--profile <file>",
+                   "profile the guest, write folded stacks to file and a "
+                   "per-label summary to stderr",
+                   opt_profile);
+    command_option(&cmd, NULL, "--reuse <file>",
+                   "write fully associative LRU miss-ratio curves of every "
+                   "size and per-section working sets over time to file",
+                   opt_reuse);
     command_option(&cmd, "-i", "--readelf <file>",
                    "show information about ELF file", opt_readelf);
     command_option(&cmd, "-x", "--hexdump <file>", "perform hexdump of file",
@@ -607,6 +1194,40 @@ int main(int argc, char **argv) {
                    opt_o);
     command_option(&cmd, "-s", "--sanitize",
                    "enable ares sanitizers (callsan)", opt_sanitize);
+    command_option(&cmd, NULL, "--pipeline",
+                   "time the guest on a 5-stage pipeline and print its CPI",
+                   opt_pipeline);
+    command_option(&cmd, NULL, "--icache <spec>",
+                   "simulate an L1 instruction cache, spec is "
+                   "size:line:ways[:lru|fifo|random][:wb|wt][:prefetch]",
+                   opt_icache);
+    command_option(&cmd, NULL, "--dcache <spec>",
+                   "simulate an L1 data cache, same spec as --icache",
+                   opt_dcache);
+    command_option(&cmd, NULL, "--bpred <spec>",
+                   "simulate a branch predictor, spec is "
+                   "nt|btfn|bimodal|gshare[:bits=N][:history=N][:btb=N]"
+                   "[:ras=N][:penalty=N]",
+                   opt_bpred);
+    command_option(&cmd, NULL, "--ooo <spec>",
+                   "time the guest on an out-of-order core instead of the "
+                   "5-stage pipeline, spec is width=N:rob=N:alu=N:mul=N:div=N:"
+                   "lsu=N:mul_lat=N:div_lat=N:load_lat=N:frontend=N, any "
+                   "subset or \"\" for the defaults",
+                   opt_ooo);
+    command_option(&cmd, NULL, "--sample <spec>",
+                   "only run the timing models on part of every period and "
+                   "extrapolate the CPI, spec is period:warmup:measure",
+                   opt_sample);
+    command_option(&cmd, NULL, "--latency <file>",
+                   "estimate cycles with a fixed cost per instruction class, "
+                   "file has \"class = cycles\" lines for alu, mul, div, load, "
+                   "store, branch_taken, branch_not_taken, jump, csr and ecall",
+                   opt_latency);
+    command_option(&cmd, NULL, "--stack <size>",
+                   "let the guest stack grow up to size bytes (default 1m), "
+                   "accepts a k or m suffix",
+                   opt_stack);
     command_parse(&cmd, argc, argv);
     g_cmd_args = (const char **)cmd.argv;
     g_cmd_args_len = cmd.argc;
@@ -619,6 +1240,10 @@ int main(int argc, char **argv) {
 
     g_command();
     free((void *)g_next_arg);
+    free(g_state_out);
+    free(g_trace_out);
+    free(g_profile_out);
+    free(g_reuse_out);
     if (g_out_changed) {
         free((void *)g_obj_out);
     }
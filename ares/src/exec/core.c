@@ -1,11 +1,33 @@
 #include "ares/core.h"
 
 #include <stddef.h>
-
+#ifndef __wasm__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "ares/bpred.h"
+#include "ares/cache.h"
 #include "ares/callsan.h"
 #include "ares/dev.h"
 #include "ares/elf.h"
 #include "ares/emulate.h"
+#include "ares/latency.h"
+#include "ares/ooo.h"
+#include "ares/pipeline.h"
+#include "ares/profile.h"
+#include "ares/reuse.h"
+#include "ares/sample.h"
+#include "ares/snapshot.h"
 
 export Section *g_text, *g_data, *g_stack, *g_kernel_text, *g_kernel_data,
     *g_mmio, *g_vga, *g_gif;
@@ -26,11 +48,29 @@ ARES_ARRAY(LabelData) g_labels = ARES_ARRAY_NEW(LabelData);
 ARES_ARRAY(Global) g_globals = ARES_ARRAY_NEW(Global);
 export ARES_ARRAY(u32) g_text_by_linenum;
 
+Arena g_runtime_arena;
+static ARES_ARRAY(Blob) g_blobs = ARES_ARRAY_NEW(Blob);
+
+// allocated from g_runtime_arena, except for the linter's
 static ARES_ARRAY(DeferredInsn)
     g_deferred_insn = ARES_ARRAY_NEW(DeferredInsn);
 
 static Section *g_section;
 
+Section *section_alloc() {
+    Section *s = ares_arena_alloc(&g_runtime_arena, sizeof(Section));
+    memset(s, 0, sizeof(Section));
+    return s;
+}
+
+Section *text_section() {
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
+        Section *s = *ARES_ARRAY_GET(&g_sections, i);
+        if (s->base == TEXT_BASE) return s;
+    }
+    return NULL;
+}
+
 export bool g_in_fixup;
 export u32 g_error_line;
 export const char *g_error;
@@ -39,6 +79,18 @@ export u32 g_runtime_error_params[2];
 export Error g_runtime_error_type;
 
 static bool g_allow_externs;
+// lint() is parsing, see there
+static bool g_linting;
+// asm_relax() is running, only sizing the instructions in g_relax_measure
+static bool g_relaxing;
+static bool g_relax_measure;
+// the instruction asm_relax() emits may use compressed forms
+static bool g_relax_compress;
+// where the linter's and g_relax_measure's instructions are emitted, only
+// the offsets matter
+static ARES_ARRAY(u8) g_scratch = ARES_ARRAY_NEW(u8);
+// next entry of g_text_by_linenum the fixup pass overwrites
+static size_t g_fixup_line_idx;
 
 // NOTE: this may seem like it can be static, but it's used elsewhere (like in
 // cli.c)
@@ -53,7 +105,20 @@ const char *const CSR_NAMES[] = {
     [0x144] = "sip",      [0x300] = "mstatus", [0x302] = "medeleg",
     [0x303] = "mideleg",  [0x304] = "mie",     [0x305] = "mtvec",
     [0x340] = "mscratch", [0x341] = "mepc",    [0x342] = "mcause",
-    [0x344] = "mip"};
+    [0x344] = "mip",
+    [0xB00] = "mcycle",         [0xB02] = "minstret",
+    [0xB03] = "mhpmcounter3",   [0xB04] = "mhpmcounter4",
+    [0xB05] = "mhpmcounter5",   [0xB06] = "mhpmcounter6",
+    [0xB80] = "mcycleh",        [0xB82] = "minstreth",
+    [0xB83] = "mhpmcounter3h",  [0xB84] = "mhpmcounter4h",
+    [0xB85] = "mhpmcounter5h",  [0xB86] = "mhpmcounter6h",
+    [0xC00] = "cycle",          [0xC01] = "time",
+    [0xC02] = "instret",        [0xC03] = "hpmcounter3",
+    [0xC04] = "hpmcounter4",    [0xC05] = "hpmcounter5",
+    [0xC06] = "hpmcounter6",    [0xC80] = "cycleh",
+    [0xC81] = "timeh",          [0xC82] = "instreth",
+    [0xC83] = "hpmcounter3h",   [0xC84] = "hpmcounter4h",
+    [0xC85] = "hpmcounter5h",   [0xC86] = "hpmcounter6h"};
 
 // clang-format off
 u32 DS1S2(u32 d, u32 s1, u32 s2) { return (d << 7) | (s1 << 15) | (s2 << 20); }
@@ -135,6 +200,110 @@ char my_tolower(char c) {
     return c;
 }
 
+// -- the lexer scans 16 bytes at a time where there's SIMD
+//
+// Each lex_*() gives a mask with bit i set if byte i of the 16 is in its
+// class. The last 15 bytes of the input go a byte at a time, so the loads
+// never read past it.
+
+#if defined(__SSE2__)
+#define LEX_SIMD
+typedef __m128i LexVec;
+
+static inline LexVec lex_load(const char *s) {
+    return _mm_loadu_si128((const __m128i *)s);
+}
+
+static inline u32 lex_eq(LexVec v, char c) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+// lo <= byte <= hi
+static inline u32 lex_in(LexVec v, u8 lo, u8 hi) {
+    __m128i t = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    __m128i m = _mm_min_epu8(t, _mm_set1_epi8(hi - lo));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(m, t));
+}
+
+static inline LexVec lex_lower(LexVec v) {
+    return _mm_or_si128(v, _mm_set1_epi8(0x20));
+}
+#elif defined(__wasm_simd128__)
+#define LEX_SIMD
+typedef v128_t LexVec;
+
+static inline LexVec lex_load(const char *s) { return wasm_v128_load(s); }
+
+static inline u32 lex_eq(LexVec v, char c) {
+    return wasm_i8x16_bitmask(wasm_i8x16_eq(v, wasm_i8x16_splat(c)));
+}
+
+static inline u32 lex_in(LexVec v, u8 lo, u8 hi) {
+    return wasm_i8x16_bitmask(wasm_v128_and(
+        wasm_u8x16_ge(v, wasm_u8x16_splat(lo)),
+        wasm_u8x16_le(v, wasm_u8x16_splat(hi))));
+}
+
+static inline LexVec lex_lower(LexVec v) {
+    return wasm_v128_or(v, wasm_u8x16_splat(0x20));
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define LEX_SIMD
+typedef uint8x16_t LexVec;
+
+static inline LexVec lex_load(const char *s) {
+    return vld1q_u8((const u8 *)s);
+}
+
+// NEON has no movemask, add up one bit per byte in each half instead
+static inline u32 lex_bits(uint8x16_t m) {
+    static const u8 weights[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                   1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t b = vandq_u8(m, vld1q_u8(weights));
+    return vaddv_u8(vget_low_u8(b)) | (u32)vaddv_u8(vget_high_u8(b)) << 8;
+}
+
+static inline u32 lex_eq(LexVec v, char c) {
+    return lex_bits(vceqq_u8(v, vdupq_n_u8(c)));
+}
+
+static inline u32 lex_in(LexVec v, u8 lo, u8 hi) {
+    return lex_bits(
+        vandq_u8(vcgeq_u8(v, vdupq_n_u8(lo)), vcleq_u8(v, vdupq_n_u8(hi))));
+}
+
+static inline LexVec lex_lower(LexVec v) {
+    return vorrq_u8(v, vdupq_n_u8(0x20));
+}
+#endif
+
+#ifdef LEX_SIMD
+#define LEX_WIDTH 16
+#define LEX_ALL 0xFFFFu
+
+// trailing()
+static inline u32 lex_blank(LexVec v) {
+    return lex_eq(v, ' ') | lex_eq(v, '\t');
+}
+
+// whitespace()
+static inline u32 lex_space(LexVec v) {
+    return lex_blank(v) | lex_eq(v, '\n') | lex_eq(v, '\r');
+}
+
+// ident()
+static inline u32 lex_ident(LexVec v) {
+    return lex_in(v, '0', '9') | lex_in(lex_lower(v), 'a', 'z') |
+           lex_eq(v, '_') | lex_eq(v, '.');
+}
+
+// newlines in the first n bytes
+static inline u32 lex_lines(LexVec v, u32 n) {
+    u32 below = n < 32 ? (1u << n) - 1 : ~0u;
+    return __builtin_popcount(lex_eq(v, '\n') & below);
+}
+#endif
+
 void advance(Parser *p) {
     if (p->pos >= p->size) return;
     if (p->input[p->pos] == '\n') p->lineidx++;
@@ -167,6 +336,41 @@ char peek_n(Parser *p, size_t n) {
 // otherwise i would be marking as valid stuff like
 // li x0, 1234li x0, 1234
 
+// up to the newline that ends the line
+static void skip_line(Parser *p) {
+#ifdef LEX_SIMD
+    for (; p->pos + LEX_WIDTH <= p->size; p->pos += LEX_WIDTH) {
+        u32 nl = lex_eq(lex_load(p->input + p->pos), '\n');
+        if (nl) {
+            p->pos += __builtin_ctz(nl);
+            break;
+        }
+    }
+#endif
+    while (p->pos < p->size && p->input[p->pos] != '\n') advance(p);
+}
+
+// past the */ that ends a block comment
+static void skip_block(Parser *p) {
+#ifdef LEX_SIMD
+    // one more byte for the / of a * at the end
+    for (; p->pos + LEX_WIDTH < p->size; p->pos += LEX_WIDTH) {
+        const char *s = p->input + p->pos;
+        LexVec v = lex_load(s);
+        u32 end = lex_eq(v, '*') & lex_eq(lex_load(s + 1), '/');
+        if (end) {
+            p->lineidx += lex_lines(v, __builtin_ctz(end));
+            p->pos += __builtin_ctz(end);
+            break;
+        }
+        p->lineidx += lex_lines(v, LEX_WIDTH);
+    }
+#endif
+    while (p->pos < p->size && !(peek(p) == '*' && peek_n(p, 1) == '/'))
+        advance(p);
+    if (p->pos < p->size) advance_n(p, 2);
+}
+
 // Skip a single comment or preprocessor line if present.
 // Returns true if a comment was skipped.
 bool skip_comment(Parser *p) {
@@ -174,19 +378,17 @@ bool skip_comment(Parser *p) {
     if (c == '/') {
         char c2 = peek_n(p, 1);
         if (c2 == '/') {
-            while (p->pos < p->size && p->input[p->pos] != '\n') advance(p);
+            skip_line(p);
             return true;
         } else if (c2 == '*') {
             advance_n(p, 2);
-            while (p->pos < p->size && !(peek(p) == '*' && peek_n(p, 1) == '/'))
-                advance(p);
-            if (p->pos < p->size) advance_n(p, 2);
+            skip_block(p);
             return true;
         }
         return false;
     }
     if (c == '#') {
-        while (p->pos < p->size && p->input[p->pos] != '\n') advance(p);
+        skip_line(p);
         return true;
     }
     return false;
@@ -194,6 +396,16 @@ bool skip_comment(Parser *p) {
 
 void skip_whitespace(Parser *p) {
     while (p->pos < p->size) {
+#ifdef LEX_SIMD
+        if (p->pos + LEX_WIDTH <= p->size) {
+            LexVec v = lex_load(p->input + p->pos);
+            u32 rest = ~lex_space(v) & LEX_ALL;
+            u32 n = rest ? __builtin_ctz(rest) : LEX_WIDTH;
+            p->lineidx += lex_lines(v, n);
+            p->pos += n;
+            if (!rest) continue;
+        }
+#endif
         if (whitespace(peek(p))) {
             advance(p);
         } else if (skip_comment(p)) {
@@ -202,6 +414,13 @@ void skip_whitespace(Parser *p) {
 }
 void skip_trailing(Parser *p) {
     while (p->pos < p->size) {
+#ifdef LEX_SIMD
+        if (p->pos + LEX_WIDTH <= p->size) {
+            u32 rest = ~lex_blank(lex_load(p->input + p->pos)) & LEX_ALL;
+            p->pos += rest ? __builtin_ctz(rest) : LEX_WIDTH;
+            if (!rest) continue;
+        }
+#endif
         if (trailing(peek(p))) {
             advance(p);
         } else if (skip_comment(p)) {
@@ -209,6 +428,14 @@ void skip_trailing(Parser *p) {
     }
 }
 
+// true at the end of a line, or before the first statement of one
+static bool at_line_boundary(Parser *p) {
+    if (p->pos >= p->size || p->input[p->pos] == '\n') return true;
+    for (size_t i = p->pos; i > 0 && p->input[i - 1] != '\n'; i--)
+        if (!whitespace(p->input[i - 1])) return false;
+    return true;
+}
+
 bool consume_if(Parser *p, char c) {
     if (p->pos >= p->size) return false;
     if (p->input[p->pos] != c) return false;
@@ -225,6 +452,16 @@ bool consume(Parser *p, char *c) {
 
 void parse_ident(Parser *p, const char **str, size_t *len) {
     size_t start = p->pos;
+#ifdef LEX_SIMD
+    // identifiers don't span lines, so there are no newlines to count
+    for (; p->pos + LEX_WIDTH <= p->size; p->pos += LEX_WIDTH) {
+        u32 rest = ~lex_ident(lex_load(p->input + p->pos)) & LEX_ALL;
+        if (rest) {
+            p->pos += __builtin_ctz(rest);
+            break;
+        }
+    }
+#endif
     while (p->pos < p->size && ident(p->input[p->pos])) advance(p);
     size_t end = p->pos;
     *str = p->input + start;
@@ -409,13 +646,105 @@ int parse_reg_prime(Parser *p) {
     return reg;
 }
 
-void asm_emit_byte(u8 byte, int linenum) {
+// room for len bytes at emit_idx, appended unless the fixup pass is filling
+// in a placeholder
+static u8 *asm_reserve(size_t len) {
+    Section *s = g_section;
+    if (g_linting || g_relax_measure) {
+        g_scratch.len = 0;
+        ARES_ARRAY_RESERVE(&g_scratch, len);
+        s->emit_idx += len;
+        return g_scratch.buf;
+    }
     if (!g_in_fixup) {
-        *ARES_ARRAY_PUSH(&g_section->contents) = byte;
-    } else {
-        *ARES_ARRAY_INSERT(&g_section->contents, g_section->emit_idx) = byte;
+        ARES_ARRAY_RESERVE(&s->contents, len);
+        s->contents.len += len;
+    }
+    u8 *out = s->contents.buf + s->emit_idx;
+    s->emit_idx += len;
+    return out;
+}
+
+void asm_emit_byte(u8 byte, int linenum) { *asm_reserve(1) = byte; }
+
+void asm_emit_bytes(const void *bytes, size_t len) {
+    if (len) memcpy(asm_reserve(len), bytes, len);
+}
+
+static bool asm_fits(u64 len) {
+    return len <= g_section->limit - g_section->base - g_section->emit_idx;
+}
+
+// count little endian copies of value, size is 1, 2 or 4 bytes
+const char *asm_emit_fill(u32 count, u32 size, u32 value) {
+    if (!asm_fits((u64)count * size)) return "Section overflow";
+
+    u8 *out = asm_reserve((size_t)count * size);
+    if (size == 1) memset(out, value, count);
+    else
+        for (u32 i = 0; i < count; i++)
+            ares_buf_write(out + (size_t)i * size, size, value);
+    return NULL;
+}
+
+export void incbin_register(const char *name, size_t name_len, const u8 *data,
+                            size_t len) {
+    *ARES_ARRAY_PUSH(&g_blobs) = (Blob){
+        .name = name, .name_len = name_len, .data = data, .len = len};
+}
+
+static Blob *incbin_find(const char *name, size_t name_len) {
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_blobs); i++) {
+        Blob *b = ARES_ARRAY_GET(&g_blobs, i);
+        if (str_eq_2(b->name, b->name_len, name, name_len)) return b;
     }
-    g_section->emit_idx++;
+#ifdef __wasm__
+    return NULL;
+#else
+    char *path = malloc(name_len + 1);
+    ARES_CHECK_OOM(path);
+    memcpy(path, name, name_len);
+    path[name_len] = 0;
+
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        free(path);
+        return NULL;
+    }
+    // the file is copied once, straight from the page cache into the section
+    void *data = NULL;
+    if (st.st_size) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            free(path);
+            return NULL;
+        }
+    }
+    close(fd);
+
+    Blob *b = ARES_ARRAY_PUSH(&g_blobs);
+    *b = (Blob){.name = path,
+                .name_len = name_len,
+                .data = data,
+                .len = st.st_size,
+                .mapped = true};
+    return b;
+#endif
+}
+
+static void incbin_free() {
+#ifndef __wasm__
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_blobs); i++) {
+        Blob *b = ARES_ARRAY_GET(&g_blobs, i);
+        if (!b->mapped) continue;
+        if (b->len) munmap((void *)b->data, b->len);
+        free((char *)b->name);
+    }
+#endif
+    ARES_ARRAY_FREE(&g_blobs);
 }
 
 static inline u32 inst_bits(u32 val, int end, int start) {
@@ -509,6 +838,11 @@ static bool try_compress(u32 inst, u16 *out) {
         if (rd == 1 && encode_c_jalr(rs1, out)) return true;
     }
 
+    if (opcode == 0b1100011 && rs2 == 0) {
+        if (funct3 == 0b000 && encode_c_beqz(rs1, btype, out)) return true;
+        if (funct3 == 0b001 && encode_c_bnez(rs1, btype, out)) return true;
+    }
+
     if (opcode == 0b1101111) {
         if (rd == 0 && encode_c_j(jtype, false, out)) return true;
         if (rd == 1 && encode_c_j(jtype, true, out)) return true;
@@ -529,25 +863,25 @@ static bool try_compress(u32 inst, u16 *out) {
     return false;
 }
 
-void asm_emit16(u16 inst, int linenum) {
-    if (g_section == g_text) {
-        *ARES_ARRAY_PUSH(&g_text_by_linenum) = linenum;
+// an entry per 2 bytes of .text, the line for the first ones of an
+// instruction, the fixup pass overwrites the ones of its placeholder
+static void asm_linenum(int linenum, size_t halves) {
+    if (g_section != g_text || g_linting || g_relax_measure) return;
+    for (size_t i = 0; i < halves; i++) {
+        u32 *slot = g_in_fixup ? &g_text_by_linenum.buf[g_fixup_line_idx++]
+                               : ARES_ARRAY_PUSH(&g_text_by_linenum);
+        *slot = i ? 0 : linenum;
     }
+}
 
-    asm_emit_byte(inst >> 0, linenum);
-    asm_emit_byte(inst >> 8, linenum);
+void asm_emit16(u16 inst, int linenum) {
+    asm_linenum(linenum, 1);
+    ares_buf_write(asm_reserve(2), 2, inst);
 }
 
 void asm_emit32_raw(u32 inst, int linenum) {
-    if (g_section == g_text) {
-        *ARES_ARRAY_PUSH(&g_text_by_linenum) = linenum;
-        *ARES_ARRAY_PUSH(&g_text_by_linenum) = 0;
-    }
-
-    asm_emit_byte(inst >> 0, linenum);
-    asm_emit_byte(inst >> 8, linenum);
-    asm_emit_byte(inst >> 16, linenum);
-    asm_emit_byte(inst >> 24, linenum);
+    asm_linenum(linenum, 2);
+    ares_buf_write(asm_reserve(4), 4, inst);
 }
 
 void asm_emit(u32 inst, int linenum) {
@@ -560,6 +894,19 @@ void asm_emit(u32 inst, int linenum) {
     asm_emit32_raw(inst, linenum);
 }
 
+// for instructions that refer to a label, they only get compressed once
+// asm_relax() knows where everything ends up
+static void asm_emit_site(u32 inst, int linenum) {
+    u16 compressed;
+    if (g_section == g_text && g_relax_compress &&
+        try_compress(inst, &compressed)) {
+        asm_emit16(compressed, linenum);
+        return;
+    }
+
+    asm_emit32_raw(inst, linenum);
+}
+
 static bool encode_c_addi4spn(int rd, i32 imm, u16 *out) {
     if (rd < 8 || rd > 15) return false;
     if (imm <= 0 || imm > 1020 || (imm & 3)) return false;
@@ -971,14 +1318,128 @@ static bool encode_c_ebreak(u16 *out) {
     return true;
 }
 
-static Extern *get_extern(const char *sym, size_t sym_len) {
-    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_externs); i++) {
-        if (ARES_ARRAY_GET(&g_externs, i)->len == sym_len &&
-            0 ==
-                memcmp(sym, ARES_ARRAY_GET(&g_externs, i)->symbol, sym_len)) {
-            return ARES_ARRAY_GET(&g_externs, i);
-        }
+// names of g_labels, g_globals and g_externs, so the assembler doesn't scan
+// them for every symbol it looks up
+typedef struct {
+    // NULL for an empty slot
+    const char *txt;
+    size_t len;
+    u32 hash;
+    // index of the first entry with this name in each array, -1 for none
+    i32 label;
+    i32 global;
+    i32 ext;
+} Symbol;
+
+// open addressing, power of two sized
+static Symbol *g_symtab;
+static size_t g_symtab_cap;
+static size_t g_symtab_len;
+// entries of each array that are indexed, the rest are added by the next
+// lookup
+static size_t g_symtab_labels;
+static size_t g_symtab_globals;
+static size_t g_symtab_externs;
+
+static u32 symtab_hash(const char *txt, size_t len) {
+    // FNV-1a
+    u32 h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (u8)txt[i]) * 16777619u;
+    return h;
+}
+
+static Symbol *symtab_slot(const char *txt, size_t len, u32 hash) {
+    size_t i = hash & (g_symtab_cap - 1);
+    while (g_symtab[i].txt &&
+           (g_symtab[i].hash != hash ||
+            !str_eq_2(g_symtab[i].txt, g_symtab[i].len, txt, len)))
+        i = (i + 1) & (g_symtab_cap - 1);
+    return &g_symtab[i];
+}
+
+static void symtab_grow() {
+    Symbol *old = g_symtab;
+    size_t old_cap = g_symtab_cap;
+    g_symtab_cap = old_cap ? old_cap * 2 : 256;
+    g_symtab = malloc(g_symtab_cap * sizeof(Symbol));
+    ARES_CHECK_OOM(g_symtab);
+    memset(g_symtab, 0, g_symtab_cap * sizeof(Symbol));
+    for (size_t i = 0; i < old_cap; i++)
+        if (old[i].txt)
+            *symtab_slot(old[i].txt, old[i].len, old[i].hash) = old[i];
+    free(old);
+}
+
+static Symbol *symtab_add(const char *txt, size_t len) {
+    if ((g_symtab_len + 1) * 2 > g_symtab_cap) symtab_grow();
+    u32 hash = symtab_hash(txt, len);
+    Symbol *s = symtab_slot(txt, len, hash);
+    if (!s->txt) {
+        *s = (Symbol){.txt = txt,
+                      .len = len,
+                      .hash = hash,
+                      .label = -1,
+                      .global = -1,
+                      .ext = -1};
+        g_symtab_len++;
+    }
+    return s;
+}
+
+void symtab_clear() {
+    free(g_symtab);
+    g_symtab = NULL;
+    g_symtab_cap = g_symtab_len = 0;
+    g_symtab_labels = g_symtab_globals = g_symtab_externs = 0;
+}
+
+// like symtab_clear(), but keeps the table
+static void symtab_reset() {
+    if (g_symtab) memset(g_symtab, 0, g_symtab_cap * sizeof(Symbol));
+    g_symtab_len = 0;
+    g_symtab_labels = g_symtab_globals = g_symtab_externs = 0;
+}
+
+static void symtab_sync() {
+    // one of the arrays was freed without symtab_clear()
+    if (g_symtab_labels > ARES_ARRAY_LEN(&g_labels) ||
+        g_symtab_globals > ARES_ARRAY_LEN(&g_globals) ||
+        g_symtab_externs > ARES_ARRAY_LEN(&g_externs))
+        symtab_clear();
+
+    for (; g_symtab_labels < ARES_ARRAY_LEN(&g_labels); g_symtab_labels++) {
+        LabelData *l = ARES_ARRAY_GET(&g_labels, g_symtab_labels);
+        Symbol *s = symtab_add(l->txt, l->len);
+        if (s->label < 0) s->label = g_symtab_labels;
     }
+    for (; g_symtab_globals < ARES_ARRAY_LEN(&g_globals); g_symtab_globals++) {
+        Global *g = ARES_ARRAY_GET(&g_globals, g_symtab_globals);
+        Symbol *s = symtab_add(g->str, g->len);
+        if (s->global < 0) s->global = g_symtab_globals;
+    }
+    for (; g_symtab_externs < ARES_ARRAY_LEN(&g_externs); g_symtab_externs++) {
+        Extern *e = ARES_ARRAY_GET(&g_externs, g_symtab_externs);
+        Symbol *s = symtab_add(e->symbol, e->len);
+        if (s->ext < 0) s->ext = g_symtab_externs;
+    }
+}
+
+// NULL if nothing has this name
+static Symbol *symtab_find(const char *txt, size_t len) {
+    symtab_sync();
+    if (!g_symtab_cap) return NULL;
+    Symbol *s = symtab_slot(txt, len, symtab_hash(txt, len));
+    return s->txt ? s : NULL;
+}
+
+static LabelData *find_label(const char *txt, size_t len) {
+    Symbol *s = symtab_find(txt, len);
+    return s && s->label >= 0 ? ARES_ARRAY_GET(&g_labels, s->label) : NULL;
+}
+
+static Extern *get_extern(const char *sym, size_t sym_len) {
+    Symbol *s = symtab_find(sym, sym_len);
+    if (s && s->ext >= 0) return ARES_ARRAY_GET(&g_externs, s->ext);
 
     Extern *e = ARES_ARRAY_PUSH(&g_externs);
     e->symbol = sym;
@@ -986,9 +1447,109 @@ static Extern *get_extern(const char *sym, size_t sym_len) {
     return e;
 }
 
+// the linter's sections: .text, .data, .kernel_text and .kernel_data
+#define LINT_SECS 4
+
+// A statement, or a run of them that ends at a line boundary. The linter
+// parses the source one chunk at a time and keeps where each one starts.
+typedef struct {
+    // first line, 0-based
+    u32 line;
+    // g_section and the emit_idx of every section at the start
+    u32 sec;
+    u32 offs[LINT_SECS];
+    // g_labels and g_globals lengths at the start
+    u32 labels;
+    u32 globals;
+    // label references, the last one is kept, its text relative to the
+    // start of the chunk
+    u32 refs;
+    u32 ref_off;
+    u32 ref_len;
+    u32 ref_sec;
+    // a reference was deferred to the fixup pass
+    bool forward;
+    const char *err;
+    u32 err_line;
+    u32 err_col;
+    // the error is something lint() doesn't model
+    bool unsupported;
+    // a label that's defined again, line 0 for none
+    u32 dup_line;
+    u32 dup_col;
+} LintChunk;
+
+typedef struct {
+    u32 hash;
+    u32 start;
+    u32 len;
+} LintLine;
+
+typedef struct {
+    // 1-based
+    u32 line;
+    u32 hash;
+} LintLabel;
+
+ARES_ARRAY_TYPE(LintChunk);
+ARES_ARRAY_TYPE(LintLine);
+ARES_ARRAY_TYPE(LintLabel);
+
+static Section g_lint_sections[LINT_SECS];
+// the chunk being parsed
+static LintChunk *g_lint_chunk;
+// labels from this index on are defined after the chunk being parsed
+static size_t g_lint_later;
+// parsing a chunk again, its labels and globals are already known
+static bool g_lint_recheck;
+// the source needs something the linter doesn't model, .section with one of
+// the runtime's other sections
+static bool g_lint_unsupported;
+static char *g_lint_text;
+static ARES_ARRAY(LintLine) g_lint_lines = ARES_ARRAY_NEW(LintLine);
+// parallel to g_labels, the names of labels that were parsed again are
+// overwritten by the time they're compared
+static ARES_ARRAY(LintLabel) g_lint_labels = ARES_ARRAY_NEW(LintLabel);
+
+// hides labels that are defined after the chunk, so a reference to them is
+// deferred like in assemble()
+static LabelData *lint_ref(LabelData *l, const char *txt, size_t len) {
+    if (g_in_fixup) return l;
+
+    LintChunk *c = g_lint_chunk;
+    c->refs++;
+    c->ref_off = txt - g_lint_text - g_lint_lines.buf[c->line].start;
+    c->ref_len = len;
+    c->ref_sec = g_section - g_lint_sections;
+    if (l && (size_t)(l - g_labels.buf) >= g_lint_later) l = NULL;
+    if (!l) c->forward = true;
+    return l;
+}
+
+// 1-based column of pos on line
+static u32 lint_col(u32 line, size_t pos) {
+    return pos - g_lint_lines.buf[line - 1].start + 1;
+}
+
+static void lint_label(const char *txt, size_t len, u32 line) {
+    if (g_lint_recheck) return;
+    LintChunk *c = g_lint_chunk;
+    if (find_label(txt, len) && !c->dup_line) {
+        c->dup_line = line;
+        c->dup_col = lint_col(line, txt - g_lint_text);
+    }
+    *ARES_ARRAY_PUSH(&g_labels) =
+        (LabelData){.txt = txt,
+                    .len = len,
+                    .addr = g_section->emit_idx + g_section->base,
+                    .section = g_section};
+    *ARES_ARRAY_PUSH(&g_lint_labels) =
+        (LintLabel){.line = line, .hash = symtab_hash(txt, len)};
+}
+
 const char *reloc_branch(const char *sym, size_t sym_len) {
     Extern *e = get_extern(sym, sym_len);
-    Relocation *r = ARES_ARRAY_PUSH(&g_section->relocations);
+    Relocation *r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
     r->symbol = e;
     r->addend = 0;
     r->offset = g_section->emit_idx;
@@ -998,7 +1559,7 @@ const char *reloc_branch(const char *sym, size_t sym_len) {
 
 const char *reloc_jal(const char *sym, size_t sym_len) {
     Extern *e = get_extern(sym, sym_len);
-    Relocation *r = ARES_ARRAY_PUSH(&g_section->relocations);
+    Relocation *r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
     r->symbol = e;
     r->addend = 0;
     r->offset = g_section->emit_idx;
@@ -1008,7 +1569,7 @@ const char *reloc_jal(const char *sym, size_t sym_len) {
 
 const char *reloc_hi20(const char *sym, size_t sym_len) {
     Extern *e = get_extern(sym, sym_len);
-    Relocation *r = ARES_ARRAY_PUSH(&g_section->relocations);
+    Relocation *r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
 
     r->symbol = e;
     r->addend = 0;
@@ -1019,7 +1580,7 @@ const char *reloc_hi20(const char *sym, size_t sym_len) {
 
 const char *reloc_lo12i(const char *sym, size_t sym_len) {
     Extern *e = get_extern(sym, sym_len);
-    Relocation *r = ARES_ARRAY_PUSH(&g_section->relocations);
+    Relocation *r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
 
     r->symbol = e;
     r->addend = 0;
@@ -1030,7 +1591,7 @@ const char *reloc_lo12i(const char *sym, size_t sym_len) {
 
 const char *reloc_lo12s(const char *sym, size_t sym_len) {
     Extern *e = get_extern(sym, sym_len);
-    Relocation *r = ARES_ARRAY_PUSH(&g_section->relocations);
+    Relocation *r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
 
     r->symbol = e;
     r->addend = 0;
@@ -1041,14 +1602,14 @@ const char *reloc_lo12s(const char *sym, size_t sym_len) {
 
 const char *reloc_hi20lo12i(const char *sym, size_t sym_len) {
     Extern *e = get_extern(sym, sym_len);
-    Relocation *r = ARES_ARRAY_PUSH(&g_section->relocations);
+    Relocation *r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
 
     r->symbol = e;
     r->addend = 0;
     r->offset = g_section->emit_idx;
     r->type = R_RISCV_HI20;
 
-    r = ARES_ARRAY_PUSH(&g_section->relocations);
+    r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
     r->symbol = e;
     r->addend = 0;
     r->offset = g_section->emit_idx + 4;
@@ -1058,14 +1619,14 @@ const char *reloc_hi20lo12i(const char *sym, size_t sym_len) {
 
 const char *reloc_hi20lo12s(const char *sym, size_t sym_len) {
     Extern *e = get_extern(sym, sym_len);
-    Relocation *r = ARES_ARRAY_PUSH(&g_section->relocations);
+    Relocation *r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
 
     r->symbol = e;
     r->addend = 0;
     r->offset = g_section->emit_idx;
     r->type = R_RISCV_HI20;
 
-    r = ARES_ARRAY_PUSH(&g_section->relocations);
+    r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
     r->symbol = e;
     r->addend = 0;
     r->offset = g_section->emit_idx + 4;
@@ -1075,7 +1636,7 @@ const char *reloc_hi20lo12s(const char *sym, size_t sym_len) {
 
 const char *reloc_abs32(const char *sym, size_t sym_len) {
     Extern *e = get_extern(sym, sym_len);
-    Relocation *r = ARES_ARRAY_PUSH(&g_section->relocations);
+    Relocation *r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
 
     r->symbol = e;
     r->addend = 0;
@@ -1084,7 +1645,126 @@ const char *reloc_abs32(const char *sym, size_t sym_len) {
     return NULL;
 }
 
-const char *handle_alu_reg(Parser *p, const char *opcode, size_t opcode_len) {
+// every mnemonic with its handler, handlers get the OP_ id of the mnemonic
+// so they don't compare strings to pick the encoding
+#define OPCODES(X) \
+    X(ADD, "add", handle_alu_reg)                  \
+    X(SLT, "slt", handle_alu_reg)                  \
+    X(SLTU, "sltu", handle_alu_reg)                \
+    X(AND, "and", handle_alu_reg)                  \
+    X(OR, "or", handle_alu_reg)                    \
+    X(XOR, "xor", handle_alu_reg)                  \
+    X(SLL, "sll", handle_alu_reg)                  \
+    X(SRL, "srl", handle_alu_reg)                  \
+    X(SUB, "sub", handle_alu_reg)                  \
+    X(SRA, "sra", handle_alu_reg)                  \
+    X(MUL, "mul", handle_alu_reg)                  \
+    X(MULH, "mulh", handle_alu_reg)                \
+    X(MULU, "mulu", handle_alu_reg)                \
+    X(MULHU, "mulhu", handle_alu_reg)              \
+    X(DIV, "div", handle_alu_reg)                  \
+    X(DIVU, "divu", handle_alu_reg)                \
+    X(REM, "rem", handle_alu_reg)                  \
+    X(REMU, "remu", handle_alu_reg)                \
+    X(ADDI, "addi", handle_alu_imm)                \
+    X(SLTI, "slti", handle_alu_imm)                \
+    X(SLTIU, "sltiu", handle_alu_imm)              \
+    X(ANDI, "andi", handle_alu_imm)                \
+    X(ORI, "ori", handle_alu_imm)                  \
+    X(XORI, "xori", handle_alu_imm)                \
+    X(SLLI, "slli", handle_alu_imm)                \
+    X(SRLI, "srli", handle_alu_imm)                \
+    X(SRAI, "srai", handle_alu_imm)                \
+    X(LB, "lb", handle_ldst)                       \
+    X(LH, "lh", handle_ldst)                       \
+    X(LW, "lw", handle_ldst)                       \
+    X(LBU, "lbu", handle_ldst)                     \
+    X(LHU, "lhu", handle_ldst)                     \
+    X(SB, "sb", handle_ldst)                       \
+    X(SH, "sh", handle_ldst)                       \
+    X(SW, "sw", handle_ldst)                       \
+    X(BEQ, "beq", handle_branch)                   \
+    X(BNE, "bne", handle_branch)                   \
+    X(BLT, "blt", handle_branch)                   \
+    X(BGE, "bge", handle_branch)                   \
+    X(BLTU, "bltu", handle_branch)                 \
+    X(BGEU, "bgeu", handle_branch)                 \
+    X(BGT, "bgt", handle_branch)                   \
+    X(BLE, "ble", handle_branch)                   \
+    X(BGTU, "bgtu", handle_branch)                 \
+    X(BLEU, "bleu", handle_branch)                 \
+    X(BEQZ, "beqz", handle_branch_zero)            \
+    X(BNEZ, "bnez", handle_branch_zero)            \
+    X(BLEZ, "blez", handle_branch_zero)            \
+    X(BGEZ, "bgez", handle_branch_zero)            \
+    X(BLTZ, "bltz", handle_branch_zero)            \
+    X(BGTZ, "bgtz", handle_branch_zero)            \
+    X(MV, "mv", handle_alu_pseudo)                 \
+    X(NOT, "not", handle_alu_pseudo)               \
+    X(NEG, "neg", handle_alu_pseudo)               \
+    X(SEQZ, "seqz", handle_alu_pseudo)             \
+    X(SNEZ, "snez", handle_alu_pseudo)             \
+    X(SLTZ, "sltz", handle_alu_pseudo)             \
+    X(SGTZ, "sgtz", handle_alu_pseudo)             \
+    X(J, "j", handle_jump)                         \
+    X(JAL, "jal", handle_jump)                     \
+    X(JR, "jr", handle_jump_reg)                   \
+    X(JALR, "jalr", handle_jump_reg)               \
+    X(RET, "ret", handle_ret)                      \
+    X(LUI, "lui", handle_upper)                    \
+    X(AUIPC, "auipc", handle_upper)                \
+    X(LI, "li", handle_li)                         \
+    X(LA, "la", handle_la)                         \
+    X(ECALL, "ecall", handle_ecall)                \
+    X(CSRRW, "csrrw", handle_csr)                  \
+    X(CSRRS, "csrrs", handle_csr)                  \
+    X(CSRRC, "csrrc", handle_csr)                  \
+    X(CSRRWI, "csrrwi", handle_csr_imm)            \
+    X(CSRRSI, "csrrsi", handle_csr_imm)            \
+    X(CSRRCI, "csrrci", handle_csr_imm)            \
+    X(RDCYCLE, "rdcycle", handle_rdcounter)        \
+    X(RDTIME, "rdtime", handle_rdcounter)          \
+    X(RDINSTRET, "rdinstret", handle_rdcounter)    \
+    X(RDCYCLEH, "rdcycleh", handle_rdcounter)      \
+    X(RDTIMEH, "rdtimeh", handle_rdcounter)        \
+    X(RDINSTRETH, "rdinstreth", handle_rdcounter)  \
+    X(SRET, "sret", handle_sret)                   \
+    X(C_ADDI4SPN, "c.addi4spn", handle_c_addi4spn) \
+    X(C_LW, "c.lw", handle_c_lw)                   \
+    X(C_SW, "c.sw", handle_c_sw)                   \
+    X(C_ADDI, "c.addi", handle_c_addi)             \
+    X(C_NOP, "c.nop", handle_c_nop)                \
+    X(C_LI, "c.li", handle_c_li)                   \
+    X(C_LUI, "c.lui", handle_c_lui)                \
+    X(C_ADDI16SP, "c.addi16sp", handle_c_addi16sp) \
+    X(C_SRLI, "c.srli", handle_c_srli)             \
+    X(C_SRAI, "c.srai", handle_c_srai)             \
+    X(C_ANDI, "c.andi", handle_c_andi)             \
+    X(C_SUB, "c.sub", handle_c_sub)                \
+    X(C_XOR, "c.xor", handle_c_xor)                \
+    X(C_OR, "c.or", handle_c_or)                   \
+    X(C_AND, "c.and", handle_c_and)                \
+    X(C_J, "c.j", handle_c_jump)                   \
+    X(C_JAL, "c.jal", handle_c_jump)               \
+    X(C_BEQZ, "c.beqz", handle_c_branch)           \
+    X(C_BNEZ, "c.bnez", handle_c_branch)           \
+    X(C_SLLI, "c.slli", handle_c_slli)             \
+    X(C_LWSP, "c.lwsp", handle_c_lwsp)             \
+    X(C_SWSP, "c.swsp", handle_c_swsp)             \
+    X(C_JR, "c.jr", handle_c_jr)                   \
+    X(C_JALR, "c.jalr", handle_c_jalr)             \
+    X(C_MV, "c.mv", handle_c_mv)                   \
+    X(C_ADD, "c.add", handle_c_add)                \
+    X(C_EBREAK, "c.ebreak", handle_c_ebreak)
+
+typedef enum Opcode {
+#define X(id, name, cb) OP_##id,
+    OPCODES(X)
+#undef X
+    OP_COUNT
+} Opcode;
+
+const char *handle_alu_reg(Parser *p, u32 op) {
     int d, s1, s2;
 
     skip_whitespace(p);
@@ -1101,30 +1781,30 @@ const char *handle_alu_reg(Parser *p, const char *opcode, size_t opcode_len) {
     if ((s2 = parse_reg(p)) == -1) return "Invalid rs2";
 
     u32 inst = 0;
-    if (str_eq_case(opcode, opcode_len, "add")) inst = ADD(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "slt")) inst = SLT(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "sltu")) inst = SLTU(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "and")) inst = AND(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "or")) inst = OR(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "xor")) inst = XOR(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "sll")) inst = SLL(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "srl")) inst = SRL(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "sub")) inst = SUB(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "sra")) inst = SRA(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "mul")) inst = MUL(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "mulh")) inst = MULH(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "mulu")) inst = MULU(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "mulhu")) inst = MULHU(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "div")) inst = DIV(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "divu")) inst = DIVU(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "rem")) inst = REM(d, s1, s2);
-    else if (str_eq_case(opcode, opcode_len, "remu")) inst = REMU(d, s1, s2);
+    if (op == OP_ADD) inst = ADD(d, s1, s2);
+    else if (op == OP_SLT) inst = SLT(d, s1, s2);
+    else if (op == OP_SLTU) inst = SLTU(d, s1, s2);
+    else if (op == OP_AND) inst = AND(d, s1, s2);
+    else if (op == OP_OR) inst = OR(d, s1, s2);
+    else if (op == OP_XOR) inst = XOR(d, s1, s2);
+    else if (op == OP_SLL) inst = SLL(d, s1, s2);
+    else if (op == OP_SRL) inst = SRL(d, s1, s2);
+    else if (op == OP_SUB) inst = SUB(d, s1, s2);
+    else if (op == OP_SRA) inst = SRA(d, s1, s2);
+    else if (op == OP_MUL) inst = MUL(d, s1, s2);
+    else if (op == OP_MULH) inst = MULH(d, s1, s2);
+    else if (op == OP_MULU) inst = MULU(d, s1, s2);
+    else if (op == OP_MULHU) inst = MULHU(d, s1, s2);
+    else if (op == OP_DIV) inst = DIV(d, s1, s2);
+    else if (op == OP_DIVU) inst = DIVU(d, s1, s2);
+    else if (op == OP_REM) inst = REM(d, s1, s2);
+    else if (op == OP_REMU) inst = REMU(d, s1, s2);
 
     asm_emit(inst, p->startline);
     return NULL;
 }
 
-const char *handle_alu_imm(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_alu_imm(Parser *p, u32 op) {
     int d, s1;
     i32 simm;
 
@@ -1144,23 +1824,22 @@ const char *handle_alu_imm(Parser *p, const char *opcode, size_t opcode_len) {
     if (simm < -2048 || simm > 2047) return "Out of bounds imm";
 
     u32 inst = 0;
-    if (str_eq_case(opcode, opcode_len, "addi")) inst = ADDI(d, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "slti")) inst = SLTI(d, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "sltiu"))
-        inst = SLTIU(d, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "andi")) inst = ANDI(d, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "ori")) inst = ORI(d, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "xori")) inst = XORI(d, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "slli")) inst = SLLI(d, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "srli")) inst = SRLI(d, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "srai")) inst = SRAI(d, s1, simm);
+    if (op == OP_ADDI) inst = ADDI(d, s1, simm);
+    else if (op == OP_SLTI) inst = SLTI(d, s1, simm);
+    else if (op == OP_SLTIU) inst = SLTIU(d, s1, simm);
+    else if (op == OP_ANDI) inst = ANDI(d, s1, simm);
+    else if (op == OP_ORI) inst = ORI(d, s1, simm);
+    else if (op == OP_XORI) inst = XORI(d, s1, simm);
+    else if (op == OP_SLLI) inst = SLLI(d, s1, simm);
+    else if (op == OP_SRLI) inst = SRLI(d, s1, simm);
+    else if (op == OP_SRAI) inst = SRAI(d, s1, simm);
 
     asm_emit(inst, p->startline);
 
     return NULL;
 }
 
-const char *handle_ldst(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_ldst(Parser *p, u32 op) {
     int reg, mem;
     i32 simm;
 
@@ -1181,21 +1860,21 @@ const char *handle_ldst(Parser *p, const char *opcode, size_t opcode_len) {
     if (!consume_if(p, ')')) return "Expected )";
 
     u32 inst = 0;
-    if (str_eq_case(opcode, opcode_len, "lb")) inst = LB(reg, mem, simm);
-    else if (str_eq_case(opcode, opcode_len, "lh")) inst = LH(reg, mem, simm);
-    else if (str_eq_case(opcode, opcode_len, "lw")) inst = LW(reg, mem, simm);
-    else if (str_eq_case(opcode, opcode_len, "lbu")) inst = LBU(reg, mem, simm);
-    else if (str_eq_case(opcode, opcode_len, "lhu")) inst = LHU(reg, mem, simm);
-    else if (str_eq_case(opcode, opcode_len, "sb")) inst = SB(reg, mem, simm);
-    else if (str_eq_case(opcode, opcode_len, "sh")) inst = SH(reg, mem, simm);
-    else if (str_eq_case(opcode, opcode_len, "sw")) inst = SW(reg, mem, simm);
+    if (op == OP_LB) inst = LB(reg, mem, simm);
+    else if (op == OP_LH) inst = LH(reg, mem, simm);
+    else if (op == OP_LW) inst = LW(reg, mem, simm);
+    else if (op == OP_LBU) inst = LBU(reg, mem, simm);
+    else if (op == OP_LHU) inst = LHU(reg, mem, simm);
+    else if (op == OP_SB) inst = SB(reg, mem, simm);
+    else if (op == OP_SH) inst = SH(reg, mem, simm);
+    else if (op == OP_SW) inst = SW(reg, mem, simm);
 
     asm_emit(inst, p->startline);
     return NULL;
 }
 
-const char *label(Parser *p, Parser *orig, DeferredInsnCb *cb,
-                  const char *opcode, size_t opcode_len, u32 *out_addr,
+const char *label(Parser *p, Parser *orig, DeferredInsnCb *cb, u32 op,
+                  u32 *out_addr,
                   bool *later, DeferredInsnReloc *reloc) {
     *later = false;
     const char *target;
@@ -1204,32 +1883,39 @@ const char *label(Parser *p, Parser *orig, DeferredInsnCb *cb,
     parse_ident(p, &target, &target_len);
     if (target_len == 0) return "No label";
 
-    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_labels); i++) {
-        if (str_eq_2(ARES_ARRAY_GET(&g_labels, i)->txt,
-                     ARES_ARRAY_GET(&g_labels, i)->len, target, target_len)) {
-            *out_addr = ARES_ARRAY_GET(&g_labels, i)->addr;
-            return NULL;
-        }
-    }
-
-    if (g_in_fixup && (!reloc || !g_allow_externs)) return "Label not found";
+    LabelData *l = find_label(target, target_len);
+    if (g_linting) l = lint_ref(l, target, target_len);
+    if (l) *out_addr = l->addr;
     if (g_in_fixup) {
+        if (l) return NULL;
+        if (!reloc || !g_allow_externs) return "Label not found";
         *out_addr = 0;
+        // asm_relax() keeps the fixup pass's relocation, and the placeholder
+        // stays uncompressed so it still matches it
+        if (g_relaxing) {
+            g_relax_compress = false;
+            return NULL;
+        }
         return reloc(target, target_len);
     }
-    DeferredInsn *insn = ARES_ARRAY_PUSH(&g_deferred_insn);
-    insn->emit_idx = g_section->emit_idx;
-    insn->p = *orig;
-    insn->cb = cb;
-    insn->reloc = reloc;
-    insn->opcode = opcode;
-    insn->opcode_len = opcode_len;
-    insn->section = g_section;
-    *later = true;
+    // asm_relax() needs every reference, the linter only the deferred ones
+    if (l && g_linting) return NULL;
+
+    DeferredInsn *insn =
+        g_linting ? ARES_ARRAY_PUSH(&g_deferred_insn)
+                  : ARES_ARENA_PUSH(&g_runtime_arena, &g_deferred_insn);
+    *insn = (DeferredInsn){.p = *orig,
+                           .section = g_section,
+                           .cb = cb,
+                           .reloc = reloc,
+                           .op = op,
+                           .emit_idx = g_section->emit_idx,
+                           .line_idx = ARES_ARRAY_LEN(&g_text_by_linenum)};
+    *later = !l;
     return NULL;
 }
 
-const char *handle_branch(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_branch(Parser *p, u32 op) {
     Parser orig = *p;
     u32 addr;
     int s1, s2;
@@ -1246,8 +1932,8 @@ const char *handle_branch(Parser *p, const char *opcode, size_t opcode_len) {
     if (!consume_if(p, ',')) return "Expected ,";
 
     skip_whitespace(p);
-    const char *err = label(p, &orig, handle_branch, opcode, opcode_len, &addr,
-                            &later, reloc_branch);
+    const char *err = label(p, &orig, handle_branch, op, &addr, &later,
+                            reloc_branch);
     if (err) return err;
     if (later) {
         asm_emit32_raw(0, p->startline);
@@ -1256,22 +1942,21 @@ const char *handle_branch(Parser *p, const char *opcode, size_t opcode_len) {
     i32 simm = addr - (g_section->emit_idx + g_section->base);
 
     u32 inst = 0;
-    if (str_eq_case(opcode, opcode_len, "beq")) inst = BEQ(s1, s2, simm);
-    else if (str_eq_case(opcode, opcode_len, "bne")) inst = BNE(s1, s2, simm);
-    else if (str_eq_case(opcode, opcode_len, "blt")) inst = BLT(s1, s2, simm);
-    else if (str_eq_case(opcode, opcode_len, "bge")) inst = BGE(s1, s2, simm);
-    else if (str_eq_case(opcode, opcode_len, "bltu")) inst = BLTU(s1, s2, simm);
-    else if (str_eq_case(opcode, opcode_len, "bgeu")) inst = BGEU(s1, s2, simm);
-    else if (str_eq_case(opcode, opcode_len, "bgt")) inst = BLT(s2, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "ble")) inst = BGE(s2, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "bgtu")) inst = BLTU(s2, s1, simm);
-    else if (str_eq_case(opcode, opcode_len, "bleu")) inst = BGEU(s2, s1, simm);
-    asm_emit(inst, p->startline);
+    if (op == OP_BEQ) inst = BEQ(s1, s2, simm);
+    else if (op == OP_BNE) inst = BNE(s1, s2, simm);
+    else if (op == OP_BLT) inst = BLT(s1, s2, simm);
+    else if (op == OP_BGE) inst = BGE(s1, s2, simm);
+    else if (op == OP_BLTU) inst = BLTU(s1, s2, simm);
+    else if (op == OP_BGEU) inst = BGEU(s1, s2, simm);
+    else if (op == OP_BGT) inst = BLT(s2, s1, simm);
+    else if (op == OP_BLE) inst = BGE(s2, s1, simm);
+    else if (op == OP_BGTU) inst = BLTU(s2, s1, simm);
+    else if (op == OP_BLEU) inst = BGEU(s2, s1, simm);
+    asm_emit_site(inst, p->startline);
     return NULL;
 }
 
-const char *handle_branch_zero(Parser *p, const char *opcode,
-                               size_t opcode_len) {
+const char *handle_branch_zero(Parser *p, u32 op) {
     Parser orig = *p;
     u32 addr;
     int s;
@@ -1283,8 +1968,8 @@ const char *handle_branch_zero(Parser *p, const char *opcode,
     if (!consume_if(p, ',')) return "Expected ,";
 
     skip_whitespace(p);
-    const char *err = label(p, &orig, handle_branch_zero, opcode, opcode_len,
-                            &addr, &later, reloc_branch);
+    const char *err = label(p, &orig, handle_branch_zero, op, &addr, &later,
+                            reloc_branch);
     if (err) return err;
     if (later) {
         asm_emit32_raw(0, p->startline);
@@ -1293,19 +1978,18 @@ const char *handle_branch_zero(Parser *p, const char *opcode,
     i32 simm = addr - (g_section->emit_idx + g_section->base);
 
     u32 inst = 0;
-    if (str_eq_case(opcode, opcode_len, "beqz")) inst = BEQ(s, 0, simm);
-    else if (str_eq_case(opcode, opcode_len, "bnez")) inst = BNE(s, 0, simm);
-    else if (str_eq_case(opcode, opcode_len, "blez")) inst = BGE(0, s, simm);
-    else if (str_eq_case(opcode, opcode_len, "bgez")) inst = BGE(s, 0, simm);
-    else if (str_eq_case(opcode, opcode_len, "bltz")) inst = BLT(s, 0, simm);
-    else if (str_eq_case(opcode, opcode_len, "bgtz")) inst = BLT(0, s, simm);
-
-    asm_emit(inst, p->startline);
+    if (op == OP_BEQZ) inst = BEQ(s, 0, simm);
+    else if (op == OP_BNEZ) inst = BNE(s, 0, simm);
+    else if (op == OP_BLEZ) inst = BGE(0, s, simm);
+    else if (op == OP_BGEZ) inst = BGE(s, 0, simm);
+    else if (op == OP_BLTZ) inst = BLT(s, 0, simm);
+    else if (op == OP_BGTZ) inst = BLT(0, s, simm);
+
+    asm_emit_site(inst, p->startline);
     return NULL;
 }
 
-const char *handle_alu_pseudo(Parser *p, const char *opcode,
-                              size_t opcode_len) {
+const char *handle_alu_pseudo(Parser *p, u32 op) {
     u32 addr;
     int d, s;
 
@@ -1318,19 +2002,19 @@ const char *handle_alu_pseudo(Parser *p, const char *opcode,
     if ((s = parse_reg(p)) == -1) return "Invalid rs";
 
     u32 inst = 0;
-    if (str_eq_case(opcode, opcode_len, "mv")) inst = ADDI(d, s, 0);
-    else if (str_eq_case(opcode, opcode_len, "not")) inst = XORI(d, s, -1);
-    else if (str_eq_case(opcode, opcode_len, "neg")) inst = SUB(d, 0, s);
-    else if (str_eq_case(opcode, opcode_len, "seqz")) inst = SLTIU(d, s, 1);
-    else if (str_eq_case(opcode, opcode_len, "snez")) inst = SLTU(d, 0, s);
-    else if (str_eq_case(opcode, opcode_len, "sltz")) inst = SLT(d, s, 0);
-    else if (str_eq_case(opcode, opcode_len, "sgtz")) inst = SLT(d, 0, s);
+    if (op == OP_MV) inst = ADDI(d, s, 0);
+    else if (op == OP_NOT) inst = XORI(d, s, -1);
+    else if (op == OP_NEG) inst = SUB(d, 0, s);
+    else if (op == OP_SEQZ) inst = SLTIU(d, s, 1);
+    else if (op == OP_SNEZ) inst = SLTU(d, 0, s);
+    else if (op == OP_SLTZ) inst = SLT(d, s, 0);
+    else if (op == OP_SGTZ) inst = SLT(d, 0, s);
 
     asm_emit(inst, p->startline);
     return NULL;
 }
 
-const char *handle_jump(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_jump(Parser *p, u32 op) {
     int d;
     Parser orig = *p;
     const char *err = NULL;
@@ -1338,7 +2022,7 @@ const char *handle_jump(Parser *p, const char *opcode, size_t opcode_len) {
 
     skip_whitespace(p);
     // jal optionally takes a register argument
-    if (str_eq_case(opcode, opcode_len, "jal")) {
+    if (op == OP_JAL) {
         if ((d = parse_reg(p)) == -1) err = "Invalid rd";
         skip_whitespace(p);
         if (consume_if(p, ',')) {
@@ -1347,25 +2031,24 @@ const char *handle_jump(Parser *p, const char *opcode, size_t opcode_len) {
             *p = orig;
             d = 1;
         }
-    } else if (str_eq_case(opcode, opcode_len, "j")) {
+    } else if (op == OP_J) {
         d = 0;
     } else assert(false);
 
     skip_whitespace(p);
     u32 addr;
-    err = label(p, &orig, handle_jump, opcode, opcode_len, &addr, &later,
-                reloc_jal);
+    err = label(p, &orig, handle_jump, op, &addr, &later, reloc_jal);
     if (err) return err;
     if (later) {
         asm_emit32_raw(0, p->startline);
         return NULL;
     }
     i32 simm = addr - (g_section->emit_idx + g_section->base);
-    asm_emit(JAL(d, simm), p->startline);
+    asm_emit_site(JAL(d, simm), p->startline);
     return NULL;
 }
 
-const char *handle_jump_reg(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_jump_reg(Parser *p, u32 op) {
     int d, s;
     i32 simm;
 
@@ -1373,7 +2056,7 @@ const char *handle_jump_reg(Parser *p, const char *opcode, size_t opcode_len) {
     // jalr rs
     // jalr rd, rs, simm
     // jalr rd, simm(rs)
-    if (str_eq_case(opcode, opcode_len, "jalr")) {
+    if (op == OP_JALR) {
         if ((d = parse_reg(p)) == -1) return "Invalid register";
         skip_whitespace(p);
         if (!consume_if(p, ',')) {
@@ -1404,19 +2087,19 @@ const char *handle_jump_reg(Parser *p, const char *opcode, size_t opcode_len) {
         if (simm >= -2048 && simm <= 2047)
             asm_emit(JALR(d, s, simm), p->startline);
         else return "Immediate out of range";
-    } else if (str_eq_case(opcode, opcode_len, "jr")) {
+    } else if (op == OP_JR) {
         if ((s = parse_reg(p)) == -1) return "Invalid rs";
         asm_emit(JALR(0, s, 0), p->startline);
     }
     return NULL;
 }
 
-const char *handle_ret(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_ret(Parser *p, u32 op) {
     asm_emit(JALR(0, 1, 0), p->startline);
     return NULL;
 }
 
-const char *handle_upper(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_upper(Parser *p, u32 op) {
     int d;
     i32 simm;
     u32 inst = 0;
@@ -1430,14 +2113,14 @@ const char *handle_upper(Parser *p, const char *opcode, size_t opcode_len) {
     // the immediate can either be signed or unsigned 20 bit
     if (simm < -524288 || simm > 1048575) return "Out of bounds imm";
 
-    if (str_eq_case(opcode, opcode_len, "lui")) inst = LUI(d, simm);
-    else if (str_eq_case(opcode, opcode_len, "auipc")) inst = AUIPC(d, simm);
+    if (op == OP_LUI) inst = LUI(d, simm);
+    else if (op == OP_AUIPC) inst = AUIPC(d, simm);
 
     asm_emit(inst, p->startline);
     return NULL;
 }
 
-const char *handle_li(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_li(Parser *p, u32 op) {
     int d;
     i32 simm;
 
@@ -1460,7 +2143,7 @@ const char *handle_li(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_la(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_la(Parser *p, u32 op) {
     Parser orig = *p;
     int d;
     bool later;
@@ -1472,8 +2155,8 @@ const char *handle_la(Parser *p, const char *opcode, size_t opcode_len) {
 
     u32 addr;
     skip_whitespace(p);
-    const char *err = label(p, &orig, handle_la, opcode, opcode_len, &addr,
-                            &later, reloc_hi20lo12i);
+    const char *err = label(p, &orig, handle_la, op, &addr, &later,
+                            reloc_hi20lo12i);
     if (later) {
         asm_emit32_raw(0, p->startline);
         asm_emit32_raw(0, p->startline);
@@ -1485,22 +2168,23 @@ const char *handle_la(Parser *p, const char *opcode, size_t opcode_len) {
     u32 lo = simm & 0xFFF;
     if (lo >= 0x800) lo -= 0x1000;
     u32 hi = (u32)(simm - lo) >> 12;
-    asm_emit(AUIPC(d, hi), p->startline);
-    asm_emit(ADDI(d, d, lo), p->startline);
+    asm_emit_site(AUIPC(d, hi), p->startline);
+    // the auipc alone is enough once it's relaxed
+    if (lo || !g_relax_compress) asm_emit_site(ADDI(d, d, lo), p->startline);
     return NULL;
 }
 
-const char *handle_ecall(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_ecall(Parser *p, u32 op) {
     asm_emit(0x73, p->startline);
     return NULL;
 }
 
-const char *handle_sret(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_sret(Parser *p, u32 op) {
     asm_emit(0x10200073, p->startline);
     return NULL;
 }
 
-const char *handle_csr(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_csr(Parser *p, u32 op) {
     int csr, d, s;
 
     skip_whitespace(p);
@@ -1519,15 +2203,34 @@ const char *handle_csr(Parser *p, const char *opcode, size_t opcode_len) {
     if ((s = parse_reg(p)) == -1) return "Invalid rs";
 
     u32 inst = 0;
-    if (str_eq_case(opcode, opcode_len, "csrrw")) inst = CSRRW(d, s, csr);
-    else if (str_eq_case(opcode, opcode_len, "csrrs")) inst = CSRRS(d, s, csr);
-    else if (str_eq_case(opcode, opcode_len, "csrrc")) inst = CSRRC(d, s, csr);
+    if (op == OP_CSRRW) inst = CSRRW(d, s, csr);
+    else if (op == OP_CSRRS) inst = CSRRS(d, s, csr);
+    else if (op == OP_CSRRC) inst = CSRRC(d, s, csr);
 
     asm_emit(inst, p->startline);
     return NULL;
 }
 
-const char *handle_csr_imm(Parser *p, const char *opcode, size_t opcode_len) {
+// rdcycle rd is csrrs rd, cycle, x0 and so on
+const char *handle_rdcounter(Parser *p, u32 op) {
+    int d;
+
+    skip_whitespace(p);
+    if ((d = parse_reg(p)) == -1) return "Invalid rd";
+
+    u32 csr = 0;
+    if (op == OP_RDCYCLE) csr = CSR_CYCLE;
+    else if (op == OP_RDTIME) csr = CSR_TIME;
+    else if (op == OP_RDINSTRET) csr = CSR_INSTRET;
+    else if (op == OP_RDCYCLEH) csr = CSR_CYCLE | CSR_COUNTER_HIGH;
+    else if (op == OP_RDTIMEH) csr = CSR_TIME | CSR_COUNTER_HIGH;
+    else if (op == OP_RDINSTRETH) csr = CSR_INSTRET | CSR_COUNTER_HIGH;
+
+    asm_emit(CSRRS(d, 0, csr), p->startline);
+    return NULL;
+}
+
+const char *handle_csr_imm(Parser *p, u32 op) {
     int csr, d;
     i32 zimm;
 
@@ -1547,17 +2250,15 @@ const char *handle_csr_imm(Parser *p, const char *opcode, size_t opcode_len) {
     if (!parse_numeric(p, &zimm)) return "Invalid imm";
 
     u32 inst = 0;
-    if (str_eq_case(opcode, opcode_len, "csrrwi")) inst = CSRRWI(d, zimm, csr);
-    else if (str_eq_case(opcode, opcode_len, "csrrsi"))
-        inst = CSRRSI(d, zimm, csr);
-    else if (str_eq_case(opcode, opcode_len, "csrrci"))
-        inst = CSRRCI(d, zimm, csr);
+    if (op == OP_CSRRWI) inst = CSRRWI(d, zimm, csr);
+    else if (op == OP_CSRRSI) inst = CSRRSI(d, zimm, csr);
+    else if (op == OP_CSRRCI) inst = CSRRCI(d, zimm, csr);
 
     asm_emit(inst, p->startline);
     return NULL;
 }
 
-const char *handle_c_addi4spn(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_addi4spn(Parser *p, u32 op) {
     int rd;
     i32 imm;
 
@@ -1583,7 +2284,7 @@ const char *handle_c_addi4spn(Parser *p, const char *opcode, size_t opcode_len)
     return NULL;
 }
 
-const char *handle_c_lw(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_lw(Parser *p, u32 op) {
     int rd, rs1;
     i32 imm;
 
@@ -1606,7 +2307,7 @@ const char *handle_c_lw(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_sw(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_sw(Parser *p, u32 op) {
     int rs2, rs1;
     i32 imm;
 
@@ -1629,7 +2330,7 @@ const char *handle_c_sw(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_addi(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_addi(Parser *p, u32 op) {
     int rd;
     i32 imm;
 
@@ -1646,14 +2347,14 @@ const char *handle_c_addi(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_nop(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_nop(Parser *p, u32 op) {
     u16 inst;
     encode_c_addi(0, 0, &inst);
     asm_emit16(inst, p->startline);
     return NULL;
 }
 
-const char *handle_c_li(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_li(Parser *p, u32 op) {
     int rd;
     i32 imm;
 
@@ -1670,7 +2371,7 @@ const char *handle_c_li(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_lui(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_lui(Parser *p, u32 op) {
     int rd;
     i32 imm;
 
@@ -1687,7 +2388,7 @@ const char *handle_c_lui(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_addi16sp(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_addi16sp(Parser *p, u32 op) {
     int rd;
     i32 imm;
 
@@ -1705,7 +2406,7 @@ const char *handle_c_addi16sp(Parser *p, const char *opcode, size_t opcode_len)
     return NULL;
 }
 
-const char *handle_c_srli(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_srli(Parser *p, u32 op) {
     int rd;
     i32 imm;
 
@@ -1723,7 +2424,7 @@ const char *handle_c_srli(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_srai(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_srai(Parser *p, u32 op) {
     int rd;
     i32 imm;
 
@@ -1741,7 +2442,7 @@ const char *handle_c_srai(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_andi(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_andi(Parser *p, u32 op) {
     int rd;
     i32 imm;
 
@@ -1758,7 +2459,7 @@ const char *handle_c_andi(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_sub(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_sub(Parser *p, u32 op) {
     int rd, rs2;
 
     skip_whitespace(p);
@@ -1774,7 +2475,7 @@ const char *handle_c_sub(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_xor(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_xor(Parser *p, u32 op) {
     int rd, rs2;
 
     skip_whitespace(p);
@@ -1790,7 +2491,7 @@ const char *handle_c_xor(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_or(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_or(Parser *p, u32 op) {
     int rd, rs2;
 
     skip_whitespace(p);
@@ -1806,7 +2507,7 @@ const char *handle_c_or(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_and(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_and(Parser *p, u32 op) {
     int rd, rs2;
 
     skip_whitespace(p);
@@ -1824,7 +2525,7 @@ const char *handle_c_and(Parser *p, const char *opcode, size_t opcode_len) {
 
 const char *reloc_rvc_jump(const char *sym, size_t sym_len) {
     Extern *e = get_extern(sym, sym_len);
-    Relocation *r = ARES_ARRAY_PUSH(&g_section->relocations);
+    Relocation *r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
     r->symbol = e;
     r->addend = 0;
     r->offset = g_section->emit_idx;
@@ -1834,7 +2535,7 @@ const char *reloc_rvc_jump(const char *sym, size_t sym_len) {
 
 const char *reloc_rvc_branch(const char *sym, size_t sym_len) {
     Extern *e = get_extern(sym, sym_len);
-    Relocation *r = ARES_ARRAY_PUSH(&g_section->relocations);
+    Relocation *r = ARES_ARENA_PUSH(&g_runtime_arena, &g_section->relocations);
     r->symbol = e;
     r->addend = 0;
     r->offset = g_section->emit_idx;
@@ -1842,14 +2543,14 @@ const char *reloc_rvc_branch(const char *sym, size_t sym_len) {
     return NULL;
 }
 
-const char *handle_c_jump(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_jump(Parser *p, u32 op) {
     Parser orig = *p;
     u32 addr;
     bool later;
 
     skip_whitespace(p);
-    const char *err = label(p, &orig, handle_c_jump, opcode, opcode_len, &addr,
-                            &later, reloc_rvc_jump);
+    const char *err = label(p, &orig, handle_c_jump, op, &addr, &later,
+                            reloc_rvc_jump);
     if (err) return err;
     if (later) {
         asm_emit16(0, p->startline);
@@ -1858,13 +2559,13 @@ const char *handle_c_jump(Parser *p, const char *opcode, size_t opcode_len) {
     i32 simm = addr - (g_section->emit_idx + g_section->base);
 
     u16 inst;
-    bool link = str_eq_case(opcode, opcode_len, "c.jal");
+    bool link = op == OP_C_JAL;
     if (!encode_c_j(simm, link, &inst)) return "Invalid c.j/c.jal";
     asm_emit16(inst, p->startline);
     return NULL;
 }
 
-const char *handle_c_branch(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_branch(Parser *p, u32 op) {
     Parser orig = *p;
     u32 addr;
     int rs1;
@@ -1876,8 +2577,8 @@ const char *handle_c_branch(Parser *p, const char *opcode, size_t opcode_len) {
     if (!consume_if(p, ',')) return "Expected ,";
     skip_whitespace(p);
 
-    const char *err = label(p, &orig, handle_c_branch, opcode, opcode_len, &addr,
-                            &later, reloc_rvc_branch);
+    const char *err = label(p, &orig, handle_c_branch, op, &addr, &later,
+                            reloc_rvc_branch);
     if (err) return err;
     if (later) {
         asm_emit16(0, p->startline);
@@ -1886,7 +2587,7 @@ const char *handle_c_branch(Parser *p, const char *opcode, size_t opcode_len) {
     i32 simm = addr - (g_section->emit_idx + g_section->base);
 
     u16 inst;
-    if (str_eq_case(opcode, opcode_len, "c.beqz")) {
+    if (op == OP_C_BEQZ) {
         if (!encode_c_beqz(rs1, simm, &inst)) return "Invalid c.beqz";
     } else {
         if (!encode_c_bnez(rs1, simm, &inst)) return "Invalid c.bnez";
@@ -1895,7 +2596,7 @@ const char *handle_c_branch(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_slli(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_slli(Parser *p, u32 op) {
     int rd;
     i32 imm;
 
@@ -1913,7 +2614,7 @@ const char *handle_c_slli(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_lwsp(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_lwsp(Parser *p, u32 op) {
     int rd, rs1;
     i32 imm;
 
@@ -1937,7 +2638,7 @@ const char *handle_c_lwsp(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_swsp(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_swsp(Parser *p, u32 op) {
     int rs2, rs1;
     i32 imm;
 
@@ -1961,7 +2662,7 @@ const char *handle_c_swsp(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_jr(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_jr(Parser *p, u32 op) {
     int rs1;
 
     skip_whitespace(p);
@@ -1973,7 +2674,7 @@ const char *handle_c_jr(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_jalr(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_jalr(Parser *p, u32 op) {
     int rs1;
 
     skip_whitespace(p);
@@ -1985,7 +2686,7 @@ const char *handle_c_jalr(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_mv(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_mv(Parser *p, u32 op) {
     int rd, rs2;
 
     skip_whitespace(p);
@@ -2001,7 +2702,7 @@ const char *handle_c_mv(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_add(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_add(Parser *p, u32 op) {
     int rd, rs2;
 
     skip_whitespace(p);
@@ -2017,69 +2718,55 @@ const char *handle_c_add(Parser *p, const char *opcode, size_t opcode_len) {
     return NULL;
 }
 
-const char *handle_c_ebreak(Parser *p, const char *opcode, size_t opcode_len) {
+const char *handle_c_ebreak(Parser *p, u32 op) {
     u16 inst;
     encode_c_ebreak(&inst);
     asm_emit16(inst, p->startline);
     return NULL;
 }
 
-typedef struct OpcodeHandling {
+static const struct {
+    const char *name;
     DeferredInsnCb *cb;
-    const char *opcodes[64];
-} OpcodeHandling;
-
-OpcodeHandling opcode_types[] = {
-    {
-        handle_alu_reg,
-        {"add", "slt", "sltu", "and", "or", "xor", "sll", "srl", "sub", "sra",
-         "mul", "mulh", "mulu", "mulhu", "div", "divu", "rem", "remu"},
-    },
-    {handle_alu_imm,
-     {"addi", "slt", "sltiu", "andi", "ori", "xori", "slli", "srli", "srai"}},
-    {handle_ldst, {"lb", "lh", "lw", "lbu", "lhu", "sb", "sh", "sw"}},
-    {handle_branch,
-     {"beq", "bne", "blt", "bge", "bltu", "bgeu", "bgt", "ble", "bgtu",
-      "bleu"}},
-    {handle_branch_zero, {"beqz", "bnez", "blez", "bgez", "bltz", "bgtz"}},
-    {handle_alu_pseudo, {"mv", "not", "neg", "seqz", "snez", "sltz", "sgtz"}},
-    {handle_jump, {"j", "jal"}},
-    {handle_jump_reg, {"jr", "jalr"}},
-    {handle_ret, {"ret"}},
-    {handle_upper, {"lui", "auipc"}},
-    {handle_li, {"li"}},
-    {handle_la, {"la"}},
-    {handle_ecall, {"ecall"}},
-    {handle_csr, {"csrrw", "csrrs", "csrrc"}},
-    {handle_csr_imm, {"csrrwi", "csrrsi", "csrrci"}},
-    {handle_sret, {"sret"}},
-    {handle_c_addi4spn, {"c.addi4spn"}},
-    {handle_c_lw, {"c.lw"}},
-    {handle_c_sw, {"c.sw"}},
-    {handle_c_addi, {"c.addi"}},
-    {handle_c_nop, {"c.nop"}},
-    {handle_c_li, {"c.li"}},
-    {handle_c_lui, {"c.lui"}},
-    {handle_c_addi16sp, {"c.addi16sp"}},
-    {handle_c_srli, {"c.srli"}},
-    {handle_c_srai, {"c.srai"}},
-    {handle_c_andi, {"c.andi"}},
-    {handle_c_sub, {"c.sub"}},
-    {handle_c_xor, {"c.xor"}},
-    {handle_c_or, {"c.or"}},
-    {handle_c_and, {"c.and"}},
-    {handle_c_jump, {"c.j", "c.jal"}},
-    {handle_c_branch, {"c.beqz", "c.bnez"}},
-    {handle_c_slli, {"c.slli"}},
-    {handle_c_lwsp, {"c.lwsp"}},
-    {handle_c_swsp, {"c.swsp"}},
-    {handle_c_jr, {"c.jr"}},
-    {handle_c_jalr, {"c.jalr"}},
-    {handle_c_mv, {"c.mv"}},
-    {handle_c_add, {"c.add"}},
-    {handle_c_ebreak, {"c.ebreak"}},
+} g_opcodes[OP_COUNT] = {
+#define X(id, name, cb) [OP_##id] = {name, cb},
+    OPCODES(X)
+#undef X
 };
 
+// longest mnemonic, c.addi4spn, c.addi16sp and rdinstreth
+#define OPCODE_MAX_LEN 10
+
+// open addressing over the lowercased mnemonics, OP_ + 1 per slot, filled on
+// the first lookup
+static u8 g_opcode_slots[256];
+static bool g_opcode_slots_ready;
+
+static size_t opcode_slot(const char *name, size_t len) {
+    size_t i = symtab_hash(name, len) & 255;
+    while (g_opcode_slots[i]) {
+        const char *other = g_opcodes[g_opcode_slots[i] - 1].name;
+        if (str_eq_2(other, strlen(other), name, len)) break;
+        i = (i + 1) & 255;
+    }
+    return i;
+}
+
+// -1 for an unknown mnemonic
+static int find_opcode(const char *txt, size_t len) {
+    if (!g_opcode_slots_ready) {
+        for (int op = 0; op < OP_COUNT; op++)
+            g_opcode_slots[opcode_slot(g_opcodes[op].name,
+                                       strlen(g_opcodes[op].name))] = op + 1;
+        g_opcode_slots_ready = true;
+    }
+
+    char name[OPCODE_MAX_LEN];
+    if (len > OPCODE_MAX_LEN) return -1;
+    for (size_t i = 0; i < len; i++) name[i] = my_tolower(txt[i]);
+    return (int)g_opcode_slots[opcode_slot(name, len)] - 1;
+}
+
 // defining _start but not making it global is a VERY common mistake
 // another mistake i've seen is putting _start in .data by accident
 const char *resolve_start(u32 *start_pc) {
@@ -2209,90 +2896,72 @@ static void prepare_default_syms(void) {
 #undef MEM_LABEL
 }
 
-export void assemble(const char *txt, size_t s, bool allow_externs) {
-    g_allow_externs = allow_externs;
-    g_in_fixup = false;
-
-    callsan_init();
-    emulator_init();
-
-    g_text = malloc(sizeof(*g_text));
-    ARES_CHECK_OOM(g_text);
-    g_data = malloc(sizeof(*g_data));
-    ARES_CHECK_OOM(g_data);
-    g_kernel_data = malloc(sizeof(*g_kernel_data));
-    ARES_CHECK_OOM(g_kernel_data);
-    g_kernel_text = malloc(sizeof(*g_kernel_text));
-    ARES_CHECK_OOM(g_kernel_text);
-
-    *g_text = (Section){.name = ".text",
-                        .base = TEXT_BASE,
-                        .limit = TEXT_END,
-                        .contents = ARES_ARRAY_NEW(u8),
-                        .emit_idx = 0,
-                        .align = 2,
-                        .relocations = ARES_ARRAY_NEW(Relocation),
-                        .read = true,
-                        .write = false,
-                        .execute = true,
-                        .super = false,
-                        .physical = true};
-
-    *g_data = (Section){.name = ".data",
-                        .base = DATA_BASE,
-                        .limit = DATA_END,
-                        .contents = ARES_ARRAY_NEW(u8),
-                        .emit_idx = 0,
-                        .align = 1,
-                        .relocations = ARES_ARRAY_NEW(Relocation),
-                        .read = true,
-                        .write = true,
-                        .execute = false,
-                        .super = false,
-                        .physical = true};
-
-    *g_kernel_data = (Section){.name = ".kernel_data",
-                               .base = KERNEL_DATA_BASE,
-                               .limit = KERNEL_DATA_END,
-                               .contents = ARES_ARRAY_NEW(u8),
-                               .emit_idx = 0,
-                               .align = 1,
-                               .relocations = ARES_ARRAY_NEW(Relocation),
-                               .read = true,
-                               .write = true,
-                               .execute = false,
-                               .super = true,
-                               .physical = false};
-
-    *g_kernel_text = (Section){.name = ".kernel_text",
-                               .base = KERNEL_TEXT_BASE,
-                               .limit = KERNEL_TEXT_END,
-                               .contents = ARES_ARRAY_NEW(u8),
-                               .emit_idx = 0,
-                               .align = 2,
-                               .relocations = ARES_ARRAY_NEW(Relocation),
-                               .read = true,
-                               .write = false,
-                               .execute = true,
-                               .super = true,
-                               .physical = false};
-
-    prepare_runtime_sections();
-    prepare_default_syms();
-    g_section = g_text;
+static void sections_init(Section *text, Section *data,
+                          Section *kernel_text, Section *kernel_data) {
+    *text = (Section){.name = ".text",
+                      .base = TEXT_BASE,
+                      .limit = TEXT_END,
+                      .contents = ARES_ARRAY_NEW(u8),
+                      .emit_idx = 0,
+                      .align = 2,
+                      .relocations = ARES_ARRAY_NEW(Relocation),
+                      .read = true,
+                      .write = false,
+                      .execute = true,
+                      .super = false,
+                      .physical = true};
+
+    *data = (Section){.name = ".data",
+                      .base = DATA_BASE,
+                      .limit = DATA_END,
+                      .contents = ARES_ARRAY_NEW(u8),
+                      .emit_idx = 0,
+                      .align = 1,
+                      .relocations = ARES_ARRAY_NEW(Relocation),
+                      .read = true,
+                      .write = true,
+                      .execute = false,
+                      .super = false,
+                      .physical = true};
+
+    *kernel_data = (Section){.name = ".kernel_data",
+                             .base = KERNEL_DATA_BASE,
+                             .limit = KERNEL_DATA_END,
+                             .contents = ARES_ARRAY_NEW(u8),
+                             .emit_idx = 0,
+                             .align = 1,
+                             .relocations = ARES_ARRAY_NEW(Relocation),
+                             .read = true,
+                             .write = true,
+                             .execute = false,
+                             .super = true,
+                             .physical = false};
+
+    *kernel_text = (Section){.name = ".kernel_text",
+                             .base = KERNEL_TEXT_BASE,
+                             .limit = KERNEL_TEXT_END,
+                             .contents = ARES_ARRAY_NEW(u8),
+                             .emit_idx = 0,
+                             .align = 2,
+                             .relocations = ARES_ARRAY_NEW(Relocation),
+                             .read = true,
+                             .write = false,
+                             .execute = true,
+                             .super = true,
+                             .physical = false};
+}
 
-    Parser parser = {0};
-    parser.input = txt;
-    parser.size = s;
-    parser.pos = 0;
-    parser.lineidx = 1;
-    Parser *p = &parser;
+// parses statements until the end of the input or, when linting, the first
+// statement boundary at or after stop
+static const char *assemble_statements(Parser *p, size_t stop) {
     const char *err = NULL;
 
     while (!err) {
+        if (p->pos >= stop && at_line_boundary(p)) break;
         skip_whitespace(p);
         if (p->pos == p->size) break;
         p->startline = p->lineidx;
+        p->startpos = p->pos;
 
         // i can fail parsing sections
         // if so, the identifier starting with . is a temp label
@@ -2314,6 +2983,7 @@ export void assemble(const char *txt, size_t s, bool allow_externs) {
                     if (str_eq(secname, secname_len, g_sections.buf[i]->name))
                         sec = g_sections.buf[i];
                 if (!sec) {
+                    if (g_linting) g_lint_unsupported = true;
                     err = "Section not found";
                     break;
                 }
@@ -2332,8 +3002,9 @@ export void assemble(const char *txt, size_t s, bool allow_externs) {
                 const char *ident;
                 size_t ident_len;
                 parse_ident(p, &ident, &ident_len);
-                *ARES_ARRAY_PUSH(&g_globals) =
-                    (Global){.str = ident, .len = ident_len};
+                if (!g_lint_recheck)
+                    *ARES_ARRAY_PUSH(&g_globals) =
+                        (Global){.str = ident, .len = ident_len};
                 continue;
             } else if (str_eq_case(directive, directive_len, "byte")) {
                 i32 value;
@@ -2404,13 +3075,102 @@ export void assemble(const char *txt, size_t s, bool allow_externs) {
                             err = "Invalid string";
                             break;
                         }
-                        for (size_t i = 0; i < out_len; i++)
-                            asm_emit_byte(out[i], p->startline);
+                        asm_emit_bytes(out, out_len);
                         free(out);
                     } else break;
                     first = false;
                 }
                 continue;
+            } else if (str_eq_case(directive, directive_len, "space") ||
+                       str_eq_case(directive, directive_len, "skip") ||
+                       str_eq_case(directive, directive_len, "zero")) {
+                // .space size[, byte], .zero takes no fill byte
+                i32 size, value = 0;
+                if (!parse_numeric(p, &size) || size < 0) {
+                    err = "Invalid size";
+                    break;
+                }
+                skip_whitespace(p);
+                if (!str_eq_case(directive, directive_len, "zero") &&
+                    consume_if(p, ',')) {
+                    skip_whitespace(p);
+                    if (!parse_numeric(p, &value)) {
+                        err = "Invalid byte";
+                        break;
+                    }
+                    if (value < -128 || value > 255) {
+                        err = "Out of bounds byte";
+                        break;
+                    }
+                }
+                if ((err = asm_emit_fill(size, 1, value))) break;
+                continue;
+            } else if (str_eq_case(directive, directive_len, "fill")) {
+                // .fill repeat[, size[, value]]
+                i32 repeat, size = 1, value = 0;
+                if (!parse_numeric(p, &repeat) || repeat < 0) {
+                    err = "Invalid repeat";
+                    break;
+                }
+                skip_whitespace(p);
+                if (consume_if(p, ',')) {
+                    skip_whitespace(p);
+                    if (!parse_numeric(p, &size) ||
+                        (size != 1 && size != 2 && size != 4)) {
+                        err = "Invalid size";
+                        break;
+                    }
+                    skip_whitespace(p);
+                    if (consume_if(p, ',')) {
+                        skip_whitespace(p);
+                        if (!parse_numeric(p, &value)) {
+                            err = "Invalid value";
+                            break;
+                        }
+                    }
+                }
+                if ((err = asm_emit_fill(repeat, size, value))) break;
+                continue;
+            } else if (str_eq_case(directive, directive_len, "incbin")) {
+                // .incbin "name"[, skip[, count]]
+                char *name;
+                size_t name_len;
+                i32 skip = 0, count = -1;
+                if (!parse_quoted_str(p, &name, &name_len)) {
+                    err = "Invalid string";
+                    break;
+                }
+                Blob *b = incbin_find(name, name_len);
+                free(name);
+                if (!b) {
+                    err = "File not found";
+                    break;
+                }
+                skip_whitespace(p);
+                if (consume_if(p, ',')) {
+                    skip_whitespace(p);
+                    if (!parse_numeric(p, &skip) || skip < 0 ||
+                        (size_t)skip > b->len) {
+                        err = "Invalid skip";
+                        break;
+                    }
+                    skip_whitespace(p);
+                    if (consume_if(p, ',')) {
+                        skip_whitespace(p);
+                        if (!parse_numeric(p, &count) || count < 0 ||
+                            (size_t)count > b->len - skip) {
+                            err = "Invalid count";
+                            break;
+                        }
+                    }
+                }
+                size_t len = count < 0 ? b->len - skip : (size_t)count;
+                if (!asm_fits(len)) {
+                    err = "Section overflow";
+                    break;
+                }
+                asm_emit_bytes(b->data + skip, len);
+                continue;
             } else if (str_eq_case(directive, directive_len, "asciz") ||
                        str_eq_case(directive, directive_len, "asciiz") ||
                        str_eq_case(directive, directive_len, "string")) {
@@ -2425,8 +3185,7 @@ export void assemble(const char *txt, size_t s, bool allow_externs) {
                             err = "Invalid string";
                             break;
                         }
-                        for (size_t i = 0; i < out_len; i++)
-                            asm_emit_byte(out[i], p->startline);
+                        asm_emit_bytes(out, out_len);
                         asm_emit_byte(0, p->startline);
                         free(out);
                     } else break;
@@ -2450,14 +3209,12 @@ export void assemble(const char *txt, size_t s, bool allow_externs) {
         skip_trailing(p);
 
         if (consume_if(p, ':')) {
-            for (size_t i = 0; i < ARES_ARRAY_LEN(&g_labels); i++) {
-                if (str_eq_2(ARES_ARRAY_GET(&g_labels, i)->txt,
-                             ARES_ARRAY_GET(&g_labels, i)->len, ident,
-                             ident_len)) {
-                    err = "Multiple definitions for the same label";
-                    break;
-                }
+            if (g_linting) {
+                lint_label(ident, ident_len, p->startline);
+                continue;
             }
+            if (find_label(ident, ident_len))
+                err = "Multiple definitions for the same label";
             u32 addr = g_section->emit_idx + g_section->base;
             *ARES_ARRAY_PUSH(&g_labels) = (LabelData){.txt = ident,
                                                         .len = ident_len,
@@ -2469,20 +3226,9 @@ export void assemble(const char *txt, size_t s, bool allow_externs) {
         opcode = ident;
         opcode_len = ident_len;
 
-        bool found = false;
-        for (size_t i = 0;
-             !found && i < sizeof(opcode_types) / sizeof(OpcodeHandling); i++) {
-            for (size_t j = 0; !found && opcode_types[i].opcodes[j]; j++) {
-                if (str_eq_case(opcode, opcode_len,
-                                opcode_types[i].opcodes[j])) {
-                    found = true;
-                    err = opcode_types[i].cb(p, opcode, opcode_len);
-                }
-            }
-        }
-        if (!found) {
-            err = "Unknown opcode";
-        }
+        int op = find_opcode(opcode, opcode_len);
+        if (op < 0) err = "Unknown opcode";
+        else err = g_opcodes[op].cb(p, op);
         if (err) break;
 
         // see comment above skip_trailing on why this is distinct from
@@ -2495,23 +3241,202 @@ export void assemble(const char *txt, size_t s, bool allow_externs) {
         }
     }
 
-    if (!err) {
-        g_in_fixup = true;
+    return err;
+}
+
+// runs the deferred instructions now that every label is known, *p becomes
+// the parser of the one that failed
+static const char *asm_fixup(Parser *p) {
+    g_in_fixup = true;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_deferred_insn); i++) {
+        struct DeferredInsn *insn = ARES_ARRAY_GET(&g_deferred_insn, i);
+        g_section = insn->section;
+        g_section->emit_idx = insn->emit_idx;
+        g_fixup_line_idx = insn->line_idx;
+        Parser ip = insn->p;
+        const char *err = insn->cb(&ip, insn->op);
+        if (err) {
+            *p = ip;
+            return err;
+        }
+        insn->size = g_section->emit_idx - insn->emit_idx;
+    }
+    return NULL;
+}
+
+// where an instruction of .text was and is, for moving what comes after it
+typedef struct {
+    u32 from, from_len;
+    u32 to, to_len;
+} RelaxMove;
+
+ARES_ARRAY_TYPE(RelaxMove);
+
+// then it stops shrinking and goes back to the uncompressed sizes, which
+// always fit
+#define RELAX_MAX_PASSES 16
+
+// emits insn again in its place, returns its size
+static u32 relax_emit(DeferredInsn *insn) {
+    g_section = insn->section;
+    g_section->emit_idx = insn->emit_idx;
+    g_fixup_line_idx = insn->line_idx;
+    g_relax_compress = !insn->pinned;
+    Parser p = insn->p;
+    if (insn->cb(&p, insn->op)) return 0;
+    return g_section->emit_idx - insn->emit_idx;
+}
+
+// the offset in .text after the moves of what was at off before them
+static u32 relax_map(ARES_ARRAY(RelaxMove) *moves, u32 off) {
+    size_t lo = 0, hi = ARES_ARRAY_LEN(moves);
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (moves->buf[mid].from <= off) lo = mid + 1;
+        else hi = mid;
+    }
+    if (!lo) return off;
+    RelaxMove *m = &moves->buf[lo - 1];
+    if (off < m->from + m->from_len) return m->to + (off - m->from);
+    return off - (m->from + m->from_len) + m->to + m->to_len;
+}
+
+// lays out .text again with the instructions at their new sizes, their bytes
+// are zero until relax_emit() fills them in
+static void relax_layout(ARES_ARRAY(RelaxMove) *moves) {
+    Section *s = g_text;
+    ARES_ARRAY(u8) contents = ARES_ARRAY_NEW(u8);
+    ARES_ARRAY(u32) lines = ARES_ARRAY_NEW(u32);
+    ARES_ARRAY_RESERVE(&contents, s->contents.len);
+    ARES_ARRAY_RESERVE(&lines, g_text_by_linenum.len);
+    size_t at = 0, line_at = 0, k = 0;
+
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_deferred_insn); i++) {
+        DeferredInsn *insn = ARES_ARRAY_GET(&g_deferred_insn, i);
+        if (insn->section != s) continue;
+        RelaxMove *m = &moves->buf[k++];
+
+        ARES_ARRAY_RESERVE(&contents, m->from - at + m->to_len);
+        memcpy(contents.buf + contents.len, s->contents.buf + at, m->from - at);
+        contents.len += m->from - at;
+        m->to = contents.len;
+        memset(contents.buf + contents.len, 0, m->to_len);
+        contents.len += m->to_len;
+        at = m->from + m->from_len;
+
+        size_t n = insn->line_idx - line_at;
+        ARES_ARRAY_RESERVE(&lines, n + m->to_len / 2);
+        memcpy(lines.buf + lines.len, g_text_by_linenum.buf + line_at,
+               n * sizeof(u32));
+        lines.len += n;
+        line_at = insn->line_idx + m->from_len / 2;
+        insn->line_idx = lines.len;
+        memset(lines.buf + lines.len, 0, m->to_len / 2 * sizeof(u32));
+        lines.len += m->to_len / 2;
+
+        insn->emit_idx = m->to;
+        insn->size = m->to_len;
+    }
+
+    size_t n = s->contents.len - at;
+    ARES_ARRAY_RESERVE(&contents, n);
+    memcpy(contents.buf + contents.len, s->contents.buf + at, n);
+    contents.len += n;
+    n = g_text_by_linenum.len - line_at;
+    ARES_ARRAY_RESERVE(&lines, n);
+    memcpy(lines.buf + lines.len, g_text_by_linenum.buf + line_at,
+           n * sizeof(u32));
+    lines.len += n;
+
+    ARES_ARRAY_FREE(&s->contents);
+    s->contents = contents;
+    s->emit_idx = contents.len;
+    ARES_ARRAY_FREE(&g_text_by_linenum);
+    g_text_by_linenum = lines;
+
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_labels); i++) {
+        LabelData *l = ARES_ARRAY_GET(&g_labels, i);
+        if (l->section == s)
+            l->addr = s->base + relax_map(moves, l->addr - s->base);
+    }
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&s->relocations); i++) {
+        Relocation *r = ARES_ARRAY_GET(&s->relocations, i);
+        r->offset = relax_map(moves, r->offset);
+    }
+}
+
+// Shrinks the instructions that refer to labels now that the fixup pass
+// knows where the labels are: branches and jumps to their compressed forms
+// and la to just its auipc, or its addi to c.addi. That moves the code after
+// them, so it sizes them again until nothing changes. One that stops fitting
+// its shorter form (la's offset can grow) is pinned to its uncompressed one,
+// so sizes only ever change a few times.
+static void asm_relax() {
+    ARES_ARRAY(RelaxMove) moves = ARES_ARRAY_NEW(RelaxMove);
+    g_relaxing = true;
+    g_in_fixup = true;
+
+    for (int pass = 0;; pass++) {
+        bool changed = false;
+        moves.len = 0;
+        g_relax_measure = true;
         for (size_t i = 0; i < ARES_ARRAY_LEN(&g_deferred_insn); i++) {
-            struct DeferredInsn *insn = ARES_ARRAY_GET(&g_deferred_insn, i);
-            g_section = insn->section;
-            g_section->emit_idx = insn->emit_idx;
-            p = &insn->p;
-            err = insn->cb(&insn->p, insn->opcode, insn->opcode_len);
-            if (err) break;
+            DeferredInsn *insn = ARES_ARRAY_GET(&g_deferred_insn, i);
+            if (insn->section != g_text) continue;
+            if (pass == RELAX_MAX_PASSES) insn->pinned = true;
+            u32 size = relax_emit(insn);
+            if (size > insn->size && !insn->pinned) {
+                insn->pinned = true;
+                size = relax_emit(insn);
+            }
+            *ARES_ARRAY_PUSH(&moves) = (RelaxMove){
+                .from = insn->emit_idx, .from_len = insn->size, .to_len = size};
+            changed |= size != insn->size;
         }
+        g_relax_measure = false;
+        if (!changed) break;
+        relax_layout(&moves);
     }
 
+    // the ones outside of .text can refer to labels that moved
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_deferred_insn); i++)
+        relax_emit(ARES_ARRAY_GET(&g_deferred_insn, i));
+    g_relaxing = false;
+    g_relax_compress = false;
+    ARES_ARRAY_FREE(&moves);
+}
+
+export void assemble(const char *txt, size_t s, bool allow_externs) {
+    g_allow_externs = allow_externs;
+    g_in_fixup = false;
+
+    callsan_init();
+    emulator_init();
+
+    g_text = section_alloc();
+    g_data = section_alloc();
+    g_kernel_data = section_alloc();
+    g_kernel_text = section_alloc();
+    sections_init(g_text, g_data, g_kernel_text, g_kernel_data);
+
+    prepare_runtime_sections();
+    prepare_default_syms();
+    g_section = g_text;
+
+    Parser parser = {0};
+    parser.input = txt;
+    parser.size = s;
+    parser.pos = 0;
+    parser.lineidx = 1;
+    Parser *p = &parser;
+    const char *err = assemble_statements(p, p->size);
+    if (!err) err = asm_fixup(p);
     if (err) {
         g_error = err;
         g_error_line = p->startline;
         return;
     }
+    asm_relax();
 
     err = resolve_entry(&g_pc);
     if (err) {
@@ -2520,6 +3445,466 @@ export void assemble(const char *txt, size_t s, bool allow_externs) {
     }
 }
 
+// -- incremental assembly for the editor's linter
+//
+// lint() keeps the chunks of the last source it saw. After an edit it parses
+// again from the chunk before the first changed line, until a chunk starts on
+// an unchanged line in the same section as before; the chunks and labels
+// after that only move. Then it parses again the chunks whose label reference
+// can resolve differently: deferred ones, ones naming a label that was added
+// or removed, and ones that moved relative to their label. If that changes
+// the size of a chunk, everything is parsed again.
+
+typedef struct {
+    Section *text, *data, *kernel_text, *kernel_data, *section;
+    ARES_ARRAY(SectionPtr) sections;
+    ARES_ARRAY(LabelData) labels;
+    ARES_ARRAY(Global) globals;
+    ARES_ARRAY(Extern) externs;
+    ARES_ARRAY(DeferredInsn) deferred;
+    Symbol *symtab;
+    size_t symtab_cap, symtab_len;
+    size_t symtab_labels, symtab_globals, symtab_externs;
+    bool in_fixup, allow_externs;
+} AsmState;
+
+// the linter's assembler globals, swapped in while it runs
+static AsmState g_lint_state;
+static bool g_lint_ready;
+// see prepare_default_syms()
+static size_t g_lint_default_labels;
+// the buffer the last lint() read, its labels point into it
+static char *g_lint_base;
+static size_t g_lint_text_cap;
+static ARES_ARRAY(LintLine) g_lint_old_lines = ARES_ARRAY_NEW(LintLine);
+static ARES_ARRAY(LintChunk) g_lint_chunks = ARES_ARRAY_NEW(LintChunk);
+static ARES_ARRAY(LintChunk) g_lint_old_chunks = ARES_ARRAY_NEW(LintChunk);
+// labels and globals from the first chunk parsed again on
+static ARES_ARRAY(LabelData) g_lint_moved_labels = ARES_ARRAY_NEW(LabelData);
+static ARES_ARRAY(LintLabel) g_lint_moved_info = ARES_ARRAY_NEW(LintLabel);
+static ARES_ARRAY(Global) g_lint_moved_globals = ARES_ARRAY_NEW(Global);
+// hashes of the labels that were added or removed, open addressing
+static u32 *g_lint_names;
+static size_t g_lint_names_cap;
+
+export ARES_ARRAY(Diagnostic) g_lint_diagnostics = ARES_ARRAY_NEW(Diagnostic);
+export u32 g_lint_parsed;
+
+static void asm_state_swap(AsmState *s) {
+    AsmState cur = {.text = g_text,
+                    .data = g_data,
+                    .kernel_text = g_kernel_text,
+                    .kernel_data = g_kernel_data,
+                    .section = g_section,
+                    .sections = g_sections,
+                    .labels = g_labels,
+                    .globals = g_globals,
+                    .externs = g_externs,
+                    .deferred = g_deferred_insn,
+                    .symtab = g_symtab,
+                    .symtab_cap = g_symtab_cap,
+                    .symtab_len = g_symtab_len,
+                    .symtab_labels = g_symtab_labels,
+                    .symtab_globals = g_symtab_globals,
+                    .symtab_externs = g_symtab_externs,
+                    .in_fixup = g_in_fixup,
+                    .allow_externs = g_allow_externs};
+    g_text = s->text;
+    g_data = s->data;
+    g_kernel_text = s->kernel_text;
+    g_kernel_data = s->kernel_data;
+    g_section = s->section;
+    g_sections = s->sections;
+    g_labels = s->labels;
+    g_globals = s->globals;
+    g_externs = s->externs;
+    g_deferred_insn = s->deferred;
+    g_symtab = s->symtab;
+    g_symtab_cap = s->symtab_cap;
+    g_symtab_len = s->symtab_len;
+    g_symtab_labels = s->symtab_labels;
+    g_symtab_globals = s->symtab_globals;
+    g_symtab_externs = s->symtab_externs;
+    g_in_fixup = s->in_fixup;
+    g_allow_externs = s->allow_externs;
+    *s = cur;
+}
+
+static void lint_init() {
+    Section *s = g_lint_sections;
+    sections_init(&s[0], &s[1], &s[2], &s[3]);
+    g_text = &s[0];
+    g_data = &s[1];
+    g_kernel_text = &s[2];
+    g_kernel_data = &s[3];
+    prepare_runtime_sections();
+    prepare_default_syms();
+    g_lint_default_labels = ARES_ARRAY_LEN(&g_labels);
+    for (size_t i = 0; i < g_lint_default_labels; i++)
+        *ARES_ARRAY_PUSH(&g_lint_labels) = (LintLabel){0};
+    g_lint_ready = true;
+}
+
+export char *lint_buffer(size_t len) {
+    if (len <= g_lint_text_cap) return g_lint_text;
+    // the labels are moved off the old text by the next lint()
+    if (g_lint_text != g_lint_base) free(g_lint_text);
+    g_lint_text_cap = len + len / 2 + 64;
+    g_lint_text = malloc(g_lint_text_cap);
+    ARES_CHECK_OOM(g_lint_text);
+    return g_lint_text;
+}
+
+static void lint_rebase() {
+    for (size_t i = g_lint_default_labels; i < ARES_ARRAY_LEN(&g_labels); i++) {
+        LabelData *l = ARES_ARRAY_GET(&g_labels, i);
+        l->txt = g_lint_text + (l->txt - g_lint_base);
+    }
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_globals); i++) {
+        Global *g = ARES_ARRAY_GET(&g_globals, i);
+        g->str = g_lint_text + (g->str - g_lint_base);
+    }
+    free(g_lint_base);
+    g_lint_base = g_lint_text;
+}
+
+static void lint_split(size_t len) {
+    ARES_ARRAY(LintLine) old = g_lint_old_lines;
+    g_lint_old_lines = g_lint_lines;
+    g_lint_lines = old;
+    g_lint_lines.len = 0;
+
+    for (size_t start = 0;;) {
+        size_t end = start;
+        while (end < len && g_lint_text[end] != '\n') end++;
+        *ARES_ARRAY_PUSH(&g_lint_lines) =
+            (LintLine){.hash = symtab_hash(g_lint_text + start, end - start),
+                       .start = start,
+                       .len = end - start};
+        if (end == len) break;
+        start = end + 1;
+    }
+}
+
+static bool lint_line_eq(LintLine *a, LintLine *b) {
+    return a->hash == b->hash && a->len == b->len;
+}
+
+static void lint_names_init(size_t count) {
+    size_t cap = 16;
+    while (cap < count * 2) cap *= 2;
+    if (cap > g_lint_names_cap) {
+        free(g_lint_names);
+        g_lint_names = malloc(cap * sizeof(u32));
+        ARES_CHECK_OOM(g_lint_names);
+        g_lint_names_cap = cap;
+    }
+    memset(g_lint_names, 0, g_lint_names_cap * sizeof(u32));
+}
+
+static bool lint_names_find(u32 hash, bool add) {
+    // 0 is an empty slot
+    hash |= 1;
+    size_t i = hash & (g_lint_names_cap - 1);
+    for (; g_lint_names[i]; i = (i + 1) & (g_lint_names_cap - 1))
+        if (g_lint_names[i] == hash) return true;
+    if (add) g_lint_names[i] = hash;
+    return false;
+}
+
+// parses c from the state it starts with, next gets the state after it
+static void lint_parse(LintChunk *c, LintChunk *next, size_t len) {
+    LintLine *line = ARES_ARRAY_GET(&g_lint_lines, c->line);
+    for (int i = 0; i < LINT_SECS; i++)
+        g_lint_sections[i].emit_idx = c->offs[i];
+    g_section = &g_lint_sections[c->sec];
+    g_in_fixup = false;
+    g_deferred_insn.len = 0;
+    g_lint_chunk = c;
+    c->refs = 0;
+    c->forward = false;
+    if (!g_lint_recheck) c->dup_line = 0;
+    g_lint_unsupported = false;
+
+    Parser parser = {.input = g_lint_text,
+                     .size = len,
+                     .pos = line->start,
+                     .lineidx = c->line + 1,
+                     .startline = c->line + 1,
+                     .startpos = line->start};
+    Parser *p = &parser;
+    const char *err = assemble_statements(p, line->start + line->len);
+
+    *next = (LintChunk){.sec = g_section - g_lint_sections,
+                        .labels = ARES_ARRAY_LEN(&g_labels),
+                        .globals = ARES_ARRAY_LEN(&g_globals)};
+    for (int i = 0; i < LINT_SECS; i++)
+        next->offs[i] = g_lint_sections[i].emit_idx;
+    // the next statement may start on the line the last one ended on
+    if (err || p->pos >= len || p->input[p->pos] == '\n')
+        next->line = p->lineidx;
+    else next->line = p->lineidx - 1;
+
+    if (!err && g_lint_recheck) err = asm_fixup(p);
+    g_in_fixup = false;
+    c->err = err;
+    c->err_line = p->startline;
+    c->err_col = lint_col(p->startline, p->startpos);
+    c->unsupported = g_lint_unsupported;
+}
+
+// whether the label reference of c can resolve differently than when it was
+// parsed, moved is whether c comes after the edit
+static bool lint_stale(LintChunk *c, bool moved, size_t suffix_labels,
+                       const u32 *delta) {
+    if (!c->refs) return false;
+    if (c->refs > 1) return true;
+
+    LintLine *line = ARES_ARRAY_GET(&g_lint_lines, c->line);
+    const char *txt = g_lint_text + line->start + c->ref_off;
+    if (lint_names_find(symtab_hash(txt, c->ref_len), false)) return true;
+    LabelData *l = find_label(txt, c->ref_len);
+    if (!l) return false;
+
+    u32 label_delta = (size_t)(l - g_labels.buf) >= suffix_labels
+                          ? delta[l->section - g_lint_sections]
+                          : 0;
+    return label_delta != (moved ? delta[c->ref_sec] : 0);
+}
+
+// false if a chunk changed size when parsed again
+static bool lint_update(size_t len, bool full) {
+    ARES_ARRAY(LintChunk) *old = &g_lint_old_chunks;
+    LintLine *lines = g_lint_lines.buf, *old_lines = g_lint_old_lines.buf;
+    size_t n = ARES_ARRAY_LEN(&g_lint_lines);
+    size_t m = ARES_ARRAY_LEN(&g_lint_old_lines);
+    full = full || !ARES_ARRAY_LEN(old);
+
+    // unchanged lines at both ends and the chunk before the first changed
+    // one, that chunk may have read into it
+    size_t pre = 0, suf = 0, ci = 0;
+    if (!full) {
+        size_t max = n < m ? n : m;
+        while (pre < max && lint_line_eq(&lines[pre], &old_lines[pre])) pre++;
+        while (suf < max - pre &&
+               lint_line_eq(&lines[n - 1 - suf], &old_lines[m - 1 - suf]))
+            suf++;
+        size_t first = pre ? pre - 1 : 0, hi = ARES_ARRAY_LEN(old) - 1;
+        while (ci < hi) {
+            size_t mid = (ci + hi + 1) / 2;
+            if (old->buf[mid].line <= first) ci = mid;
+            else hi = mid - 1;
+        }
+    }
+
+    LintChunk c = full ? (LintChunk){.labels = g_lint_default_labels}
+                       : old->buf[ci];
+    g_lint_chunks.len = 0;
+    if (ci) {
+        ARES_ARRAY_RESERVE(&g_lint_chunks, ci);
+        memcpy(g_lint_chunks.buf, old->buf, ci * sizeof(LintChunk));
+        g_lint_chunks.len = ci;
+    }
+
+    size_t label0 = c.labels, global0 = c.globals;
+    g_lint_moved_labels.len = 0;
+    g_lint_moved_info.len = 0;
+    g_lint_moved_globals.len = 0;
+    if (!full) {
+        for (size_t i = label0; i < ARES_ARRAY_LEN(&g_labels); i++) {
+            *ARES_ARRAY_PUSH(&g_lint_moved_labels) = g_labels.buf[i];
+            *ARES_ARRAY_PUSH(&g_lint_moved_info) = g_lint_labels.buf[i];
+        }
+        for (size_t i = global0; i < ARES_ARRAY_LEN(&g_globals); i++)
+            *ARES_ARRAY_PUSH(&g_lint_moved_globals) = g_globals.buf[i];
+    }
+    g_labels.len = g_lint_labels.len = label0;
+    g_globals.len = global0;
+    symtab_reset();
+
+    // the edited chunks, until they line up with the old ones
+    u32 dline = n - m;
+    size_t resync = ARES_ARRAY_LEN(old);
+    g_lint_recheck = false;
+    g_lint_later = -1;
+    for (size_t j = ci; c.line < n;) {
+        if (!full && c.line >= n - suf) {
+            u32 old_line = c.line - dline;
+            while (j < ARES_ARRAY_LEN(old) && old->buf[j].line < old_line) j++;
+            if (j < ARES_ARRAY_LEN(old) && old->buf[j].line == old_line &&
+                old->buf[j].sec == c.sec) {
+                resync = j;
+                break;
+            }
+        }
+        LintChunk next;
+        lint_parse(&c, &next, len);
+        *ARES_ARRAY_PUSH(&g_lint_chunks) = c;
+        c = next;
+        g_lint_parsed++;
+    }
+
+    // the rest moves by what the edited chunks grew by
+    size_t region_end = ARES_ARRAY_LEN(&g_lint_chunks);
+    size_t suffix_labels = ARES_ARRAY_LEN(&g_labels);
+    size_t removed = ARES_ARRAY_LEN(&g_lint_moved_labels);
+    u32 delta[LINT_SECS] = {0};
+    if (resync == ARES_ARRAY_LEN(old)) {
+        *ARES_ARRAY_PUSH(&g_lint_chunks) = c;
+    } else {
+        LintChunk *o = &old->buf[resync];
+        for (int i = 0; i < LINT_SECS; i++) delta[i] = c.offs[i] - o->offs[i];
+        ptrdiff_t dbyte = (ptrdiff_t)lines[c.line].start -
+                          (ptrdiff_t)old_lines[o->line].start;
+        removed = o->labels - label0;
+
+        for (size_t k = resync; k < ARES_ARRAY_LEN(old); k++) {
+            LintChunk s = old->buf[k];
+            s.line += dline;
+            for (int i = 0; i < LINT_SECS; i++) s.offs[i] += delta[i];
+            s.labels += c.labels - o->labels;
+            s.globals += c.globals - o->globals;
+            s.err_line += dline;
+            s.dup_line = 0;
+            *ARES_ARRAY_PUSH(&g_lint_chunks) = s;
+        }
+
+        size_t owner = region_end;
+        for (size_t k = removed; k < ARES_ARRAY_LEN(&g_lint_moved_labels);
+             k++) {
+            LabelData l = g_lint_moved_labels.buf[k];
+            LintLabel info = g_lint_moved_info.buf[k];
+            info.line += dline;
+            l.txt += dbyte;
+            l.addr += delta[l.section - g_lint_sections];
+            while (g_lint_chunks.buf[owner + 1].labels <= g_labels.len) owner++;
+            LintChunk *oc = ARES_ARRAY_GET(&g_lint_chunks, owner);
+            if (find_label(l.txt, l.len) && !oc->dup_line) {
+                oc->dup_line = info.line;
+                oc->dup_col = lint_col(info.line, l.txt - g_lint_text);
+            }
+            *ARES_ARRAY_PUSH(&g_labels) = l;
+            *ARES_ARRAY_PUSH(&g_lint_labels) = info;
+        }
+        for (size_t k = o->globals - global0;
+             k < ARES_ARRAY_LEN(&g_lint_moved_globals); k++) {
+            Global g = g_lint_moved_globals.buf[k];
+            g.str += dbyte;
+            *ARES_ARRAY_PUSH(&g_globals) = g;
+        }
+    }
+
+    if (!full) {
+        lint_names_init(removed + suffix_labels - label0);
+        for (size_t k = 0; k < removed; k++)
+            lint_names_find(g_lint_moved_info.buf[k].hash, true);
+        for (size_t k = label0; k < suffix_labels; k++)
+            lint_names_find(g_lint_labels.buf[k].hash, true);
+    }
+
+    // every label is known now
+    g_lint_recheck = true;
+    for (size_t k = 0; k + 1 < ARES_ARRAY_LEN(&g_lint_chunks); k++) {
+        LintChunk *ck = ARES_ARRAY_GET(&g_lint_chunks, k);
+        bool stale = k >= ci && k < region_end
+                         ? ck->forward
+                         : !full && lint_stale(ck, k >= region_end,
+                                               suffix_labels, delta);
+        if (!stale) continue;
+
+        LintChunk next;
+        g_lint_later = ck[1].labels;
+        lint_parse(ck, &next, len);
+        g_lint_parsed++;
+        if (next.sec != ck[1].sec ||
+            memcmp(next.offs, ck[1].offs, sizeof(next.offs))) {
+            g_lint_recheck = false;
+            return false;
+        }
+    }
+    g_lint_recheck = false;
+    return true;
+}
+
+static void lint_diagnose(u32 line, u32 col, const char *msg) {
+    *ARES_ARRAY_PUSH(&g_lint_diagnostics) =
+        (Diagnostic){.line = line, .col = col, .msg = msg};
+}
+
+static void lint_report() {
+    g_lint_diagnostics.len = 0;
+    g_lint_unsupported = false;
+
+    // like resolve_entry(), without entering the kernel
+    u32 pc;
+    const char *err;
+    if (resolve_kernel_start(&pc) && (err = resolve_start(&pc)))
+        lint_diagnose(1, 1, err);
+
+    for (size_t k = 0; k + 1 < ARES_ARRAY_LEN(&g_lint_chunks); k++) {
+        LintChunk *c = ARES_ARRAY_GET(&g_lint_chunks, k);
+        bool dup_first = c->dup_line && (!c->err || c->dup_line < c->err_line);
+        if (dup_first)
+            lint_diagnose(c->dup_line, c->dup_col,
+                          "Multiple definitions for the same label");
+        if (c->err) lint_diagnose(c->err_line, c->err_col, c->err);
+        if (c->dup_line && !dup_first)
+            lint_diagnose(c->dup_line, c->dup_col,
+                          "Multiple definitions for the same label");
+        g_lint_unsupported |= c->err && c->unsupported;
+    }
+}
+
+export bool lint(size_t len) {
+    asm_state_swap(&g_lint_state);
+    g_linting = true;
+    if (!g_lint_ready) lint_init();
+    if (g_lint_base != g_lint_text) lint_rebase();
+    lint_split(len);
+    ARES_ARRAY(LintChunk) old = g_lint_old_chunks;
+    g_lint_old_chunks = g_lint_chunks;
+    g_lint_chunks = old;
+
+    g_lint_parsed = 0;
+    if (!lint_update(len, false)) lint_update(len, true);
+    lint_report();
+
+    g_linting = false;
+    asm_state_swap(&g_lint_state);
+    return !g_lint_unsupported;
+}
+
+void lint_free() {
+    asm_state_swap(&g_lint_state);
+    ARES_ARRAY_FREE(&g_sections);
+    ARES_ARRAY_FREE(&g_labels);
+    ARES_ARRAY_FREE(&g_globals);
+    ARES_ARRAY_FREE(&g_externs);
+    ARES_ARRAY_FREE(&g_deferred_insn);
+    symtab_clear();
+    asm_state_swap(&g_lint_state);
+    g_lint_state = (AsmState){0};
+
+    ARES_ARRAY_FREE(&g_scratch);
+    ARES_ARRAY_FREE(&g_lint_labels);
+    ARES_ARRAY_FREE(&g_lint_lines);
+    ARES_ARRAY_FREE(&g_lint_old_lines);
+    ARES_ARRAY_FREE(&g_lint_chunks);
+    ARES_ARRAY_FREE(&g_lint_old_chunks);
+    ARES_ARRAY_FREE(&g_lint_moved_labels);
+    ARES_ARRAY_FREE(&g_lint_moved_info);
+    ARES_ARRAY_FREE(&g_lint_moved_globals);
+    ARES_ARRAY_FREE(&g_lint_diagnostics);
+    free(g_lint_names);
+    g_lint_names = NULL;
+    g_lint_names_cap = 0;
+    if (g_lint_base != g_lint_text) free(g_lint_base);
+    free(g_lint_text);
+    g_lint_text = g_lint_base = NULL;
+    g_lint_text_cap = 0;
+    g_lint_ready = false;
+}
+
 bool pc_to_label_r(u32 pc, LabelData **ret, u32 *off) {
     LabelData *closest = NULL;
 
@@ -2560,39 +3945,39 @@ void pc_to_label(u32 pc) {
 
 bool resolve_symbol(const char *sym, size_t sym_len, bool global, u32 *addr,
                     Section **sec) {
-    LabelData *ret = NULL;
-    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_labels); i++) {
-        LabelData *l = ARES_ARRAY_GET(&g_labels, i);
-        if (str_eq_2(sym, sym_len, l->txt, l->len)) {
-            ret = l;
-            break;
-        }
+    Symbol *s = symtab_find(sym, sym_len);
+    if (!s || s->label < 0 || (global && s->global < 0)) return false;
+    LabelData *ret = ARES_ARRAY_GET(&g_labels, s->label);
+    *addr = ret->addr;
+    if (sec) {
+        *sec = ret->section;
     }
-    if (ret && global) {
-        for (size_t i = 0; i < ARES_ARRAY_LEN(&g_globals); i++)
-            if (str_eq_2(sym, sym_len, ARES_ARRAY_GET(&g_globals, i)->str,
-                         ARES_ARRAY_GET(&g_globals, i)->len)) {
-                *addr = ret->addr;
-                if (sec) {
-                    *sec = ret->section;
-                }
-                return true;
-            }
-        return false;
-    }
-    if (ret) {
-        *addr = ret->addr;
-        if (sec) {
-            *sec = ret->section;
-        }
-        return true;
-    }
-    return false;
+    return true;
+}
+
+// anonymous pages natively, calloc() in WASM (see wasm.c)
+u8 *zero_pages_alloc(size_t size) {
+#ifdef __wasm__
+    u8 *buf = calloc(size, 1);
+#else
+    u8 *buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (buf == MAP_FAILED) buf = NULL;
+#endif
+    ARES_CHECK_OOM(buf);
+    return buf;
+}
+
+static void zero_pages_free(u8 *buf, size_t size) {
+#ifdef __wasm__
+    free(buf);
+#else
+    if (buf) munmap(buf, size);
+#endif
 }
 
 void prepare_aux_sections() {
-    g_stack = malloc(sizeof(Section));
-    ARES_CHECK_OOM(g_stack);
+    g_stack = section_alloc();
     *g_stack = (Section){.name = "ARES_STACK",
                          .base = STACK_TOP - STACK_LEN,
                          .limit = STACK_TOP,
@@ -2612,8 +3997,7 @@ void prepare_aux_sections() {
     g_regs[2] = STACK_TOP;  // FIXME: now i am diverging from RARS, which
                             // does STACK_TOP - 4
 
-    g_mmio = malloc(sizeof(*g_mmio));
-    ARES_CHECK_OOM(g_mmio);
+    g_mmio = section_alloc();
     *g_mmio = (Section){.name = ".mmio",
                         .base = MMIO_BASE,
                         .limit = MMIO_END,
@@ -2627,8 +4011,7 @@ void prepare_aux_sections() {
                         .super = true,
                         .physical = false};
 
-    g_vga = malloc(sizeof(*g_vga));
-    ARES_CHECK_OOM(g_vga);
+    g_vga = section_alloc();
     *g_vga = (Section){.name = ".vga",
                        .base = VGA_BASE,
                        .limit = VGA_END,
@@ -2639,12 +4022,11 @@ void prepare_aux_sections() {
                        .read = true,
                        .write = true,
                        .execute = false,
-                       .physical = true};
-    g_vga->contents.buf = malloc(g_vga->contents.len);
-    memset(g_vga->contents.buf, 0, g_vga->contents.len);
+                       .physical = true,
+                       .zero_pages = true};
+    g_vga->contents.buf = zero_pages_alloc(g_vga->contents.len);
 
-    g_gif = malloc(sizeof(*g_gif));
-    ARES_CHECK_OOM(g_gif);
+    g_gif = section_alloc();
     *g_gif = (Section){.name = ".gif",
                        .base = GIF_BASE,
                        .limit = GIF_END,
@@ -2655,9 +4037,9 @@ void prepare_aux_sections() {
                        .read = true,
                        .write = true,
                        .execute = false,
-                       .physical = true};
-    g_gif->contents.buf = malloc(g_gif->contents.len);
-    memset(g_gif->contents.buf, 0, g_gif->contents.len);
+                       .physical = true,
+                       .zero_pages = true};
+    g_gif->contents.buf = zero_pages_alloc(g_gif->contents.len);
 
     g_vga_base_addr = g_vga->base;
     g_vga_len = g_vga->contents.len;
@@ -2676,8 +4058,6 @@ void prepare_aux_sections() {
 }
 
 void prepare_runtime_sections() {
-    // TODO: dynamically growing stacks?
-
     *ARES_ARRAY_PUSH(&g_sections) = g_text;
     *ARES_ARRAY_PUSH(&g_sections) = g_data;
     *ARES_ARRAY_PUSH(&g_sections) = g_kernel_text;
@@ -2685,18 +4065,35 @@ void prepare_runtime_sections() {
 }
 
 void free_runtime() {
+    snapshot_free();
+    profile_stop();
+    // before the models, it would enable them again
+    sample_stop();
+    pipeline_stop();
+    cache_stop();
+    bpred_stop();
+    ooo_stop();
+    reuse_stop();
+    latency_stop();
+
     for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
         Section *s = *ARES_ARRAY_GET(&g_sections, i);
-        ARES_ARRAY_FREE(&s->relocations);
-        ARES_ARRAY_FREE(&s->contents);
-        free(s);
+        if (s->zero_pages)
+            zero_pages_free(s->contents.buf, s->contents.len);
+        else if (!s->mapped) ARES_ARRAY_FREE(&s->contents);
     }
 
     ARES_ARRAY_FREE(&g_sections);
     ARES_ARRAY_FREE(&g_text_by_linenum);
     ARES_ARRAY_FREE(&g_labels);
-    ARES_ARRAY_FREE(&g_deferred_insn);
+    g_deferred_insn = ARES_ARRAY_NEW(DeferredInsn);
     ARES_ARRAY_FREE(&g_globals);
     ARES_ARRAY_FREE(&g_externs);
+    symtab_clear();
+    incbin_free();
+    lint_free();
     ARES_ARRAY_FREE(&g_shadow_stack);
+    ARES_ARRAY_FREE(&g_callsan_stack_written_by);
+    // sections, their relocations and the deferred instructions
+    ares_arena_free(&g_runtime_arena);
 }
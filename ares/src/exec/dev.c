@@ -35,7 +35,7 @@ typedef struct {
     u32 devaddr;
 } PACKED RICRegisters;
 
-static Device g_mmio_devices[];
+static Device g_mmio_devices[MMIO_DEVICE_COUNT];
 
 static void ric_send_interrupt(u32 devaddr) {
     RICRegisters *ric = (void *)g_mmio_devices[6].buffer;
@@ -124,7 +124,7 @@ static bool ric_handler(u32 devaddr, u8 *buf, u32 op_size, u32 off, int op) {
     return op == MMIO_OP_READ;
 }
 
-static Device g_mmio_devices[] = {
+static Device g_mmio_devices[MMIO_DEVICE_COUNT] = {
     [0] = {dma_handler, {0}},      // DMA 0
     [1] = {dma_handler, {0}},      // DMA 1
     [2] = {dma_handler, {0}},      // DMA 2
@@ -171,3 +171,15 @@ bool mmio_write(u32 mmio_addr, int size, u32 value) {
 
     return dev->handler(dev_addr, buf, size, off, MMIO_OP_WRITE);
 }
+
+void mmio_save_state(u8 *out) {
+    for (size_t i = 0; i < MMIO_DEVICE_COUNT; i++)
+        memcpy(out + i * MMIO_DEVICE_RSV, g_mmio_devices[i].buffer,
+               MMIO_DEVICE_RSV);
+}
+
+void mmio_load_state(const u8 *in) {
+    for (size_t i = 0; i < MMIO_DEVICE_COUNT; i++)
+        memcpy(g_mmio_devices[i].buffer, in + i * MMIO_DEVICE_RSV,
+               MMIO_DEVICE_RSV);
+}
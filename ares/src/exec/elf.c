@@ -2,10 +2,17 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#ifndef __wasm__
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
+#include "ares/callsan.h"
 #include "ares/core.h"
 #include "ares/emulate.h"
 #include "ares/util.h"
@@ -22,17 +29,13 @@
 #define STRTAB_ISYM 9   // Index of .symtab in strtab
 #define STRTAB_ISEC 17  // Start of section names in strtab
 
-static inline void copy_n(void *dst, const void *src, size_t src_sz,
-                          size_t *off) {
-    memcpy((uint8_t *)dst + *off, src, src_sz);
-    *off += src_sz;
-}
+// granularity of the loader's zero page check
+#define ELF_PAGE 4096
 
-static inline void copy_s(void *dst, const char *src, size_t *off) {
-    size_t len = strlen(src) + 1;
-    memcpy((uint8_t *)dst + *off, src, len);
-    *off += len;
-}
+// the section headers, .symtab and .rela tables are arrays of 4 byte fields
+#define ELF_TABLE_ALIGN 4
+#define ELF_TABLE_ALIGN_UP(off) \
+    (((off) + ELF_TABLE_ALIGN - 1) & ~(size_t)(ELF_TABLE_ALIGN - 1))
 
 bool elf_read(u8 *elf_contents, size_t elf_contents_len, ReadElfResult *out,
               char **error) {
@@ -249,105 +252,183 @@ fail:
     return false;
 }
 
-// Constructs a buffer containing program headers, segments and section headers
-// ORDER;
+// the WASM build only loads executables
+#ifndef __wasm__
+// Where every part of the output goes, computed before anything is written so
+// each part can go straight to its final offset
+// ORDER (exec):
+// - ELF header
 // - Program headers
 // - Segments
 // - Section headers
+// - String table
+// ORDER (obj): same, without program headers, then the symbol table and
+// relocations
 // ORDER OF SECTION HEADERS:
 // - NULL section
-// - Reserved sections
+// - Reserved sections (.strtab, then .symtab in objects)
 // - Segment-related sections (in the same order as the segments)
 // - Relocation sections (in the same order as the segments)
-// ADDITIONAL INFORMATION:
-// This function assumes that section names are the first strings in the strtab.
-// This function also assumes that name_off points to a value > 0.
-// phdrs_start, shdrs_start, name_off are all byte offsets.
-// This functions also assumes that the names of relocation sections follow
-// those of the relative section withing the string table. E.g., .rela.text
-// comes immediately after .text NOTE: This function changes elf.shidx in each
-// physical section in g_sections with len > 0
-static bool make_core(u8 **out, size_t *out_sz, size_t *name_off,
-                      size_t *phdrs_start, size_t *shdrs_start, size_t *phnum,
-                      size_t *shnum, size_t *reloc_idx, size_t *reloc_num,
-                      size_t file_off, size_t rsv_shdrs, size_t symtab_idx,
-                      bool use_phdrs, bool use_shdrs, char **error) {
-    size_t segments_count = 0;
+typedef struct {
+    bool obj;
+    u32 entry;
+    size_t segments;
+    size_t relas;
+    size_t rsv_shdrs;
+    size_t shnum;
+    size_t sym_names;  // start of extern and global names in the strtab
+    size_t strtab_sz;
+    size_t symnum;
+    size_t relanum;
+    size_t phdrs_off;
+    size_t segs_off;
+    size_t shdrs_off;
+    size_t strtab_off;
+    size_t symtab_off;
+    size_t rela_off;
+    size_t size;
+} ElfLayout;
+
+// writes to a buffer sized by the layout, or streams to a file
+typedef struct {
+    u8 *buf;
+    FILE *f;
+    size_t off;
+    bool failed;
+} ElfWriter;
+
+static inline bool elf_has_segment(Section *s) {
+    return s->physical && 0 != s->contents.len;
+}
+
+// NOTE: this sets elf.shidx in each section with a segment and elf.stidx in
+// each extern and global, the writer relies on both
+static bool elf_layout(ElfLayout *l, bool obj, char **error) {
+    *l = (ElfLayout){.obj = obj, .rsv_shdrs = obj ? 2 : 1};
+
+    if (!obj && !resolve_symbol("_start", strlen("_start"), true, &l->entry,
+                                NULL)) {
+        *error = "unresolved reference to `_start`";
+        return false;
+    }
+
     size_t segments_sz = 0;
-    size_t reloc_shdrs_num = 0;
+    l->sym_names = STRTAB_ISEC;
     for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
         Section *s = *ARES_ARRAY_GET(&g_sections, i);
-        if (s->physical && 0 != s->contents.len) {
-            segments_count++;
-            segments_sz += s->contents.len;
-
-            if (0 != s->relocations.len) {
-                reloc_shdrs_num++;
-            }
+        if (!elf_has_segment(s)) {
+            continue;
         }
-    }
 
-    size_t sections_count = 1 + segments_count + rsv_shdrs + reloc_shdrs_num;
-    size_t region_sz = segments_sz;
+        s->elf.shidx = 1 + l->rsv_shdrs + l->segments++;
+        segments_sz += s->contents.len;
+        l->sym_names += strlen(s->name) + 1;
 
-    if (use_phdrs) {
-        region_sz += segments_count * sizeof(ElfProgramHeader);
+        if (0 != s->relocations.len) {
+            l->relas++;
+            l->relanum += s->relocations.len;
+            l->sym_names += strlen(".rela") + strlen(s->name) + 1;
+        }
     }
 
-    if (use_shdrs) {
-        region_sz += sections_count * sizeof(ElfSectionHeader);
+    l->shnum = 1 + l->rsv_shdrs + l->segments + l->relas;
+    l->strtab_sz = l->sym_names;
+    l->symnum = 1;
+
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_externs); i++) {
+        Extern *e = ARES_ARRAY_GET(&g_externs, i);
+        e->elf.stidx = l->symnum++;
+        l->strtab_sz += e->len + 1;
     }
 
-    u8 *region = malloc(region_sz);
-    ARES_CHECK_OOM(region);
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_globals); i++) {
+        Global *g = ARES_ARRAY_GET(&g_globals, i);
+        g->elf.stidx = l->symnum++;
+        l->strtab_sz += g->len + 1;
 
-    size_t phdrs_off = 0;
-    size_t segment_off = 0;
+        // checked here so that nothing is written for a broken object
+        u32 addr;
+        if (obj && !resolve_symbol(g->str, g->len, true, &addr, NULL)) {
+            *error = "symbol is declared global but never defined";
+            return false;
+        }
+    }
 
-    if (use_phdrs) {
-        segment_off += segments_count * sizeof(ElfProgramHeader);
+    size_t off = sizeof(ElfHeader);
+    l->phdrs_off = off;
+    if (!obj) {
+        off += l->segments * sizeof(ElfProgramHeader);
     }
+    l->segs_off = off;
+    off += segments_sz;
+    l->shdrs_off = off = ELF_TABLE_ALIGN_UP(off);
+    off += l->shnum * sizeof(ElfSectionHeader);
+    l->strtab_off = off;
+    off += l->strtab_sz;
+    l->symtab_off = off = ELF_TABLE_ALIGN_UP(off);
+    if (obj) {
+        off += l->symnum * sizeof(ElfSymtabEntry);
+    }
+    l->rela_off = off = ELF_TABLE_ALIGN_UP(off);
+    if (obj) {
+        off += l->relanum * sizeof(ElfRelaEntry);
+    }
+    l->size = off;
+    return true;
+}
 
-    size_t shdrs_off = segment_off + segments_sz;
-    size_t shdrs_i = 0;
+static void elf_put(ElfWriter *w, const void *src, size_t sz) {
+    if (0 == sz) {
+        return;
+    }
 
-    // Create null section
-    if (use_shdrs) {
-        ElfSectionHeader null_s = {0};
-        null_s.type = SHT_NULL;
-        copy_n(region, &null_s, sizeof(null_s), &shdrs_off);
-        shdrs_i++;
+    if (w->buf) {
+        memcpy(w->buf + w->off, src, sz);
+    } else if (!w->failed && fwrite(src, 1, sz, w->f) != sz) {
+        w->failed = true;
     }
+    w->off += sz;
+}
 
-    // Move past reserved sections
-    shdrs_off += rsv_shdrs * sizeof(ElfSectionHeader);
-    shdrs_i += rsv_shdrs;
+static void elf_put_s(ElfWriter *w, const char *str, size_t len) {
+    elf_put(w, str, len);
+    elf_put(w, "", 1);
+}
 
-    size_t reloc_off = shdrs_off + segments_count * sizeof(ElfSectionHeader);
-    size_t reloc_i = 1 + rsv_shdrs + segments_count;
+// zero fills up to off, which elf_layout() aligned
+static void elf_pad(ElfWriter *w, size_t off) {
+    static const u8 zeros[ELF_TABLE_ALIGN] = {0};
+    elf_put(w, zeros, off - w->off);
+}
 
-    // Return already known values
-    if (NULL != reloc_idx) {
-        *reloc_idx = reloc_i;
-    }
-    if (NULL != reloc_num) {
-        *reloc_num = reloc_shdrs_num;
-    }
-    *out = region;
-    *out_sz = region_sz;
-    *phdrs_start = 0;
-    *shdrs_start = segments_sz;
-    if (use_phdrs) {
-        *shdrs_start += segments_count * sizeof(ElfProgramHeader);
-    }
-    *phnum = segments_count;
-    *shnum = sections_count;
+static void write_ehdr(ElfWriter *w, const ElfLayout *l) {
+    ElfHeader e_hdr = {
+        .magic = {0x7F, 'E', 'L', 'F'},  // ELF magic
+        .bits = 1,                       // 32 bits
+        .endianness = 1,                 // little endian
+        .ehdr_ver = 1,                   // ELF header version 1
+        .abi = 0,                        // System V ABI
+        .type = l->obj ? 1 : 2,          // Relocatable or executable
+        .isa = 0xF3,                     // Arch = RISC-V
+        .elf_ver = 1,                    // ELF version 1
+        .entry = l->entry,               // Program entrypoint
+        .phdrs_off = l->obj ? 0 : l->phdrs_off,
+        .phent_num = l->obj ? 0 : l->segments,
+        .phent_sz = l->obj ? 0 : sizeof(ElfProgramHeader),
+        .shdrs_off = l->shdrs_off,
+        .shent_num = l->shnum,
+        .shent_sz = sizeof(ElfSectionHeader),
+        .ehdr_sz = sizeof(ElfHeader),
+        .flags = 0,
+        .shdr_str_idx = 1};
+    elf_put(w, &e_hdr, sizeof(e_hdr));
+}
 
-    // Write program headers, segments, and section headers
-    // RELOCATION HEADERS EXCLUDED
+static void write_phdrs(ElfWriter *w, const ElfLayout *l) {
+    size_t seg_off = l->segs_off;
     for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
         Section *s = *ARES_ARRAY_GET(&g_sections, i);
-        if (!s->physical || 0 == s->contents.len) {
+        if (!elf_has_segment(s)) {
             continue;
         }
 
@@ -365,12 +446,64 @@ static bool make_core(u8 **out, size_t *out_sz, size_t *name_off,
 
         ElfProgramHeader prog_header = {.type = PT_LOAD,
                                         .flags = phdr_flags,
-                                        .off = segment_off + file_off,
+                                        .off = seg_off,
                                         .virt_addr = s->base,
                                         .phys_addr = s->base,
                                         .file_sz = s->contents.len,
                                         .mem_sz = s->contents.len,
                                         .align = s->align};
+        elf_put(w, &prog_header, sizeof(prog_header));
+        seg_off += s->contents.len;
+    }
+}
+
+static void write_segments(ElfWriter *w) {
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
+        Section *s = *ARES_ARRAY_GET(&g_sections, i);
+        if (elf_has_segment(s)) {
+            elf_put(w, s->contents.buf, s->contents.len);
+        }
+    }
+}
+
+static void write_shdrs(ElfWriter *w, const ElfLayout *l) {
+    ElfSectionHeader null_s = {0};
+    null_s.type = SHT_NULL;
+    elf_put(w, &null_s, sizeof(null_s));
+
+    ElfSectionHeader strtab_s = {.name_off = STRTAB_ISTR,
+                                 .type = SHT_STRTAB,
+                                 .flags = 0,
+                                 .off = l->strtab_off,
+                                 .virt_addr = 0,
+                                 .mem_sz = l->strtab_sz,
+                                 .align = 1,
+                                 .link = 0,
+                                 .ent_sz = 0};
+    elf_put(w, &strtab_s, sizeof(strtab_s));
+
+    if (l->obj) {
+        ElfSectionHeader symtab_s = {
+            .name_off = STRTAB_ISYM,
+            .type = SHT_SYMTAB,
+            .flags = SHF_INFO_LINK,
+            .info = 1,
+            .off = l->symtab_off,
+            .virt_addr = 0,
+            .mem_sz = l->symnum * sizeof(ElfSymtabEntry),
+            .align = ELF_TABLE_ALIGN,
+            .link = 1,
+            .ent_sz = sizeof(ElfSymtabEntry)};
+        elf_put(w, &symtab_s, sizeof(symtab_s));
+    }
+
+    size_t name_off = STRTAB_ISEC;
+    size_t seg_off = l->segs_off;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
+        Section *s = *ARES_ARRAY_GET(&g_sections, i);
+        if (!elf_has_segment(s)) {
+            continue;
+        }
 
         // Ugly but avoids UB
         u32 shdr_flags = SHF_ALLOC;
@@ -381,431 +514,284 @@ static bool make_core(u8 **out, size_t *out_sz, size_t *name_off,
             shdr_flags |= SHF_EXECINSTR;
         }
 
-        ElfSectionHeader sec_header = {.name_off = *name_off,
+        ElfSectionHeader sec_header = {.name_off = name_off,
                                        .type = SHT_PROGBITS,
                                        .flags = shdr_flags,
-                                       .off = segment_off + file_off,
+                                       .off = seg_off,
                                        .virt_addr = s->base,
                                        .mem_sz = s->contents.len,
                                        .align = s->align,
                                        .link = 0,
                                        .ent_sz = 0};
+        elf_put(w, &sec_header, sizeof(sec_header));
 
-        if (use_phdrs) {
-            copy_n(region, &prog_header, sizeof(prog_header), &phdrs_off);
+        seg_off += s->contents.len;
+        name_off += strlen(s->name) + 1;
+        if (0 != s->relocations.len) {
+            name_off += strlen(".rela") + strlen(s->name) + 1;
         }
-        copy_n(region, s->contents.buf, s->contents.len, &segment_off);
-        if (use_shdrs) {
-            s->elf.shidx = shdrs_i;
-            *(name_off) += strlen(s->name) + 1;
-            copy_n(region, &sec_header, sizeof(sec_header), &shdrs_off);
+    }
+
+    // .rela.<name> follows <name> in the strtab, executables keep the headers
+    // but not the entries
+    name_off = STRTAB_ISEC;
+    size_t rela_off = l->rela_off;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
+        Section *s = *ARES_ARRAY_GET(&g_sections, i);
+        if (!elf_has_segment(s)) {
+            continue;
         }
 
-        // Write relocation section header
-        if (use_shdrs && 0 != s->relocations.len) {
-            ElfSectionHeader reloc_shdr = {.name_off = *name_off,
-                                           .type = SHT_RELA,
-                                           .flags = SHF_INFO_LINK,
-                                           .info = shdrs_i,
-                                           .off = 0,
-                                           .virt_addr = 0,
-                                           .mem_sz = 0,
-                                           .align = 1,
-                                           .link = symtab_idx,
-                                           .ent_sz = sizeof(ElfRelaEntry)};
-            copy_n(region, &reloc_shdr, sizeof(reloc_shdr), &reloc_off);
-            *(name_off) += strlen(".rela") + strlen(s->name) + 1;
+        name_off += strlen(s->name) + 1;
+        if (0 == s->relocations.len) {
+            continue;
         }
 
-        // Tail update to index to avoid issue with relocation sections
-        shdrs_i++;
-    }
+        size_t rela_sz = s->relocations.len * sizeof(ElfRelaEntry);
+        ElfSectionHeader reloc_shdr = {.name_off = name_off,
+                                       .type = SHT_RELA,
+                                       .flags = SHF_INFO_LINK,
+                                       .info = s->elf.shidx,
+                                       .off = l->obj ? rela_off : 0,
+                                       .virt_addr = 0,
+                                       .mem_sz = l->obj ? rela_sz : 0,
+                                       .align = ELF_TABLE_ALIGN,
+                                       .link = l->obj ? 2 : 0,
+                                       .ent_sz = sizeof(ElfRelaEntry)};
+        elf_put(w, &reloc_shdr, sizeof(reloc_shdr));
 
-    return true;
-fail:
-    free(region);
-    return false;
+        rela_off += rela_sz;
+        name_off += strlen(".rela") + strlen(s->name) + 1;
+    }
 }
 
-// This function makes an ELF string table
 // The string table always starts with:
 // \0.strtab\0.symtab\0
 // Thus, the indices for .startab and .symtab are 1 and 9 respectively
 // Section names start at index 17
-// Then come, in this order, externs and globals (if included)
-static bool make_strtab(char **out, size_t *out_sz, bool inc_externs,
-                        bool inc_globs, char **error) {
-    size_t base_len = strlen(".strtab") + 1 + strlen(".symtab") + 1;
-    size_t strtab_sz = 1 + base_len;
-    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
-        Section *s = *ARES_ARRAY_GET(&g_sections, i);
-        if (s->physical && 0 != s->contents.len) {
-            strtab_sz += strlen(s->name) + 1;
+// Then come, in this order, externs and globals
+static void write_strtab(ElfWriter *w) {
+    elf_put(w, "", 1);
+    elf_put_s(w, ".strtab", strlen(".strtab"));
+    elf_put_s(w, ".symtab", strlen(".symtab"));
 
-            if (0 != s->relocations.len) {
-                strtab_sz += strlen(".rela") + strlen(s->name) + 1;
-            }
-        }
-    }
-    if (inc_externs) {
-        for (size_t i = 0; i < ARES_ARRAY_LEN(&g_externs); i++) {
-            Extern *e = ARES_ARRAY_GET(&g_externs, i);
-            strtab_sz += e->len + 1;
-        }
-    }
-    if (inc_globs) {
-        for (size_t i = 0; i < ARES_ARRAY_LEN(&g_globals); i++) {
-            Global *g = ARES_ARRAY_GET(&g_globals, i);
-            strtab_sz += g->len + 1;
-        }
-    }
-
-    char *strtab = malloc(strtab_sz);
-    ARES_CHECK_OOM(strtab);
-
-    strtab[0] = '\0';
-    size_t strtab_off = 1;
-
-    copy_s(strtab, ".strtab", &strtab_off);
-    copy_s(strtab, ".symtab", &strtab_off);
     for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
         Section *s = *ARES_ARRAY_GET(&g_sections, i);
-        if (s->physical && 0 != s->contents.len) {
-            copy_s(strtab, s->name, &strtab_off);
-
-            if (0 != s->relocations.len) {
-                copy_s(strtab, ".rela", &strtab_off);
-                strtab_off--;
-                copy_s(strtab, s->name, &strtab_off);
-            }
+        if (!elf_has_segment(s)) {
+            continue;
         }
-    }
 
-    if (inc_externs) {
-        for (size_t i = 0; i < ARES_ARRAY_LEN(&g_externs); i++) {
-            Extern *e = ARES_ARRAY_GET(&g_externs, i);
-            copy_n(strtab, e->symbol, e->len, &strtab_off);
-            strtab[strtab_off++] = '\0';
+        elf_put_s(w, s->name, strlen(s->name));
+        if (0 != s->relocations.len) {
+            elf_put(w, ".rela", strlen(".rela"));
+            elf_put_s(w, s->name, strlen(s->name));
         }
     }
 
-    if (inc_globs) {
-        for (size_t i = 0; i < ARES_ARRAY_LEN(&g_globals); i++) {
-            Global *g = ARES_ARRAY_GET(&g_globals, i);
-            copy_n(strtab, g->str, g->len, &strtab_off);
-            strtab[strtab_off++] = '\0';
-        }
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_externs); i++) {
+        Extern *e = ARES_ARRAY_GET(&g_externs, i);
+        elf_put_s(w, e->symbol, e->len);
     }
 
-    *out = strtab;
-    *out_sz = strtab_sz;
-    return true;
-
-fail:
-    free(strtab);
-    return false;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_globals); i++) {
+        Global *g = ARES_ARRAY_GET(&g_globals, i);
+        elf_put_s(w, g->str, g->len);
+    }
 }
 
-static bool make_symtab(u8 **out, size_t *out_sz, size_t *ent_num,
-                        size_t name_off, char **error) {
-    size_t symtab_sz =
-        sizeof(ElfSymtabEntry) *
-        (1 + ARES_ARRAY_LEN(&g_externs) + ARES_ARRAY_LEN(&g_globals));
-    ElfSymtabEntry *symtab = malloc(symtab_sz);
-    ARES_CHECK_OOM(symtab);
-
+static void write_symtab(ElfWriter *w, const ElfLayout *l) {
     ElfSymtabEntry null_e = {0};
     null_e.shent_idx = SHN_UNDEF;
-    symtab[0] = null_e;
+    elf_put(w, &null_e, sizeof(null_e));
 
-    size_t symtab_i = 1;
+    size_t name_off = l->sym_names;
 
-    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_externs); i++, symtab_i++) {
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_externs); i++) {
         Extern *e = ARES_ARRAY_GET(&g_externs, i);
-        ElfSymtabEntry *sym = &symtab[symtab_i];
-        e->elf.stidx = symtab_i;
-        sym->name_off = name_off;
-        sym->shent_idx = SHN_UNDEF;
-        sym->other = 0;
-        sym->size = 0;
-        sym->value = 0;
-        sym->info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+        ElfSymtabEntry sym = {.name_off = name_off,
+                              .value = 0,
+                              .size = 0,
+                              .info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE),
+                              .other = 0,
+                              .shent_idx = SHN_UNDEF};
+        elf_put(w, &sym, sizeof(sym));
         name_off += e->len + 1;
     }
 
-    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_globals); i++, symtab_i++) {
+    // elf_layout() already checked that every global resolves
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_globals); i++) {
         Global *g = ARES_ARRAY_GET(&g_globals, i);
-        ElfSymtabEntry *sym = &symtab[symtab_i];
-        g->elf.stidx = symtab_i;
-        sym->name_off = name_off;
-        sym->other = 0;
-        sym->size = 0;
-
         u32 addr = 0;
         Section *sec = NULL;
-
-        if (!resolve_symbol(g->str, g->len, true, &addr, &sec)) {
-            *error = "symbol is declared global but never defined";
-            goto fail;
-        }
-
-        sym->shent_idx = sec->elf.shidx;
-        sym->value = addr - sec->base;
-        sym->info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+        resolve_symbol(g->str, g->len, true, &addr, &sec);
+
+        ElfSymtabEntry sym = {.name_off = name_off,
+                              .value = addr - sec->base,
+                              .size = 0,
+                              .info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE),
+                              .other = 0,
+                              .shent_idx = sec->elf.shidx};
+        elf_put(w, &sym, sizeof(sym));
         name_off += g->len + 1;
     }
-
-    *out = (u8 *)symtab;
-    *out_sz = symtab_sz;
-
-    *ent_num = symtab_i;
-    return true;
-
-fail:
-    free(symtab);
-    return false;
 }
 
-static bool make_rela(u8 **out, size_t *out_sz, size_t file_off,
-                      ElfSectionHeader *shdrs, size_t reloc_idx,
-                      ElfSymtabEntry *symtab, char **error) {
-    size_t rela_count = 0;
-    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
-        Section *s = *ARES_ARRAY_GET(&g_sections, i);
-        rela_count += s->relocations.len;
-    }
-
-    ElfRelaEntry *relas = malloc(sizeof(ElfRelaEntry) * rela_count);
-    ARES_CHECK_OOM(relas);
-
-    // NOTE: this works because it assumes that section headers have been palced
-    // by the make_core function. The make_core function places section headers
-    // in the order they appear in the g_sections array if they contain data.
-    // The same applies to .rela sections that appear in section headers
-    // starting at index reloc_idx and are placed in the same order (excluding
-    // sections that do not require relocations)
-    size_t rel_i = 0;
+static void write_rela(ElfWriter *w) {
     for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
         Section *s = *ARES_ARRAY_GET(&g_sections, i);
-        if (!s->physical || 0 == s->contents.len || 0 == s->relocations.len) {
+        if (!elf_has_segment(s)) {
             continue;
         }
 
-        ElfSectionHeader *rela_shdr = &shdrs[reloc_idx];
-        rela_shdr->off = file_off + rel_i * sizeof(ElfRelaEntry);
-        rela_shdr->mem_sz = 0;
-
-        for (size_t j = 0; j < s->relocations.len; j++, rel_i++) {
+        for (size_t j = 0; j < s->relocations.len; j++) {
             Relocation *r = &s->relocations.buf[j];
-            ElfRelaEntry *rela = &relas[rel_i];
-
-            rela->offset = r->offset;
-            rela->addend = r->addend;
-            rela->info = ELF32_R_INFO(r->symbol->elf.stidx, r->type);
-            rela_shdr->mem_sz += sizeof(ElfRelaEntry);
+            ElfRelaEntry rela = {
+                .offset = r->offset,
+                .info = ELF32_R_INFO(r->symbol->elf.stidx, r->type),
+                .addend = r->addend};
+            elf_put(w, &rela, sizeof(rela));
         }
-        reloc_idx++;
     }
-
-    *out = (u8 *)relas;
-    *out_sz = rela_count * sizeof(ElfRelaEntry);
-    return true;
-
-fail:
-    free(relas);
-    return false;
 }
 
-bool elf_emit_exec(void **out, size_t *len, char **error) {
-    char *strtab = NULL;
-    u8 *core = NULL;
-    u8 *elf_contents = NULL;
-    size_t strtab_sz = 0;
-    size_t core_sz = 0;
-    size_t name_off = STRTAB_ISEC;
-    size_t phdrs_start = 0;
-    size_t shdrs_start = 0;
-    size_t phnum = 0;
-    size_t shnum = 0;
+static void elf_write(ElfWriter *w, const ElfLayout *l) {
+    write_ehdr(w, l);
+    if (!l->obj) {
+        write_phdrs(w, l);
+    }
+    write_segments(w);
+    elf_pad(w, l->shdrs_off);
+    write_shdrs(w, l);
+    write_strtab(w);
+    if (l->obj) {
+        elf_pad(w, l->symtab_off);
+        write_symtab(w, l);
+        elf_pad(w, l->rela_off);
+        write_rela(w);
+    }
+}
 
-    u32 entrypoint;
-    if (!resolve_symbol("_start", strlen("_start"), true, &entrypoint, NULL)) {
-        *error = "unresolved reference to `_start`";
+static bool elf_emit(bool obj, void **out, size_t *len, char **error) {
+    ElfLayout l;
+    if (!elf_layout(&l, obj, error)) {
         return false;
     }
 
-    ARES_CHECK_CALL(make_strtab(&strtab, &strtab_sz, true, true, error),
-                      fail);
-    ARES_CHECK_CALL(make_core(&core, &core_sz, &name_off, &phdrs_start,
-                                &shdrs_start, &phnum, &shnum, NULL, NULL,
-                                sizeof(ElfHeader), 1, 0, true, true, error),
-                      fail);
+    ElfWriter w = {.buf = malloc(l.size)};
+    ARES_CHECK_OOM(w.buf);
+    elf_write(&w, &l);
 
-    ElfHeader e_hdr = {
-        .magic = {0x7F, 'E', 'L', 'F'},  // ELF magic
-        .bits = 1,                       // 32 bits
-        .endianness = 1,                 // little endian
-        .ehdr_ver = 1,                   // ELF header version 1
-        .abi = 0,                        // System V ABI
-        .type = 2,                       // Executable
-        .isa = 0xF3,                     // Arch = RISC-V
-        .elf_ver = 1,                    // ELF version 1
-        .entry = entrypoint,             // Program entrypoint
-        .phdrs_off = sizeof(ElfHeader) +
-                     phdrs_start,  // Start offset of program header tabe
-        .phent_num = phnum,        // 2 program headers
-        .phent_sz = sizeof(
-            ElfProgramHeader),  // Size of each program header table entry
-        .shdrs_off = sizeof(ElfHeader) +
-                     shdrs_start,  // Start offset of section header table
-        .shent_num = shnum,        // 2 sections (.text, .data)
-        .shent_sz = sizeof(ElfSectionHeader),  // Size of each section header
-        .ehdr_sz = sizeof(ElfHeader),          // Size of the ELF ehader
-        .flags = 0,                            // Flags
-        .shdr_str_idx = 1};
+    *out = w.buf;
+    *len = w.off;
+    return true;
+}
+
+static bool elf_emit_file(bool obj, const char *path, char **error) {
+    ElfLayout l;
+    if (!elf_layout(&l, obj, error)) {
+        return false;
+    }
 
-    ElfSectionHeader *shdrs = (ElfSectionHeader *)(core + shdrs_start);
-    shdrs[1] = (ElfSectionHeader){.name_off = 1,
-                                  .type = SHT_STRTAB,
-                                  .flags = 0,
-                                  .off = sizeof(ElfHeader) + core_sz,
-                                  .virt_addr = 0,
-                                  .mem_sz = strtab_sz,
-                                  .align = 1,
-                                  .link = 0,
-                                  .ent_sz = 0};
-
-    elf_contents = malloc(sizeof(ElfHeader) + core_sz + strtab_sz);
-    ARES_CHECK_OOM(elf_contents);
-    size_t elf_off = 0;
-
-    copy_n(elf_contents, &e_hdr, sizeof(e_hdr), &elf_off);
-    copy_n(elf_contents, core, core_sz, &elf_off);
-    copy_n(elf_contents, strtab, strtab_sz, &elf_off);
-    *out = elf_contents;
-    *len = elf_off;
-
-    free(core);
-    free(strtab);
+    ElfWriter w = {.f = fopen(path, "wb")};
+    if (!w.f) {
+        *error = "could not open output file";
+        return false;
+    }
+
+    elf_write(&w, &l);
+    if (0 != fclose(w.f) || w.failed) {
+        *error = "could not write output file";
+        return false;
+    }
     return true;
+}
 
-fail:
-    free(strtab);
-    free(core);
-    free(elf_contents);
-    return false;
+bool elf_emit_exec(void **out, size_t *len, char **error) {
+    return elf_emit(false, out, len, error);
 }
 
 bool elf_emit_obj(void **out, size_t *len, char **error) {
-    char *strtab = NULL;
-    u8 *core = NULL;
-    u8 *symtab = NULL;
-    u8 *relas = NULL;
-    u8 *elf_contents = NULL;
-
-    size_t strtab_sz = 0;
-    size_t core_sz = 0;
-    size_t name_off = STRTAB_ISEC;
-    size_t phdrs_start = 0;
-    size_t shdrs_start = 0;
-    size_t phnum = 0;
-    size_t shnum = 0;
-    size_t reloc_idx = 0;
-    size_t reloc_num = 0;
-    size_t symtab_sz = 0;
-    size_t symtab_entnum = 0;
-    size_t relas_sz = 0;
-
-    ARES_CHECK_CALL(make_strtab(&strtab, &strtab_sz, true, true, error),
-                      fail);
-    ARES_CHECK_CALL(
-        make_core(&core, &core_sz, &name_off, &phdrs_start, &shdrs_start,
-                  &phnum, &shnum, &reloc_idx, &reloc_num, sizeof(ElfHeader), 2,
-                  2, false, true, error),
-        fail);
-    ARES_CHECK_CALL(
-        make_symtab(&symtab, &symtab_sz, &symtab_entnum, name_off, error),
-        fail);
-
-    ElfSectionHeader *shdrs = (ElfSectionHeader *)(core + shdrs_start);
-    ARES_CHECK_CALL(
-        make_rela(&relas, &relas_sz,
-                  sizeof(ElfHeader) + core_sz + strtab_sz + symtab_sz, shdrs,
-                  reloc_idx, (ElfSymtabEntry *)symtab, error),
-        fail);
+    return elf_emit(true, out, len, error);
+}
 
-    ElfHeader e_hdr = {
-        .magic = {0x7F, 'E', 'L', 'F'},  // ELF magic
-        .bits = 1,                       // 32 bits
-        .endianness = 1,                 // little endian
-        .ehdr_ver = 1,                   // ELF header version 1
-        .abi = 0,                        // System V ABI
-        .type = 1,                       // Executable
-        .isa = 0xF3,                     // Arch = RISC-V
-        .elf_ver = 1,                    // ELF version 1
-        .entry = 0,                      // Program entrypoint
-        .phdrs_off = 0,                  // Start offset of program header tabe
-        .phent_num = 0,                  // 2 program headers
-        .phent_sz = 0,  // Size of each program header table entry
-        .shdrs_off = sizeof(ElfHeader) +
-                     shdrs_start,  // Start offset of section header table
-        .shent_num = shnum,        // 2 sections (.text, .data)
-        .shent_sz = sizeof(ElfSectionHeader),  // Size of each section header
-        .ehdr_sz = sizeof(ElfHeader),          // Size of the ELF ehader
-        .flags = 0,                            // Flags
-        .shdr_str_idx = 1};
+bool elf_write_exec(const char *path, char **error) {
+    return elf_emit_file(false, path, error);
+}
 
-    shdrs[1] = (ElfSectionHeader){.name_off = STRTAB_ISTR,
-                                  .type = SHT_STRTAB,
-                                  .flags = 0,
-                                  .off = sizeof(ElfHeader) + core_sz,
-                                  .virt_addr = 0,
-                                  .mem_sz = strtab_sz,
-                                  .align = 1,
-                                  .link = 0,
-                                  .ent_sz = 0};
-    shdrs[2] =
-        (ElfSectionHeader){.name_off = STRTAB_ISYM,
-                           .type = SHT_SYMTAB,
-                           .flags = SHF_INFO_LINK,
-                           .info = 1,
-                           .off = sizeof(ElfHeader) + core_sz + strtab_sz,
-                           .virt_addr = 0,
-                           .mem_sz = symtab_sz,
-                           .align = 1,
-                           .link = 1,
-                           .ent_sz = sizeof(ElfSymtabEntry)};
-
-    elf_contents =
-        malloc(sizeof(ElfHeader) + core_sz + strtab_sz + symtab_sz + relas_sz);
-    ARES_CHECK_OOM(elf_contents);
-    size_t elf_off = 0;
-
-    copy_n(elf_contents, &e_hdr, sizeof(e_hdr), &elf_off);
-    copy_n(elf_contents, core, core_sz, &elf_off);
-    copy_n(elf_contents, strtab, strtab_sz, &elf_off);
-    copy_n(elf_contents, symtab, symtab_sz, &elf_off);
-    copy_n(elf_contents, relas, relas_sz, &elf_off);
-
-    *out = elf_contents;
-    *len = elf_off;
-
-    free(core);
-    free(strtab);
-    free(symtab);
-    free(relas);
-    return true;
+bool elf_write_obj(const char *path, char **error) {
+    return elf_emit_file(true, path, error);
+}
+#endif
 
-fail:
-    free(strtab);
-    free(core);
-    free(symtab);
-    free(elf_contents);
-    free(relas);
-    return false;
+static bool elf_range_ok(size_t off, size_t sz, size_t file_sz) {
+    return off <= file_sz && sz <= file_sz - off;
+}
+
+static bool elf_ranges_overlap(u64 lo, u64 hi, u64 other_lo, u64 other_hi) {
+    return lo < other_hi && other_lo < hi;
+}
+
+static bool elf_is_zero(const u8 *buf, size_t len) {
+    return 0 == buf[0] && 0 == memcmp(buf, buf + 1, len - 1);
+}
+
+// names segments after the allocated section that starts with them, if the
+// section headers can be trusted
+static const char *elf_segment_name(u8 *elf_contents, size_t elf_len,
+                                    ElfProgramHeader *phdr) {
+    ElfHeader *e_header = (ElfHeader *)elf_contents;
+    size_t shdrs_sz = (size_t)e_header->shent_num * sizeof(ElfSectionHeader);
+    if (e_header->shent_sz != sizeof(ElfSectionHeader) ||
+        e_header->shdr_str_idx >= e_header->shent_num ||
+        !elf_range_ok(e_header->shdrs_off, shdrs_sz, elf_len)) {
+        return "LOAD";
+    }
+
+    ElfSectionHeader *shdrs =
+        (ElfSectionHeader *)(elf_contents + e_header->shdrs_off);
+    ElfSectionHeader *str_sh = &shdrs[e_header->shdr_str_idx];
+    const char *str_tab = (const char *)(elf_contents + str_sh->off);
+    if (0 == str_sh->mem_sz ||
+        !elf_range_ok(str_sh->off, str_sh->mem_sz, elf_len) ||
+        0 != str_tab[str_sh->mem_sz - 1]) {
+        return "LOAD";
+    }
+
+    for (u32 i = 0; i < e_header->shent_num; i++) {
+        ElfSectionHeader *s_hdr = &shdrs[i];
+        if ((SHF_ALLOC & s_hdr->flags) && s_hdr->virt_addr == phdr->virt_addr &&
+            s_hdr->name_off < str_sh->mem_sz) {
+            return str_tab + s_hdr->name_off;
+        }
+    }
+    return "LOAD";
 }
 
-bool elf_load(u8 *elf_contents, size_t elf_len, char **error) {
+static void elf_bind_section(Section *s) {
+    switch (s->base) {
+        case TEXT_BASE:
+            g_text = s;
+            break;
+        case DATA_BASE:
+            g_data = s;
+            break;
+        case KERNEL_TEXT_BASE:
+            g_kernel_text = s;
+            break;
+        case KERNEL_DATA_BASE:
+            g_kernel_data = s;
+            break;
+    }
+}
+
+// the emulator expects these even if the executable has nothing there
+static Section *elf_empty_section(const char *name, u32 base) {
+    Section *s = section_alloc();
+    *s = (Section){.name = name, .base = base, .limit = base, .read = true};
+    return s;
+}
+
+export bool elf_load(u8 *elf_contents, size_t elf_len, char **error) {
     if (!elf_contents) {
         *error = "null buffer";
         return false;
@@ -839,59 +825,180 @@ bool elf_load(u8 *elf_contents, size_t elf_len, char **error) {
         return false;
     }
 
+    size_t phdrs_sz = (size_t)e_header->phent_num * sizeof(ElfProgramHeader);
+    if ((0 != e_header->phent_num &&
+         e_header->phent_sz != sizeof(ElfProgramHeader)) ||
+        !elf_range_ok(e_header->phdrs_off, phdrs_sz, elf_len)) {
+        *error = "program headers offset exceeds buffer size";
+        return false;
+    }
+
     ElfProgramHeader *phdrs =
         (ElfProgramHeader *)(elf_contents + e_header->phdrs_off);
-    ElfSectionHeader *shdrs =
-        (ElfSectionHeader *)(elf_contents + e_header->shdrs_off);
 
-    ElfSectionHeader *str_tab_shdr = &shdrs[e_header->shdr_str_idx];
-    char *str_tab = (char *)(elf_contents + str_tab_shdr->off);
-    u32 str_tab_len = str_tab_shdr->mem_sz;
+    for (u32 i = 0; i < e_header->phent_num; i++) {
+        ElfProgramHeader *phdr = &phdrs[i];
+        if (PT_LOAD != phdr->type) {
+            continue;
+        }
 
-    for (u32 i = 0; i < e_header->shent_num; i++) {
-        ElfSectionHeader *s_hdr = &shdrs[i];
-        if (!(SHF_ALLOC & s_hdr->flags)) {
+        if (!elf_range_ok(phdr->off, phdr->file_sz, elf_len)) {
+            *error = "segment offset exceeds buffer size";
+            return false;
+        }
+
+        if (phdr->file_sz > phdr->mem_sz ||
+            (u64)phdr->virt_addr + phdr->mem_sz > (u64)UINT32_MAX + 1) {
+            *error = "segment does not fit in memory";
+            return false;
+        }
+    }
+
+    callsan_init();
+    emulator_init();
+
+    // the stack and the devices are already there, segments that land in
+    // them (like .vga and .gif in ares' own executables) are copied in, and
+    // everything else has to stay clear of them
+    for (u32 i = 0; i < e_header->phent_num; i++) {
+        ElfProgramHeader *phdr = &phdrs[i];
+        if (PT_LOAD != phdr->type || 0 == phdr->mem_sz) {
             continue;
         }
 
-        Section *s = calloc(1, sizeof(Section));
-        ARES_CHECK_OOM(s);
-        s->read = true;
-        s->align = s_hdr->align;
-        s->base = s_hdr->virt_addr;
-        s->contents.cap = s->contents.len = s_hdr->mem_sz;
-        s->contents.buf = malloc(s->contents.len);
-        ARES_CHECK_OOM(s->contents.buf);
-        memcpy(s->contents.buf, elf_contents + s_hdr->off, s->contents.len);
-        s->limit = s->base + s->contents.len;
-
-        if (s_hdr->name_off >= str_tab_len) {
-            *error = "section header name offset out of range";
-            free(s);
-            goto fail;
+        u64 lo = phdr->virt_addr, hi = lo + phdr->mem_sz;
+        // nor be in the way of the stack growing, or of its guard page
+        u64 stack_end = STACK_TOP - g_stack_limit - STACK_PAGE;
+        if (elf_ranges_overlap(lo, hi, stack_end, g_stack->base)) {
+            *error = "segment overlaps emulator memory";
+            return false;
+        }
+        for (size_t j = 0; j < ARES_ARRAY_LEN(&g_sections); j++) {
+            Section *sec = *ARES_ARRAY_GET(&g_sections, j);
+            bool inside =
+                lo >= sec->base && hi <= (u64)sec->base + sec->contents.len;
+            if (elf_ranges_overlap(lo, hi, sec->base, sec->limit) && !inside) {
+                *error = "segment overlaps emulator memory";
+                return false;
+            }
         }
 
-        s->name = str_tab + s_hdr->name_off;
+        // the segments themselves each become a section of their own
+        for (u32 j = 0; j < i; j++) {
+            ElfProgramHeader *prev = &phdrs[j];
+            if (PT_LOAD == prev->type &&
+                elf_ranges_overlap(lo, hi, prev->virt_addr,
+                                   (u64)prev->virt_addr + prev->mem_sz)) {
+                *error = "segments overlap";
+                return false;
+            }
+        }
+    }
+
+    g_text = g_data = g_kernel_text = g_kernel_data = NULL;
+
+    for (u32 i = 0; i < e_header->phent_num; i++) {
+        ElfProgramHeader *phdr = &phdrs[i];
+        if (PT_LOAD != phdr->type || 0 == phdr->mem_sz) {
+            continue;
+        }
 
-        if (SHF_WRITE & s_hdr->flags) {
-            s->write = true;
+        u8 *file = elf_contents + phdr->off;
+        Section *dev = emulator_get_section(phdr->virt_addr);
+        if (dev) {
+            // device memory starts zeroed, so all-zero pages aren't touched
+            u8 *dst = dev->contents.buf + (phdr->virt_addr - dev->base);
+            for (size_t off = 0; off < phdr->file_sz; off += ELF_PAGE) {
+                size_t n = phdr->file_sz - off;
+                if (n > ELF_PAGE) {
+                    n = ELF_PAGE;
+                }
+                if (!elf_is_zero(file + off, n)) {
+                    memcpy(dst + off, file + off, n);
+                }
+            }
+            continue;
         }
 
-        if (SHF_EXECINSTR & s_hdr->flags) {
-            s->execute = true;
+        Section *s = section_alloc();
+        s->name = elf_segment_name(elf_contents, elf_len, phdr);
+        s->base = phdr->virt_addr;
+        s->limit = phdr->virt_addr + phdr->mem_sz;
+        s->align = phdr->align;
+        s->read = 0b100 & phdr->flags;
+        s->write = 0b010 & phdr->flags;
+        s->execute = 0b001 & phdr->flags;
+        s->physical = true;
+        s->contents.len = s->contents.cap = phdr->mem_sz;
+        s->emit_idx = phdr->mem_sz;
+
+        if (phdr->file_sz == phdr->mem_sz) {
+            s->contents.buf = file;
+            s->mapped = true;
+        } else {
+            // .bss, only the part that's in the file is copied
+            s->contents.buf = zero_pages_alloc(phdr->mem_sz);
+            s->zero_pages = true;
+            memcpy(s->contents.buf, file, phdr->file_sz);
         }
 
         *ARES_ARRAY_PUSH(&g_sections) = s;
+        elf_bind_section(s);
+    }
+
+    if (!g_text) {
+        g_text = elf_empty_section(".text", TEXT_BASE);
+    }
+    if (!g_data) {
+        g_data = elf_empty_section(".data", DATA_BASE);
+    }
+    if (!g_kernel_text) {
+        g_kernel_text = elf_empty_section(".kernel_text", KERNEL_TEXT_BASE);
+    }
+    if (!g_kernel_data) {
+        g_kernel_data = elf_empty_section(".kernel_data", KERNEL_DATA_BASE);
     }
 
-    emulator_init();
     g_pc = e_header->entry;
     return true;
+}
 
-fail:
-    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
-        free(*ARES_ARRAY_GET(&g_sections, i));
+#ifndef __wasm__
+// The mapping is private and writable, so segments run straight from the
+// page cache and only the pages the guest stores to are copied. Sections
+// keep pointing into it until the process exits.
+bool elf_load_file(const char *path, char **error) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *error = "could not open input file";
+        return false;
     }
-    ARES_ARRAY_FREE(&g_sections);
-    return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        *error = "could not stat input file";
+        return false;
+    }
+
+    size_t sz = st.st_size;
+    if (sz < sizeof(ElfHeader)) {
+        close(fd);
+        *error = "corrupt or invalid elf header";
+        return false;
+    }
+
+    u8 *map = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        *error = "could not map input file";
+        return false;
+    }
+
+    if (!elf_load(map, sz, error)) {
+        munmap(map, sz);
+        return false;
+    }
+    return true;
 }
+#endif
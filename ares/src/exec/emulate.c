@@ -1,8 +1,17 @@
 #include "ares/emulate.h"
 
+#include "ares/bpred.h"
+#include "ares/cache.h"
 #include "ares/callsan.h"
 #include "ares/core.h"
 #include "ares/dev.h"
+#include "ares/latency.h"
+#include "ares/ooo.h"
+#include "ares/pipeline.h"
+#include "ares/profile.h"
+#include "ares/reuse.h"
+#include "ares/sample.h"
+#include "ares/snapshot.h"
 
 export u32 g_regs[32];
 export u32 g_csr[4096];
@@ -10,11 +19,28 @@ export u32 g_pc;
 
 export u32 g_mem_written_len;
 export u32 g_mem_written_addr;
+export u32 g_mem_read_len;
+export u32 g_mem_read_addr;
 export u32 g_reg_written;
+export u32 g_fetch_pc;
+export u32 g_inst;
+export u32 g_inst_len;
+export bool g_trap_taken;
+export u32 g_trap_cause;
 
 export bool g_exited;
 export int g_exit_code;
 
+export u32 g_stack_limit = STACK_LIMIT;
+
+export u64 g_cycle;
+export u64 g_instret;
+export u64 g_hpm_counters[HPM_EVENT_COUNT];
+// time CSR epoch, set by emulator_init()
+static u64 g_time_base;
+// a CSR write to mcycle/minstret replaces this instruction's increment
+static bool g_counters_written;
+
 extern u32 g_runtime_error_params[2];
 extern Error g_runtime_error_type;
 extern Section *g_gif;
@@ -103,9 +129,55 @@ u8 *emulator_get_addr(u32 addr, int size, Section **out_sec) {
     return NULL;
 }
 
-u32 LOAD(u32 addr, int size, bool *err) {
+// maps the stack down to addr. It at least doubles, so a deep recursion
+// only copies the stack O(log n) times
+static bool stack_grow(u32 addr) {
+    if (!g_stack || addr >= g_stack->base || addr < STACK_TOP - g_stack_limit)
+        return false;
+
+    u32 len = ARES_ARRAY_LEN(&g_stack->contents);
+    u32 new_len = STACK_TOP - (addr & ~(STACK_PAGE - 1));
+    if (new_len < len * 2) new_len = len * 2;
+    if (new_len > g_stack_limit) new_len = g_stack_limit;
+    u32 added = new_len - len;
+
+    // never over something else that's mapped below it
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
+        Section *sec = *ARES_ARRAY_GET(&g_sections, i);
+        if (sec != g_stack && sec->base < g_stack->base &&
+            sec->limit > g_stack->base - added)
+            return false;
+    }
+
+    u8 *buf = malloc(new_len);
+    ARES_CHECK_OOM(buf);
+    // fill all the memory with random uninitialized values
+    memset(buf, 0xAB, added);
+    memcpy(buf + added, g_stack->contents.buf, len);
+    if (!g_stack->mapped) free(g_stack->contents.buf);
+    g_stack->mapped = false;
+    g_stack->contents.buf = buf;
+    g_stack->contents.len = g_stack->contents.cap = new_len;
+    g_stack->emit_idx = new_len;
+    g_stack->base -= added;
+
+    callsan_grow_stack(new_len / 4);
+    if (g_stack->snapshot.pages) snapshot_grow_front(g_stack, added);
+    return true;
+}
+
+bool emulator_stack_overflow(u32 addr) {
+    u32 end = STACK_TOP - g_stack_limit;
+    return addr < end && addr >= end - STACK_PAGE;
+}
+
+// grow is false for accesses that don't come from the guest, so they only
+// see the stack it has mapped so far
+static inline u32 mem_load(u32 addr, int size, bool grow, bool *err) {
     Section *mem_sec;
     u8 *mem = emulator_get_addr(addr, size, &mem_sec);
+    if (!mem_sec && grow && stack_grow(addr))
+        mem = emulator_get_addr(addr, size, &mem_sec);
 
     if (!mem_sec || !mem_sec->read ||
         (mem_sec->super && g_privilege_level == PRIV_USER)) {
@@ -138,12 +210,15 @@ u32 LOAD(u32 addr, int size, bool *err) {
     return ret;
 }
 
-void STORE(u32 addr, u32 val, int size, bool *err) {
+static inline void mem_store(u32 addr, u32 val, int size, bool grow,
+                             bool *err) {
     g_mem_written_len = size;
     g_mem_written_addr = addr;
 
     Section *mem_sec;
     u8 *mem = emulator_get_addr(addr, size, &mem_sec);
+    if (!mem_sec && grow && stack_grow(addr))
+        mem = emulator_get_addr(addr, size, &mem_sec);
 
     if (!mem_sec || !mem_sec->write ||
         (mem_sec->super && g_privilege_level == PRIV_USER)) {
@@ -159,6 +234,9 @@ void STORE(u32 addr, u32 val, int size, bool *err) {
         return;
     }
 
+    if (mem_sec->snapshot.pages)
+        snapshot_cow(mem_sec, addr - mem_sec->base, size);
+
     if (size == 1) {
         mem[0] = val;
     } else if (size == 2) {
@@ -173,6 +251,14 @@ void STORE(u32 addr, u32 val, int size, bool *err) {
     *err = false;
 }
 
+u32 LOAD(u32 addr, int size, bool *err) {
+    return mem_load(addr, size, true, err);
+}
+
+void STORE(u32 addr, u32 val, int size, bool *err) {
+    mem_store(addr, val, size, true, err);
+}
+
 #define GIF_STRIP_SYSCALL 100
 
 static bool gif_strip_header(u32 *body_ptr, u32 *body_len) {
@@ -336,7 +422,41 @@ void do_sret() {
 #define SSTATUS_MASK (STATUS_SIE|STATUS_SPIE|STATUS_SPP|STATUS_FS_MASK)
 #define SUPERVISOR_INT_MASK ((1<<1)|(1<<5)|(1<<9))
 
+// cycle..hpmcounter31(h) and mcycle..mhpmcounter31(h)
+static inline bool is_counter_csr(u32 csr) {
+    u32 base = csr & ~(CSR_COUNTER_HIGH | 0x1Fu);
+    return base == CSR_CYCLE || base == CSR_MCYCLE;
+}
+
+// NULL for time and for the counters without an event
+static u64 *counter_csr(u32 csr) {
+    u32 idx = csr & 0x1F;
+    if (idx == CSR_CYCLE - CSR_CYCLE) return &g_cycle;
+    if (idx == CSR_INSTRET - CSR_CYCLE) return &g_instret;
+    idx -= CSR_HPMCOUNTER3 - CSR_CYCLE;
+    if (idx < HPM_EVENT_COUNT) return &g_hpm_counters[idx];
+    return NULL;
+}
+
+static u32 rdcounter(u32 csr) {
+    u64 val = 0;
+    if ((csr & ~CSR_COUNTER_HIGH) == CSR_TIME) val = gettime64() - g_time_base;
+    else if (counter_csr(csr)) val = *counter_csr(csr);
+    return csr & CSR_COUNTER_HIGH ? val >> 32 : val;
+}
+
+static void wrcounter(u32 csr, u32 val) {
+    u64 *counter = counter_csr(csr);
+    // the user counters are read-only views
+    if ((csr & ~(CSR_COUNTER_HIGH | 0x1Fu)) != CSR_MCYCLE || !counter) return;
+    if (csr & CSR_COUNTER_HIGH)
+        *counter = (*counter & 0xFFFFFFFFu) | (u64)val << 32;
+    else *counter = (*counter & ~(u64)0xFFFFFFFFu) | val;
+    g_counters_written = true;
+}
+
 u32 rdcsr(u32 csr) {
+    if (is_counter_csr(csr)) return rdcounter(csr);
     u32 mask = -1u;
     if (csr == _CSR_SSTATUS) csr = CSR_MSTATUS, mask = SSTATUS_MASK;
     else if (csr == _CSR_SIE) csr = CSR_MIE, mask = SUPERVISOR_INT_MASK;
@@ -345,6 +465,10 @@ u32 rdcsr(u32 csr) {
 }
 
 void wrcsr(u32 csr, u32 val) {
+    if (is_counter_csr(csr)) {
+        wrcounter(csr, val);
+        return;
+    }
     // for SIP, only SSIP (software interrupts) is writable
     // since it is the way to EOI a software interrupt
     // whereas the other ones are EOI'd by the respective devices
@@ -697,6 +821,7 @@ static void execute_inst(u32 inst, u32 inst_len) {
             return;
         }
         if (funct3 & 1) T = !T;
+        if (T) g_hpm_counters[HPM_EVENT_TAKEN_BRANCH]++;
         g_pc += T ? btype : (i32)inst_len;
         return;
     }
@@ -716,9 +841,13 @@ static void execute_inst(u32 inst, u32 inst_len) {
         }
         if (err) {
             g_runtime_error_params[0] = S1 + itype;
-            g_runtime_error_type = ERROR_LOAD;
+            g_runtime_error_type = emulator_stack_overflow(S1 + itype)
+                                       ? ERROR_STACK_OVERFLOW
+                                       : ERROR_LOAD;
             return;
         }
+        g_mem_read_addr = S1 + itype;
+        g_mem_read_len = 1 << (funct3 & 0b11);
         if (!callsan_check_load(S1 + itype, 1 << (funct3 & 0b11))) {
             g_runtime_error_params[0] = S1 + itype;
             g_runtime_error_type = ERROR_CALLSAN_LOAD_STACK;
@@ -745,7 +874,9 @@ static void execute_inst(u32 inst, u32 inst_len) {
         }
         if (err) {
             g_runtime_error_params[0] = S1 + stype;
-            g_runtime_error_type = ERROR_STORE;
+            g_runtime_error_type = emulator_stack_overflow(S1 + stype)
+                                       ? ERROR_STACK_OVERFLOW
+                                       : ERROR_STORE;
             return;
         }
         callsan_report_store(S1 + stype, 1 << funct3, rs2);
@@ -826,41 +957,45 @@ static void execute_inst(u32 inst, u32 inst_len) {
                 do_syscall(inst_len);
             }
             return;
-        } else if (funct3 == 0b001) {  // CSRRW
-            u32 old = rdcsr(itype);
-            if (rs1 != 0) wrcsr(itype, g_regs[rs1]);
+        }
+
+        // bits 9:8 of the CSR number are the lowest privilege level that can
+        // access it, m-mode CSRs are treated as s-mode ones
+        u32 csr = inst >> 20;
+        if (g_privilege_level == PRIV_USER && (csr >> 8 & 3) != PRIV_USER) {
+            g_runtime_error_params[0] = g_pc;
+            g_runtime_error_type = ERROR_PROTECTION;
+            return;
+        }
+
+        if (funct3 == 0b001) {  // CSRRW
+            u32 old = rdcsr(csr);
+            if (rs1 != 0) wrcsr(csr, g_regs[rs1]);
             g_regs[rd] = old;
         } else if (funct3 == 0b010) {  // CSRRS
-            u32 old = rdcsr(itype);
-            if (rs1 != 0) wrcsr(itype, old | g_regs[rs1]);
+            u32 old = rdcsr(csr);
+            if (rs1 != 0) wrcsr(csr, old | g_regs[rs1]);
             g_regs[rd] = old;
         } else if (funct3 == 0b011) {  // CSRRC
-            u32 old = rdcsr(itype);
-            if (rs1 != 0) wrcsr(itype, old & ~g_regs[rs1]);
+            u32 old = rdcsr(csr);
+            if (rs1 != 0) wrcsr(csr, old & ~g_regs[rs1]);
             g_regs[rd] = old;
         } else if (funct3 == 0b101) {  // CSRRWI
-            g_regs[rd] = g_csr[itype];
-            if (rs1 != 0) wrcsr(itype, rs1);        // used as imm
+            g_regs[rd] = rdcsr(csr);
+            if (rs1 != 0) wrcsr(csr, rs1);        // used as imm
         } else if (funct3 == 0b110) {  // CSRRSI
-            u32 old = rdcsr(itype);
-            if (rs1 != 0) wrcsr(itype, old | rs1);
+            u32 old = rdcsr(csr);
+            if (rs1 != 0) wrcsr(csr, old | rs1);
             g_regs[rd] = old;
         } else if (funct3 == 0b111) {  // CSRRCI
-            u32 old = rdcsr(itype);
-            if (rs1 != 0) wrcsr(itype, old & ~rs1);
+            u32 old = rdcsr(csr);
+            if (rs1 != 0) wrcsr(csr, old & ~rs1);
             g_regs[rd] = old;
         } else {
             goto end;
         }
         callsan_store(rd);
 
-        // TODO: CSR instructions themselves are not privileged, s/m CSRs are,
-        // so this is wrong, but close enough
-        if (g_privilege_level == PRIV_USER) {
-            g_runtime_error_params[0] = g_pc;
-            g_runtime_error_type = ERROR_PROTECTION;
-        }
-
         g_pc += inst_len;
         g_reg_written = rd;
         return;
@@ -873,10 +1008,48 @@ end:
     return;
 }
 
+static inline bool is_mmio(u32 addr) {
+    return addr >= MMIO_BASE && addr < MMIO_END;
+}
+
+static void emulator_retire(void) {
+    if (g_cache_enabled) cache_retire();
+    if (g_bpred_enabled) bpred_retire();
+    if (g_reuse_enabled) reuse_retire();
+    u32 cycles = 1;
+    if (g_ooo_enabled) {
+        cycles = ooo_retire();
+    } else if (g_pipeline_enabled) {
+        cycles = pipeline_retire();
+    } else {
+        if (g_latency_enabled) cycles = latency_retire();
+        if (g_bpred_enabled && g_bpred_outcome == BPRED_MISS)
+            cycles += g_bpred_config.mispredict_penalty;
+    }
+    if (g_sampling) sample_retire(cycles);
+    if (g_counters_written) {
+        g_counters_written = false;
+    } else {
+        g_cycle += cycles;
+        g_instret++;
+    }
+
+    if (g_mem_read_len) {
+        g_hpm_counters[HPM_EVENT_LOAD]++;
+        if (is_mmio(g_mem_read_addr)) g_hpm_counters[HPM_EVENT_MMIO]++;
+    }
+    if (g_mem_written_len) {
+        g_hpm_counters[HPM_EVENT_STORE]++;
+        if (is_mmio(g_mem_written_addr)) g_hpm_counters[HPM_EVENT_MMIO]++;
+    }
+}
+
 void emulate() {
     g_runtime_error_type = ERROR_NONE;
     g_mem_written_len = 0;
+    g_mem_read_len = 0;
     g_reg_written = 0;
+    g_trap_taken = false;
     g_regs[0] = 0;
     bool err;
 
@@ -888,6 +1061,9 @@ void emulate() {
         }
     }
 
+    g_fetch_pc = g_pc;
+    if (g_profiling) profile_tick();
+
     u16 inst16 = LOAD(g_pc, 2, &err);
     if (err) {
         g_runtime_error_params[0] = g_pc;
@@ -902,31 +1078,44 @@ void emulate() {
             g_runtime_error_type = ERROR_UNHANDLED_INSN;
             return;
         }
+        g_inst = inst32;
+        g_inst_len = 2;
         execute_inst(inst32, 2);
-        return;
-    }
-
-    u32 inst = LOAD(g_pc, 4, &err);
-    if (err) {
-        g_runtime_error_params[0] = g_pc;
-        g_runtime_error_type = ERROR_FETCH;
-        return;
+    } else {
+        u32 inst = LOAD(g_pc, 4, &err);
+        if (err) {
+            g_runtime_error_params[0] = g_pc;
+            g_runtime_error_type = ERROR_FETCH;
+            return;
+        }
+        g_inst = inst;
+        g_inst_len = 4;
+        execute_inst(inst, 4);
     }
 
-    execute_inst(inst, 4);
+    if (g_runtime_error_type == ERROR_NONE) emulator_retire();
 }
 
-// wrapper for the webui
+// wrapper for the webui, peeking at memory never grows the stack
 export u32 emu_load(u32 addr, int size) {
     bool err;
-    u32 val = LOAD(addr, size, &err);
+    u32 val = mem_load(addr, size, false, &err);
     if (err) return 0;
     return val;
 }
 
 export void emu_store(u32 addr, u32 val, int size) {
     bool err;
-    STORE(addr, val, size, &err);
+    mem_store(addr, val, size, false, &err);
+}
+
+export bool emu_set_stack_limit(u32 bytes) {
+    if (bytes < STACK_LEN || bytes > STACK_LIMIT_MAX || bytes % STACK_PAGE)
+        return false;
+    // what's already mapped stays mapped
+    if (g_stack && STACK_TOP - g_stack->base > bytes) return false;
+    g_stack_limit = bytes;
+    return true;
 }
 
 void emulator_enter_kernel() {
@@ -937,6 +1126,10 @@ void emulator_leave_kernel() {
     g_privilege_level = PRIV_USER;
 }
 
+int emulator_get_privilege_level() { return g_privilege_level; }
+
+void emulator_set_privilege_level(int level) { g_privilege_level = level; }
+
 void emulator_interrupt_set_pending(u32 intno) {
     g_csr[CSR_MIP] |= 1u << intno;
 }
@@ -951,6 +1144,8 @@ void emulator_deliver_interrupt(u32 cause) {
     assert(off < 32);
 
     int prev_privilege = g_privilege_level;
+    g_trap_taken = true;
+    g_trap_cause = cause;
     
     g_csr[CSR_SEPC] = g_pc;
     g_csr[CSR_SCAUSE] = cause;
@@ -991,6 +1186,12 @@ void emulator_init(void) {
 
     prepare_aux_sections();
 
+    g_cycle = 0;
+    g_instret = 0;
+    memset(g_hpm_counters, 0, sizeof(g_hpm_counters));
+    g_counters_written = false;
+    g_time_base = gettime64();
+
     memset(g_csr, 0, sizeof(g_csr));
     g_csr[CSR_MSTATUS] |= STATUS_SIE;
     g_csr[CSR_MIE] |= 1u << (CAUSE_SUPERVISOR_SOFTWARE & ~CAUSE_INTERRUPT);
@@ -0,0 +1,120 @@
+#include "ares/latency.h"
+
+#include "ares/core.h"
+#include "ares/emulate.h"
+
+export bool g_latency_enabled;
+export u32 g_latency_table[LAT_COUNT] = {
+    [LAT_ALU] = 1,
+    [LAT_MUL] = 3,
+    [LAT_DIV] = 20,
+    [LAT_LOAD] = 3,
+    [LAT_STORE] = 1,
+    [LAT_BRANCH_TAKEN] = 3,
+    [LAT_BRANCH_NOT_TAKEN] = 1,
+    [LAT_JUMP] = 2,
+    [LAT_CSR] = 2,
+    [LAT_ECALL] = 5,
+};
+export u64 g_latency_counts[LAT_COUNT];
+
+static const char *const g_latency_names[LAT_COUNT] = {
+    [LAT_ALU] = "alu",
+    [LAT_MUL] = "mul",
+    [LAT_DIV] = "div",
+    [LAT_LOAD] = "load",
+    [LAT_STORE] = "store",
+    [LAT_BRANCH_TAKEN] = "branch_taken",
+    [LAT_BRANCH_NOT_TAKEN] = "branch_not_taken",
+    [LAT_JUMP] = "jump",
+    [LAT_CSR] = "csr",
+    [LAT_ECALL] = "ecall",
+};
+
+// class of each major opcode (bits 6..2), MUL/DIV, branches and SYSTEM
+// are refined by latency_retire()
+static const u8 g_opcode_class[32] = {
+    [0b00000] = LAT_LOAD,
+    [0b01000] = LAT_STORE,
+    [0b11000] = LAT_BRANCH_NOT_TAKEN,
+    [0b11001] = LAT_JUMP,
+    [0b11011] = LAT_JUMP,
+    [0b11100] = LAT_ECALL,
+};
+
+export void latency_start(void) {
+    memset(g_latency_counts, 0, sizeof(g_latency_counts));
+    g_latency_enabled = true;
+}
+
+export void latency_stop(void) { g_latency_enabled = false; }
+
+u32 latency_retire(void) {
+    u32 inst = g_inst;
+    u32 cls = g_opcode_class[(inst >> 2) & 0x1F];
+
+    if (cls == LAT_ALU && (inst & 0x7F) == 0b0110011 && (inst >> 25) == 1)
+        cls = ((inst >> 12) & 7) < 4 ? LAT_MUL : LAT_DIV;
+    else if (cls == LAT_BRANCH_NOT_TAKEN && g_pc != g_fetch_pc + g_inst_len)
+        cls = LAT_BRANCH_TAKEN;
+    else if (cls == LAT_ECALL && ((inst >> 12) & 7))
+        cls = LAT_CSR;
+
+    g_latency_counts[cls]++;
+    return g_latency_table[cls];
+}
+
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+bool latency_parse_config(const char *text, size_t len, char **error,
+                          int *error_line) {
+    u32 table[LAT_COUNT];
+    memcpy(table, g_latency_table, sizeof(table));
+    const char *p = text, *end = text + len;
+
+    for (int line = 1; p < end; line++) {
+        const char *eol = p;
+        while (eol < end && *eol != '\n') eol++;
+        const char *hash = p;
+        while (hash < eol && *hash != '#') hash++;
+
+        while (p < hash && is_blank(*p)) p++;
+        if (p < hash) {
+            const char *name = p;
+            while (p < hash && !is_blank(*p) && *p != '=') p++;
+            size_t name_len = p - name;
+            while (p < hash && (is_blank(*p) || *p == '=')) p++;
+
+            int cls = -1;
+            for (int i = 0; i < LAT_COUNT; i++)
+                if (strlen(g_latency_names[i]) == name_len &&
+                    !memcmp(g_latency_names[i], name, name_len))
+                    cls = i;
+            if (cls < 0) {
+                *error = "unknown instruction class";
+                *error_line = line;
+                return false;
+            }
+
+            u32 v;
+            if (p == hash || !ares_parse_u32(&p, &v)) {
+                *error = "expected a cycle count";
+                *error_line = line;
+                return false;
+            }
+            while (p < hash && is_blank(*p)) p++;
+            if (p != hash) {
+                *error = "unexpected characters after the cycle count";
+                *error_line = line;
+                return false;
+            }
+            table[cls] = v;
+        }
+        p = eol + 1;
+    }
+
+    memcpy(g_latency_table, table, sizeof(table));
+    return true;
+}
@@ -0,0 +1,321 @@
+#include "ares/ooo.h"
+
+#include "ares/bpred.h"
+#include "ares/cache.h"
+#include "ares/core.h"
+#include "ares/emulate.h"
+
+export bool g_ooo_enabled;
+export OooConfig g_ooo_config = {
+    .width = 4,
+    .rob_size = 64,
+    .units = {[OOO_FU_ALU] = 4, [OOO_FU_MUL] = 1, [OOO_FU_DIV] = 1,
+              [OOO_FU_LSU] = 2},
+    .latency = {[OOO_FU_ALU] = 1, [OOO_FU_MUL] = 3, [OOO_FU_DIV] = 16,
+                [OOO_FU_LSU] = 2},
+    .frontend_depth = 3,
+};
+export OooStats g_ooo_stats;
+export ARES_ARRAY(u32) g_ooo_window = ARES_ARRAY_NEW(u32);
+
+typedef enum {
+    STALL_NONE,
+    STALL_CONTROL,
+    STALL_FRONTEND,
+    STALL_ROB_FULL,
+    STALL_DEPENDENCY,
+    STALL_STRUCTURAL,
+    STALL_MEMORY,
+    STALL_EXECUTE,
+} Stall;
+
+// recent stores by word address, so loads can wait for them
+#define OOO_STORES 1024
+
+typedef struct {
+    // cycle of the last dispatch, later instructions can't use the
+    // functional units any earlier
+    u64 base;
+    // dispatch and commit cycles of the last width instructions, and commit
+    // cycles of the last rob_size, indexed by instret
+    u64 dispatched[OOO_MAX_WIDTH];
+    u64 committed[OOO_MAX_WIDTH];
+    u64 rob[OOO_MAX_ROB];
+    // earliest dispatch after a redirect, and why
+    u64 fetch_at;
+    Stall fetch_reason;
+    // cycle the result is broadcast
+    u64 reg_ready[32];
+    struct {
+        u32 word;
+        u64 ready;
+    } stores[OOO_STORES];
+    // issues per unit for cycles base .. base + OOO_HISTORY - 1
+    u8 busy[OOO_HISTORY][OOO_FU_COUNT];
+    // ROB entries added (dispatch) and removed (after commit) per cycle,
+    // folded into occupancy once the cycle is final
+    i32 occ_delta[OOO_HISTORY];
+    u32 occupancy[OOO_HISTORY];
+    u32 occ_value;
+    // occupancy is known for cycles below this one
+    u64 occ_final;
+} Ooo;
+
+static Ooo g_ooo;
+
+static bool ooo_config_valid(const OooConfig *cfg) {
+    if (!cfg->width || cfg->width > OOO_MAX_WIDTH || !cfg->rob_size ||
+        cfg->rob_size > OOO_MAX_ROB)
+        return false;
+    for (int i = 0; i < OOO_FU_COUNT; i++)
+        if (!cfg->units[i] || cfg->units[i] > 255 || !cfg->latency[i] ||
+            cfg->latency[i] >= OOO_HISTORY / 2)
+            return false;
+    return true;
+}
+
+export bool ooo_start(void) {
+    ooo_stop();
+    if (!ooo_config_valid(&g_ooo_config)) return false;
+
+    memset(&g_ooo, 0, sizeof(g_ooo));
+    g_ooo.occ_final = 1;
+    memset(&g_ooo_stats, 0, sizeof(g_ooo_stats));
+    g_ooo_enabled = true;
+    return true;
+}
+
+export void ooo_stop(void) {
+    g_ooo_enabled = false;
+    ARES_ARRAY_FREE(&g_ooo_window);
+}
+
+// makes the occupancy of every cycle below upto final
+static void ooo_finalize(u64 upto) {
+    for (; g_ooo.occ_final < upto; g_ooo.occ_final++) {
+        u32 slot = g_ooo.occ_final % OOO_HISTORY;
+        g_ooo.occ_value += g_ooo.occ_delta[slot];
+        g_ooo.occ_delta[slot] = 0;
+        g_ooo.occupancy[slot] = g_ooo.occ_value;
+        g_ooo_stats.rob_occupancy_sum += g_ooo.occ_value;
+    }
+}
+
+static void ooo_advance(u64 cycle) {
+    u64 end = g_ooo.base + OOO_HISTORY;
+    for (u64 c = g_ooo.base; c < cycle && c < end; c++)
+        memset(g_ooo.busy[c % OOO_HISTORY], 0, sizeof(g_ooo.busy[0]));
+    g_ooo.base = cycle;
+    ooo_finalize(cycle);
+}
+
+static inline bool ooo_unit_free(int fu, u64 t, u32 cycles) {
+    for (u64 c = t; c < t + cycles; c++)
+        if (g_ooo.busy[c % OOO_HISTORY][fu] >= g_ooo_config.units[fu])
+            return false;
+    return true;
+}
+
+// earliest cycle from t on with a free unit, reserving it. Past the end of
+// the window the unit is assumed to be free
+static u64 ooo_issue(int fu, u64 t) {
+    u32 cycles = fu == OOO_FU_DIV ? g_ooo_config.latency[fu] : 1;
+    u64 end = g_ooo.base + OOO_HISTORY;
+    while (t + cycles <= end && !ooo_unit_free(fu, t, cycles)) t++;
+    for (u64 c = t; c < t + cycles && c < end; c++)
+        g_ooo.busy[c % OOO_HISTORY][fu]++;
+    return t;
+}
+
+static inline void bound_by(u64 *t, u64 bound, Stall reason, Stall *why) {
+    if (bound > *t) {
+        *t = bound;
+        *why = reason;
+    }
+}
+
+u32 ooo_retire(void) {
+    OooConfig *cfg = &g_ooo_config;
+    u32 inst = g_inst;
+    u32 opcode = inst & 0x7F;
+    u32 rd = (inst >> 7) & 0x1F;
+    u32 funct3 = (inst >> 12) & 0x7;
+    u32 rs1 = (inst >> 15) & 0x1F;
+    u32 rs2 = (inst >> 20) & 0x1F;
+    u64 n = g_ooo_stats.instret;
+    u64 last_dispatch = n ? g_ooo.dispatched[(n - 1) % cfg->width] : 1;
+    u64 last_commit = g_ooo_stats.cycles;
+
+    // x0 is always ready, so clearing the field drops the dependency
+    bool load = opcode == 0b0000011, store = opcode == 0b0100011;
+    bool branch = opcode == 0b1100011;
+    if (opcode == 0b0110111 || opcode == 0b0010111 || opcode == 0b1101111 ||
+        (opcode == 0x73 && (funct3 & 4)))
+        rs1 = 0;
+    if (opcode != 0b0110011 && !store && !branch) rs2 = 0;
+    if (store || branch) rd = 0;
+
+    int fu = OOO_FU_ALU;
+    if (opcode == 0b0110011 && (inst >> 25) == 1)
+        fu = funct3 < 4 ? OOO_FU_MUL : OOO_FU_DIV;
+    else if (load || store) fu = OOO_FU_LSU;
+
+    // dispatch, in order and at most width per cycle
+    Stall dispatch_why = STALL_NONE;
+    u64 d_nat = last_dispatch;
+    if (n >= cfg->width)
+        d_nat = ares_max64(d_nat, g_ooo.dispatched[n % cfg->width] + 1);
+    u64 d = d_nat;
+    if (g_cache_enabled && g_cache_stall[CACHE_I])
+        bound_by(&d, last_dispatch + g_cache_stall[CACHE_I], STALL_FRONTEND,
+                 &dispatch_why);
+    bound_by(&d, g_ooo.fetch_at, g_ooo.fetch_reason, &dispatch_why);
+    if (n >= cfg->rob_size)
+        bound_by(&d, g_ooo.rob[n % cfg->rob_size] + 1, STALL_ROB_FULL,
+                 &dispatch_why);
+    ooo_advance(d);
+
+    // issue once the operands are broadcast and a unit is free
+    u64 i_nat = d + 1;
+    u64 ops = ares_max64(g_ooo.reg_ready[rs1], g_ooo.reg_ready[rs2]);
+    u32 word = g_mem_read_addr >> 2;
+    if (load && g_ooo.stores[word % OOO_STORES].word == word)
+        ops = ares_max64(ops, g_ooo.stores[word % OOO_STORES].ready);
+    u64 ready = ares_max64(i_nat, ops);
+    u64 issue = ooo_issue(fu, ready);
+
+    u32 latency = fu == OOO_FU_LSU && store ? 1 : cfg->latency[fu];
+    if (load && g_cache_enabled) latency += g_cache_stall[CACHE_D];
+    u64 complete = issue + latency;
+
+    // commit, in order and at most width per cycle
+    u64 c = ares_max64(last_commit, complete);
+    if (n >= cfg->width) c = ares_max64(c, g_ooo.committed[n % cfg->width] + 1);
+
+    if (n && c > last_commit + 1) {
+        // blame whichever step delayed this instruction the most
+        u64 extra = c - last_commit - 1;
+        Stall why = dispatch_why != STALL_NONE ? dispatch_why : STALL_FRONTEND;
+        u64 worst = d - d_nat;
+        if (ops > i_nat && ops - i_nat > worst) {
+            worst = ops - i_nat;
+            why = STALL_DEPENDENCY;
+        }
+        if (issue - ready > worst) {
+            worst = issue - ready;
+            why = STALL_STRUCTURAL;
+        }
+        if (latency - 1 > worst) why = load ? STALL_MEMORY : STALL_EXECUTE;
+
+        OooStats *st = &g_ooo_stats;
+        if (why == STALL_CONTROL) st->control_stalls += extra;
+        else if (why == STALL_ROB_FULL) st->rob_full_stalls += extra;
+        else if (why == STALL_DEPENDENCY) st->dependency_stalls += extra;
+        else if (why == STALL_STRUCTURAL) st->structural_stalls += extra;
+        else if (why == STALL_MEMORY) st->memory_stalls += extra;
+        else if (why == STALL_EXECUTE) st->execute_stalls += extra;
+        else st->frontend_stalls += extra;
+    }
+
+    if (rd) g_ooo.reg_ready[rd] = complete;
+    if (store) {
+        word = g_mem_written_addr >> 2;
+        g_ooo.stores[word % OOO_STORES].word = word;
+        g_ooo.stores[word % OOO_STORES].ready = complete;
+    }
+
+    // the next instruction can't be dispatched before the front end is on
+    // the right path again
+    u64 redirect = 0;
+    Stall redirect_why = STALL_CONTROL;
+    bool taken = g_pc != g_fetch_pc + g_inst_len;
+    if (g_trap_taken || (opcode == 0x73 && funct3 == 0)) {
+        redirect = c + cfg->frontend_depth;
+    } else if (g_bpred_enabled) {
+        if (g_bpred_outcome == BPRED_MISS)
+            redirect = complete + cfg->frontend_depth;
+        else if (g_bpred_outcome == BPRED_DECODE) {
+            redirect = d + 1;
+            redirect_why = STALL_FRONTEND;
+        }
+    } else if (opcode == 0b1101111) {
+        redirect = d + 1;
+        redirect_why = STALL_FRONTEND;
+    } else if (taken) {
+        redirect = complete + cfg->frontend_depth;
+    }
+    if (redirect > g_ooo.fetch_at) {
+        g_ooo.fetch_at = redirect;
+        g_ooo.fetch_reason = redirect_why;
+    }
+
+    // the entry is occupied from dispatch until the cycle it commits
+    u64 leave = c + 1;
+    if (leave >= g_ooo.base + OOO_HISTORY) leave = g_ooo.base + OOO_HISTORY - 1;
+    g_ooo.occ_delta[d % OOO_HISTORY]++;
+    g_ooo.occ_delta[leave % OOO_HISTORY]--;
+
+    g_ooo.dispatched[n % cfg->width] = d;
+    g_ooo.committed[n % cfg->width] = c;
+    g_ooo.rob[n % cfg->rob_size] = c;
+    g_ooo_stats.instret++;
+    g_ooo_stats.cycles = c;
+    if (g_exited) ooo_finalize(c + 1);
+    return c - last_commit;
+}
+
+bool ooo_parse_config(const char *spec, OooConfig *out, char **error) {
+    OooConfig cfg = *out;
+    const char *p = spec;
+
+    while (*p) {
+        u32 *field;
+        if (ares_option_eq(&p, "width")) field = &cfg.width;
+        else if (ares_option_eq(&p, "rob")) field = &cfg.rob_size;
+        else if (ares_option_eq(&p, "alu")) field = &cfg.units[OOO_FU_ALU];
+        else if (ares_option_eq(&p, "mul")) field = &cfg.units[OOO_FU_MUL];
+        else if (ares_option_eq(&p, "div")) field = &cfg.units[OOO_FU_DIV];
+        else if (ares_option_eq(&p, "lsu")) field = &cfg.units[OOO_FU_LSU];
+        else if (ares_option_eq(&p, "mul_lat"))
+            field = &cfg.latency[OOO_FU_MUL];
+        else if (ares_option_eq(&p, "div_lat"))
+            field = &cfg.latency[OOO_FU_DIV];
+        else if (ares_option_eq(&p, "load_lat"))
+            field = &cfg.latency[OOO_FU_LSU];
+        else if (ares_option_eq(&p, "frontend")) field = &cfg.frontend_depth;
+        else {
+            *error = "unknown out-of-order option";
+            return false;
+        }
+        if (!ares_parse_u32(&p, field)) {
+            *error = "expected a number";
+            return false;
+        }
+        if (*p == ':') p++;
+        else if (*p) {
+            *error = "expected ':' between options";
+            return false;
+        }
+    }
+    if (!ooo_config_valid(&cfg)) {
+        *error = "invalid out-of-order configuration";
+        return false;
+    }
+
+    *out = cfg;
+    return true;
+}
+
+export u32 ooo_occupancy(u32 first, u32 count) {
+    u64 oldest =
+        g_ooo.occ_final > OOO_HISTORY ? g_ooo.occ_final - OOO_HISTORY : 1;
+
+    g_ooo_window.len = 0;
+    u32 n = 0;
+    for (u64 c = first; c < (u64)first + count; c++) {
+        if (c < oldest || c >= g_ooo.occ_final) break;
+        *ARES_ARRAY_PUSH(&g_ooo_window) = g_ooo.occupancy[c % OOO_HISTORY];
+        n++;
+    }
+    return n;
+}
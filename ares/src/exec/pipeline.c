@@ -0,0 +1,157 @@
+#include "ares/pipeline.h"
+
+#include "ares/bpred.h"
+#include "ares/cache.h"
+#include "ares/core.h"
+#include "ares/emulate.h"
+
+export bool g_pipeline_enabled;
+export PipelineConfig g_pipeline_config = {
+    .mul_latency = 3,
+    .div_latency = 16,
+};
+export PipelineStats g_pipeline_stats;
+export ARES_ARRAY(u32) g_pipeline_window = ARES_ARRAY_NEW(u32);
+
+typedef enum {
+    STALL_NONE,
+    STALL_LOAD_USE,
+    STALL_STRUCTURAL,
+    STALL_CONTROL,
+    STALL_MEMORY,
+} Stall;
+
+typedef struct {
+    // cycle at which the previous instruction entered each stage, the last
+    // entry is the cycle it left WB
+    u64 prev[PIPE_STAGES + 1];
+    // earliest IF of the next instruction after a redirect
+    u64 fetch_at;
+    // earliest EX of an instruction reading the register
+    u64 reg_ready[32];
+    // ring slots are valid for cycles up to this one
+    u64 cleared;
+    u32 ring[PIPELINE_HISTORY][PIPE_STAGES];
+} Pipeline;
+
+static Pipeline g_pipe;
+
+export void pipeline_start(void) {
+    memset(&g_pipe, 0, sizeof(g_pipe));
+    memset(&g_pipeline_stats, 0, sizeof(g_pipeline_stats));
+    g_pipeline_enabled = true;
+}
+
+export void pipeline_stop(void) {
+    g_pipeline_enabled = false;
+    ARES_ARRAY_FREE(&g_pipeline_window);
+}
+
+static void pipeline_occupy(u32 pc, u64 from, u64 to, int stage) {
+    for (; g_pipe.cleared < to; g_pipe.cleared++)
+        memset(g_pipe.ring[(g_pipe.cleared + 1) % PIPELINE_HISTORY], 0,
+               sizeof(g_pipe.ring[0]));
+    for (u64 c = from; c < to; c++)
+        g_pipe.ring[c % PIPELINE_HISTORY][stage] = pc;
+}
+
+u32 pipeline_retire(void) {
+    u32 inst = g_inst;
+    u32 opcode = inst & 0x7F;
+    u32 rd = (inst >> 7) & 0x1F;
+    u32 funct3 = (inst >> 12) & 0x7;
+    u32 rs1 = (inst >> 15) & 0x1F;
+    u32 rs2 = (inst >> 20) & 0x1F;
+    u64 *prev = g_pipe.prev;
+
+    // x0 is always ready, so clearing the field drops the dependency
+    bool store = opcode == 0b0100011, branch = opcode == 0b1100011;
+    if (opcode == 0b0110111 || opcode == 0b0010111 || opcode == 0b1101111 ||
+        (opcode == 0x73 && (funct3 & 4)))
+        rs1 = 0;
+    if (opcode != 0b0110011 && !store && !branch) rs2 = 0;
+    if (store || branch) rd = 0;
+
+    u32 ex_latency = 1;
+    if (opcode == 0b0110011 && (inst >> 25) == 1)
+        ex_latency = funct3 < 4 ? g_pipeline_config.mul_latency
+                                : g_pipeline_config.div_latency;
+    if (!ex_latency) ex_latency = 1;
+    u32 if_latency = 1, mem_latency = 1;
+    if (g_cache_enabled) {
+        if_latency += g_cache_stall[CACHE_I];
+        mem_latency += g_cache_stall[CACHE_D];
+    }
+
+    // each stage is entered once the instruction is done with the previous
+    // one and the previous instruction has moved out of the way
+    Stall stall = STALL_NONE;
+    u64 natural_if = ares_max64(prev[PIPE_IF] + 1, prev[PIPE_ID]);
+    u64 t_if = ares_max64(natural_if, g_pipe.fetch_at);
+    if (t_if > natural_if) stall = STALL_CONTROL;
+    u64 t_id = ares_max64(t_if + if_latency, prev[PIPE_EX]);
+    if (if_latency > 1) stall = STALL_MEMORY;
+
+    u64 ex_struct = ares_max64(t_id + 1, prev[PIPE_MEM]);
+    if (prev[PIPE_MEM] > t_id + 1) stall = STALL_STRUCTURAL;
+    // EX isn't pipelined, so only loads can still be in flight here
+    u64 ready = ares_max64(g_pipe.reg_ready[rs1], g_pipe.reg_ready[rs2]);
+    u64 t_ex = ares_max64(ex_struct, ready);
+    if (t_ex > ex_struct) stall = STALL_LOAD_USE;
+
+    u64 t_mem = ares_max64(t_ex + ex_latency, prev[PIPE_WB]);
+    u64 t_wb = ares_max64(t_mem + mem_latency, prev[PIPE_WB + 1]);
+    if (mem_latency > 1) stall = STALL_MEMORY;
+    u64 t[PIPE_STAGES + 1] = {t_if, t_id, t_ex, t_mem, t_wb, t_wb + 1};
+
+    u32 added = t_wb - g_pipeline_stats.cycles;
+    if (g_pipeline_stats.instret && added > 1) {
+        u64 extra = added - 1;
+        if (stall == STALL_LOAD_USE) g_pipeline_stats.load_use_stalls += extra;
+        else if (stall == STALL_CONTROL)
+            g_pipeline_stats.control_stalls += extra;
+        else if (stall == STALL_MEMORY) g_pipeline_stats.memory_stalls += extra;
+        else g_pipeline_stats.structural_stalls += extra;
+    }
+    g_pipeline_stats.cycles = t_wb;
+    g_pipeline_stats.instret++;
+
+    if (rd)
+        g_pipe.reg_ready[rd] =
+            opcode == 0b0000011 ? t_mem + mem_latency : t_ex + ex_latency;
+
+    if (g_trap_taken || (opcode == 0x73 && funct3 == 0))
+        g_pipe.fetch_at = t_mem + 1;
+    else if (g_bpred_enabled) {
+        if (g_bpred_outcome == BPRED_MISS) g_pipe.fetch_at = t_ex + 1;
+        else if (g_bpred_outcome == BPRED_DECODE) g_pipe.fetch_at = t_id + 1;
+    } else if (opcode == 0b1101111) g_pipe.fetch_at = t_id + 1;
+    else if (g_pc != g_fetch_pc + g_inst_len) g_pipe.fetch_at = t_ex + 1;
+
+    for (int s = 0; s < PIPE_STAGES; s++) {
+        pipeline_occupy(g_fetch_pc, t[s], t[s + 1], s);
+        prev[s] = t[s];
+    }
+    prev[PIPE_STAGES] = t[PIPE_STAGES];
+    return added;
+}
+
+export u32 pipeline_stages(u32 first, u32 count) {
+    // later instructions are fetched after the last one, so every cycle up
+    // to its IF is final
+    u64 known = g_exited ? g_pipeline_stats.cycles : g_pipe.prev[PIPE_IF];
+    u64 oldest = g_pipe.cleared >= PIPELINE_HISTORY
+                     ? g_pipe.cleared - PIPELINE_HISTORY + 1
+                     : 1;
+
+    g_pipeline_window.len = 0;
+    u32 n = 0;
+    for (u64 c = first; c < (u64)first + count; c++) {
+        if (c < oldest || c > known) break;
+        for (int s = 0; s < PIPE_STAGES; s++)
+            *ARES_ARRAY_PUSH(&g_pipeline_window) =
+                g_pipe.ring[c % PIPELINE_HISTORY][s];
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,192 @@
+#include "ares/profile.h"
+
+#include "ares/callsan.h"
+#include "ares/core.h"
+#include "ares/emulate.h"
+
+export bool g_profiling;
+export ARES_ARRAY(u64) g_profile_counts = ARES_ARRAY_NEW(u64);
+export u64 g_profile_other;
+ARES_ARRAY(ProfileNode) g_profile_nodes = ARES_ARRAY_NEW(ProfileNode);
+export ARES_ARRAY(u64) g_profile_label_counts = ARES_ARRAY_NEW(u64);
+export ARES_ARRAY(u32) g_profile_lines = ARES_ARRAY_NEW(u32);
+export ARES_ARRAY(char) g_profile_folded = ARES_ARRAY_NEW(char);
+
+// node indices of the frames in g_shadow_stack, kept in sync lazily
+static ARES_ARRAY(u32) g_profile_path = ARES_ARRAY_NEW(u32);
+
+#define PROFILE_NO_NODE ((u32)-1)
+
+static u32 profile_new_node(u32 parent, u32 func_pc) {
+    u32 idx = ARES_ARRAY_LEN(&g_profile_nodes);
+    *ARES_ARRAY_PUSH(&g_profile_nodes) = (ProfileNode){
+        .func_pc = func_pc,
+        .parent = parent,
+        .first_child = PROFILE_NO_NODE,
+        .next_sibling = PROFILE_NO_NODE,
+        .self = 0,
+    };
+    if (parent != PROFILE_NO_NODE) {
+        ProfileNode *p = ARES_ARRAY_GET(&g_profile_nodes, parent);
+        ARES_ARRAY_GET(&g_profile_nodes, idx)->next_sibling = p->first_child;
+        p->first_child = idx;
+    }
+    return idx;
+}
+
+static u32 profile_child(u32 parent, u32 func_pc) {
+    u32 c = ARES_ARRAY_GET(&g_profile_nodes, parent)->first_child;
+    for (; c != PROFILE_NO_NODE;
+         c = ARES_ARRAY_GET(&g_profile_nodes, c)->next_sibling)
+        if (ARES_ARRAY_GET(&g_profile_nodes, c)->func_pc == func_pc) return c;
+    return profile_new_node(parent, func_pc);
+}
+
+export void profile_start(void) {
+    profile_stop();
+
+    Section *text = text_section();
+
+    size_t slots = text ? (ARES_ARRAY_LEN(&text->contents) + 1) / 2 : 0;
+    g_profile_counts = ARES_ARRAY_PREPARE(u64, slots);
+    if (slots) {
+        g_profile_counts.buf = malloc(slots * sizeof(u64));
+        ARES_CHECK_OOM(g_profile_counts.buf);
+        memset(g_profile_counts.buf, 0, slots * sizeof(u64));
+    }
+    g_profile_other = 0;
+
+    // the root is whatever runs outside of any call
+    profile_new_node(PROFILE_NO_NODE, g_pc);
+    g_profiling = true;
+}
+
+export void profile_stop(void) {
+    g_profiling = false;
+    ARES_ARRAY_FREE(&g_profile_counts);
+    ARES_ARRAY_FREE(&g_profile_nodes);
+    ARES_ARRAY_FREE(&g_profile_path);
+    ARES_ARRAY_FREE(&g_profile_label_counts);
+    ARES_ARRAY_FREE(&g_profile_lines);
+    ARES_ARRAY_FREE(&g_profile_folded);
+}
+
+// At most one call or return happens between two ticks, so this is O(1)
+// unless the shadow stack was replaced wholesale (e.g. by emu_restore)
+static u32 profile_sync_path(void) {
+    size_t depth = ARES_ARRAY_LEN(&g_shadow_stack);
+    ARES_ARRAY(u32) *path = &g_profile_path;
+
+    if (path->len > depth) path->len = depth;
+    while (path->len &&
+           ARES_ARRAY_GET(&g_profile_nodes, path->buf[path->len - 1])
+                   ->func_pc !=
+               ARES_ARRAY_GET(&g_shadow_stack, path->len - 1)->pc)
+        path->len--;
+    while (path->len < depth) {
+        u32 parent = path->len ? path->buf[path->len - 1] : 0;
+        u32 func_pc = ARES_ARRAY_GET(&g_shadow_stack, path->len)->pc;
+        u32 node = profile_child(parent, func_pc);
+        *ARES_ARRAY_PUSH(path) = node;
+    }
+
+    return path->len ? path->buf[path->len - 1] : 0;
+}
+
+void profile_tick(void) {
+    u32 slot = (g_fetch_pc - TEXT_BASE) / 2;
+    if (slot < ARES_ARRAY_LEN(&g_profile_counts)) g_profile_counts.buf[slot]++;
+    else g_profile_other++;
+
+    ARES_ARRAY_GET(&g_profile_nodes, profile_sync_path())->self++;
+}
+
+export void profile_attribute(void) {
+    size_t n = ARES_ARRAY_LEN(&g_labels);
+    g_profile_label_counts.len = 0;
+    for (size_t i = 0; i < n; i++)
+        *ARES_ARRAY_PUSH(&g_profile_label_counts) = 0;
+
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_profile_counts); i++) {
+        u64 count = g_profile_counts.buf[i];
+        if (!count) continue;
+        LabelData *label;
+        u32 off;
+        if (pc_to_label_r(TEXT_BASE + i * 2, &label, &off))
+            g_profile_label_counts.buf[label - g_labels.buf] += count;
+    }
+}
+
+export void profile_lines(void) {
+    g_profile_lines.len = 0;
+    size_t n = ARES_ARRAY_LEN(&g_profile_counts);
+    if (ARES_ARRAY_LEN(&g_text_by_linenum) < n)
+        n = ARES_ARRAY_LEN(&g_text_by_linenum);
+
+    for (size_t i = 0; i < n; i++) {
+        u64 count = g_profile_counts.buf[i];
+        u32 line = g_text_by_linenum.buf[i];
+        if (!count || !line) continue;
+        while (g_profile_lines.len <= line)
+            *ARES_ARRAY_PUSH(&g_profile_lines) = 0;
+        u64 sum = g_profile_lines.buf[line] + count;
+        // saturate, the UI reads these as u32
+        g_profile_lines.buf[line] = sum > (u32)-1 ? (u32)-1 : sum;
+    }
+}
+
+static void folded_puts(ARES_ARRAY(char) *out, const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) *ARES_ARRAY_PUSH(out) = s[i];
+}
+
+static void folded_putnum(ARES_ARRAY(char) *out, u64 v, int base) {
+    char buf[24];
+    int i = 0;
+    do {
+        buf[i++] = "0123456789abcdef"[v % base];
+        v /= base;
+    } while (v);
+    if (base == 16) folded_puts(out, "0x", 2);
+    while (i--) *ARES_ARRAY_PUSH(out) = buf[i];
+}
+
+static void folded_frame(ARES_ARRAY(char) *out, u32 pc) {
+    LabelData *label;
+    u32 off;
+    if (pc_to_label_r(pc, &label, &off)) {
+        folded_puts(out, label->txt, label->len);
+        if (off) {
+            *ARES_ARRAY_PUSH(out) = '+';
+            folded_putnum(out, off, 16);
+        }
+    } else {
+        folded_putnum(out, pc, 16);
+    }
+}
+
+void profile_folded(ARES_ARRAY(char) *out) {
+    // not recursive, guests can recurse deeper than the host stack allows
+    ARES_ARRAY(u32) frames = ARES_ARRAY_NEW(u32);
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_profile_nodes); i++) {
+        ProfileNode *n = ARES_ARRAY_GET(&g_profile_nodes, i);
+        if (!n->self) continue;
+
+        frames.len = 0;
+        for (u32 f = i; f != PROFILE_NO_NODE;
+             f = ARES_ARRAY_GET(&g_profile_nodes, f)->parent)
+            *ARES_ARRAY_PUSH(&frames) = f;
+        while (frames.len) {
+            u32 f = *ARES_ARRAY_POP(&frames);
+            folded_frame(out, ARES_ARRAY_GET(&g_profile_nodes, f)->func_pc);
+            *ARES_ARRAY_PUSH(out) = frames.len ? ';' : ' ';
+        }
+        folded_putnum(out, n->self, 10);
+        *ARES_ARRAY_PUSH(out) = '\n';
+    }
+    ARES_ARRAY_FREE(&frames);
+}
+
+export void profile_folded_text(void) {
+    g_profile_folded.len = 0;
+    profile_folded(&g_profile_folded);
+}
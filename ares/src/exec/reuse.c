@@ -0,0 +1,251 @@
+#include "ares/reuse.h"
+
+#include "ares/core.h"
+#include "ares/emulate.h"
+
+export bool g_reuse_enabled;
+export ReuseConfig g_reuse_config = {
+    .line_size = 32,
+    .epoch = 100000,
+};
+export ReuseStats g_reuse_stats[REUSE_COUNT];
+export ARES_ARRAY(u64) g_reuse_hist[REUSE_COUNT];
+export ARES_ARRAY(u32) g_reuse_working_set = ARES_ARRAY_NEW(u32);
+export u32 g_reuse_sections;
+export ARES_ARRAY(u64) g_reuse_mrc = ARES_ARRAY_NEW(u64);
+
+typedef struct {
+    // line + 1, 0 for an empty slot
+    u32 key;
+    // time of the last access
+    u32 last;
+    // last epoch + 1 the line was counted in the working set
+    u32 epoch;
+    // index in g_sections, g_sections.len if it's in none of them
+    u32 section;
+} ReuseEntry;
+
+typedef struct {
+    // open addressing, power of two sized
+    ReuseEntry *table;
+    u32 table_cap;
+    u32 table_len;
+    // Fenwick tree over times 1 .. cap with a 1 at the last access time of
+    // every line, and the key of that line
+    u32 *tree;
+    u32 *owner;
+    u32 cap;
+    u32 now;
+} Reuse;
+
+static Reuse g_reuse[REUSE_COUNT];
+static u32 g_reuse_line_shift;
+static u32 g_reuse_instret;
+static u32 g_reuse_epoch;
+static u32 *g_reuse_counts;
+
+static void reuse_alloc(Reuse *r, u32 table_cap, u32 cap) {
+    r->table = malloc(table_cap * sizeof(ReuseEntry));
+    ARES_CHECK_OOM(r->table);
+    memset(r->table, 0, table_cap * sizeof(ReuseEntry));
+    r->table_cap = table_cap;
+    r->tree = malloc((cap + 1) * sizeof(u32));
+    ARES_CHECK_OOM(r->tree);
+    memset(r->tree, 0, (cap + 1) * sizeof(u32));
+    r->owner = malloc((cap + 1) * sizeof(u32));
+    ARES_CHECK_OOM(r->owner);
+    memset(r->owner, 0, (cap + 1) * sizeof(u32));
+    r->cap = cap;
+}
+
+export bool reuse_start(void) {
+    reuse_stop();
+    if (!ares_is_pow2(g_reuse_config.line_size) || !g_reuse_config.epoch)
+        return false;
+
+    g_reuse_line_shift = __builtin_ctz(g_reuse_config.line_size);
+    for (int i = 0; i < REUSE_COUNT; i++) {
+        reuse_alloc(&g_reuse[i], 1024, 1 << 16);
+    }
+    memset(g_reuse_stats, 0, sizeof(g_reuse_stats));
+
+    g_reuse_sections = ARES_ARRAY_LEN(&g_sections) + 1;
+    g_reuse_counts = malloc(g_reuse_sections * sizeof(u32));
+    ARES_CHECK_OOM(g_reuse_counts);
+    memset(g_reuse_counts, 0, g_reuse_sections * sizeof(u32));
+    g_reuse_instret = 0;
+    g_reuse_epoch = 0;
+    g_reuse_enabled = true;
+    return true;
+}
+
+export void reuse_stop(void) {
+    g_reuse_enabled = false;
+    for (int i = 0; i < REUSE_COUNT; i++) {
+        free(g_reuse[i].table);
+        free(g_reuse[i].tree);
+        free(g_reuse[i].owner);
+        g_reuse[i] = (Reuse){0};
+        ARES_ARRAY_FREE(&g_reuse_hist[i]);
+    }
+    free(g_reuse_counts);
+    g_reuse_counts = NULL;
+    ARES_ARRAY_FREE(&g_reuse_working_set);
+    ARES_ARRAY_FREE(&g_reuse_mrc);
+}
+
+static inline u32 hash_slot(Reuse *r, u32 key) {
+    return (key * 0x9E3779B1u) & (r->table_cap - 1);
+}
+
+static ReuseEntry *reuse_lookup(Reuse *r, u32 key) {
+    u32 i = hash_slot(r, key);
+    while (r->table[i].key && r->table[i].key != key)
+        i = (i + 1) & (r->table_cap - 1);
+    return &r->table[i];
+}
+
+static void reuse_grow_table(Reuse *r) {
+    ReuseEntry *old = r->table;
+    u32 old_cap = r->table_cap;
+    r->table_cap *= 2;
+    r->table = malloc(r->table_cap * sizeof(ReuseEntry));
+    ARES_CHECK_OOM(r->table);
+    memset(r->table, 0, r->table_cap * sizeof(ReuseEntry));
+    for (u32 i = 0; i < old_cap; i++)
+        if (old[i].key) *reuse_lookup(r, old[i].key) = old[i];
+    free(old);
+}
+
+static inline void fenwick_add(Reuse *r, u32 i, i32 v) {
+    for (; i <= r->cap; i += i & -i) r->tree[i] += v;
+}
+
+static inline u32 fenwick_sum(Reuse *r, u32 i) {
+    u32 sum = 0;
+    for (; i; i -= i & -i) sum += r->tree[i];
+    return sum;
+}
+
+// renumbers the live access times to 1 .. distinct lines, so the times fit
+// in the tree again
+static void reuse_compact(Reuse *r) {
+    if (r->table_len * 2 > r->cap) {
+        // there's no realloc in the WASM build
+        u32 cap = r->cap * 2;
+        u32 *owner = malloc((cap + 1) * sizeof(u32));
+        ARES_CHECK_OOM(owner);
+        memcpy(owner, r->owner, (r->cap + 1) * sizeof(u32));
+        memset(owner + r->cap + 1, 0, (cap - r->cap) * sizeof(u32));
+        free(r->owner);
+        r->owner = owner;
+        free(r->tree);
+        r->tree = malloc((cap + 1) * sizeof(u32));
+        ARES_CHECK_OOM(r->tree);
+        r->cap = cap;
+    }
+
+    u32 live = 0;
+    for (u32 t = 1; t <= r->now; t++) {
+        u32 key = r->owner[t];
+        if (!key) continue;
+        r->owner[t] = 0;
+        r->owner[++live] = key;
+        reuse_lookup(r, key)->last = live;
+    }
+
+    // linear time build of a tree with ones at 1 .. live
+    for (u32 i = 1; i <= r->cap; i++) r->tree[i] = i <= live;
+    for (u32 i = 1; i <= r->cap; i++) {
+        u32 j = i + (i & -i);
+        if (j <= r->cap) r->tree[j] += r->tree[i];
+    }
+    r->now = live;
+}
+
+static u32 reuse_section(u32 addr) {
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
+        Section *sec = *ARES_ARRAY_GET(&g_sections, i);
+        if (addr >= sec->base && addr < sec->limit) return i;
+    }
+    return g_reuse_sections - 1;
+}
+
+static void reuse_access(int which, u32 line) {
+    Reuse *r = &g_reuse[which];
+    ReuseStats *st = &g_reuse_stats[which];
+    u32 key = line + 1;
+
+    if ((r->table_len + 1) * 2 > r->table_cap) reuse_grow_table(r);
+    ReuseEntry *e = reuse_lookup(r, key);
+    st->accesses++;
+    if (!e->key) {
+        e->key = key;
+        e->section = reuse_section(line << g_reuse_line_shift);
+        r->table_len++;
+        st->cold++;
+    } else {
+        // lines touched after the previous access to this one
+        u32 d = fenwick_sum(r, r->now) - fenwick_sum(r, e->last);
+        if (d >= REUSE_MAX_DISTANCE) {
+            st->far++;
+        } else {
+            ARES_ARRAY(u64) *hist = &g_reuse_hist[which];
+            while (ARES_ARRAY_LEN(hist) <= d) *ARES_ARRAY_PUSH(hist) = 0;
+            hist->buf[d]++;
+        }
+        fenwick_add(r, e->last, -1);
+        r->owner[e->last] = 0;
+    }
+
+    // a line that's in both streams is only in the working set once
+    if (e->epoch != g_reuse_epoch + 1) {
+        e->epoch = g_reuse_epoch + 1;
+        ReuseEntry *other = reuse_lookup(&g_reuse[which ^ 1], key);
+        if (other->epoch != g_reuse_epoch + 1) g_reuse_counts[e->section]++;
+    }
+
+    if (r->now == r->cap) reuse_compact(r);
+    e->last = ++r->now;
+    r->owner[r->now] = key;
+    fenwick_add(r, r->now, 1);
+}
+
+static void reuse_range(int which, u32 addr, u32 size) {
+    for (u32 line = addr >> g_reuse_line_shift;
+         line <= (addr + size - 1) >> g_reuse_line_shift; line++)
+        reuse_access(which, line);
+}
+
+static inline bool is_uncached(u32 addr) {
+    return addr >= MMIO_BASE && addr < MMIO_END;
+}
+
+void reuse_retire(void) {
+    reuse_range(REUSE_I, g_fetch_pc, g_inst_len);
+    if (g_mem_read_len && !is_uncached(g_mem_read_addr))
+        reuse_range(REUSE_D, g_mem_read_addr, g_mem_read_len);
+    if (g_mem_written_len && !is_uncached(g_mem_written_addr))
+        reuse_range(REUSE_D, g_mem_written_addr, g_mem_written_len);
+
+    if (++g_reuse_instret == g_reuse_config.epoch) {
+        for (u32 i = 0; i < g_reuse_sections; i++) {
+            *ARES_ARRAY_PUSH(&g_reuse_working_set) = g_reuse_counts[i];
+            g_reuse_counts[i] = 0;
+        }
+        g_reuse_instret = 0;
+        g_reuse_epoch++;
+    }
+}
+
+export void reuse_mrc(u32 which, u32 lines) {
+    g_reuse_mrc.len = 0;
+    if (which >= REUSE_COUNT) return;
+    ARES_ARRAY(u64) *hist = &g_reuse_hist[which];
+    u64 hits = 0;
+    for (u32 c = 1; c <= lines; c++) {
+        // a cache of c lines hits on distances 0 .. c - 1
+        if (c - 1 < ARES_ARRAY_LEN(hist)) hits += hist->buf[c - 1];
+        *ARES_ARRAY_PUSH(&g_reuse_mrc) = g_reuse_stats[which].accesses - hits;
+    }
+}
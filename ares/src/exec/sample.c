@@ -0,0 +1,134 @@
+#include "ares/sample.h"
+
+#include "ares/bpred.h"
+#include "ares/cache.h"
+#include "ares/core.h"
+#include "ares/latency.h"
+#include "ares/ooo.h"
+#include "ares/pipeline.h"
+
+export bool g_sampling;
+export SampleConfig g_sample_config = {
+    .period = 1000000,
+    .warmup = 10000,
+    .measure = 10000,
+};
+export SampleStats g_sample_stats;
+export SampleEstimate g_sample_estimate;
+
+// the models are switched by their enable flag, so their state survives
+// the functional part of each period
+static bool *const g_models[] = {
+    &g_cache_enabled,
+    &g_bpred_enabled,
+    &g_pipeline_enabled,
+    &g_ooo_enabled,
+    &g_latency_enabled,
+};
+#define MODEL_COUNT (sizeof(g_models) / sizeof(g_models[0]))
+
+static bool g_detailed[MODEL_COUNT];
+static u64 g_window_cycles;
+
+static void sample_select(u64 pos) {
+    SampleConfig *cfg = &g_sample_config;
+    bool on = pos >= cfg->period - cfg->warmup - cfg->measure;
+    for (size_t i = 0; i < MODEL_COUNT; i++)
+        *g_models[i] = g_detailed[i] && on;
+}
+
+static bool sample_config_valid(const SampleConfig *cfg) {
+    return cfg->period && cfg->measure &&
+           cfg->warmup + cfg->measure <= cfg->period;
+}
+
+export bool sample_start(void) {
+    sample_stop();
+    if (!sample_config_valid(&g_sample_config)) return false;
+
+    for (size_t i = 0; i < MODEL_COUNT; i++) g_detailed[i] = *g_models[i];
+    memset(&g_sample_stats, 0, sizeof(g_sample_stats));
+    memset(&g_sample_estimate, 0, sizeof(g_sample_estimate));
+    g_window_cycles = 0;
+    g_sampling = true;
+    sample_select(0);
+    return true;
+}
+
+export void sample_stop(void) {
+    if (!g_sampling) return;
+    g_sampling = false;
+    for (size_t i = 0; i < MODEL_COUNT; i++) *g_models[i] = g_detailed[i];
+}
+
+void sample_retire(u32 cycles) {
+    SampleConfig *cfg = &g_sample_config;
+    SampleStats *st = &g_sample_stats;
+    u64 pos = st->instret % cfg->period;
+
+    if (pos >= cfg->period - cfg->measure) {
+        g_window_cycles += cycles;
+        if (pos == cfg->period - 1) {
+            double cpi = (double)g_window_cycles / cfg->measure;
+            st->samples++;
+            st->measured_instret += cfg->measure;
+            st->measured_cycles += g_window_cycles;
+            st->cpi_sum += cpi;
+            st->cpi_sq_sum += cpi * cpi;
+            g_window_cycles = 0;
+        }
+    }
+
+    st->instret++;
+    sample_select((pos + 1) % cfg->period);
+}
+
+// there's no libm in the WASM build
+static double sample_sqrt(double x) {
+    if (x <= 0) return 0;
+    double r = x > 1 ? x : 1;
+    for (int i = 0; i < 100; i++) r = (r + x / r) / 2;
+    return r;
+}
+
+export void sample_estimate(void) {
+    SampleStats *st = &g_sample_stats;
+    SampleEstimate *est = &g_sample_estimate;
+    memset(est, 0, sizeof(*est));
+    if (!st->samples) return;
+
+    double n = st->samples;
+    double mean = st->cpi_sum / n;
+    double half = 0;
+    if (st->samples > 1) {
+        double var = (st->cpi_sq_sum - n * mean * mean) / (n - 1);
+        half = 1.96 * sample_sqrt(var / n);
+    }
+    est->cpi = mean;
+    est->cpi_low = mean - half;
+    est->cpi_high = mean + half;
+    est->cycles = mean * st->instret;
+}
+
+static bool parse_count(const char **s, u64 *out) {
+    return ares_parse_num(s, 1000, UINT64_MAX, out);
+}
+
+bool sample_parse_config(const char *spec, SampleConfig *out, char **error) {
+    SampleConfig cfg;
+    const char *p = spec;
+
+    if (!parse_count(&p, &cfg.period) || *p++ != ':' ||
+        !parse_count(&p, &cfg.warmup) || *p++ != ':' ||
+        !parse_count(&p, &cfg.measure) || *p) {
+        *error = "expected period:warmup:measure";
+        return false;
+    }
+    if (!sample_config_valid(&cfg)) {
+        *error = "warmup and measure must fit in the period";
+        return false;
+    }
+
+    *out = cfg;
+    return true;
+}
@@ -0,0 +1,221 @@
+#include "ares/snapshot.h"
+
+#include "ares/callsan.h"
+#include "ares/core.h"
+#include "ares/dev.h"
+#include "ares/emulate.h"
+
+typedef struct {
+    u32 regs[32];
+    u32 csr[4096];
+    u32 pc;
+    int privilege_level;
+    bool exited;
+    int exit_code;
+    u64 cycle;
+    u64 instret;
+    u64 hpm_counters[HPM_EVENT_COUNT];
+    u8 mmio[MMIO_STATE_SIZE];
+    u32 gif_used;
+    u32 gif_body_ptr;
+    u32 gif_body_len;
+    u32 reg_bitmap;
+    ARES_ARRAY(ShadowStackEnt) shadow_stack;
+    ARES_ARRAY(u8) callsan_stack_written_by;
+    // sections at the time of the snapshot, used to detect a rebuild
+    ARES_ARRAY(SectionPtr) sections;
+} Snapshot;
+
+static Snapshot g_snapshot;
+static bool g_snapshot_taken;
+
+static size_t snapshot_page_len(Section *sec, size_t page) {
+    size_t off = page * SNAPSHOT_PAGE_SIZE;
+    size_t left = sec->contents.len - off;
+    return left < SNAPSHOT_PAGE_SIZE ? left : SNAPSHOT_PAGE_SIZE;
+}
+
+static void snapshot_untrack_section(Section *sec) {
+    for (size_t i = 0; i < sec->snapshot.npages; i++)
+        free(sec->snapshot.pages[i]);
+    free(sec->snapshot.pages);
+    free(sec->snapshot.dirty);
+    sec->snapshot.pages = NULL;
+    sec->snapshot.dirty = NULL;
+    sec->snapshot.npages = 0;
+}
+
+static void snapshot_track_section(Section *sec) {
+    size_t npages =
+        (sec->contents.len + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+    size_t dirty_size = (npages + 31) / 32 * sizeof(u32);
+
+    // retaking a snapshot keeps the page buffers around, since pages are
+    // copied again on the first store anyway
+    if (sec->snapshot.pages && sec->snapshot.npages == npages) {
+        memset(sec->snapshot.dirty, 0, dirty_size);
+        return;
+    }
+
+    snapshot_untrack_section(sec);
+    if (npages == 0) return;
+
+    sec->snapshot.pages = malloc(npages * sizeof(u8 *));
+    ARES_CHECK_OOM(sec->snapshot.pages);
+    memset(sec->snapshot.pages, 0, npages * sizeof(u8 *));
+    sec->snapshot.dirty = malloc(dirty_size);
+    ARES_CHECK_OOM(sec->snapshot.dirty);
+    memset(sec->snapshot.dirty, 0, dirty_size);
+    sec->snapshot.npages = npages;
+}
+
+static bool snapshot_same_sections() {
+    if (ARES_ARRAY_LEN(&g_snapshot.sections) != ARES_ARRAY_LEN(&g_sections))
+        return false;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++)
+        if (*ARES_ARRAY_GET(&g_snapshot.sections, i) !=
+            *ARES_ARRAY_GET(&g_sections, i))
+            return false;
+    return true;
+}
+
+void snapshot_cow(Section *sec, u32 off, u32 size) {
+    size_t first = off / SNAPSHOT_PAGE_SIZE;
+    size_t last = (off + size - 1) / SNAPSHOT_PAGE_SIZE;
+    for (size_t i = first; i <= last && i < sec->snapshot.npages; i++) {
+        u32 bit = 1u << (i % 32);
+        if (sec->snapshot.dirty[i / 32] & bit) continue;
+        if (!sec->snapshot.pages[i]) {
+            sec->snapshot.pages[i] = malloc(SNAPSHOT_PAGE_SIZE);
+            ARES_CHECK_OOM(sec->snapshot.pages[i]);
+        }
+        memcpy(sec->snapshot.pages[i],
+               sec->contents.buf + i * SNAPSHOT_PAGE_SIZE,
+               snapshot_page_len(sec, i));
+        sec->snapshot.dirty[i / 32] |= bit;
+    }
+}
+
+void snapshot_grow_front(Section *sec, u32 added) {
+    size_t shift = added / SNAPSHOT_PAGE_SIZE;
+    size_t npages = sec->snapshot.npages + shift;
+    size_t dirty_size = (npages + 31) / 32 * sizeof(u32);
+
+    u8 **pages = malloc(npages * sizeof(u8 *));
+    ARES_CHECK_OOM(pages);
+    memset(pages, 0, shift * sizeof(u8 *));
+    memcpy(pages + shift, sec->snapshot.pages,
+           sec->snapshot.npages * sizeof(u8 *));
+    u32 *dirty = malloc(dirty_size);
+    ARES_CHECK_OOM(dirty);
+    memset(dirty, 0, dirty_size);
+    for (size_t i = 0; i < sec->snapshot.npages; i++)
+        if (sec->snapshot.dirty[i / 32] & (1u << (i % 32)))
+            dirty[(i + shift) / 32] |= 1u << ((i + shift) % 32);
+
+    free(sec->snapshot.pages);
+    free(sec->snapshot.dirty);
+    sec->snapshot.pages = pages;
+    sec->snapshot.dirty = dirty;
+    sec->snapshot.npages = npages;
+    // the new pages didn't exist when the snapshot was taken, restoring puts
+    // back their initial contents
+    snapshot_cow(sec, 0, added);
+}
+
+export void emu_snapshot(void) {
+    if (g_snapshot_taken && !snapshot_same_sections()) snapshot_free();
+
+    memcpy(g_snapshot.regs, g_regs, sizeof(g_regs));
+    memcpy(g_snapshot.csr, g_csr, sizeof(g_csr));
+    g_snapshot.pc = g_pc;
+    g_snapshot.privilege_level = emulator_get_privilege_level();
+    g_snapshot.exited = g_exited;
+    g_snapshot.exit_code = g_exit_code;
+    g_snapshot.cycle = g_cycle;
+    g_snapshot.instret = g_instret;
+    memcpy(g_snapshot.hpm_counters, g_hpm_counters, sizeof(g_hpm_counters));
+    mmio_save_state(g_snapshot.mmio);
+    g_snapshot.gif_used = g_gif_used;
+    g_snapshot.gif_body_ptr = g_gif_body_ptr;
+    g_snapshot.gif_body_len = g_gif_body_len;
+
+    g_snapshot.reg_bitmap = g_reg_bitmap;
+    g_snapshot.shadow_stack.len = 0;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_shadow_stack); i++)
+        *ARES_ARRAY_PUSH(&g_snapshot.shadow_stack) =
+            *ARES_ARRAY_GET(&g_shadow_stack, i);
+    g_snapshot.callsan_stack_written_by.len = 0;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_callsan_stack_written_by); i++)
+        *ARES_ARRAY_PUSH(&g_snapshot.callsan_stack_written_by) =
+            *ARES_ARRAY_GET(&g_callsan_stack_written_by, i);
+
+    g_snapshot.sections.len = 0;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
+        Section *sec = *ARES_ARRAY_GET(&g_sections, i);
+        *ARES_ARRAY_PUSH(&g_snapshot.sections) = sec;
+        snapshot_track_section(sec);
+    }
+
+    g_snapshot_taken = true;
+}
+
+export bool emu_restore(void) {
+    if (!g_snapshot_taken || !snapshot_same_sections()) return false;
+
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++) {
+        Section *sec = *ARES_ARRAY_GET(&g_sections, i);
+        for (size_t w = 0; w < (sec->snapshot.npages + 31) / 32; w++) {
+            u32 dirty = sec->snapshot.dirty[w];
+            while (dirty) {
+                size_t page = w * 32 + __builtin_ctz(dirty);
+                memcpy(sec->contents.buf + page * SNAPSHOT_PAGE_SIZE,
+                       sec->snapshot.pages[page],
+                       snapshot_page_len(sec, page));
+                dirty &= dirty - 1;
+            }
+            sec->snapshot.dirty[w] = 0;
+        }
+    }
+
+    memcpy(g_regs, g_snapshot.regs, sizeof(g_regs));
+    memcpy(g_csr, g_snapshot.csr, sizeof(g_csr));
+    g_pc = g_snapshot.pc;
+    emulator_set_privilege_level(g_snapshot.privilege_level);
+    g_exited = g_snapshot.exited;
+    g_exit_code = g_snapshot.exit_code;
+    g_cycle = g_snapshot.cycle;
+    g_instret = g_snapshot.instret;
+    memcpy(g_hpm_counters, g_snapshot.hpm_counters, sizeof(g_hpm_counters));
+    mmio_load_state(g_snapshot.mmio);
+    g_gif_used = g_snapshot.gif_used;
+    g_gif_body_ptr = g_snapshot.gif_body_ptr;
+    g_gif_body_len = g_snapshot.gif_body_len;
+
+    g_reg_bitmap = g_snapshot.reg_bitmap;
+    g_shadow_stack.len = 0;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_snapshot.shadow_stack); i++)
+        *ARES_ARRAY_PUSH(&g_shadow_stack) =
+            *ARES_ARRAY_GET(&g_snapshot.shadow_stack, i);
+    // the stack may have grown since, its new words are poisoned
+    size_t len = ARES_ARRAY_LEN(&g_callsan_stack_written_by);
+    size_t saved = ARES_ARRAY_LEN(&g_snapshot.callsan_stack_written_by);
+    memset(g_callsan_stack_written_by.buf, 0xFF, len - saved);
+    memcpy(g_callsan_stack_written_by.buf + len - saved,
+           g_snapshot.callsan_stack_written_by.buf, saved);
+    callsan_sync();
+
+    g_runtime_error_type = ERROR_NONE;
+    memset(g_runtime_error_params, 0, sizeof(g_runtime_error_params));
+    return true;
+}
+
+void snapshot_free(void) {
+    if (!g_snapshot_taken) return;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_snapshot.sections); i++)
+        snapshot_untrack_section(*ARES_ARRAY_GET(&g_snapshot.sections, i));
+    ARES_ARRAY_FREE(&g_snapshot.sections);
+    ARES_ARRAY_FREE(&g_snapshot.shadow_stack);
+    ARES_ARRAY_FREE(&g_snapshot.callsan_stack_written_by);
+    g_snapshot_taken = false;
+}
@@ -0,0 +1,373 @@
+#include "ares/state.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ares/callsan.h"
+#include "ares/core.h"
+#include "ares/dev.h"
+#include "ares/emulate.h"
+#include "ares/util.h"
+
+#define STATE_ALIGN_UP(x) \
+    (((x) + STATE_PAGE_ALIGN - 1) & ~(size_t)(STATE_PAGE_ALIGN - 1))
+
+static u32 state_strtab_add(ARES_ARRAY(char) *strtab, const char *str,
+                            size_t len) {
+    u32 off = ARES_ARRAY_LEN(strtab);
+    for (size_t i = 0; i < len; i++) *ARES_ARRAY_PUSH(strtab) = str[i];
+    *ARES_ARRAY_PUSH(strtab) = 0;
+    return off;
+}
+
+static bool state_write(FILE *f, const void *buf, size_t sz, size_t *pos) {
+    if (sz && fwrite(buf, 1, sz, f) != sz) return false;
+    *pos += sz;
+    return true;
+}
+
+static bool state_pad(FILE *f, size_t to, size_t *pos) {
+    static const u8 zeros[STATE_PAGE_ALIGN];
+    return state_write(f, zeros, to - *pos, pos);
+}
+
+static u32 state_section_flags(Section *s) {
+    u32 flags = 0;
+    if (s->read) flags |= STATE_SEC_READ;
+    if (s->write) flags |= STATE_SEC_WRITE;
+    if (s->execute) flags |= STATE_SEC_EXECUTE;
+    if (s->super) flags |= STATE_SEC_SUPER;
+    if (s->physical) flags |= STATE_SEC_PHYSICAL;
+    return flags;
+}
+
+static i32 state_section_idx(Section *s) {
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_sections); i++)
+        if (*ARES_ARRAY_GET(&g_sections, i) == s) return i;
+    return -1;
+}
+
+bool state_save(const char *path, char **error) {
+    size_t nsecs = ARES_ARRAY_LEN(&g_sections);
+    size_t nlabels = ARES_ARRAY_LEN(&g_labels);
+    size_t nshadow = ARES_ARRAY_LEN(&g_shadow_stack);
+    size_t ncallsan = ARES_ARRAY_LEN(&g_callsan_stack_written_by);
+    ARES_ARRAY(char) strtab = ARES_ARRAY_NEW(char);
+    StateSection *secs = NULL;
+    StateLabel *labels = NULL;
+    FILE *f = NULL;
+    size_t pos = 0;
+
+    StateHeader *hdr = calloc(1, sizeof(StateHeader));
+    ARES_CHECK_OOM(hdr);
+    secs = calloc(nsecs + 1, sizeof(StateSection));
+    ARES_CHECK_OOM(secs);
+    labels = calloc(nlabels + 1, sizeof(StateLabel));
+    ARES_CHECK_OOM(labels);
+
+    memcpy(hdr->magic, STATE_MAGIC, sizeof(hdr->magic));
+    hdr->version = STATE_VERSION;
+    hdr->header_sz = sizeof(StateHeader);
+    hdr->cycle = g_cycle;
+    hdr->instret = g_instret;
+    memcpy(hdr->hpm_counters, g_hpm_counters, sizeof(g_hpm_counters));
+    hdr->pc = g_pc;
+    hdr->privilege_level = emulator_get_privilege_level();
+    hdr->exited = g_exited;
+    hdr->exit_code = g_exit_code;
+    memcpy(hdr->regs, g_regs, sizeof(hdr->regs));
+    memcpy(hdr->csr, g_csr, sizeof(hdr->csr));
+    mmio_save_state(hdr->mmio);
+    hdr->gif_used = g_gif_used;
+    hdr->gif_body_ptr = g_gif_body_ptr;
+    hdr->gif_body_len = g_gif_body_len;
+    hdr->reg_bitmap = g_reg_bitmap;
+
+    for (size_t i = 0; i < nsecs; i++) {
+        Section *s = *ARES_ARRAY_GET(&g_sections, i);
+        secs[i] = (StateSection){
+            .name_off = state_strtab_add(&strtab, s->name, strlen(s->name)),
+            .base = s->base,
+            .limit = s->limit,
+            .align = s->align,
+            .flags = state_section_flags(s),
+            .contents_sz = ARES_ARRAY_LEN(&s->contents)};
+    }
+
+    for (size_t i = 0; i < nlabels; i++) {
+        LabelData *l = ARES_ARRAY_GET(&g_labels, i);
+        labels[i] = (StateLabel){
+            .name_off = state_strtab_add(&strtab, l->txt, l->len),
+            .name_len = l->len,
+            .addr = l->addr,
+            .section_idx = state_section_idx(l->section)};
+    }
+
+    // compute the layout up front, contents go last so they can be page
+    // aligned without padding the tables
+    pos = sizeof(StateHeader);
+    hdr->sections_off = pos;
+    hdr->sections_num = nsecs;
+    pos += nsecs * sizeof(StateSection);
+    hdr->labels_off = pos;
+    hdr->labels_num = nlabels;
+    pos += nlabels * sizeof(StateLabel);
+    hdr->shadow_stack_off = pos;
+    hdr->shadow_stack_num = nshadow;
+    pos += nshadow * sizeof(ShadowStackEnt);
+    hdr->callsan_off = pos;
+    hdr->callsan_num = ncallsan;
+    pos += ncallsan;
+    hdr->strtab_off = pos;
+    hdr->strtab_sz = ARES_ARRAY_LEN(&strtab);
+    pos += ARES_ARRAY_LEN(&strtab);
+    for (size_t i = 0; i < nsecs; i++) {
+        pos = STATE_ALIGN_UP(pos);
+        secs[i].contents_off = pos;
+        pos += secs[i].contents_sz;
+    }
+
+    f = fopen(path, "wb");
+    if (!f) {
+        *error = "could not open output file";
+        goto fail;
+    }
+
+    pos = 0;
+    ARES_CHECK_CALL(state_write(f, hdr, sizeof(StateHeader), &pos), io_fail);
+    ARES_CHECK_CALL(state_write(f, secs, nsecs * sizeof(StateSection), &pos),
+                    io_fail);
+    ARES_CHECK_CALL(state_write(f, labels, nlabels * sizeof(StateLabel), &pos),
+                    io_fail);
+    ARES_CHECK_CALL(state_write(f, g_shadow_stack.buf,
+                                nshadow * sizeof(ShadowStackEnt), &pos),
+                    io_fail);
+    ARES_CHECK_CALL(
+        state_write(f, g_callsan_stack_written_by.buf, ncallsan, &pos),
+        io_fail);
+    ARES_CHECK_CALL(state_write(f, strtab.buf, strtab.len, &pos), io_fail);
+    for (size_t i = 0; i < nsecs; i++) {
+        Section *s = *ARES_ARRAY_GET(&g_sections, i);
+        ARES_CHECK_CALL(state_pad(f, secs[i].contents_off, &pos), io_fail);
+        ARES_CHECK_CALL(
+            state_write(f, s->contents.buf, secs[i].contents_sz, &pos),
+            io_fail);
+    }
+
+    fclose(f);
+    free(hdr);
+    free(secs);
+    free(labels);
+    ARES_ARRAY_FREE(&strtab);
+    return true;
+
+io_fail:
+    *error = "could not write output file";
+fail:
+    if (f) fclose(f);
+    free(hdr);
+    free(secs);
+    free(labels);
+    ARES_ARRAY_FREE(&strtab);
+    return false;
+}
+
+static bool state_range_ok(size_t off, size_t sz, size_t file_sz) {
+    return off <= file_sz && sz <= file_sz - off;
+}
+
+static void state_bind_section(Section *s) {
+    // the stack's base depends on how far it grew
+    if (s->limit == STACK_TOP) {
+        g_stack = s;
+        return;
+    }
+
+    switch (s->base) {
+        case TEXT_BASE:
+            g_text = s;
+            break;
+        case DATA_BASE:
+            g_data = s;
+            break;
+        case KERNEL_TEXT_BASE:
+            g_kernel_text = s;
+            break;
+        case KERNEL_DATA_BASE:
+            g_kernel_data = s;
+            break;
+        case MMIO_BASE:
+            g_mmio = s;
+            break;
+        case VGA_BASE:
+            g_vga = s;
+            break;
+        case GIF_BASE:
+            g_gif = s;
+            break;
+    }
+}
+
+// The file is mapped privately: guest stores dirty private copies of the
+// pages and never reach the file. The mapping backs section contents and
+// label names, so it stays alive until the process exits.
+bool state_load(const char *path, char **error) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *error = "could not open input file";
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        *error = "could not stat input file";
+        return false;
+    }
+
+    size_t sz = st.st_size;
+    if (sz < sizeof(StateHeader)) {
+        close(fd);
+        *error = "corrupt or truncated state file";
+        return false;
+    }
+
+    u8 *map = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        *error = "could not map input file";
+        return false;
+    }
+
+    StateHeader *hdr = (StateHeader *)map;
+    if (memcmp(hdr->magic, STATE_MAGIC, sizeof(hdr->magic)) != 0) {
+        *error = "not an ares state file";
+        goto fail;
+    }
+
+    if (hdr->version != STATE_VERSION ||
+        hdr->header_sz != sizeof(StateHeader)) {
+        *error = "unsupported state file version";
+        goto fail;
+    }
+
+    if (!state_range_ok(hdr->sections_off,
+                        (size_t)hdr->sections_num * sizeof(StateSection),
+                        sz) ||
+        !state_range_ok(hdr->labels_off,
+                        (size_t)hdr->labels_num * sizeof(StateLabel), sz) ||
+        !state_range_ok(hdr->shadow_stack_off,
+                        (size_t)hdr->shadow_stack_num * sizeof(ShadowStackEnt),
+                        sz) ||
+        !state_range_ok(hdr->callsan_off, hdr->callsan_num, sz) ||
+        !state_range_ok(hdr->strtab_off, hdr->strtab_sz, sz) ||
+        (hdr->strtab_sz && map[hdr->strtab_off + hdr->strtab_sz - 1] != 0)) {
+        *error = "corrupt or truncated state file";
+        goto fail;
+    }
+
+    StateSection *secs = (StateSection *)(map + hdr->sections_off);
+    StateLabel *labels = (StateLabel *)(map + hdr->labels_off);
+    ShadowStackEnt *shadow = (ShadowStackEnt *)(map + hdr->shadow_stack_off);
+    const char *strtab = (const char *)(map + hdr->strtab_off);
+
+    StateSection *stack = NULL;
+    for (u32 i = 0; i < hdr->sections_num; i++) {
+        StateSection *ss = &secs[i];
+        if (ss->name_off >= hdr->strtab_sz ||
+            ss->contents_off % STATE_PAGE_ALIGN != 0 ||
+            !state_range_ok(ss->contents_off, ss->contents_sz, sz) ||
+            ss->limit < ss->base ||
+            ss->contents_sz > ss->limit - ss->base) {
+            *error = "corrupt section in state file";
+            goto fail;
+        }
+        if (ss->limit == STACK_TOP) stack = ss;
+    }
+
+    // the stack is mapped down from STACK_TOP, and callsan tracks every one
+    // of its words
+    if (!stack || stack->contents_sz < STACK_LEN ||
+        stack->base != STACK_TOP - stack->contents_sz ||
+        hdr->callsan_num != stack->contents_sz / 4) {
+        *error = "corrupt stack in state file";
+        goto fail;
+    }
+
+    for (u32 i = 0; i < hdr->labels_num; i++) {
+        StateLabel *sl = &labels[i];
+        if (!state_range_ok(sl->name_off, sl->name_len, hdr->strtab_sz) ||
+            sl->section_idx < -1 || sl->section_idx >= (i32)hdr->sections_num) {
+            *error = "corrupt label in state file";
+            goto fail;
+        }
+    }
+
+    size_t first_sec = ARES_ARRAY_LEN(&g_sections);
+    for (u32 i = 0; i < hdr->sections_num; i++) {
+        StateSection *ss = &secs[i];
+        Section *s = section_alloc();
+        s->name = strtab + ss->name_off;
+        s->base = ss->base;
+        s->limit = ss->limit;
+        s->align = ss->align;
+        s->read = ss->flags & STATE_SEC_READ;
+        s->write = ss->flags & STATE_SEC_WRITE;
+        s->execute = ss->flags & STATE_SEC_EXECUTE;
+        s->super = ss->flags & STATE_SEC_SUPER;
+        s->physical = ss->flags & STATE_SEC_PHYSICAL;
+        s->contents.len = s->contents.cap = ss->contents_sz;
+        s->contents.buf = ss->contents_sz ? map + ss->contents_off : NULL;
+        s->emit_idx = ss->contents_sz;
+        s->mapped = true;
+        *ARES_ARRAY_PUSH(&g_sections) = s;
+        state_bind_section(s);
+    }
+
+    for (u32 i = 0; i < hdr->labels_num; i++) {
+        StateLabel *sl = &labels[i];
+        Section *sec = NULL;
+        if (sl->section_idx >= 0)
+            sec = *ARES_ARRAY_GET(&g_sections, first_sec + sl->section_idx);
+        *ARES_ARRAY_PUSH(&g_labels) = (LabelData){.txt = strtab + sl->name_off,
+                                                  .len = sl->name_len,
+                                                  .addr = sl->addr,
+                                                  .section = sec};
+    }
+
+    memcpy(g_regs, hdr->regs, sizeof(g_regs));
+    memcpy(g_csr, hdr->csr, sizeof(g_csr));
+    g_pc = hdr->pc;
+    emulator_set_privilege_level(hdr->privilege_level);
+    g_exited = hdr->exited;
+    g_exit_code = hdr->exit_code;
+    mmio_load_state(hdr->mmio);
+    g_gif_used = hdr->gif_used;
+    g_gif_body_ptr = hdr->gif_body_ptr;
+    g_gif_body_len = hdr->gif_body_len;
+
+    g_reg_bitmap = hdr->reg_bitmap;
+    g_shadow_stack.len = 0;
+    for (u32 i = 0; i < hdr->shadow_stack_num; i++)
+        *ARES_ARRAY_PUSH(&g_shadow_stack) = shadow[i];
+    callsan_reset_stack(hdr->callsan_num);
+    memcpy(g_callsan_stack_written_by.buf, map + hdr->callsan_off,
+           hdr->callsan_num);
+    callsan_sync();
+
+    g_runtime_error_type = ERROR_NONE;
+    g_cycle = hdr->cycle;
+    g_instret = hdr->instret;
+    memcpy(g_hpm_counters, hdr->hpm_counters, sizeof(g_hpm_counters));
+    return true;
+
+fail:
+    munmap(map, sz);
+    return false;
+}
@@ -0,0 +1,326 @@
+#include "ares/trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ares/core.h"
+#include "ares/emulate.h"
+#include "ares/util.h"
+
+#define TRACE_BUF_SIZE (1 << 20)
+// flags + 4 varints + 3 bytes, rounded up
+#define TRACE_MAX_RECORD 32
+
+// Records are encoded by the emulator thread into one buffer while the
+// writer thread flushes the other one, so emulation only blocks on I/O when
+// the disk can't keep up
+typedef struct {
+    FILE *f;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    u8 *bufs[2];
+    int cur;
+    size_t len;
+    u8 *pending;
+    size_t pending_len;
+    bool done;
+    bool io_error;
+    u32 prev_pc;
+    u32 prev_addr;
+} Tracer;
+
+static Tracer g_tracer;
+
+static inline u32 zigzag(u32 delta) {
+    return (delta << 1) ^ (u32)((i32)delta >> 31);
+}
+
+static inline u32 unzigzag(u32 v) { return (v >> 1) ^ -(v & 1); }
+
+static inline u8 *put_varint(u8 *p, u32 v) {
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static void *trace_writer(void *arg) {
+    pthread_mutex_lock(&g_tracer.lock);
+    while (true) {
+        while (!g_tracer.pending && !g_tracer.done)
+            pthread_cond_wait(&g_tracer.cond, &g_tracer.lock);
+        if (!g_tracer.pending) break;
+
+        u8 *buf = g_tracer.pending;
+        size_t len = g_tracer.pending_len;
+        pthread_mutex_unlock(&g_tracer.lock);
+        bool ok = fwrite(buf, 1, len, g_tracer.f) == len;
+        pthread_mutex_lock(&g_tracer.lock);
+
+        if (!ok) g_tracer.io_error = true;
+        g_tracer.pending = NULL;
+        pthread_cond_broadcast(&g_tracer.cond);
+    }
+    pthread_mutex_unlock(&g_tracer.lock);
+    return NULL;
+}
+
+static void trace_flush(void) {
+    pthread_mutex_lock(&g_tracer.lock);
+    while (g_tracer.pending)
+        pthread_cond_wait(&g_tracer.cond, &g_tracer.lock);
+    g_tracer.pending = g_tracer.bufs[g_tracer.cur];
+    g_tracer.pending_len = g_tracer.len;
+    pthread_cond_broadcast(&g_tracer.cond);
+    pthread_mutex_unlock(&g_tracer.lock);
+
+    g_tracer.cur ^= 1;
+    g_tracer.len = 0;
+}
+
+bool trace_open(const char *path, char **error) {
+    g_tracer = (Tracer){0};
+    g_tracer.f = fopen(path, "wb");
+    if (!g_tracer.f) {
+        *error = "could not open output file";
+        return false;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        g_tracer.bufs[i] = malloc(TRACE_BUF_SIZE);
+        ARES_CHECK_OOM(g_tracer.bufs[i]);
+    }
+
+    // the header goes through the buffer like everything else, labels are
+    // flushed early if there are a lot of them
+    u8 *buf = g_tracer.bufs[0];
+    memcpy(buf, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    g_tracer.len = sizeof(TRACE_MAGIC);
+    u32 version = TRACE_VERSION;
+    ares_buf_write(buf + g_tracer.len, 4, version);
+    g_tracer.len += 4;
+
+    pthread_mutex_init(&g_tracer.lock, NULL);
+    pthread_cond_init(&g_tracer.cond, NULL);
+    pthread_create(&g_tracer.thread, NULL, trace_writer, NULL);
+
+    u8 *p = put_varint(buf + g_tracer.len, ARES_ARRAY_LEN(&g_labels));
+    g_tracer.len = p - buf;
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_labels); i++) {
+        LabelData *l = ARES_ARRAY_GET(&g_labels, i);
+        size_t len = l->len;
+        if (len > TRACE_BUF_SIZE - 2 * TRACE_MAX_RECORD)
+            len = TRACE_BUF_SIZE - 2 * TRACE_MAX_RECORD;
+        if (g_tracer.len + len + TRACE_MAX_RECORD > TRACE_BUF_SIZE)
+            trace_flush();
+        buf = g_tracer.bufs[g_tracer.cur];
+        p = put_varint(buf + g_tracer.len, l->addr);
+        p = put_varint(p, len);
+        memcpy(p, l->txt, len);
+        g_tracer.len = p + len - buf;
+    }
+
+    g_tracer.prev_pc = TEXT_BASE;
+    return true;
+}
+
+void trace_record(void) {
+    u8 *buf = g_tracer.bufs[g_tracer.cur];
+    u8 *p = buf + g_tracer.len;
+    bool ok = g_runtime_error_type == ERROR_NONE;
+
+    u8 flags = 0;
+    if (ok && g_reg_written) flags |= TRACE_REG;
+    if (ok && g_mem_read_len) flags |= TRACE_LOAD;
+    if (ok && g_mem_written_len) flags |= TRACE_STORE;
+    if (g_trap_taken) flags |= TRACE_TRAP;
+    if (!ok) flags |= TRACE_ERROR;
+
+    *p++ = flags;
+    p = put_varint(p, zigzag(g_fetch_pc - g_tracer.prev_pc));
+    g_tracer.prev_pc = g_fetch_pc;
+
+    if (flags & TRACE_REG) {
+        *p++ = g_reg_written;
+        p = put_varint(p, g_regs[g_reg_written]);
+    }
+    if (flags & TRACE_LOAD) {
+        p = put_varint(p, zigzag(g_mem_read_addr - g_tracer.prev_addr));
+        *p++ = g_mem_read_len;
+        g_tracer.prev_addr = g_mem_read_addr;
+    }
+    if (flags & TRACE_STORE) {
+        p = put_varint(p, zigzag(g_mem_written_addr - g_tracer.prev_addr));
+        *p++ = g_mem_written_len;
+        g_tracer.prev_addr = g_mem_written_addr;
+    }
+    if (flags & TRACE_TRAP) p = put_varint(p, g_trap_cause);
+    if (flags & TRACE_ERROR) *p++ = g_runtime_error_type;
+
+    g_tracer.len = p - buf;
+    if (g_tracer.len > TRACE_BUF_SIZE - TRACE_MAX_RECORD) trace_flush();
+}
+
+bool trace_close(char **error) {
+    if (g_tracer.len) trace_flush();
+
+    pthread_mutex_lock(&g_tracer.lock);
+    g_tracer.done = true;
+    pthread_cond_broadcast(&g_tracer.cond);
+    pthread_mutex_unlock(&g_tracer.lock);
+    pthread_join(g_tracer.thread, NULL);
+
+    pthread_mutex_destroy(&g_tracer.lock);
+    pthread_cond_destroy(&g_tracer.cond);
+    bool ok = !g_tracer.io_error && fclose(g_tracer.f) == 0;
+    if (g_tracer.io_error) fclose(g_tracer.f);
+    free(g_tracer.bufs[0]);
+    free(g_tracer.bufs[1]);
+    g_tracer = (Tracer){0};
+
+    if (!ok) *error = "could not write output file";
+    return ok;
+}
+
+// DECODER
+
+static bool get_varint(FILE *f, u32 *out) {
+    u32 v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int c = getc(f);
+        if (c == EOF) return false;
+        v |= (u32)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool get_u8(FILE *f, u32 *out) {
+    int c = getc(f);
+    if (c == EOF) return false;
+    *out = c;
+    return true;
+}
+
+static void print_pc(FILE *out, u32 pc) {
+    LabelData *label;
+    u32 off;
+    fprintf(out, "0x%08x", pc);
+    if (pc_to_label_r(pc, &label, &off))
+        fprintf(out, " <%.*s+0x%x>", (int)label->len, label->txt, off);
+}
+
+bool trace_decode(const char *path, FILE *out, char **error) {
+    FILE *f = fopen(path, "rb");
+    char *names = NULL;
+    bool ok = false;
+
+    if (!f) {
+        *error = "could not open input file";
+        return false;
+    }
+
+    u8 hdr[sizeof(TRACE_MAGIC) + 4];
+    if (fread(hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        *error = "not an ares trace file";
+        goto exit;
+    }
+
+    u32 version;
+    ares_buf_read(hdr + sizeof(TRACE_MAGIC), 4, &version);
+    if (version != TRACE_VERSION) {
+        *error = "unsupported trace file version";
+        goto exit;
+    }
+
+    // label names are read into one buffer so g_labels can point into it
+    u32 nlabels;
+    ARES_CHECK_CALL(get_varint(f, &nlabels), corrupt);
+    ARES_ARRAY(char) strs = ARES_ARRAY_NEW(char);
+    ARES_ARRAY(LabelData) labels = ARES_ARRAY_NEW(LabelData);
+    for (u32 i = 0; i < nlabels; i++) {
+        u32 addr, len;
+        if (!get_varint(f, &addr) || !get_varint(f, &len)) goto corrupt_labels;
+        size_t off = ARES_ARRAY_LEN(&strs);
+        for (u32 j = 0; j < len; j++) {
+            int c = getc(f);
+            if (c == EOF) goto corrupt_labels;
+            *ARES_ARRAY_PUSH(&strs) = c;
+        }
+        // the pointer is fixed up below, strs may still move
+        *ARES_ARRAY_PUSH(&labels) =
+            (LabelData){.txt = (const char *)off, .len = len, .addr = addr};
+    }
+    names = strs.buf;
+    ARES_ARRAY_FREE(&g_labels);
+    g_labels = labels;
+    symtab_clear();
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_labels); i++) {
+        LabelData *l = ARES_ARRAY_GET(&g_labels, i);
+        l->txt = names + (size_t)l->txt;
+    }
+
+    u32 pc = TEXT_BASE, addr = 0;
+    u32 flags;
+    while (get_u8(f, &flags)) {
+        u32 delta, v, size;
+        ARES_CHECK_CALL(get_varint(f, &delta), corrupt);
+        pc += unzigzag(delta);
+        print_pc(out, pc);
+
+        if (flags & TRACE_REG) {
+            ARES_CHECK_CALL(get_u8(f, &v), corrupt);
+            ARES_CHECK_CALL(get_varint(f, &delta), corrupt);
+            if (v >= 32) goto corrupt;
+            fprintf(out, "  %s=0x%08x", REGISTER_NAMES[v], delta);
+        }
+        if (flags & TRACE_LOAD) {
+            ARES_CHECK_CALL(get_varint(f, &delta), corrupt);
+            ARES_CHECK_CALL(get_u8(f, &size), corrupt);
+            addr += unzigzag(delta);
+            fprintf(out, "  load%u [0x%08x]", size, addr);
+        }
+        if (flags & TRACE_STORE) {
+            ARES_CHECK_CALL(get_varint(f, &delta), corrupt);
+            ARES_CHECK_CALL(get_u8(f, &size), corrupt);
+            addr += unzigzag(delta);
+            fprintf(out, "  store%u [0x%08x]", size, addr);
+        }
+        if (flags & TRACE_TRAP) {
+            ARES_CHECK_CALL(get_varint(f, &v), corrupt);
+            fprintf(out, "  trap cause=0x%08x", v);
+        }
+        if (flags & TRACE_ERROR) {
+            ARES_CHECK_CALL(get_u8(f, &v), corrupt);
+            fprintf(out, "  error %u", v);
+        }
+        fputc('\n', out);
+    }
+
+    ok = true;
+    goto exit;
+
+corrupt_labels:
+    ARES_ARRAY_FREE(&strs);
+    ARES_ARRAY_FREE(&labels);
+corrupt:
+    *error = "corrupt or truncated trace file";
+exit:
+    fclose(f);
+    // labels point into names
+    if (names) {
+        ARES_ARRAY_FREE(&g_labels);
+        symtab_clear();
+    }
+    free(names);
+    return ok;
+}
@@ -58,4 +58,19 @@ void *memset(void *dest, int c, size_t n) {
 
     return dest;
 }
+
+// the webui copies the initial memory (128 pages) back before every build,
+// where the heap is zero, and memory.grow returns zeroed pages. Only memory
+// grown during an earlier build can hold stale data
+#define WASM_INITIAL_SIZE (128 << 16)
+void *calloc(size_t n, size_t size) {
+    size_t bytes = n * size;
+    size_t mem = __builtin_wasm_memory_size(0) << 16;
+    uint8_t *alloc = malloc(bytes);
+    size_t start = (size_t)alloc, end = start + bytes;
+    if (start < WASM_INITIAL_SIZE) start = WASM_INITIAL_SIZE;
+    if (end > mem) end = mem;
+    if (start < end) memset((void *)start, 0, end - start);
+    return alloc;
+}
 #endif
\ No newline at end of file
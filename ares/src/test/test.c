@@ -4,6 +4,18 @@
 #include <stdbool.h>
 #include "../exec/ares/emulate.h"
 #include "../exec/ares/core.h"
+#include "../exec/ares/elf.h"
+#include "../exec/ares/latency.h"
+#include "../exec/ares/ooo.h"
+#include "../exec/ares/bpred.h"
+#include "../exec/ares/cache.h"
+#include "../exec/ares/pipeline.h"
+#include "../exec/ares/profile.h"
+#include "../exec/ares/reuse.h"
+#include "../exec/ares/sample.h"
+#include "../exec/ares/snapshot.h"
+#include "../exec/ares/state.h"
+#include "../exec/ares/trace.h"
 
 void setUp(void) {}
 void tearDown(void) {
@@ -287,6 +299,46 @@ void test_parse_directives_str() {
     free_runtime();
 }
 
+void test_parse_directives_fill() {
+    assemble_line(".data\nbuf: .space 3, 7\n.zero 2\n.fill 2, 2, 0x1234\n"
+                  ".asciz \"\"\n.word 5");
+    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    TEST_ASSERT_EQUAL_INT(g_data->contents.len, 3 + 2 + 4 + 1 + 4);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY("\7\7\7\0\0\x34\x12\x34\x12\0\5\0\0\0",
+                                 g_data->contents.buf, g_data->contents.len);
+    free_runtime();
+
+    assemble_line(".data\n.fill 2, 3");
+    TEST_ASSERT_EQUAL_STRING(g_error, "Invalid size");
+    free_runtime();
+
+    assemble_line(".data\n.space 0x7fffffff");
+    TEST_ASSERT_EQUAL_STRING(g_error, "Section overflow");
+}
+
+void test_parse_directives_incbin() {
+    static const u8 blob[] = {1, 2, 3, 4, 5};
+    incbin_register("sprite", 6, blob, sizeof(blob));
+    assemble_line(".data\n.byte 9\n.incbin \"sprite\", 1, 3\n.incbin \"sprite\"");
+    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY("\11\2\3\4\1\2\3\4\5", g_data->contents.buf,
+                                 g_data->contents.len);
+    free_runtime();
+
+    // natively, unregistered names are files
+    FILE *f = fopen("incbin_test.bin", "wb");
+    fwrite("abc", 1, 3, f);
+    fclose(f);
+    assemble_line(".data\n.incbin \"incbin_test.bin\", 1");
+    remove("incbin_test.bin");
+    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    TEST_ASSERT_EQUAL_STR("bc", g_data->contents.buf, g_data->contents.len);
+    free_runtime();
+
+    assemble_line(".data\n.incbin \"missing.bin\"");
+    TEST_ASSERT_EQUAL_STRING(g_error, "File not found");
+}
+
 void test_parse_multiple_definitions() {
     assemble_line(".data\nvar: .word 5\nvar: .word 10");
     TEST_ASSERT_EQUAL_STRING(g_error, "Multiple definitions for the same label");
@@ -317,6 +369,94 @@ void test_resolve_data_symbol_found(void) {
     TEST_ASSERT_TRUE(addr >= g_data->base && addr < g_data->limit);
 }
 
+// enough labels for the symbol index to grow a few times
+void test_resolve_many_symbols(void) {
+    static char prog[4000 * 24];
+    char *p = prog;
+    p += sprintf(p, ".globl l1234\nj l3999\n");
+    for (int i = 0; i < 4000; i++) p += sprintf(p, "l%d: xori a0, a0, %d\n", i, i & 7);
+    assemble_line(prog);
+    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+
+    u32 addr;
+    TEST_ASSERT_TRUE(resolve_symbol("l3999", 5, false, &addr, NULL));
+    TEST_ASSERT_EQUAL_UINT32(g_text->base + 4 + 3999 * 4, addr);
+    TEST_ASSERT_TRUE(resolve_symbol("l1234", 5, true, &addr, NULL));
+    TEST_ASSERT_EQUAL_UINT32(g_text->base + 4 + 1234 * 4, addr);
+    TEST_ASSERT_FALSE(resolve_symbol("l1235", 5, true, &addr, NULL));
+    TEST_ASSERT_FALSE(resolve_symbol("l4000", 5, false, &addr, NULL));
+
+    free_runtime();
+    p += sprintf(p, "l2000: nop\n");
+    assemble_line(prog);
+    TEST_ASSERT_EQUAL_STRING(g_error, "Multiple definitions for the same label");
+}
+
+static bool lint_text(const char *txt) {
+    size_t len = strlen(txt);
+    memcpy(lint_buffer(len), txt, len);
+    return lint(len);
+}
+
+void test_lint_incremental(void) {
+    static char prog[200 * 24];
+    char *p = prog;
+    p += sprintf(p, "j l199\n");
+    for (int i = 0; i < 200; i++) p += sprintf(p, "l%d: xori a0, a0, %d\n", i, i & 7);
+    p += sprintf(p, "j l0\n");
+    TEST_ASSERT_TRUE(lint_text(prog));
+    TEST_ASSERT_EQUAL(0, g_lint_diagnostics.len);
+    TEST_ASSERT_TRUE(g_lint_parsed > 200);
+
+    char *line = strstr(prog, "l100: xori");
+    memcpy(line, "l100: xorj", 10);
+    TEST_ASSERT_TRUE(lint_text(prog));
+    TEST_ASSERT_EQUAL(1, g_lint_diagnostics.len);
+    TEST_ASSERT_EQUAL_STRING("Unknown opcode", g_lint_diagnostics.buf[0].msg);
+    TEST_ASSERT_EQUAL_UINT32(102, g_lint_diagnostics.buf[0].line);
+    TEST_ASSERT_TRUE(g_lint_parsed < 10);
+
+    memcpy(line, "l3:   xori", 10);
+    TEST_ASSERT_TRUE(lint_text(prog));
+    TEST_ASSERT_EQUAL(1, g_lint_diagnostics.len);
+    TEST_ASSERT_EQUAL_STRING("Multiple definitions for the same label", g_lint_diagnostics.buf[0].msg);
+    TEST_ASSERT_EQUAL_UINT32(102, g_lint_diagnostics.buf[0].line);
+
+    memcpy(line, "l100: xori", 10);
+    TEST_ASSERT_TRUE(lint_text(prog));
+    TEST_ASSERT_EQUAL(0, g_lint_diagnostics.len);
+
+    memcpy(strstr(prog, "l199:"), "     ", 5);
+    TEST_ASSERT_TRUE(lint_text(prog));
+    TEST_ASSERT_EQUAL(1, g_lint_diagnostics.len);
+    TEST_ASSERT_EQUAL_STRING("Label not found", g_lint_diagnostics.buf[0].msg);
+    TEST_ASSERT_EQUAL_UINT32(1, g_lint_diagnostics.buf[0].line);
+    TEST_ASSERT_TRUE(g_lint_parsed < 10);
+
+    TEST_ASSERT_TRUE(lint_text(prog + 7));
+    TEST_ASSERT_EQUAL(0, g_lint_diagnostics.len);
+    TEST_ASSERT_TRUE(g_lint_parsed < 10);
+}
+
+void test_lint_diagnostics(void) {
+    TEST_ASSERT_TRUE(lint_text("xori a0, a0, 1\n  bogus a0\nl: j nowhere\n"
+                               "l: addi a0, a0, 1\n  .byte 300\n"));
+    TEST_ASSERT_EQUAL(4, g_lint_diagnostics.len);
+    Diagnostic *d = g_lint_diagnostics.buf;
+    TEST_ASSERT_EQUAL_STRING("Unknown opcode", d[0].msg);
+    TEST_ASSERT_EQUAL_UINT32(2, d[0].line);
+    TEST_ASSERT_EQUAL_UINT32(3, d[0].col);
+    TEST_ASSERT_EQUAL_STRING("Label not found", d[1].msg);
+    TEST_ASSERT_EQUAL_UINT32(3, d[1].line);
+    TEST_ASSERT_EQUAL_UINT32(4, d[1].col);
+    TEST_ASSERT_EQUAL_STRING("Multiple definitions for the same label", d[2].msg);
+    TEST_ASSERT_EQUAL_UINT32(4, d[2].line);
+    TEST_ASSERT_EQUAL_UINT32(1, d[2].col);
+    TEST_ASSERT_EQUAL_STRING("Out of bounds byte", d[3].msg);
+    TEST_ASSERT_EQUAL_UINT32(5, d[3].line);
+    TEST_ASSERT_EQUAL_UINT32(3, d[3].col);
+}
+
 void test_pc_to_label_r2(void) {
     assemble_line("label: add x0, x0, x0");
     LabelData *ret = NULL;
@@ -337,7 +477,8 @@ void test_pc_to_label_r_no_label(void) {
 void test_fixup(void) {
     assemble_line("j exit\nexit:");
     bool err;
-    TEST_ASSERT_EQUAL_INT(LOAD(g_text->base, 4, &err), 0x0040006f);
+    // c.j 2, once relaxed
+    TEST_ASSERT_EQUAL_INT(LOAD(g_text->base, 2, &err), 0xa009);
     TEST_ASSERT_FALSE(err);
 }
 
@@ -345,10 +486,69 @@ void test_backtrack(void) {
     assemble_line("j .exit\n.exit:");
     TEST_ASSERT_EQUAL_STRING(g_error, NULL);
     bool err;
-    TEST_ASSERT_EQUAL_INT(LOAD(g_text->base, 4, &err), 0x0040006f);
+    TEST_ASSERT_EQUAL_INT(LOAD(g_text->base, 2, &err), 0xa009);
     TEST_ASSERT_FALSE(err);
 }
 
+void test_relax(void) {
+    assemble_line("\
+.data\n\
+pad: .word 0\n\
+msg: .word 42\n\
+.text\n\
+    beqz a0, skip\n\
+    .fill 200, 4, 0x13\n\
+skip:\n\
+    beqz a0, near\n\
+near:\n\
+    la a1, msg\n\
+    j end\n\
+end:\n\
+");
+    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    u32 skip, near, end;
+    TEST_ASSERT_TRUE(resolve_symbol("skip", 4, false, &skip, NULL));
+    TEST_ASSERT_TRUE(resolve_symbol("near", 4, false, &near, NULL));
+    TEST_ASSERT_TRUE(resolve_symbol("end", 3, false, &end, NULL));
+    // too far for c.beqz
+    TEST_ASSERT_EQUAL_UINT32(g_text->base + 4 + 800, skip);
+    TEST_ASSERT_EQUAL_UINT32(skip + 2, near);
+    // la keeps its addi, msg's low bits don't fit c.addi, then c.j
+    TEST_ASSERT_EQUAL_UINT32(near + 8 + 2, end);
+    TEST_ASSERT_EQUAL_UINT32(end - g_text->base, g_text->contents.len);
+    TEST_ASSERT_EQUAL_UINT32((end - g_text->base - 800) / 2,
+                             g_text_by_linenum.len);
+}
+
+void test_relax_externs(void) {
+    const char *src = "\
+.globl _start\n\
+_start:\n\
+    j next\n\
+next:\n\
+    jal ext_fn\n\
+    la a0, ext_data\n\
+    addi a0, a0, 1\n\
+";
+    assemble(src, strlen(src), true);
+    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    // c.j, then the placeholders for the externs stay uncompressed and
+    // relative to where they moved
+    TEST_ASSERT_EQUAL_UINT32(16, g_text->contents.len);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY("\x09\xa0\xef\xf0\xff\xff\x17\x05"
+                                 "\xc0\xff\x13\x05\xa5\xff\x05\x05",
+                                 g_text->contents.buf, 16);
+
+    Relocation *r = g_text->relocations.buf;
+    TEST_ASSERT_EQUAL(3, g_text->relocations.len);
+    TEST_ASSERT_EQUAL(2, r[0].offset);
+    TEST_ASSERT_EQUAL(R_RISCV_JAL, r[0].type);
+    TEST_ASSERT_EQUAL(6, r[1].offset);
+    TEST_ASSERT_EQUAL(R_RISCV_HI20, r[1].type);
+    TEST_ASSERT_EQUAL(10, r[2].offset);
+    TEST_ASSERT_EQUAL(R_RISCV_LO12_I, r[2].type);
+}
+
 void test_dotlabel_fail(void) {
     assemble_line("j .data\n.data:");
     TEST_ASSERT_EQUAL_STRING(g_error, "Label not found");
@@ -381,13 +581,50 @@ addi x0, x0, 3 \n\
     TEST_ASSERT_EQUAL_INT(g_text_by_linenum.buf[2], 4);
 }
 
+void test_lex_long_runs(void) {
+    assemble_line("\
+                                        \n\
+\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\n\
+# a hash comment well past sixteen bytes\n\
+/* a block comment\n\
+\n\
+   spanning lines, with * and / inside */\n\
+a_label_longer_than_sixteen_chars:   // trailing comment past the block\n\
+    addi a0, a0, 1                                  \n\
+    j a_label_longer_than_sixteen_chars\n\
+");
+    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    u32 addr;
+    TEST_ASSERT_TRUE(resolve_symbol("a_label_longer_than_sixteen_chars", 33,
+                                    false, &addr, NULL));
+    TEST_ASSERT_EQUAL_UINT32(g_text->base, addr);
+    TEST_ASSERT_EQUAL_INT(8, g_text_by_linenum.buf[0]);
+
+    assemble_line("/* one\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n two */\n"
+                  "                                        \n\n\n\n\n\n\n\n"
+                  "\n\n\n\n\n\n\n\n\n\n\n\n  bogus a0\n");
+    TEST_ASSERT_EQUAL_STRING("Unknown opcode", g_error);
+    TEST_ASSERT_EQUAL_UINT32(41, g_error_line);
+}
+
 // -- runtime tests
 
-void build_and_run(const char* txt) {
+// assembles txt and starts at _start, if there is one
+void build(const char* txt) {
     u32 addr;
     assemble(txt, strlen(txt), false);
     TEST_ASSERT_EQUAL_STRING(g_error, NULL);
     if (resolve_symbol("_start", strlen("_start"), true, &addr, NULL)) g_pc = addr;
+}
+// runs the guest until it exits, failing on any runtime error
+void run_to_exit(void) {
+    while (!g_exited) {
+        emulate();
+        TEST_ASSERT_EQUAL(ERROR_NONE, g_runtime_error_type);
+    }
+}
+void build_and_run(const char* txt) {
+    build(txt);
     while (!g_exited) {
         emulate();
         if (g_runtime_error_type != ERROR_NONE) break;
@@ -398,6 +635,31 @@ void check_pc_at_label(const char* label) {
     TEST_ASSERT_TRUE(resolve_symbol(label, strlen(label), false, &addr, NULL));
     TEST_ASSERT_EQUAL(g_pc, addr);
 }
+void test_relax_run(void) {
+    build_and_run("\
+.data\n\
+pad: .word 0\n\
+msg: .word 42\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    li a0, 0\n\
+    beqz a0, skip\n\
+    li a0, 1\n\
+skip:\n\
+    la a1, msg\n\
+    lw a2, 0(a1)\n\
+    j done\n\
+    li a2, 0\n\
+done:\n\
+    li a7, 93\n\
+    ecall\n\
+");
+    TEST_ASSERT_EQUAL(g_runtime_error_type, ERROR_NONE);
+    TEST_ASSERT_EQUAL_UINT32(0, g_regs[REG_A0]);
+    TEST_ASSERT_EQUAL_UINT32(42, g_regs[REG_A2]);
+}
+
 void test_runtime_exit() {
     build_and_run("li a7, 93\necall");
     TEST_ASSERT_EQUAL(g_runtime_error_type, ERROR_NONE);
@@ -508,6 +770,38 @@ _start:             \n\
     check_pc_at_label("E");
 }
 
+// the frames of a deep recursion are poisoned once it returns, but what a
+// callee stored in its caller's frame stays readable
+void test_callsan_poison_recursion() {
+    build_and_run("\
+fn:                    \n\
+    addi sp, sp, -8    \n\
+    sw ra, 4(sp)       \n\
+    sw a0, 0(sp)       \n\
+    beq a0, zero, done \n\
+    addi a0, a0, -1    \n\
+    jal fn             \n\
+    lw a0, 0(sp)       \n\
+done:                  \n\
+    lw ra, 4(sp)       \n\
+    addi sp, sp, 8     \n\
+    ret                \n\
+put:                   \n\
+    sw a0, 0(sp)       \n\
+    ret                \n\
+.globl _start          \n\
+_start:                \n\
+    addi sp, sp, -4    \n\
+    li a0, 100         \n\
+    jal fn             \n\
+    jal put            \n\
+    lw t0, 0(sp)       \n\
+E:  lw t1, -400(sp)    \n\
+");
+    TEST_ASSERT_EQUAL(g_runtime_error_type, ERROR_CALLSAN_LOAD_STACK);
+    check_pc_at_label("E");
+}
+
 void test_registers_and_arithmetic(void) {
     build_and_run("\
 .globl _start\n\
@@ -521,6 +815,26 @@ _start:\n\
     TEST_ASSERT_EQUAL_UINT32((u32)-3, g_regs[REG_A1]);
 }
 
+// mnemonics are looked up case insensitively, slti used to be shadowed by slt
+void test_opcode_lookup(void) {
+    build_and_run("\
+.globl _start\n\
+_start:\n\
+    ADDI a1, x0, 3\n\
+    Slti a0, a1, 5\n\
+    sltiu a2, a1, 2\n\
+    c.li a3, 7\n\
+    li a7, 93\n\
+    ecall\n\
+");
+    TEST_ASSERT_EQUAL_UINT32(1, g_regs[REG_A0]);
+    TEST_ASSERT_EQUAL_UINT32(0, g_regs[REG_A2]);
+    TEST_ASSERT_EQUAL_UINT32(7, g_regs[REG_A3]);
+    free_runtime();
+    assemble_line("c.addi4spnx a0, sp, 4");
+    TEST_ASSERT_EQUAL_STRING(g_error, "Unknown opcode");
+}
+
 void test_stack_store_load(void) {
     build_and_run("\
 .globl _start\n\
@@ -548,8 +862,7 @@ void test_load_store_api(void) {
 
 void test_kernel_memory_protection(void) {
     const char* prog = ".section .kernel_data\nvar: .word 0xCAFEBABE";
-    assemble(prog, strlen(prog), false);
-    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    build(prog);
 
     bool err = false;
     // user mode should not be able to read supervisor memory
@@ -577,8 +890,7 @@ handler: addi x0, x0, 0\n\
 .globl _start\n\
 _start: ecall\n\
 ";
-    assemble(prog, strlen(prog), false);
-    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    build(prog);
     TEST_ASSERT_TRUE(g_kernel_text->contents.len > 0);
     TEST_ASSERT_TRUE(g_text->contents.len > 0);
     g_pc = g_kernel_text->base;
@@ -597,8 +909,7 @@ _start: ecall\n\
 
 void test_emulator_interrupt_set_pending(void) {
     const char *prog = "addi x0, x0, 0";
-    assemble(prog, strlen(prog), false);
-    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    build(prog);
 
     g_csr[CSR_MIP] = 0;
     g_csr[CSR_STVEC] = 0xAABB00;
@@ -656,8 +967,7 @@ vector_handlers:\n\
 .globl _start\n\
 _start: addi x0, x0, 0\n\
 ";
-    assemble(prog, strlen(prog), false);
-    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    build(prog);
 
     u32 vector_handlers;
     TEST_ASSERT_TRUE(resolve_symbol("vector_handlers", strlen("vector_handlers"), false, &vector_handlers, NULL));
@@ -678,8 +988,7 @@ void test_sstatus_write_mask(void) {
     li t0, -1\n\
     csrrw zero, sstatus, t0\n\
 ";
-    assemble(prog, strlen(prog), false);
-    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    build(prog);
     emulator_enter_kernel();
     g_pc = g_kernel_text->base;
     step();
@@ -744,8 +1053,7 @@ sw_irq_handle:                \n\
 .globl _start\n\
 _start: ecall\n\
 ";
-    assemble(prog, strlen(prog), false);
-    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    build(prog);
     
     u32 handler_addr;
     TEST_ASSERT_TRUE(resolve_symbol("handler", strlen("handler"), false, &handler_addr, NULL));
@@ -777,4 +1085,1080 @@ _start: ecall\n\
     step(); // ecall.sret
     // PC is generally advanced by the handler, but it's not necessary in this test
     TEST_ASSERT_EQUAL(start_addr, g_pc);
-}
\ No newline at end of file
+}
+void test_snapshot_restore(void) {
+    const char *prog = "\
+.data\n\
+var: .word 1\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    la t0, var\n\
+    li t1, 2\n\
+    sw t1, 0(t0)\n\
+    addi sp, sp, -4\n\
+    sw t1, 0(sp)\n\
+    li a7, 93\n\
+    ecall\n\
+";
+    build(prog);
+    emu_snapshot();
+    u32 start_pc = g_pc;
+
+    for (int i = 0; i < 2; i++) {
+        run_to_exit();
+        TEST_ASSERT_EQUAL_UINT32(2, emu_load(g_data->base, 4));
+        TEST_ASSERT_EQUAL_UINT32(2, emu_load(STACK_TOP - 4, 4));
+
+        TEST_ASSERT_TRUE(emu_restore());
+        TEST_ASSERT_FALSE(g_exited);
+        TEST_ASSERT_EQUAL(start_pc, g_pc);
+        TEST_ASSERT_EQUAL_UINT32(STACK_TOP, g_regs[REG_SP]);
+        TEST_ASSERT_EQUAL_UINT32(1, emu_load(g_data->base, 4));
+        TEST_ASSERT_EQUAL_UINT32(0xABABABAB, emu_load(STACK_TOP - 4, 4));
+    }
+}
+
+// the stack grows on demand up to g_stack_limit, past which accesses hit the
+// guard page
+void test_stack_growth(void) {
+    const char *prog = "\
+fn:                    \n\
+    addi sp, sp, -16   \n\
+    sw ra, 12(sp)      \n\
+    sw a0, 8(sp)       \n\
+    beq a0, zero, done \n\
+    addi a0, a0, -1    \n\
+    jal fn             \n\
+    lw a0, 8(sp)       \n\
+done:                  \n\
+    lw ra, 12(sp)      \n\
+    addi sp, sp, 16    \n\
+    ret                \n\
+.globl _start          \n\
+_start:                \n\
+    li a0, 10000       \n\
+    jal fn             \n\
+    li a7, 93          \n\
+    ecall              \n\
+";
+    build(prog);
+    emu_snapshot();
+    run_to_exit();
+    TEST_ASSERT_EQUAL(0, g_exit_code);
+    TEST_ASSERT_TRUE(g_stack->base <= STACK_TOP - 10001 * 16);
+    TEST_ASSERT_EQUAL_UINT32(STACK_TOP, g_stack->base + g_stack->contents.len);
+    TEST_ASSERT_EQUAL_UINT32(0, g_stack->contents.len % STACK_PAGE);
+
+    // the pages mapped after the snapshot go back to their initial contents
+    TEST_ASSERT_TRUE(emu_restore());
+    TEST_ASSERT_EQUAL_UINT32(0xABABABAB, emu_load(STACK_TOP - 10000 * 16, 4));
+    TEST_ASSERT_EQUAL_UINT32(STACK_TOP, g_regs[REG_SP]);
+
+    u32 limit = g_stack_limit;
+    g_stack_limit = 64 * 1024;
+    free_runtime();
+    build_and_run(prog);
+    g_stack_limit = limit;
+    TEST_ASSERT_EQUAL(ERROR_STACK_OVERFLOW, g_runtime_error_type);
+    TEST_ASSERT_TRUE(g_runtime_error_params[0] < STACK_TOP - 64 * 1024);
+    TEST_ASSERT_EQUAL_UINT32(64 * 1024, g_stack->contents.len);
+}
+
+// the webui peeking below the stack doesn't map it
+void test_stack_no_growth_from_ui(void) {
+    build_and_run("\
+.globl _start          \n\
+_start:                \n\
+    li a7, 93          \n\
+    ecall              \n\
+");
+    u32 base = g_stack->base;
+    u32 len = g_stack->contents.len;
+    TEST_ASSERT_EQUAL_UINT32(0, emu_load(base - 4, 4));
+    emu_store(base - 4, 1, 4);
+    TEST_ASSERT_EQUAL_UINT32(base, g_stack->base);
+    TEST_ASSERT_EQUAL_UINT32(len, g_stack->contents.len);
+    TEST_ASSERT_EQUAL_UINT32(0xABABABAB, emu_load(base, 4));
+}
+
+void test_set_stack_limit(void) {
+    build_and_run("\
+.globl _start          \n\
+_start:                \n\
+    li t0, 0x7FFFC000  \n\
+    sw zero, 0(t0)     \n\
+    li a7, 93          \n\
+    ecall              \n\
+");
+    u32 limit = g_stack_limit;
+    TEST_ASSERT_FALSE(emu_set_stack_limit(STACK_LEN - STACK_PAGE));
+    TEST_ASSERT_FALSE(emu_set_stack_limit(STACK_LIMIT_MAX + STACK_PAGE));
+    TEST_ASSERT_FALSE(emu_set_stack_limit(STACK_LEN + 1));
+    // below what the stack grew to
+    TEST_ASSERT_FALSE(emu_set_stack_limit(STACK_PAGE));
+    TEST_ASSERT_EQUAL_UINT32(limit, g_stack_limit);
+    TEST_ASSERT_TRUE(emu_set_stack_limit(STACK_TOP - g_stack->base));
+    TEST_ASSERT_EQUAL_UINT32(STACK_TOP - g_stack->base, g_stack_limit);
+    g_stack_limit = limit;
+}
+
+// the VGA and GIF sections start zeroed on every build, without being
+// cleared by hand
+void test_zero_page_sections(void) {
+    const char *prog = "\
+.globl _start          \n\
+_start:                \n\
+    la t0, _GIF_BASE   \n\
+    li t1, 0x100000    \n\
+    add t0, t0, t1     \n\
+    li t1, 42          \n\
+    sw t1, 0(t0)       \n\
+    la t0, _VGA_BASE   \n\
+    sw t1, 0(t0)       \n\
+    li a7, 93          \n\
+    ecall              \n\
+";
+    build_and_run(prog);
+    TEST_ASSERT_EQUAL(ERROR_NONE, g_runtime_error_type);
+    TEST_ASSERT_TRUE(g_gif->zero_pages);
+    TEST_ASSERT_EQUAL_UINT32(42, emu_load(GIF_BASE + 0x100000, 4));
+    TEST_ASSERT_EQUAL_UINT32(42, emu_load(VGA_BASE, 4));
+    TEST_ASSERT_EQUAL_UINT32(0, emu_load(GIF_END - 4, 4));
+
+    free_runtime();
+    build(prog);
+    TEST_ASSERT_EQUAL_UINT32(0, emu_load(GIF_BASE + 0x100000, 4));
+    TEST_ASSERT_EQUAL_UINT32(0, emu_load(VGA_BASE, 4));
+}
+
+void test_restore_without_snapshot(void) {
+    assemble_line("add x0, x0, x0");
+    TEST_ASSERT_FALSE(emu_restore());
+}
+
+void test_profile_folded(void) {
+    const char *prog = "\
+.text\n\
+.globl _start\n\
+_start:\n\
+    jal fn\n\
+    jal fn\n\
+    li a7, 93\n\
+    ecall\n\
+fn:\n\
+    li t0, 1\n\
+    ret\n\
+";
+    build(prog);
+    profile_start();
+    run_to_exit();
+
+    profile_attribute();
+    u64 per_label[2] = {0};
+    for (size_t i = 0; i < ARES_ARRAY_LEN(&g_labels); i++) {
+        LabelData *l = ARES_ARRAY_GET(&g_labels, i);
+        if (l->len == 6 && !memcmp(l->txt, "_start", 6))
+            per_label[0] = g_profile_label_counts.buf[i];
+        if (l->len == 2 && !memcmp(l->txt, "fn", 2))
+            per_label[1] = g_profile_label_counts.buf[i];
+    }
+    TEST_ASSERT_EQUAL_UINT64(4, per_label[0]);
+    TEST_ASSERT_EQUAL_UINT64(4, per_label[1]);
+
+    profile_lines();
+    TEST_ASSERT_EQUAL_UINT32(2, g_profile_lines.buf[9]);
+
+    profile_folded_text();
+    *ARES_ARRAY_PUSH(&g_profile_folded) = 0;
+    TEST_ASSERT_NOT_NULL(strstr(g_profile_folded.buf, "_start 4\n"));
+    TEST_ASSERT_NOT_NULL(strstr(g_profile_folded.buf, "_start;fn 4\n"));
+    profile_stop();
+}
+
+void test_counter_csrs(void) {
+    const char *prog = "\
+.data\n\
+var: .word 0\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    la t0, var\n\
+    lw t1, 0(t0)\n\
+    sw t1, 0(t0)\n\
+    beq t1, zero, skip\n\
+skip:\n\
+    rdinstret a0\n\
+    rdcycle a1\n\
+    csrrs a2, hpmcounter3, zero\n\
+    csrrs a3, hpmcounter5, zero\n\
+    rdinstreth a4\n\
+    csrrw zero, instret, t0\n\
+    rdinstret a5\n\
+    li a7, 93\n\
+    ecall\n\
+";
+    build(prog);
+    run_to_exit();
+    // la of the start of .data is just an auipc
+    TEST_ASSERT_EQUAL_UINT32(4, g_regs[REG_A0]);
+    TEST_ASSERT_EQUAL_UINT32(5, g_regs[REG_A1]);
+    TEST_ASSERT_EQUAL_UINT32(1, g_regs[REG_A2]);
+    TEST_ASSERT_EQUAL_UINT32(1, g_regs[REG_A3]);
+    TEST_ASSERT_EQUAL_UINT32(0, g_regs[REG_A4]);
+    // instret is read-only
+    TEST_ASSERT_EQUAL_UINT32(10, g_regs[REG_A5]);
+    TEST_ASSERT_EQUAL_UINT64(1, g_hpm_counters[HPM_EVENT_STORE]);
+}
+
+void test_pipeline_hazards(void) {
+    const char *prog = "\
+.data\n\
+var: .word 7\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    la t0, var\n\
+load:\n\
+    lw t1, 0(t0)\n\
+    add t2, t1, t1\n\
+    mul t3, t2, t2\n\
+    add t4, t3, t3\n\
+    beq zero, zero, end\n\
+    li a0, 1\n\
+end:\n\
+    li a7, 93\n\
+    ecall\n\
+";
+    build(prog);
+    pipeline_start();
+    run_to_exit();
+
+    // 8 instructions (la of the start of .data is just an auipc) + 4 to
+    // fill, 1 load-use bubble, mul takes 3 cycles in EX, the taken branch
+    // flushes 2 instructions
+    TEST_ASSERT_EQUAL_UINT64(8, g_pipeline_stats.instret);
+    TEST_ASSERT_EQUAL_UINT64(1, g_pipeline_stats.load_use_stalls);
+    TEST_ASSERT_EQUAL_UINT64(2, g_pipeline_stats.structural_stalls);
+    TEST_ASSERT_EQUAL_UINT64(2, g_pipeline_stats.control_stalls);
+    TEST_ASSERT_EQUAL_UINT64(17, g_pipeline_stats.cycles);
+    TEST_ASSERT_EQUAL_UINT64(17, g_cycle);
+
+    // the lw sits in ID while the add waits in IF
+    TEST_ASSERT_EQUAL_UINT32(g_pipeline_stats.cycles,
+                             pipeline_stages(1, 100));
+    u32 lw_pc;
+    TEST_ASSERT_TRUE(resolve_symbol("load", 4, false, &lw_pc, NULL));
+    TEST_ASSERT_EQUAL_UINT32(lw_pc, g_pipeline_window.buf[4 * 5 + PIPE_MEM]);
+    TEST_ASSERT_EQUAL_UINT32(0, g_pipeline_window.buf[4 * 5 + PIPE_EX]);
+    TEST_ASSERT_EQUAL_UINT32(lw_pc + 4, g_pipeline_window.buf[5 * 5 + PIPE_EX]);
+    pipeline_stop();
+}
+
+void test_cache_sim(void) {
+    const char *prog = "\
+.data\n\
+buf: .word 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    li t0, 0x10000000\n\
+    lw a1, 0(t0)\n\
+    lw a2, 4(t0)\n\
+conflict:\n\
+    lw a3, 64(t0)\n\
+    lw a4, 0(t0)\n\
+    li a7, 93\n\
+    ecall\n\
+";
+    build(prog);
+
+    // direct-mapped, 4 sets of 16 bytes, so buf and buf+64 conflict
+    CacheConfig saved[CACHE_COUNT];
+    memcpy(saved, g_cache_config, sizeof(saved));
+    char *error = NULL;
+    TEST_ASSERT_TRUE(
+        cache_parse_config("64:16:1", &g_cache_config[CACHE_D], &error));
+    TEST_ASSERT_FALSE(
+        cache_parse_config("48:16:1", &g_cache_config[CACHE_I], &error));
+    TEST_ASSERT_NOT_NULL(error);
+    // line * ways overflows
+    TEST_ASSERT_FALSE(cache_parse_config("4k:65536:65536",
+                                         &g_cache_config[CACHE_I], &error));
+    TEST_ASSERT_FALSE(cache_parse_config("5000000000:16:1",
+                                         &g_cache_config[CACHE_I], &error));
+    TEST_ASSERT_EQUAL_STRING("expected size:line:ways, each below 4G", error);
+    g_cache_config[CACHE_I].size = 0;
+    TEST_ASSERT_TRUE(cache_start());
+
+    run_to_exit();
+
+    CacheStats *st = &g_cache_stats[CACHE_D];
+    TEST_ASSERT_EQUAL_UINT64(4, st->accesses);
+    TEST_ASSERT_EQUAL_UINT64(3, st->misses);
+    TEST_ASSERT_EQUAL_UINT64(2, st->evictions);
+    TEST_ASSERT_EQUAL_UINT64(0, g_cache_stats[CACHE_I].accesses);
+
+    u32 pc;
+    TEST_ASSERT_TRUE(resolve_symbol("conflict", 8, false, &pc, NULL));
+    CacheSiteStats *site = ARES_ARRAY_GET(&g_cache_sites[CACHE_D],
+                                          (pc - TEXT_BASE) / 2);
+    TEST_ASSERT_EQUAL_UINT64(1, site->misses);
+    TEST_ASSERT_EQUAL_UINT64(1, site->evictions);
+
+    cache_stop();
+    memcpy(g_cache_config, saved, sizeof(saved));
+}
+
+void test_bpred_bimodal(void) {
+    const char *prog = "\
+.text\n\
+.globl _start\n\
+_start:\n\
+    li s0, 0\n\
+loop:\n\
+    addi s0, s0, 1\n\
+    li t0, 10\n\
+back:\n\
+    blt s0, t0, loop\n\
+    jal ra, f\n\
+    li a0, 0\n\
+    li a7, 93\n\
+    ecall\n\
+f:\n\
+    ret\n\
+";
+    build(prog);
+
+    BpredConfig saved = g_bpred_config;
+    char *error = NULL;
+    TEST_ASSERT_FALSE(bpred_parse_config("bimodal:btb=3", &g_bpred_config,
+                                         &error));
+    // would wrap around to 16
+    TEST_ASSERT_FALSE(bpred_parse_config("bimodal:btb=4294967312",
+                                         &g_bpred_config, &error));
+    TEST_ASSERT_TRUE(bpred_parse_config("bimodal:bits=6:btb=16:ras=4",
+                                        &g_bpred_config, &error));
+    TEST_ASSERT_TRUE(bpred_start());
+
+    run_to_exit();
+
+    // the counter starts weakly not taken, so the first and last iterations
+    // mispredict. The jal target isn't in the BTB yet, the ret hits the RAS
+    TEST_ASSERT_EQUAL_UINT64(10, g_bpred_stats.branches);
+    TEST_ASSERT_EQUAL_UINT64(2, g_bpred_stats.branch_mispredicts);
+    TEST_ASSERT_EQUAL_UINT64(1, g_bpred_stats.jumps);
+    TEST_ASSERT_EQUAL_UINT64(1, g_bpred_stats.returns);
+    TEST_ASSERT_EQUAL_UINT64(0, g_bpred_stats.return_mispredicts);
+    TEST_ASSERT_EQUAL_UINT64(1, g_bpred_stats.decode_redirects);
+
+    u32 pc;
+    TEST_ASSERT_TRUE(resolve_symbol("back", 4, false, &pc, NULL));
+    BpredSiteStats *site =
+        ARES_ARRAY_GET(&g_bpred_sites, (pc - TEXT_BASE) / 2);
+    TEST_ASSERT_EQUAL_UINT64(10, site->executed);
+    TEST_ASSERT_EQUAL_UINT64(2, site->mispredicts);
+
+    bpred_stop();
+    g_bpred_config = saved;
+}
+
+void test_ooo_model(void) {
+    const char *prog = "\
+.text\n\
+.globl _start\n\
+_start:\n\
+    li t0, 3\n\
+    mul t1, t0, t0\n\
+    mul t2, t1, t1\n\
+    add t3, t0, t0\n\
+    li a7, 93\n\
+    li a0, 0\n\
+    ecall\n\
+";
+    build(prog);
+
+    OooConfig saved = g_ooo_config;
+    char *error = NULL;
+    TEST_ASSERT_FALSE(ooo_parse_config("width=0", &g_ooo_config, &error));
+    TEST_ASSERT_FALSE(
+        ooo_parse_config("width=4294967298", &g_ooo_config, &error));
+    TEST_ASSERT_FALSE(ooo_parse_config("width:rob=8", &g_ooo_config, &error));
+    TEST_ASSERT_TRUE(ooo_parse_config("width=2:rob=8:mul=1:mul_lat=3",
+                                      &g_ooo_config, &error));
+    TEST_ASSERT_TRUE(ooo_start());
+
+    run_to_exit();
+
+    // the first mul waits for its 3 cycles in the multiplier, the second
+    // one for the first. The add runs ahead but commits after them
+    TEST_ASSERT_EQUAL_UINT64(7, g_ooo_stats.instret);
+    TEST_ASSERT_EQUAL_UINT64(11, g_ooo_stats.cycles);
+    TEST_ASSERT_EQUAL_UINT64(11, g_cycle);
+    TEST_ASSERT_EQUAL_UINT64(2, g_ooo_stats.execute_stalls);
+    TEST_ASSERT_EQUAL_UINT64(2, g_ooo_stats.dependency_stalls);
+
+    TEST_ASSERT_EQUAL_UINT32(11, ooo_occupancy(1, 100));
+    TEST_ASSERT_EQUAL_UINT32(2, g_ooo_window.buf[0]);
+    TEST_ASSERT_EQUAL_UINT32(6, g_ooo_window.buf[2]);
+    TEST_ASSERT_EQUAL_UINT32(1, g_ooo_window.buf[10]);
+
+    ooo_stop();
+    g_ooo_config = saved;
+}
+
+void test_sampled_pipeline(void) {
+    const char *prog = "\
+.text\n\
+.globl _start\n\
+_start:\n\
+    li s0, 0\n\
+loop:\n\
+    addi s0, s0, 1\n\
+    li t0, 500\n\
+    blt s0, t0, loop\n\
+    li a0, 0\n\
+    li a7, 93\n\
+    ecall\n\
+";
+    build(prog);
+
+    SampleConfig saved = g_sample_config;
+    char *error = NULL;
+    TEST_ASSERT_FALSE(sample_parse_config("100:90:20", &g_sample_config,
+                                          &error));
+    TEST_ASSERT_TRUE(sample_parse_config("100:10:20", &g_sample_config,
+                                         &error));
+    pipeline_start();
+    TEST_ASSERT_TRUE(sample_start());
+    TEST_ASSERT_FALSE(g_pipeline_enabled);
+
+    run_to_exit();
+    sample_stop();
+    TEST_ASSERT_TRUE(g_pipeline_enabled);
+
+    // 1504 instructions, the last 30 of each full period ran on the pipeline
+    TEST_ASSERT_EQUAL_UINT64(1504, g_sample_stats.instret);
+    TEST_ASSERT_EQUAL_UINT64(15, g_sample_stats.samples);
+    TEST_ASSERT_EQUAL_UINT64(300, g_sample_stats.measured_instret);
+    TEST_ASSERT_EQUAL_UINT64(450, g_pipeline_stats.instret);
+
+    // every taken branch costs 2 bubbles, so about 5 cycles per iteration
+    sample_estimate();
+    TEST_ASSERT_TRUE(g_sample_estimate.cpi > 1.5 && g_sample_estimate.cpi < 1.9);
+    TEST_ASSERT_TRUE(g_sample_estimate.cpi_low <= g_sample_estimate.cpi);
+    TEST_ASSERT_TRUE(g_sample_estimate.cpi_high >= g_sample_estimate.cpi);
+
+    pipeline_stop();
+    g_sample_config = saved;
+}
+
+void test_reuse_distance(void) {
+    const char *prog = "\
+.data\n\
+buf: .word 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    li t0, 0x10000000\n\
+    li t1, 2\n\
+loop:\n\
+    lw a1, 0(t0)\n\
+    lw a1, 16(t0)\n\
+    lw a1, 32(t0)\n\
+    lw a1, 48(t0)\n\
+    addi t1, t1, -1\n\
+    bnez t1, loop\n\
+    li a0, 0\n\
+    li a7, 93\n\
+    ecall\n\
+";
+    build(prog);
+
+    ReuseConfig saved = g_reuse_config;
+    g_reuse_config.line_size = 16;
+    g_reuse_config.epoch = 4;
+    TEST_ASSERT_TRUE(reuse_start());
+
+    run_to_exit();
+
+    // 4 lines in a cycle, every reuse has 3 other lines in between
+    ReuseStats *st = &g_reuse_stats[REUSE_D];
+    TEST_ASSERT_EQUAL_UINT64(8, st->accesses);
+    TEST_ASSERT_EQUAL_UINT64(4, st->cold);
+    TEST_ASSERT_EQUAL_UINT64(4, ARES_ARRAY_LEN(&g_reuse_hist[REUSE_D]));
+    TEST_ASSERT_EQUAL_UINT64(4, g_reuse_hist[REUSE_D].buf[3]);
+
+    reuse_mrc(REUSE_D, 5);
+    TEST_ASSERT_EQUAL_UINT64(8, g_reuse_mrc.buf[2]);
+    TEST_ASSERT_EQUAL_UINT64(4, g_reuse_mrc.buf[3]);
+    TEST_ASSERT_EQUAL_UINT64(4, g_reuse_mrc.buf[4]);
+
+    TEST_ASSERT_EQUAL_UINT64(g_instret / 4 * g_reuse_sections,
+                             ARES_ARRAY_LEN(&g_reuse_working_set));
+
+    reuse_stop();
+    g_reuse_config = saved;
+}
+
+// code that reads itself is in the working set once
+void test_reuse_working_set_shared(void) {
+    const char *prog = "\
+.globl _start\n\
+_start:\n\
+    auipc t0, 0\n\
+    lw t1, 0(t0)\n\
+    lw t1, 4(t0)\n\
+    li a7, 93\n\
+    ecall\n\
+";
+    build(prog);
+
+    ReuseConfig saved = g_reuse_config;
+    g_reuse_config.line_size = 64;
+    g_reuse_config.epoch = 3;
+    TEST_ASSERT_TRUE(reuse_start());
+    run_to_exit();
+
+    size_t text = 0;
+    while (*ARES_ARRAY_GET(&g_sections, text) != g_text) text++;
+    TEST_ASSERT_EQUAL_UINT64(1, g_reuse_stats[REUSE_I].cold);
+    TEST_ASSERT_EQUAL_UINT64(1, g_reuse_stats[REUSE_D].cold);
+    TEST_ASSERT_EQUAL_UINT32(1, g_reuse_working_set.buf[text]);
+
+    reuse_stop();
+    g_reuse_config = saved;
+}
+
+void test_latency_table(void) {
+    const char *prog = "\
+.data\n\
+var: .word 7\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    li t0, 0x10000000\n\
+    lw t1, 0(t0)\n\
+    mul t2, t1, t1\n\
+    div t3, t2, t1\n\
+    sw t3, 0(t0)\n\
+    beq t3, t1, skip\n\
+    li a0, 1\n\
+skip:\n\
+    bne t3, t1, skip\n\
+    csrrs t4, cycle, zero\n\
+    li a0, 0\n\
+    li a7, 93\n\
+    ecall\n\
+";
+    build(prog);
+
+    u32 saved[LAT_COUNT];
+    memcpy(saved, g_latency_table, sizeof(saved));
+    const char *cfg = "# costs\nmul = 4\n div=30 # slow\n\nbranch_taken 5\n";
+    const char *bad = "alu = 1\nfoo = 2\n";
+    char *error = NULL;
+    int line = 0;
+    TEST_ASSERT_FALSE(latency_parse_config(bad, strlen(bad), &error, &line));
+    TEST_ASSERT_EQUAL(2, line);
+    TEST_ASSERT_TRUE(latency_parse_config(cfg, strlen(cfg), &error, &line));
+    TEST_ASSERT_EQUAL_UINT32(30, g_latency_table[LAT_DIV]);
+    latency_start();
+
+    run_to_exit();
+
+    // li(2) lw(3) mul(4) div(30) sw(1) beq taken(5) bne(1) csrrs(2) li li(2)
+    // ecall(5)
+    TEST_ASSERT_EQUAL_UINT64(4, g_latency_counts[LAT_ALU]);
+    TEST_ASSERT_EQUAL_UINT64(1, g_latency_counts[LAT_BRANCH_TAKEN]);
+    TEST_ASSERT_EQUAL_UINT64(1, g_latency_counts[LAT_BRANCH_NOT_TAKEN]);
+    TEST_ASSERT_EQUAL_UINT64(1, g_latency_counts[LAT_CSR]);
+    TEST_ASSERT_EQUAL_UINT64(55, g_cycle);
+
+    latency_stop();
+    memcpy(g_latency_table, saved, sizeof(saved));
+}
+
+// -- elf tests
+
+static ElfSectionHeader *find_shdr(ReadElfResult *r, const char *name) {
+    for (u32 i = 0; i < r->ehdr->shent_num; i++)
+        if (!strcmp(r->shdrs[i].name, name)) return r->shdrs[i].shdr;
+    return NULL;
+}
+
+// what elf_write_*() put in path is what elf_emit_*() returned
+static void assert_file_matches(const char *path, const void *buf, size_t len) {
+    FILE *f = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    u8 *contents = malloc(len + 1);
+    TEST_ASSERT_EQUAL(len, fread(contents, 1, len + 1, f));
+    fclose(f);
+    remove(path);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(buf, contents, len);
+    free(contents);
+}
+
+void test_elf_emit_exec(void) {
+    assemble_line("\
+.data\n\
+msg: .word 42\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    la a0, msg\n\
+    lw a0, 0(a0)\n\
+");
+    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    void *buf;
+    size_t len;
+    char *error = NULL;
+    TEST_ASSERT_TRUE(elf_emit_exec(&buf, &len, &error));
+
+    ReadElfResult r = {0};
+    TEST_ASSERT_TRUE(elf_read(buf, len, &r, &error));
+    TEST_ASSERT_EQUAL(ET_EXEC, r.ehdr->type);
+    TEST_ASSERT_EQUAL_UINT32(g_text->base, r.ehdr->entry);
+    TEST_ASSERT_EQUAL_STRING(".strtab", r.shdrs[r.ehdr->shdr_str_idx].name);
+
+    // every segment holds its section's bytes, and so does its header
+    Section *secs[] = {g_text, g_data};
+    TEST_ASSERT_EQUAL(4, r.ehdr->phent_num);
+    for (size_t i = 0; i < 2; i++) {
+        Section *s = secs[i];
+        ElfProgramHeader *ph = NULL;
+        for (u32 j = 0; j < r.ehdr->phent_num; j++)
+            if (r.phdrs[j].phdr->virt_addr == s->base) ph = r.phdrs[j].phdr;
+        TEST_ASSERT_NOT_NULL(ph);
+        TEST_ASSERT_EQUAL(s->contents.len, ph->file_sz);
+        TEST_ASSERT_TRUE(ph->off + ph->file_sz <= len);
+        TEST_ASSERT_EQUAL_CHAR_ARRAY(s->contents.buf, (u8 *)buf + ph->off,
+                                     s->contents.len);
+
+        ElfSectionHeader *sh = find_shdr(&r, s->name);
+        TEST_ASSERT_NOT_NULL(sh);
+        TEST_ASSERT_EQUAL_UINT32(ph->off, sh->off);
+        TEST_ASSERT_EQUAL_UINT32(s->contents.len, sh->mem_sz);
+    }
+
+    TEST_ASSERT_TRUE(elf_write_exec("elf_test.bin", &error));
+    assert_file_matches("elf_test.bin", buf, len);
+    free(r.phdrs);
+    free(r.shdrs);
+    free(buf);
+}
+
+void test_elf_emit_obj(void) {
+    const char *src = "\
+.data\n\
+.globl tbl\n\
+tbl: .word 1\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    jal ext_fn\n\
+    la a0, ext_data\n\
+";
+    assemble(src, strlen(src), true);
+    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    void *buf;
+    size_t len;
+    char *error = NULL;
+    TEST_ASSERT_TRUE(elf_emit_obj(&buf, &len, &error));
+
+    ReadElfResult r = {0};
+    TEST_ASSERT_TRUE(elf_read(buf, len, &r, &error));
+    TEST_ASSERT_EQUAL(ET_REL, r.ehdr->type);
+    TEST_ASSERT_EQUAL(0, r.ehdr->phent_num);
+
+    ElfSectionHeader *text = find_shdr(&r, ".text");
+    ElfSectionHeader *data = find_shdr(&r, ".data");
+    ElfSectionHeader *symtab = find_shdr(&r, ".symtab");
+    ElfSectionHeader *rela = find_shdr(&r, ".rela.text");
+    ElfSectionHeader *strtab = find_shdr(&r, ".strtab");
+    TEST_ASSERT_NOT_NULL(text);
+    TEST_ASSERT_NOT_NULL(data);
+    TEST_ASSERT_NOT_NULL(symtab);
+    TEST_ASSERT_NOT_NULL(rela);
+    TEST_ASSERT_EQUAL(0, r.ehdr->shdrs_off % 4);
+    TEST_ASSERT_EQUAL(0, symtab->off % symtab->align);
+    TEST_ASSERT_EQUAL(0, rela->off % rela->align);
+    TEST_ASSERT_EQUAL(4, rela->align);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(g_text->contents.buf, (u8 *)buf + text->off,
+                                 g_text->contents.len);
+
+    // null, the externs, then the globals
+    const char *names[] = {"", "ext_fn", "ext_data", "tbl", "_start"};
+    ElfSymtabEntry *syms = (ElfSymtabEntry *)((u8 *)buf + symtab->off);
+    TEST_ASSERT_EQUAL(5 * sizeof(ElfSymtabEntry), symtab->mem_sz);
+    for (size_t i = 0; i < 5; i++)
+        TEST_ASSERT_EQUAL_STRING(
+            names[i], (char *)buf + strtab->off + syms[i].name_off);
+    TEST_ASSERT_EQUAL(SHN_UNDEF, syms[1].shent_idx);
+    TEST_ASSERT_TRUE(data == r.shdrs[syms[3].shent_idx].shdr);
+    TEST_ASSERT_TRUE(text == r.shdrs[syms[4].shent_idx].shdr);
+
+    // jal, and la's auipc and addi
+    ElfRelaEntry *relas = (ElfRelaEntry *)((u8 *)buf + rela->off);
+    TEST_ASSERT_EQUAL(3 * sizeof(ElfRelaEntry), rela->mem_sz);
+    TEST_ASSERT_TRUE(text == r.shdrs[rela->info].shdr);
+    u32 offsets[] = {0, 4, 8};
+    u32 types[] = {R_RISCV_JAL, R_RISCV_HI20, R_RISCV_LO12_I};
+    u32 symbols[] = {1, 2, 2};
+    for (size_t i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL_UINT32(offsets[i], relas[i].offset);
+        TEST_ASSERT_EQUAL_UINT32(ELF32_R_INFO(symbols[i], types[i]),
+                                 relas[i].info);
+    }
+
+    TEST_ASSERT_TRUE(elf_write_obj("elf_test.o", &error));
+    assert_file_matches("elf_test.o", buf, len);
+    free(r.phdrs);
+    free(r.shdrs);
+    free(buf);
+}
+
+// an executable to patch the program headers of
+static u8 *emit_test_exec(size_t *len) {
+    assemble_line("\
+.data\n\
+msg: .word 42\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    la a0, msg\n\
+    lw a0, 0(a0)\n\
+");
+    TEST_ASSERT_EQUAL_STRING(g_error, NULL);
+    void *buf;
+    char *error = NULL;
+    TEST_ASSERT_TRUE(elf_emit_exec(&buf, len, &error));
+    // elf_load() starts from nothing, like the cli does
+    free_runtime();
+    return buf;
+}
+
+static ElfProgramHeader *find_phdr(u8 *buf, u32 virt_addr) {
+    ElfHeader *ehdr = (ElfHeader *)buf;
+    ElfProgramHeader *phdrs = (ElfProgramHeader *)(buf + ehdr->phdrs_off);
+    for (u32 i = 0; i < ehdr->phent_num; i++)
+        if (phdrs[i].virt_addr == virt_addr) return &phdrs[i];
+    return NULL;
+}
+
+void test_elf_load_bss(void) {
+    size_t len;
+    u8 *buf = emit_test_exec(&len);
+    ElfProgramHeader *data = find_phdr(buf, DATA_BASE);
+    TEST_ASSERT_NOT_NULL(data);
+    data->mem_sz += 3 * STACK_PAGE;
+
+    char *error = NULL;
+    TEST_ASSERT_TRUE(elf_load(buf, len, &error));
+    TEST_ASSERT_EQUAL_UINT32(DATA_BASE, g_data->base);
+    TEST_ASSERT_EQUAL_UINT32(DATA_BASE + data->mem_sz, g_data->limit);
+    bool err = false;
+    TEST_ASSERT_EQUAL_UINT32(42, LOAD(DATA_BASE, 4, &err));
+    TEST_ASSERT_EQUAL_UINT32(0, LOAD(DATA_BASE + data->mem_sz - 4, 4, &err));
+    STORE(DATA_BASE + data->mem_sz - 4, 7, 4, &err);
+    TEST_ASSERT_EQUAL_UINT32(7, LOAD(DATA_BASE + data->mem_sz - 4, 4, &err));
+    TEST_ASSERT_FALSE(err);
+
+    emulate();
+    emulate();
+    TEST_ASSERT_EQUAL_UINT32(42, g_regs[10]);
+    free(buf);
+}
+
+void test_elf_load_bad_phdrs(void) {
+    size_t len;
+    u8 *buf = emit_test_exec(&len);
+    ElfHeader *ehdr = (ElfHeader *)buf;
+    char *error = NULL;
+
+    // cut off in the middle of the program headers
+    TEST_ASSERT_FALSE(elf_load(buf, ehdr->phdrs_off + 10, &error));
+    TEST_ASSERT_EQUAL_STRING("program headers offset exceeds buffer size",
+                             error);
+    u32 phdrs_off = ehdr->phdrs_off;
+    ehdr->phdrs_off = 0xFFFFFFF0;
+    TEST_ASSERT_FALSE(elf_load(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("program headers offset exceeds buffer size",
+                             error);
+    ehdr->phdrs_off = phdrs_off;
+
+    ElfProgramHeader *data = find_phdr(buf, DATA_BASE);
+    TEST_ASSERT_NOT_NULL(data);
+    data->off = len - 2;
+    TEST_ASSERT_FALSE(elf_load(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("segment offset exceeds buffer size", error);
+    data->off = 0xFFFFFFFF;
+    TEST_ASSERT_FALSE(elf_load(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("segment offset exceeds buffer size", error);
+
+    data->off = 0;
+    data->mem_sz = data->file_sz - 1;
+    TEST_ASSERT_FALSE(elf_load(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("segment does not fit in memory", error);
+    data->mem_sz = data->file_sz;
+    data->virt_addr = 0xFFFFFFFF;
+    TEST_ASSERT_FALSE(elf_load(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("segment does not fit in memory", error);
+    free(buf);
+}
+
+void test_elf_load_overlap(void) {
+    size_t len;
+    u8 *buf = emit_test_exec(&len);
+    ElfProgramHeader *data = find_phdr(buf, DATA_BASE);
+    TEST_ASSERT_NOT_NULL(data);
+    char *error = NULL;
+
+    // starts just below the stack and runs into it
+    data->virt_addr = STACK_TOP - STACK_LEN - 2;
+    TEST_ASSERT_FALSE(elf_load(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("segment overlaps emulator memory", error);
+
+    // clear of the stack, but where it grows to
+    data->virt_addr = STACK_TOP - STACK_LEN - 2 * STACK_PAGE;
+    TEST_ASSERT_FALSE(elf_load(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("segment overlaps emulator memory", error);
+
+    // starts in the stack and runs past its top
+    data->virt_addr = STACK_TOP - 2;
+    TEST_ASSERT_FALSE(elf_load(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("segment overlaps emulator memory", error);
+
+    // lands inside the .text segment
+    data->virt_addr = TEXT_BASE + 2;
+    TEST_ASSERT_FALSE(elf_load(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("segments overlap", error);
+
+    // inside the stack, copied in
+    data->virt_addr = STACK_TOP - 8;
+    TEST_ASSERT_TRUE(elf_load(buf, len, &error));
+    bool err = false;
+    TEST_ASSERT_EQUAL_UINT32(42, LOAD(STACK_TOP - 8, 4, &err));
+    TEST_ASSERT_FALSE(err);
+
+    // and the stack doesn't grow over what's mapped below it
+    u32 base = g_stack->base;
+    Section below = {.name = "below",
+                     .base = base - 2 * STACK_PAGE,
+                     .limit = base - STACK_PAGE};
+    *ARES_ARRAY_PUSH(&g_sections) = &below;
+    LOAD(base - 4, 4, &err);
+    TEST_ASSERT_FALSE(err);
+    TEST_ASSERT_EQUAL_UINT32(base - STACK_PAGE, g_stack->base);
+    LOAD(g_stack->base - 4, 4, &err);
+    TEST_ASSERT_TRUE(err);
+    TEST_ASSERT_EQUAL_UINT32(base - STACK_PAGE, g_stack->base);
+    g_sections.len--;
+    free(buf);
+}
+
+// -- state tests
+
+static const char *state_prog = "\
+.data\n\
+sum: .word 0\n\
+.text\n\
+.globl _start\n\
+_start:\n\
+    li s0, 0\n\
+    li t0, 100\n\
+loop:\n\
+    addi sp, sp, -4\n\
+    sw t0, 0(sp)\n\
+    add s0, s0, t0\n\
+    la t1, sum\n\
+    sw s0, 0(t1)\n\
+    addi t0, t0, -1\n\
+    bnez t0, loop\n\
+    mv a0, s0\n\
+    li a7, 93\n\
+    ecall\n\
+";
+
+// runs state_prog for steps instructions and saves the state to path
+static void save_state_prog(const char *path, int steps) {
+    build(state_prog);
+    for (int i = 0; i < steps; i++) emulate();
+    char *error = NULL;
+    TEST_ASSERT_TRUE(state_save(path, &error));
+}
+
+void test_state_round_trip(void) {
+    save_state_prog("state_test.bin", 150);
+    u32 pc = g_pc;
+    u64 instret = g_instret;
+    u32 regs[32];
+    memcpy(regs, g_regs, sizeof(regs));
+    u32 sum = emu_load(g_data->base, 4);
+    u32 top = emu_load(g_regs[REG_SP], 4);
+    TEST_ASSERT_TRUE(sum != 0 && top != 0);
+
+    free_runtime();
+    char *error = NULL;
+    TEST_ASSERT_TRUE(state_load("state_test.bin", &error));
+    remove("state_test.bin");
+    TEST_ASSERT_EQUAL_UINT32(pc, g_pc);
+    TEST_ASSERT_EQUAL(instret, g_instret);
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(regs, g_regs, sizeof(regs));
+    TEST_ASSERT_EQUAL_UINT32(sum, emu_load(g_data->base, 4));
+    TEST_ASSERT_EQUAL_UINT32(top, emu_load(g_regs[REG_SP], 4));
+
+    run_to_exit();
+    TEST_ASSERT_EQUAL_UINT32(5050, g_regs[REG_A0]);
+}
+
+// writes len bytes of buf to a state file and loads it back
+static bool load_state_bytes(const u8 *buf, size_t len, char **error) {
+    FILE *f = fopen("state_bad.bin", "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(len, fwrite(buf, 1, len, f));
+    fclose(f);
+    bool ok = state_load("state_bad.bin", error);
+    remove("state_bad.bin");
+    return ok;
+}
+
+void test_state_corrupt(void) {
+    save_state_prog("state_test.bin", 150);
+    FILE *f = fopen("state_test.bin", "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    fseek(f, 0, SEEK_END);
+    size_t len = ftell(f);
+    rewind(f);
+    u8 *buf = malloc(len);
+    TEST_ASSERT_EQUAL(len, fread(buf, 1, len, f));
+    fclose(f);
+    remove("state_test.bin");
+    free_runtime();
+
+    StateHeader *hdr = (StateHeader *)buf;
+    StateSection *secs = (StateSection *)(buf + hdr->sections_off);
+    StateSection *stack = NULL;
+    for (u32 i = 0; i < hdr->sections_num; i++)
+        if (secs[i].limit == STACK_TOP) stack = &secs[i];
+    TEST_ASSERT_NOT_NULL(stack);
+    char *error = NULL;
+
+    TEST_ASSERT_FALSE(load_state_bytes(buf, sizeof(StateHeader) - 1, &error));
+    TEST_ASSERT_EQUAL_STRING("corrupt or truncated state file", error);
+    TEST_ASSERT_FALSE(load_state_bytes(buf, hdr->strtab_off, &error));
+    TEST_ASSERT_EQUAL_STRING("corrupt or truncated state file", error);
+    TEST_ASSERT_FALSE(load_state_bytes(buf, stack->contents_off, &error));
+    TEST_ASSERT_EQUAL_STRING("corrupt section in state file", error);
+
+    // limit - base would wrap around
+    u32 limit = stack->limit;
+    stack->limit = stack->base - 1;
+    TEST_ASSERT_FALSE(load_state_bytes(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("corrupt section in state file", error);
+    stack->limit = limit;
+
+    // callsan would copy past its own stack
+    hdr->callsan_num++;
+    TEST_ASSERT_FALSE(load_state_bytes(buf, len, &error));
+    TEST_ASSERT_EQUAL_STRING("corrupt stack in state file", error);
+    hdr->callsan_num--;
+
+    TEST_ASSERT_TRUE(load_state_bytes(buf, len, &error));
+    free(buf);
+}
+
+// -- trace tests
+
+static u32 get_trace_varint(const u8 **p) {
+    u32 v = 0;
+    int shift = 0;
+    while (**p & 0x80) {
+        v |= (u32)(*(*p)++ & 0x7F) << shift;
+        shift += 7;
+    }
+    return v | (u32)*(*p)++ << shift;
+}
+
+static u32 get_trace_delta(const u8 **p) {
+    u32 v = get_trace_varint(p);
+    return (v >> 1) ^ -(v & 1);
+}
+
+void test_trace_records(void) {
+    const char *src = "\
+.globl _start\n\
+_start:\n\
+    li a0, 5\n\
+    addi a1, a0, 3\n\
+    sw a1, -4(sp)\n\
+    lw a2, -4(sp)\n\
+    li a7, 93\n\
+    ecall\n\
+";
+    build(src);
+    char *error = NULL;
+    TEST_ASSERT_TRUE(trace_open("trace_test.bin", &error));
+    while (!g_exited) {
+        emulate();
+        trace_record();
+        TEST_ASSERT_EQUAL(ERROR_NONE, g_runtime_error_type);
+    }
+    TEST_ASSERT_TRUE(trace_close(&error));
+
+    FILE *f = fopen("trace_test.bin", "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    u8 *buf = malloc(1 << 16);
+    size_t len = fread(buf, 1, 1 << 16, f);
+    fclose(f);
+    remove("trace_test.bin");
+
+    const u8 *p = buf;
+    TEST_ASSERT_EQUAL_CHAR_ARRAY(TRACE_MAGIC, p, sizeof(TRACE_MAGIC));
+    p += sizeof(TRACE_MAGIC);
+    u32 version;
+    ares_buf_read((u8 *)p, 4, &version);
+    TEST_ASSERT_EQUAL_UINT32(TRACE_VERSION, version);
+    p += 4;
+    u32 nlabels = get_trace_varint(&p);
+    TEST_ASSERT_EQUAL(ARES_ARRAY_LEN(&g_labels), nlabels);
+    for (u32 i = 0; i < nlabels; i++) {
+        get_trace_varint(&p);
+        p += get_trace_varint(&p);
+    }
+
+    // pc, the instruction there, and the register it writes if any
+    struct {
+        u32 pc, inst, rd, val;
+        u8 flags;
+    } expected[] = {
+        {TEXT_BASE, 0x4515, REG_A0, 5, TRACE_REG},
+        {TEXT_BASE + 2, 0x00350593, REG_A1, 8, TRACE_REG},
+        {TEXT_BASE + 6, 0xfeb12e23, 0, 0, TRACE_STORE},
+        {TEXT_BASE + 10, 0xffc12603, REG_A2, 8, TRACE_REG | TRACE_LOAD},
+        {TEXT_BASE + 14, 0x05d00893, REG_A7, 93, TRACE_REG},
+        {TEXT_BASE + 18, 0x00000073, 0, 0, 0},
+    };
+    u32 pc = TEXT_BASE, addr = 0;
+    for (size_t i = 0; i < sizeof(expected) / sizeof(*expected); i++) {
+        TEST_ASSERT_TRUE(p < buf + len);
+        u8 flags = *p++;
+        TEST_ASSERT_EQUAL(expected[i].flags, flags);
+        pc += get_trace_delta(&p);
+        TEST_ASSERT_EQUAL_UINT32(expected[i].pc, pc);
+        u32 inst = emu_load(pc, 4);
+        if ((inst & 3) != 3) inst &= 0xFFFF;
+        TEST_ASSERT_EQUAL_UINT32(expected[i].inst, inst);
+        if (flags & TRACE_REG) {
+            TEST_ASSERT_EQUAL(expected[i].rd, *p++);
+            TEST_ASSERT_EQUAL_UINT32(expected[i].val, get_trace_varint(&p));
+        }
+        if (flags & (TRACE_LOAD | TRACE_STORE)) {
+            addr += get_trace_delta(&p);
+            TEST_ASSERT_EQUAL_UINT32(STACK_TOP - 4, addr);
+            TEST_ASSERT_EQUAL(4, *p++);
+        }
+    }
+    TEST_ASSERT_TRUE(p == buf + len);
+    free(buf);
+}
@@ -1,15 +1,16 @@
 import { linter } from "@codemirror/lint";
 
 import { lineHighlightEffect } from "./LineHighlight";
-import { AsmErrState, buildAsm, buildWithTestcase, IdleState, latestAsm, RuntimeState, setWasmRuntime, StoppedState, testData, wasmRuntime } from "./EmulatorState";
+import { AsmErrState, buildWithTestcase, IdleState, latestAsm, lintAsm, RuntimeState, setWasmRuntime, StoppedState, testData, wasmRuntime } from "./EmulatorState";
 
 export const createAsmLinter = () => {
   let delay: number = 300;
   return linter(
     async (ev) => {
       if (wasmRuntime.status != "idle" && wasmRuntime.status != "stopped" && wasmRuntime.status != "asmerr") return [];
+      let errs = null;
       if (latestAsm["text"] != ev.state.doc.toString()) {
-        if (testData == null) await buildAsm(wasmRuntime, setWasmRuntime);
+        if (testData == null) errs = await lintAsm(wasmRuntime, setWasmRuntime);
         else {
           let testcases = testData.testcases;
 	        let testPrefix = testData.testPrefix;
@@ -20,7 +21,17 @@ export const createAsmLinter = () => {
       ev.dispatch({
         effects: lineHighlightEffect.of(0), // disable the line highlight, as line numbering starts from 1
       });
-      if (wasmRuntime.status === "asmerr") {
+      if (errs) {
+        return errs.map((err) => {
+          const line = ev.state.doc.line(err.line);
+          return {
+            from: Math.min(line.from + err.col - 1, line.to),
+            to: line.to,
+            message: err.message,
+            severity: "error" as const,
+          };
+        });
+      } else if (wasmRuntime.status === "asmerr") {
         return [
           {
             from: ev.state.doc.line(wasmRuntime.line).from,
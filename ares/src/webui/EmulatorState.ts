@@ -14,6 +14,8 @@ export const TEXT_END = 0x10000000;
 export const DATA_BASE = 0x10000000;
 export const STACK_TOP = 0x7FFFF000;
 export const STACK_LEN = 4096;
+// default limit the stack grows to, see g_stack_limit
+export const STACK_LIMIT = 1024 * 1024;
 export const DATA_END = 0x70000000;
 export const GIF_BASE = 0x50000000;
 export const GIF_END = 0x50000000 + 4 * 1024 * 1024;
@@ -22,7 +24,7 @@ export function convertNumber(x: number, decimal: boolean): string {
 	let ptr = false;
 	if (decimal) {
 		if (x >= TEXT_BASE && x <= TEXT_END) ptr = true;
-		else if (x >= STACK_TOP - STACK_LEN && x <= STACK_TOP) ptr = true;
+		else if (x >= STACK_TOP - STACK_LIMIT && x <= STACK_TOP) ptr = true;
 		else if (x >= DATA_BASE && x <= DATA_END) ptr = true;
 		else if (x >= GIF_BASE && x <= GIF_END) ptr = true;
 		if (ptr) return "0x" + (toUnsigned(x).toString(16).padStart(8, "0"));
@@ -132,7 +134,7 @@ export let [pipelineCycle, setPipelineCycle] = createSignal<number>(0);
 export let [pipelineIfLine, setPipelineIfLine] = createSignal<number>(0);
 export let [pipelineHistory, setPipelineHistory] = createSignal<PipelineSnapshotEntry[]>([]);
 let pipelineHistoryIndex = -1;
-let pipelineSlots: Array<number | null> = Array.from({ length: pipelineDepth }, () => null);
+let pipelineKnownCycles = 0;
 let pipelineTrackingEnabled = true;
 let cycleSummaryAppended = false;
 
@@ -169,7 +171,8 @@ function buildShadowStack() {
 }
 
 function resetPipeline(): void {
-	pipelineSlots = Array.from({ length: pipelineDepth }, () => null);
+	wasmInterface.pipelineStart();
+	pipelineKnownCycles = 0;
 	const emptyStages = pipelineStageNames.map((stage) => ({ stage, pc: null }));
 	setPipelineSnapshot(emptyStages);
 	setPipelineCycle(0);
@@ -195,36 +198,42 @@ function setPipelineFromEntry(entry: PipelineSnapshotEntry): void {
 	setPipelineIfLine(getLineForPc(entry.stages[0]?.pc ?? null));
 }
 
-function advancePipeline(pc: number): void {
-	if (!pc) return;
-	const nextCycle = pipelineCycle() + 1;
-	pipelineSlots = [pc, ...pipelineSlots.slice(0, pipelineDepth - 1)];
-	const stages = pipelineStageNames.map((stage, index) => ({
-		stage,
-		pc: pipelineSlots[index]
-	}));
-	const entry: PipelineSnapshotEntry = { cycle: nextCycle, stages };
+// Pulls the cycles the C timing model has finished since the last call.
+function advancePipeline(): void {
+	const window = wasmInterface.pipelineStages(pipelineKnownCycles + 1, 1 << 12);
+	const count = window.length / pipelineDepth;
+	if (count === 0) return;
+	const entries: PipelineSnapshotEntry[] = new Array(count);
+	for (let i = 0; i < count; i++) {
+		const stages = pipelineStageNames.map((stage, index) => ({
+			stage,
+			pc: window[i * pipelineDepth + index] || null
+		}));
+		entries[i] = { cycle: pipelineKnownCycles + 1 + i, stages };
+	}
+	pipelineKnownCycles += count;
 	setPipelineHistory((prev) => {
 		const trimmed = prev.slice(0, pipelineHistoryIndex + 1);
-		const updated = [...trimmed, entry];
+		const updated = [...trimmed, ...entries];
 		pipelineHistoryIndex = updated.length - 1;
 		return updated;
 	});
-	setPipelineFromEntry(entry);
+	setPipelineFromEntry(entries[count - 1]);
 }
 
 function appendCycleSummary(): void {
 	if (cycleSummaryAppended) return;
+	const stats = wasmInterface.pipelineStats();
+	const cpi = stats.instret ? (stats.cycles / stats.instret).toFixed(3) : "-";
 	const suffix = wasmInterface.textBuffer.endsWith("\n") || wasmInterface.textBuffer.length === 0 ? "" : "\n";
-	wasmInterface.textBuffer += `${suffix}Cycles: ${pipelineCycle()}`;
+	wasmInterface.textBuffer += `${suffix}Cycles: ${stats.cycles} (CPI ${cpi})`;
 	cycleSummaryAppended = true;
 }
 
 function runCpuStep(): void {
-	const pcBefore = wasmInterface.pc?.[0] ?? 0;
 	wasmInterface.run();
 	if (pipelineTrackingEnabled) {
-		advancePipeline(pcBefore);
+		advancePipeline();
 	}
 }
 
@@ -375,6 +384,31 @@ export async function buildAsm(_runtime: RuntimeState, setRuntime): Promise<void
 	latestAsm.text = asm;
 }
 
+// buildAsm() for the linter, it only assembles what changed since the last
+// lint and leaves the emulator alone. Returns every error it found, the first
+// one goes to the runtime state, or null if it fell back to buildAsm().
+export async function lintAsm(_runtime: RuntimeState, setRuntime): Promise<{ line: number; col: number; message: string }[] | null> {
+	const asm = view.state.doc.toString();
+	const errs = await wasmInterface.lint(asm);
+	if (errs === undefined) {
+		await buildAsm(_runtime, setRuntime);
+		return null;
+	}
+	if (errs.length) {
+		const err = errs[0];
+		setRuntime({
+			status: "asmerr",
+			consoleText: `Error on line ${err.line}: ${err.message}`,
+			line: err.line,
+			message: err.message,
+			version: globalVersion++
+		});
+	} else if (_runtime.status != "idle") {
+		setRuntime({ status: "idle", version: globalVersion++ });
+	}
+	return errs;
+}
+
 export async function runNormal(_runtime: RuntimeState, setRuntime): Promise<void> {
 	await buildAsm(_runtime, setRuntime);
 	if (_runtime.status == "asmerr") {
@@ -623,12 +657,9 @@ export function shadowStackAugmented(shadowStack: ShadowEntry[], load, writeAddr
 		let elems = new Array(elemCnt);
 		for (let j = 0, ptr = ent.sp - 4; j < elemCnt; j++, ptr -= 4) {
 			let text = load ? convertNumber(load(ptr, 4), true) : "0";
-			if (wasmInterface.callsanWrittenBy) {
-				let off = (ptr - (0x7FFFF000 - 4096)) / 4;
-				let regidx = wasmInterface.callsanWrittenBy[off];
-				if (regidx == 0xff) text = "??";
-				else if (regidx != 0) text += " (" + wasmInterface.getRegisterName(regidx) + ")";
-			}
+			let regidx = wasmInterface.callsanWrittenBy(ptr);
+			if (regidx == 0xff) text = "??";
+			else if (regidx != 0) text += " (" + wasmInterface.getRegisterName(regidx) + ")";
 			let isAnimated = ptr >= writeAddr && ptr < writeAddr + writeLen;
 			elems[j] = { addr: ptr.toString(16), isAnimated, text };
 		}
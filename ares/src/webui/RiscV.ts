@@ -4,9 +4,44 @@ import wasmUrl from "./main.wasm?url";
 interface WasmExports {
   emulate(): void;
   assemble: (offset: number, len: number, allow_externs: boolean) => void;
+  incbin_register: (
+    name: number,
+    nameLen: number,
+    data: number,
+    len: number,
+  ) => void;
+  elf_load: (elf: number, len: number, error: number) => boolean;
+  lint_buffer: (len: number) => number;
+  lint: (len: number) => boolean;
   pc_to_label: (pc: number) => void;
   emu_load: (addr: number, size: number) => number;
   emu_store: (addr: number, val: number, size: number) => void;
+  emu_set_stack_limit: (bytes: number) => boolean;
+  emu_snapshot: () => void;
+  emu_restore: () => boolean;
+  profile_start: () => void;
+  profile_stop: () => void;
+  profile_lines: () => void;
+  profile_folded_text: () => void;
+  pipeline_start: () => void;
+  pipeline_stop: () => void;
+  pipeline_stages: (first: number, count: number) => number;
+  cache_start: () => boolean;
+  cache_stop: () => void;
+  cache_lines: () => void;
+  bpred_start: () => boolean;
+  bpred_stop: () => void;
+  ooo_start: () => boolean;
+  ooo_stop: () => void;
+  ooo_occupancy: (first: number, count: number) => number;
+  sample_start: () => boolean;
+  sample_stop: () => void;
+  sample_estimate: () => void;
+  reuse_start: () => boolean;
+  reuse_stop: () => void;
+  reuse_mrc: (which: number, lines: number) => void;
+  latency_start: () => void;
+  latency_stop: () => void;
   __heap_base: number;
   g_regs: number;
   g_heap_size: number;
@@ -17,6 +52,7 @@ interface WasmExports {
   g_text_by_linenum: number;
   g_error: number;
   g_error_line: number;
+  g_lint_diagnostics: number;
   g_runtime_error_pc: number;
   g_runtime_error_params: number;
   g_runtime_error_type: number;
@@ -33,8 +69,145 @@ interface WasmExports {
   g_gif_used: number;
   g_gif_body_ptr: number;
   g_gif_body_len: number;
+  g_profile_lines: number;
+  g_profile_folded: number;
+  g_pipeline_stats: number;
+  g_pipeline_window: number;
+  g_cache_config: number;
+  g_cache_stats: number;
+  g_cache_lines: number;
+  g_bpred_config: number;
+  g_bpred_stats: number;
+  g_ooo_config: number;
+  g_ooo_stats: number;
+  g_ooo_window: number;
+  g_sample_config: number;
+  g_sample_stats: number;
+  g_sample_estimate: number;
+  g_reuse_config: number;
+  g_reuse_stats: number;
+  g_reuse_working_set: number;
+  g_reuse_sections: number;
+  g_reuse_mrc: number;
+  g_latency_table: number;
+  g_latency_counts: number;
 }
 
+export type PipelineStats = {
+  cycles: number;
+  instret: number;
+  loadUseStalls: number;
+  structuralStalls: number;
+  controlStalls: number;
+  memoryStalls: number;
+};
+
+export type CacheConfig = {
+  size: number;
+  lineSize: number;
+  assoc: number;
+  replacement: "lru" | "fifo" | "random";
+  writeBack: boolean;
+  prefetch: boolean;
+  missPenalty: number;
+};
+
+export type CacheStats = {
+  accesses: number;
+  misses: number;
+  evictions: number;
+  writebacks: number;
+  prefetches: number;
+};
+
+// indices of the instruction and data cache in the C arrays
+export const CACHE_I = 0;
+export const CACHE_D = 1;
+const CACHE_REPLACEMENT = ["lru", "fifo", "random"];
+
+export type BpredConfig = {
+  type: "nt" | "btfn" | "bimodal" | "gshare";
+  tableBits: number;
+  historyBits: number;
+  btbEntries: number;
+  rasDepth: number;
+  mispredictPenalty: number;
+};
+
+export type BpredStats = {
+  branches: number;
+  branchMispredicts: number;
+  jumps: number;
+  jumpMispredicts: number;
+  returns: number;
+  returnMispredicts: number;
+  decodeRedirects: number;
+};
+
+const BPRED_TYPES = ["nt", "btfn", "bimodal", "gshare"];
+
+// functional units are ALU, MUL, DIV and LSU, in that order
+export type OooConfig = {
+  width: number;
+  robSize: number;
+  units: [number, number, number, number];
+  latency: [number, number, number, number];
+  frontendDepth: number;
+};
+
+// indices of the fetch and data streams in the C arrays
+export const REUSE_I = 0;
+export const REUSE_D = 1;
+
+// instruction classes of the latency model, in the order of the C tables
+export const LATENCY_CLASSES = [
+  "alu",
+  "mul",
+  "div",
+  "load",
+  "store",
+  "branch_taken",
+  "branch_not_taken",
+  "jump",
+  "csr",
+  "ecall",
+] as const;
+
+export type LatencyClass = (typeof LATENCY_CLASSES)[number];
+
+export type LatencyStats = {
+  cycles: number;
+  counts: Record<LatencyClass, number>;
+};
+
+export type SampleConfig = {
+  period: number;
+  warmup: number;
+  measure: number;
+};
+
+export type SampleEstimate = {
+  samples: number;
+  measuredInstret: number;
+  cpi: number;
+  cpiLow: number;
+  cpiHigh: number;
+  cycles: number;
+};
+
+export type OooStats = {
+  cycles: number;
+  instret: number;
+  controlStalls: number;
+  frontendStalls: number;
+  robFullStalls: number;
+  dependencyStalls: number;
+  structuralStalls: number;
+  memoryStalls: number;
+  executeStalls: number;
+  robOccupancySum: number;
+};
+
 const INSTRUCTION_LIMIT: number = 1000 * 1000;
 
 export class WasmInterface {
@@ -43,6 +216,9 @@ export class WasmInterface {
   private exports?: WasmExports;
   private loadedPromise?: Promise<void>;
   private originalMemory?: Uint8Array;
+  private blobs = new Map<string, Uint8Array>();
+  // blobs were set since the last build, lint() can't see them
+  private blobsChanged = false;
   public textBuffer: string = "";
   public successfulExecution: boolean;
   public regsArr?: Uint32Array;
@@ -56,10 +232,10 @@ export class WasmInterface {
   public runtimeErrorType?: Uint32Array;
   public hasError: boolean = false;
   public instructions: number;
+  private snapshotInstructions: number = 0;
   public shadowStackPtr?: Uint32Array;
   public shadowStack?: Uint32Array;
   public shadowStackLen?: Uint32Array;
-  public callsanWrittenBy?: Uint8Array;
   public vgaBase?: Uint32Array;
   public vgaLen?: Uint32Array;
   public vgaPtr?: Uint32Array;
@@ -116,13 +292,28 @@ export class WasmInterface {
     return this.loadedPromise;
   }
 
-  async build(
-    source: string,
-  ): Promise<{ line: number; message: string } | null> {
-    if (!this.wasmInstance) {
-      await this.loadModule();
-    }
+  // Data for .incbin "name" in the following builds, null removes it.
+  setIncbin(name: string, data: Uint8Array | null): void {
+    if (data) this.blobs.set(name, data);
+    else this.blobs.delete(name);
+    this.blobsChanged = true;
+  }
+
+  private readError(
+    errorSym: number,
+    lineSym: number,
+  ): { line: number; message: string } | null {
+    const errorLine = this.createU32(lineSym)[0];
+    const errorPtr = this.createU32(errorSym)[0];
+    if (!errorPtr) return null;
+    const error = this.createU8(errorPtr);
+    const errorLen = error.indexOf(0);
+    const errorStr = new TextDecoder("utf8").decode(error.slice(0, errorLen));
+    return { line: errorLine, message: errorStr };
+  }
 
+  // Restores the module's memory and points the views at the new state.
+  private reset(): void {
     this.successfulExecution = false;
     this.instructions = 0;
     this.hasError = false;
@@ -130,11 +321,6 @@ export class WasmInterface {
 
     this.createU8(0).set(this.originalMemory);
 
-    const encoder = new TextEncoder();
-    const strBytes = encoder.encode(source);
-    const strLen = strBytes.length;
-    const offset = this.exports.__heap_base;
-
     this.memWrittenAddr = this.createU32(this.exports.g_mem_written_addr);
     this.memWrittenLen = this.createU32(this.exports.g_mem_written_len);
     this.regWritten = this.createU32(this.exports.g_reg_written);
@@ -146,9 +332,6 @@ export class WasmInterface {
     this.runtimeErrorType = this.createU32(this.exports.g_runtime_error_type);
     this.shadowStackLen = this.createU32(this.exports.g_shadow_stack);
     this.shadowStackPtr = this.createU32(this.exports.g_shadow_stack + 8);
-    this.callsanWrittenBy = this.createU8(
-      this.exports.g_callsan_stack_written_by,
-    );
     this.vgaBase = this.createU32(this.exports.g_vga_base_addr);
     this.vgaLen = this.createU32(this.exports.g_vga_len);
     this.vgaPtr = this.createU32(this.exports.g_vga_ptr);
@@ -158,31 +341,434 @@ export class WasmInterface {
     this.gifUsed = this.createU32(this.exports.g_gif_used);
     this.gifBodyPtr = this.createU32(this.exports.g_gif_body_ptr);
     this.gifBodyLen = this.createU32(this.exports.g_gif_body_len);
-    if (offset + strLen > this.memory.buffer.byteLength) {
-      const pages = Math.ceil(
-        (offset + strLen - this.memory.buffer.byteLength) / 65536,
-      );
+  }
+
+  async build(
+    source: string,
+  ): Promise<{ line: number; message: string } | null> {
+    if (!this.wasmInstance) {
+      await this.loadModule();
+    }
+    this.reset();
+
+    const encoder = new TextEncoder();
+    const strBytes = encoder.encode(source);
+    const strLen = strBytes.length;
+    const offset = this.exports.__heap_base;
+
+    // .incbin blobs go after the source, below the heap
+    const blobs = [...this.blobs].map(([name, data]) => ({
+      name: encoder.encode(name),
+      data,
+      offset: 0,
+    }));
+    let end = offset + strLen;
+    for (const blob of blobs) {
+      blob.offset = end;
+      end += blob.name.length + blob.data.length;
+    }
+    if (end > this.memory.buffer.byteLength) {
+      const pages = Math.ceil((end - this.memory.buffer.byteLength) / 65536);
       this.memory.grow(pages);
     }
 
     this.createU8(offset).set(strBytes);
-    this.createU32(this.exports.g_heap_size)[0] = (strLen + 7) & ~7; // align up to 8
+    // before registering the blobs, that mallocs
+    this.createU32(this.exports.g_heap_size)[0] = (end - offset + 7) & ~7; // align up to 8
+    for (const blob of blobs) {
+      const dataOffset = blob.offset + blob.name.length;
+      this.createU8(blob.offset).set(blob.name);
+      this.createU8(dataOffset).set(blob.data);
+      this.exports.incbin_register(
+        blob.offset,
+        blob.name.length,
+        dataOffset,
+        blob.data.length,
+      );
+    }
+    this.blobsChanged = false;
     this.exports.assemble(offset, strLen, false);
     const textByLinenumPtr = this.createU32(this.exports.g_text_by_linenum)[2];
     this.textByLinenum = this.createU32(textByLinenumPtr);
     this.textByLinenumLen = this.createU32(this.exports.g_text_by_linenum);
 
-    const errorLine = this.createU32(this.exports.g_error_line)[0];
-    const errorPtr = this.createU32(this.exports.g_error)[0];
-    if (errorPtr) {
-      const error = this.createU8(errorPtr);
-      const errorLen = error.indexOf(0);
-      const errorStr = new TextDecoder("utf8").decode(error.slice(0, errorLen));
-      return { line: errorLine, message: errorStr };
+    return this.readError(this.exports.g_error, this.exports.g_error_line);
+  }
+
+  // Loads an ELF32 executable to run instead of source. Its segments run
+  // from the one copy in WASM memory where they can, so nothing is
+  // assembled first. Returns the loader's error, if any.
+  async loadElf(elf: Uint8Array): Promise<string | null> {
+    if (!this.wasmInstance) {
+      await this.loadModule();
+    }
+    this.reset();
+
+    // the executable goes below the heap, followed by the error pointer
+    const offset = this.exports.__heap_base;
+    const errorPtr = (offset + elf.length + 3) & ~3;
+    const end = errorPtr + 4;
+    if (end > this.memory.buffer.byteLength) {
+      const pages = Math.ceil((end - this.memory.buffer.byteLength) / 65536);
+      this.memory.grow(pages);
+    }
+
+    this.createU8(offset).set(elf);
+    this.createU32(errorPtr)[0] = 0;
+    this.createU32(this.exports.g_heap_size)[0] = (end - offset + 7) & ~7; // align up to 8
+    const ok = this.exports.elf_load(offset, elf.length, errorPtr);
+    const textByLinenumPtr = this.createU32(this.exports.g_text_by_linenum)[2];
+    this.textByLinenum = this.createU32(textByLinenumPtr);
+    this.textByLinenumLen = this.createU32(this.exports.g_text_by_linenum);
+    if (ok) return null;
+
+    const error = this.createU8(this.createU32(errorPtr)[0]);
+    return new TextDecoder("utf8").decode(error.slice(0, error.indexOf(0)));
+  }
+
+  // Assembler errors of source without building it, every line that fails
+  // gets one, in line order. Only what changed since the last call is
+  // assembled again. Undefined if it takes a build() to tell. The linter's
+  // state lasts until the next build.
+  async lint(
+    source: string,
+  ): Promise<{ line: number; col: number; message: string }[] | undefined> {
+    if (!this.wasmInstance) {
+      await this.loadModule();
     }
+    if (this.blobsChanged) return undefined;
 
-    return null;
+    const strBytes = new TextEncoder().encode(source);
+    const ptr = this.exports.lint_buffer(strBytes.length);
+    this.createU8(ptr).set(strBytes);
+    if (!this.exports.lint(strBytes.length)) return undefined;
+
+    // ARES_ARRAY(Diagnostic): len, cap, buf of { line, col, msg }
+    const arr = this.createU32(this.exports.g_lint_diagnostics);
+    const len = arr[0];
+    const diags = new Uint32Array(this.memory.buffer, arr[2], len * 3);
+    const decoder = new TextDecoder("utf8");
+    const result = [];
+    for (let i = 0; i < len; i++) {
+      const msg = this.createU8(diags[i * 3 + 2]);
+      result.push({
+        line: diags[i * 3],
+        col: diags[i * 3 + 1],
+        message: decoder.decode(msg.slice(0, msg.indexOf(0))),
+      });
+    }
+    return result;
+  }
+
+  // Cheap: section pages are only copied once the guest writes to them.
+  snapshot(): void {
+    this.exports.emu_snapshot();
+    this.snapshotInstructions = this.instructions;
+  }
+
+  // Rewinds the machine to the last snapshot, returns false if there is none
+  // for the current build.
+  restore(): boolean {
+    if (!this.exports.emu_restore()) return false;
+    this.instructions = this.snapshotInstructions;
+    this.successfulExecution = false;
+    this.hasError = false;
+    return true;
   }
+
+  // Counts every instruction from here on, until profileStop() or the next
+  // build.
+  profileStart(): void {
+    this.exports.profile_start();
+  }
+
+  profileStop(): void {
+    this.exports.profile_stop();
+  }
+
+  // Instructions executed per source line, indexed by line number.
+  profileLines(): Uint32Array {
+    this.exports.profile_lines();
+    const arr = this.createU32(this.exports.g_profile_lines);
+    return new Uint32Array(this.memory.buffer, arr[2], arr[0]);
+  }
+
+  // Folded stacks, one "a;b;c count" line per call path.
+  profileFolded(): string {
+    this.exports.profile_folded_text();
+    const arr = this.createU32(this.exports.g_profile_folded);
+    const bytes = this.createU8(arr[2]).slice(0, arr[0]);
+    return new TextDecoder("utf8").decode(bytes);
+  }
+
+  // Times every instruction from here on on the 5-stage pipeline model,
+  // until pipelineStop() or the next build.
+  pipelineStart(): void {
+    this.exports.pipeline_start();
+  }
+
+  pipelineStop(): void {
+    this.exports.pipeline_stop();
+  }
+
+  pipelineStats(): PipelineStats {
+    const st = new BigUint64Array(this.memory.buffer, this.exports.g_pipeline_stats, 6);
+    return {
+      cycles: Number(st[0]),
+      instret: Number(st[1]),
+      loadUseStalls: Number(st[2]),
+      structuralStalls: Number(st[3]),
+      controlStalls: Number(st[4]),
+      memoryStalls: Number(st[5]),
+    };
+  }
+
+  // PCs in IF, ID, EX, MEM and WB (0 for a bubble) for each cycle from
+  // first on, only covers the cycles the model already knows.
+  pipelineStages(first: number, count: number): Uint32Array {
+    const n = this.exports.pipeline_stages(first, count);
+    const arr = this.createU32(this.exports.g_pipeline_window);
+    return new Uint32Array(this.memory.buffer, arr[2], n * 5);
+  }
+
+  // CacheConfig is 24 bytes: 4 u32, 2 bools, padding and the penalty.
+  // A size of 0 disables that cache.
+  setCacheConfig(which: number, cfg: CacheConfig): void {
+    const base = this.exports.g_cache_config + which * 24;
+    const words = new Uint32Array(this.memory.buffer, base, 6);
+    words[0] = cfg.size;
+    words[1] = cfg.lineSize;
+    words[2] = cfg.assoc;
+    words[3] = CACHE_REPLACEMENT.indexOf(cfg.replacement);
+    const flags = new Uint8Array(this.memory.buffer, base + 16, 2);
+    flags[0] = cfg.writeBack ? 1 : 0;
+    flags[1] = cfg.prefetch ? 1 : 0;
+    words[5] = cfg.missPenalty;
+  }
+
+  // Simulates the configured caches from here on, until cacheStop() or the
+  // next build. Returns false if a geometry is invalid.
+  cacheStart(): boolean {
+    return this.exports.cache_start();
+  }
+
+  cacheStop(): void {
+    this.exports.cache_stop();
+  }
+
+  cacheStats(which: number): CacheStats {
+    const st = new BigUint64Array(this.memory.buffer, this.exports.g_cache_stats + which * 40, 5);
+    return {
+      accesses: Number(st[0]),
+      misses: Number(st[1]),
+      evictions: Number(st[2]),
+      writebacks: Number(st[3]),
+      prefetches: Number(st[4]),
+    };
+  }
+
+  setBpredConfig(cfg: BpredConfig): void {
+    const words = new Uint32Array(this.memory.buffer, this.exports.g_bpred_config, 6);
+    words[0] = BPRED_TYPES.indexOf(cfg.type);
+    words[1] = cfg.tableBits;
+    words[2] = cfg.historyBits;
+    words[3] = cfg.btbEntries;
+    words[4] = cfg.rasDepth;
+    words[5] = cfg.mispredictPenalty;
+  }
+
+  // Predicts every control transfer from here on, until bpredStop() or the
+  // next build. Returns false if the configuration is invalid.
+  bpredStart(): boolean {
+    return this.exports.bpred_start();
+  }
+
+  bpredStop(): void {
+    this.exports.bpred_stop();
+  }
+
+  bpredStats(): BpredStats {
+    const st = new BigUint64Array(this.memory.buffer, this.exports.g_bpred_stats, 7);
+    return {
+      branches: Number(st[0]),
+      branchMispredicts: Number(st[1]),
+      jumps: Number(st[2]),
+      jumpMispredicts: Number(st[3]),
+      returns: Number(st[4]),
+      returnMispredicts: Number(st[5]),
+      decodeRedirects: Number(st[6]),
+    };
+  }
+
+  setOooConfig(cfg: OooConfig): void {
+    const words = new Uint32Array(this.memory.buffer, this.exports.g_ooo_config, 11);
+    words[0] = cfg.width;
+    words[1] = cfg.robSize;
+    words.set(cfg.units, 2);
+    words.set(cfg.latency, 6);
+    words[10] = cfg.frontendDepth;
+  }
+
+  // Times every instruction from here on on the out-of-order model instead
+  // of the pipeline, until oooStop() or the next build. Returns false if
+  // the configuration is invalid.
+  oooStart(): boolean {
+    return this.exports.ooo_start();
+  }
+
+  oooStop(): void {
+    this.exports.ooo_stop();
+  }
+
+  oooStats(): OooStats {
+    const st = new BigUint64Array(this.memory.buffer, this.exports.g_ooo_stats, 10);
+    return {
+      cycles: Number(st[0]),
+      instret: Number(st[1]),
+      controlStalls: Number(st[2]),
+      frontendStalls: Number(st[3]),
+      robFullStalls: Number(st[4]),
+      dependencyStalls: Number(st[5]),
+      structuralStalls: Number(st[6]),
+      memoryStalls: Number(st[7]),
+      executeStalls: Number(st[8]),
+      robOccupancySum: Number(st[9]),
+    };
+  }
+
+  // ROB occupancy for each cycle from first on, only covers the cycles the
+  // model already knows.
+  oooOccupancy(first: number, count: number): Uint32Array {
+    const n = this.exports.ooo_occupancy(first, count);
+    const arr = this.createU32(this.exports.g_ooo_window);
+    return new Uint32Array(this.memory.buffer, arr[2], n);
+  }
+
+  // Classes that aren't given keep their cost.
+  setLatencyTable(table: Partial<Record<LatencyClass, number>>): void {
+    const words = new Uint32Array(this.memory.buffer, this.exports.g_latency_table, LATENCY_CLASSES.length);
+    LATENCY_CLASSES.forEach((cls, i) => {
+      if (table[cls] !== undefined) words[i] = table[cls];
+    });
+  }
+
+  // Charges every instruction from here on the cost of its class, when
+  // neither the pipeline nor the out-of-order model is running, until
+  // latencyStop() or the next build.
+  latencyStart(): void {
+    this.exports.latency_start();
+  }
+
+  latencyStop(): void {
+    this.exports.latency_stop();
+  }
+
+  latencyStats(): LatencyStats {
+    const n = LATENCY_CLASSES.length;
+    const table = new Uint32Array(this.memory.buffer, this.exports.g_latency_table, n);
+    const counts = new BigUint64Array(this.memory.buffer, this.exports.g_latency_counts, n);
+    const stats = { cycles: 0, counts: {} } as LatencyStats;
+    LATENCY_CLASSES.forEach((cls, i) => {
+      stats.counts[cls] = Number(counts[i]);
+      stats.cycles += stats.counts[cls] * table[i];
+    });
+    return stats;
+  }
+
+  setSampleConfig(cfg: SampleConfig): void {
+    const words = new BigUint64Array(this.memory.buffer, this.exports.g_sample_config, 3);
+    words[0] = BigInt(cfg.period);
+    words[1] = BigInt(cfg.warmup);
+    words[2] = BigInt(cfg.measure);
+  }
+
+  // Runs the timing models started so far only on the last warmup + measure
+  // instructions of every period, until sampleStop() or the next build.
+  // Returns false if the configuration is invalid.
+  sampleStart(): boolean {
+    return this.exports.sample_start();
+  }
+
+  sampleStop(): void {
+    this.exports.sample_stop();
+  }
+
+  sampleEstimate(): SampleEstimate {
+    this.exports.sample_estimate();
+    const st = new BigUint64Array(this.memory.buffer, this.exports.g_sample_stats, 4);
+    const est = new Float64Array(this.memory.buffer, this.exports.g_sample_estimate, 4);
+    return {
+      samples: Number(st[1]),
+      measuredInstret: Number(st[2]),
+      cpi: est[0],
+      cpiLow: est[1],
+      cpiHigh: est[2],
+      cycles: est[3],
+    };
+  }
+
+  // Records reuse distances of the fetch and data streams from here on,
+  // until reuseStop() or the next build. Returns false if the line size
+  // isn't a power of two.
+  reuseStart(lineSize: number, epoch: number): boolean {
+    const cfg = new Uint32Array(this.memory.buffer, this.exports.g_reuse_config, 2);
+    cfg[0] = lineSize;
+    cfg[1] = epoch;
+    return this.exports.reuse_start();
+  }
+
+  reuseStop(): void {
+    this.exports.reuse_stop();
+  }
+
+  // Miss ratios of fully associative LRU caches of 1 .. lines lines.
+  reuseMissRatios(which: number, lines: number): Float64Array {
+    this.exports.reuse_mrc(which, lines);
+    const st = new BigUint64Array(this.memory.buffer, this.exports.g_reuse_stats + which * 24, 1);
+    const accesses = Number(st[0]);
+    const arr = this.createU32(this.exports.g_reuse_mrc);
+    // malloc doesn't align the buffer to 8 bytes
+    const view = new DataView(this.memory.buffer, arr[2], arr[0] * 8);
+    const ratios = new Float64Array(arr[0]);
+    for (let i = 0; i < arr[0]; i++)
+      ratios[i] = accesses ? Number(view.getBigUint64(i * 8, true)) / accesses : 0;
+    return ratios;
+  }
+
+  // Distinct lines touched per epoch, one row per finished epoch and one
+  // column per section plus a last one for addresses outside of them.
+  reuseWorkingSet(): Uint32Array[] {
+    const sections = this.createU32(this.exports.g_reuse_sections)[0];
+    const arr = this.createU32(this.exports.g_reuse_working_set);
+    const rows: Uint32Array[] = [];
+    for (let i = 0; i + sections <= arr[0]; i += sections)
+      rows.push(new Uint32Array(this.memory.buffer, arr[2] + i * 4, sections));
+    return rows;
+  }
+
+  // Accesses, misses and evictions of the instruction then the data cache,
+  // 6 entries per source line.
+  cacheLines(): Uint32Array {
+    this.exports.cache_lines();
+    const arr = this.createU32(this.exports.g_cache_lines);
+    return new Uint32Array(this.memory.buffer, arr[2], arr[0]);
+  }
+
+  // Register that last wrote the stack word at addr, 0xff if it's poisoned
+  // or not tracked.
+  callsanWrittenBy(addr: number): number {
+    const arr = this.createU32(this.exports.g_callsan_stack_written_by);
+    const off = (addr - (0x7FFFF000 - arr[0] * 4)) >>> 2;
+    if (addr >= 0x7FFFF000 || off >= arr[0]) return 0xff;
+    return this.createU8(arr[2])[off];
+  }
+
+  // Bytes the stack may grow to, a multiple of 4096 up to 64 MiB. False if
+  // the limit is out of range or below what the stack already uses.
+  setStackLimit(bytes: number): boolean {
+    return this.exports.emu_set_stack_limit(bytes);
+  }
+
   getShadowStack(): Uint32Array {
     return this.createU32(this.shadowStackPtr[0]);
   }
@@ -293,6 +879,10 @@ export class WasmInterface {
           str = convertNumber(runtimeParam1, false);
           this.textBuffer += `CallSan: ${pcString}\nAttempted to read from stack address 0x${str}, which hasn't been written to in the current function.\n`;
           break;
+        case 13:
+          str = convertNumber(runtimeParam1, false);
+          this.textBuffer += `ERROR: stack overflow on address 0x${str} at ${pcString}\n`;
+          break;
         default:
           this.textBuffer += `ERROR${errorType}: ${pcString} ${this.runtimeErrorParams[0].toString(
             16,
@@ -9,7 +9,7 @@ function compile(outpath, optimize) {
       fs.mkdirSync(outpath, { recursive: true });
     }
     exec(
-      `clang --target=wasm32 -flto -nostdlib -Wl,--export-all -Wl,--no-entry -Wl,--allow-undefined -Wl,--import-memory ${opts} -o ${outpath}/main.wasm src/exec/dev.c src/exec/core.c src/exec/emulate.c src/exec/callsan.c src/exec/wasm.c`,
+      `clang --target=wasm32 -msimd128 -flto -nostdlib -Wl,--export-all -Wl,--no-entry -Wl,--allow-undefined -Wl,--import-memory ${opts} -o ${outpath}/main.wasm src/exec/dev.c src/exec/core.c src/exec/emulate.c src/exec/callsan.c src/exec/snapshot.c src/exec/profile.c src/exec/pipeline.c src/exec/cache.c src/exec/bpred.c src/exec/ooo.c src/exec/sample.c src/exec/reuse.c src/exec/latency.c src/exec/elf.c src/exec/wasm.c`,
       (error, stdout, stderr) => {
         if (error) {
           reject(stderr);